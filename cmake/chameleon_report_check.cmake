@@ -0,0 +1,71 @@
+# Run a test on Chameleon with the deterministic overview report enabled, then check that every report it
+# wrote is byte-identical to the jsoncpp serialization of the same data, and to its checked-in golden report
+# in GOLDEN_DIR. Paths to the source and build directories are replaced by <SOURCE_DIR> and <BINARY_DIR>
+# before comparing, so that the golden reports do not depend on where the tree is built.
+#
+# Changes to the report content need the golden reports updated in the same commit. Run the test with
+# CHAMELEON_UPDATE_GOLDEN=1 in the environment to write them from the current build, then check that
+# the diff to them is the one you intended.
+
+foreach(var TEST_EXECUTABLE CHECK_EXECUTABLE REPORT_BASE GOLDEN_DIR SOURCE_DIR BINARY_DIR)
+	if(NOT DEFINED ${var})
+		message(FATAL_ERROR "${var} is required")
+	endif()
+endforeach()
+
+file(GLOB old_reports "${REPORT_BASE}_[0-9]*.json")
+if(old_reports)
+	file(REMOVE ${old_reports})
+endif()
+
+set(ENV{CHAMELEON_REPORT} "${REPORT_BASE}")
+set(ENV{CHAMELEON_DETERMINISTIC} 1)
+execute_process(COMMAND "${TEST_EXECUTABLE}" RESULT_VARIABLE test_result)
+if(NOT test_result EQUAL 0)
+	message(FATAL_ERROR "${TEST_EXECUTABLE} failed: ${test_result}")
+endif()
+
+file(GLOB reports "${REPORT_BASE}_[0-9]*.json")
+if(NOT reports)
+	message(FATAL_ERROR "No reports written to ${REPORT_BASE}_*.json")
+endif()
+
+execute_process(COMMAND "${CHECK_EXECUTABLE}" ${reports} RESULT_VARIABLE check_result)
+if(NOT check_result EQUAL 0)
+	message(FATAL_ERROR "Streamed report differs from the jsoncpp output")
+endif()
+
+get_filename_component(report_prefix "${REPORT_BASE}" NAME)
+set(differing 0)
+foreach(report ${reports})
+	get_filename_component(report_name "${report}" NAME)
+	string(REPLACE "${report_prefix}" "report" golden_name "${report_name}")
+	set(golden "${GOLDEN_DIR}/${golden_name}")
+
+	file(READ "${report}" contents)
+	# The build directory is often inside the source directory, so replace it first
+	string(REPLACE "${BINARY_DIR}" "<BINARY_DIR>" contents "${contents}")
+	string(REPLACE "${SOURCE_DIR}" "<SOURCE_DIR>" contents "${contents}")
+
+	if("$ENV{CHAMELEON_UPDATE_GOLDEN}" STREQUAL "1")
+		file(WRITE "${golden}" "${contents}")
+		message(STATUS "Updated ${golden}")
+		continue()
+	endif()
+	if(NOT EXISTS "${golden}")
+		message(SEND_ERROR "No golden report ${golden} for ${report}. Run with CHAMELEON_UPDATE_GOLDEN=1 to write it.")
+		math(EXPR differing "${differing} + 1")
+		continue()
+	endif()
+
+	file(READ "${golden}" expected)
+	if(NOT contents STREQUAL expected)
+		set(normalized "${report}.normalized")
+		file(WRITE "${normalized}" "${contents}")
+		message(SEND_ERROR "${report} differs from its golden report, see: diff -u ${golden} ${normalized}")
+		math(EXPR differing "${differing} + 1")
+	endif()
+endforeach()
+if(differing GREATER 0)
+	message(FATAL_ERROR "${differing} reports differ from their golden reports")
+endif()
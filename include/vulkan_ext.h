@@ -113,3 +113,11 @@ typedef struct VkFlushRangesFlagsARM
 	const void* pNext;
 	VkFlushOperationFlagsARM flags;
 } VkFlushRangesFlagsARM;
+
+// -- Chameleon live object counts
+// Not an extension, only returned by Chameleon's vkGetDeviceProcAddr. Lets a test harness check that a test destroyed
+// everything it created before the next one reuses the same device.
+
+// Return the number of live objects of each type that Chameleon keeps count of, across all devices. If pTypes and pLive
+// are null, only the number of types is returned in pCount.
+typedef void (VKAPI_PTR *PFN_vkGetLiveObjectCountsCHAMELEON)(VkDevice device, uint32_t* pCount, VkObjectType* pTypes, int64_t* pLive);
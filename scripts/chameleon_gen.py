@@ -24,11 +24,15 @@ for v in spec.root.findall('platforms/platform'):
 print('// This file contains only auto-generated code!', file=source)
 print("\n", file=source)
 print( '#include "vulkan_auto.h"', file=source)
+print( '#include <algorithm>', file=source)
+print( '#include <mutex>', file=source)
+print( '#include <vector>', file=source)
 print("\n", file=source)
 print('// This file contains only auto-generated code!', file=header)
 print("\n", file=header)
 print('#pragma once', file=header)
 print("\n", file=header)
+print('#include <atomic>', file=header)
 print('#include <string>', file=header)
 print('#include <stdio.h>', file=header)
 print('#include <unordered_map>', file=header)
@@ -104,10 +108,45 @@ print("\n", file=source)
 
 
 # -- Function call counters --
+# Each thread counts calls in its own block, indexed by a function enum, so that the
+# hot path never touches memory shared with other threads. Blocks register themselves
+# when a thread first makes a call, are folded into a retired block when the thread
+# exits, and are summed up in save_counts().
 
-for name in spec.functions:
-	print('uint64_t count_%s = 0;' % name, file=source)
-	print('extern uint64_t count_%s;' % name, file=header)
+print('enum vk_function', file=header)
+print('{', file=header)
+for n in spec.functions:
+	print('\tFUNC_%s,' % n, file=header)
+print('\tFUNC_MAX_FUNCTIONS', file=header)
+print('};', file=header)
+print("\n", file=header)
+print('struct call_counters', file=header)
+print('{', file=header)
+print('\t// Only ever written by the owning thread, atomic only so that save_counts() can read them', file=header)
+print('\tstd::atomic_uint64_t counts[FUNC_MAX_FUNCTIONS] = {};', file=header)
+print('\tcall_counters();', file=header)
+print('\t~call_counters();', file=header)
+print('\tinline void increment(vk_function f) { counts[f].store(counts[f].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }', file=header)
+print('};', file=header)
+print('extern thread_local call_counters thread_call_counters;', file=header)
+
+print('static std::mutex call_counters_mutex;', file=source)
+print('static std::vector<call_counters*> call_counters_live;', file=source)
+print('static uint64_t call_counters_retired[FUNC_MAX_FUNCTIONS] = {};', file=source)
+print('thread_local call_counters thread_call_counters;', file=source)
+print("\n", file=source)
+print('call_counters::call_counters()', file=source)
+print('{', file=source)
+print('\tstd::lock_guard<std::mutex> lock(call_counters_mutex);', file=source)
+print('\tcall_counters_live.push_back(this);', file=source)
+print('}', file=source)
+print("\n", file=source)
+print('call_counters::~call_counters()', file=source)
+print('{', file=source)
+print('\tstd::lock_guard<std::mutex> lock(call_counters_mutex);', file=source)
+print('\tfor (int i = 0; i < FUNC_MAX_FUNCTIONS; i++) call_counters_retired[i] += counts[i].load(std::memory_order_relaxed);', file=source)
+print('\tcall_counters_live.erase(std::find(call_counters_live.begin(), call_counters_live.end(), this));', file=source)
+print('}', file=source)
 
 print("\n", file=source)
 print("\n", file=header)
@@ -115,25 +154,161 @@ print('void save_counts(const char* filename);', file=header)
 print("\n", file=source)
 print('void save_counts(const char* filename)', file=source)
 print('{', file=source)
+print('\tuint64_t counts[FUNC_MAX_FUNCTIONS];', file=source)
+print('\t{', file=source)
+print('\t\tstd::lock_guard<std::mutex> lock(call_counters_mutex);', file=source)
+print('\t\tfor (int i = 0; i < FUNC_MAX_FUNCTIONS; i++) counts[i] = call_counters_retired[i];', file=source)
+print('\t\tfor (const call_counters* c : call_counters_live)', file=source)
+print('\t\t{', file=source)
+print('\t\t\tfor (int i = 0; i < FUNC_MAX_FUNCTIONS; i++) counts[i] += c->counts[i].load(std::memory_order_relaxed);', file=source)
+print('\t\t}', file=source)
+print('\t}', file=source)
 print('\tFILE* fp = fopen(filename, "w");', file=source)
 print('\tfprintf(fp, "Function,Count\\n");', file=source)
 for f in spec.functions:
-	print('\tif (count_%s > 0) fprintf(fp, "%s,%%lu\\n", (unsigned long)count_%s);' % (f, f, f), file=source)
+	print('\tif (counts[FUNC_%s] > 0) fprintf(fp, "%s,%%lu\\n", (unsigned long)counts[FUNC_%s]);' % (f, f, f), file=source)
 print('\tfclose(fp);', file=source)
 print('}', file=source)
 
-# -- Function pointer utility --
+# -- Function pointer lookup --
+# Functions are looked up by name through a perfect hash table, built here with the
+# hash-and-displace method. The name is hashed once. Its hash picks a bucket, and the
+# bucket's seed picks the table slot, where seeds are chosen so that no two functions
+# share a slot. A lookup is then two hash mixes and one string compare.
+
+MASK32 = 0xffffffff
+
+def proc_name_hash(name): # FNV-1a
+	h = 2166136261
+	for c in name.encode():
+		h = ((h ^ c) * 16777619) & MASK32
+	return h
+
+def proc_mix(h, seed): # murmur3 finalizer
+	h = (h ^ ((seed * 0x9e3779b9) & MASK32)) & MASK32
+	h ^= h >> 16
+	h = (h * 0x85ebca6b) & MASK32
+	h ^= h >> 13
+	h = (h * 0xc2b2ae35) & MASK32
+	h ^= h >> 16
+	return h
+
+def next_power_of_two(n):
+	p = 1
+	while p < n: p *= 2
+	return p
 
-print('extern std::unordered_map<std::string, PFN_vkVoidFunction> function_map;', file=header)
-print('std::unordered_map<std::string, PFN_vkVoidFunction> function_map = {', file=source)
+def build_perfect_hash(names):
+	hashes = [ proc_name_hash(n) for n in names ]
+	assert len(set(hashes)) == len(hashes), 'Function name hash collision, change the hash'
+	table_size = next_power_of_two(len(names) * 5 // 4)
+	bucket_count = next_power_of_two(max(1, len(names) // 4))
+	buckets = [ [] for i in range(bucket_count) ]
+	for i, h in enumerate(hashes):
+		buckets[proc_mix(h, 0) & (bucket_count - 1)].append(i)
+	seeds = [ 0 ] * bucket_count
+	slots = [ None ] * table_size
+	for b in sorted(range(bucket_count), key=lambda b: -len(buckets[b])):
+		if not buckets[b]: break
+		seed = 1
+		while True:
+			wanted = [ proc_mix(hashes[i], seed) & (table_size - 1) for i in buckets[b] ]
+			if len(set(wanted)) == len(wanted) and all(slots[w] is None for w in wanted): break
+			seed += 1
+			assert seed < 65536, 'Could not find a perfect hash'
+		seeds[b] = seed
+		for i, w in zip(buckets[b], wanted):
+			slots[w] = names[i]
+	return seeds, slots
+
+# Core version and device extensions that provide each function. vkGetDeviceProcAddr only
+# returns a function if the device supports its core version, or was created with one of its
+# extensions enabled. Instance extension functions are not gated.
+core_versions = {}
+for v in spec.root.findall('feature'):
+	if 'vulkan' not in v.attrib.get('api', 'vulkan').split(','): continue
+	major, minor = v.attrib.get('number').split('.')
+	for c in v.findall('require/command'):
+		core_versions.setdefault(c.attrib.get('name'), 'VK_MAKE_API_VERSION(0, %s, %s, 0)' % (major, minor))
+function_extensions = {}
+instance_extension_functions = set()
+for v in spec.root.findall('extensions/extension'):
+	if 'vulkan' not in v.attrib.get('supported', '').split(','): continue
+	for c in v.findall('require/command'):
+		n = c.attrib.get('name')
+		if v.attrib.get('type') == 'device':
+			function_extensions.setdefault(n, []).append(v.attrib.get('name'))
+		else:
+			instance_extension_functions.add(n)
+for n in instance_extension_functions:
+	function_extensions.pop(n, None)
+
+seeds, slots = build_perfect_hash(spec.functions)
+
+print("\n", file=header)
+print('#define PROC_TABLE_SIZE %d' % len(slots), file=header)
+print('#define PROC_BUCKETS %d' % len(seeds), file=header)
+print("\n", file=header)
+print('struct vk_proc_entry', file=header)
+print('{', file=header)
+print('\tconst char* name;', file=header)
+print('\tPFN_vkVoidFunction proc;', file=header)
+print('\t/// Device extensions that provide this function, null terminated, or null if it does not need any', file=header)
+print('\tconst char* const* extensions;', file=header)
+print('\t/// Core version that provides this function, or zero if it is only provided by extensions', file=header)
+print('\tuint32_t version;', file=header)
+print('};', file=header)
+print('extern const vk_proc_entry proc_table[PROC_TABLE_SIZE];', file=header)
+print("\n", file=header)
+print('/// Find a Vulkan function by name, without any memory allocation. Returns null if we do not know it.', file=header)
+print('const vk_proc_entry* lookup_proc(const char* name);', file=header)
+
+print('#include <string.h>', file=source)
+print("\n", file=source)
 for n in spec.functions:
+	if n in function_extensions:
+		print('static const char* const %s_extensions[] = { %s, nullptr };' % (n, ', '.join('"%s"' % e for e in function_extensions[n])), file=source)
+print("\n", file=source)
+print('static const uint16_t proc_seeds[PROC_BUCKETS] = {', file=source)
+for i in range(0, len(seeds), 16):
+	print('\t%s,' % ', '.join(str(x) for x in seeds[i:i + 16]), file=source)
+print('};', file=source)
+print("\n", file=source)
+print('const vk_proc_entry proc_table[PROC_TABLE_SIZE] = {', file=source)
+for n in slots:
+	if n is None:
+		print('\t{ nullptr, nullptr, nullptr, 0 },', file=source)
+		continue
 	if n in spec.protected_funcs:
 		print('#ifdef %s' % spec.protected_funcs[n], file=source)
-	print('\t{ "%s", (PFN_vkVoidFunction)%s },' % (n, n), file=source)
+	extensions = ('%s_extensions' % n) if n in function_extensions else 'nullptr'
+	print('\t{ "%s", (PFN_vkVoidFunction)%s, %s, %s },' % (n, n, extensions, core_versions.get(n, '0')), file=source)
 	if n in spec.protected_funcs:
+		print('#else', file=source)
+		print('\t{ nullptr, nullptr, nullptr, 0 },', file=source)
 		print('#endif // %s' % spec.protected_funcs[n], file=source)
 print('};', file=source)
 print("\n", file=source)
+print('static inline uint32_t proc_mix(uint32_t h, uint32_t seed)', file=source)
+print('{', file=source)
+print('\th ^= seed * 0x9e3779b9u;', file=source)
+print('\th ^= h >> 16;', file=source)
+print('\th *= 0x85ebca6bu;', file=source)
+print('\th ^= h >> 13;', file=source)
+print('\th *= 0xc2b2ae35u;', file=source)
+print('\th ^= h >> 16;', file=source)
+print('\treturn h;', file=source)
+print('}', file=source)
+print("\n", file=source)
+print('const vk_proc_entry* lookup_proc(const char* name)', file=source)
+print('{', file=source)
+print('\tuint32_t h = 2166136261u;', file=source)
+print('\tfor (const char* c = name; *c; c++) h = (h ^ (unsigned char)*c) * 16777619u;', file=source)
+print('\tconst uint32_t seed = proc_seeds[proc_mix(h, 0) & (PROC_BUCKETS - 1)];', file=source)
+print('\tconst vk_proc_entry* entry = &proc_table[proc_mix(h, seed) & (PROC_TABLE_SIZE - 1)];', file=source)
+print('\treturn (entry->name && strcmp(entry->name, name) == 0) ? entry : nullptr;', file=source)
+print('}', file=source)
+print("\n", file=source)
 
 # -- Command enum generator --
 # See above for description.
@@ -0,0 +1,52 @@
+// Check the per-scene benchmarking statistics against runs with a known shape.
+
+#include <algorithm>
+
+#include "util.h"
+
+static int failures = 0;
+
+static void expect(const char* run, const char* name, uint64_t value, uint64_t expected)
+{
+	if (value == expected) return;
+	ELOG("%s: expected %s to be %llu, but it is %llu", run, name, (unsigned long long)expected, (unsigned long long)value);
+	failures++;
+}
+
+/// Record a run of iterations that starts with a few slow ones and then settles within the given
+/// spread, in nanoseconds, around one millisecond.
+static bench_summary slow_start(unsigned slow, unsigned settled, uint64_t spread)
+{
+	benchmarking b;
+	uint64_t now = 0;
+	for (unsigned i = 0; i < slow; i++, now += 5000000) bench_record_iteration(b, now, now + 5000000);
+	for (unsigned i = 0; i < settled; i++)
+	{
+		const uint64_t time = 1000000 + (i * 7919) % (spread + 1);
+		bench_record_iteration(b, now, now + time);
+		now += time;
+	}
+	return bench_summarize(b.stats.at(0));
+}
+
+int main()
+{
+	// Steady state spread well inside one histogram bucket
+	bench_summary r = slow_start(3, 3000, 6000);
+	expect("tight", "iterations", r.iterations, 3003);
+	expect("tight", "warmup_iterations", r.warmup_iterations, 3);
+	expect("tight", "outliers", r.outliers, 0);
+	expect("tight", "max", r.max, std::min<uint64_t>(r.max, 1006000)); // no warmup iteration in it
+
+	// Steady state spread over several buckets
+	r = slow_start(3, 3000, 100000);
+	expect("wide", "warmup_iterations", r.warmup_iterations, 3);
+	expect("wide", "outliers", r.outliers, 0);
+
+	// No warmup at all
+	r = slow_start(0, 3000, 6000);
+	expect("steady", "warmup_iterations", r.warmup_iterations, 0);
+	expect("steady", "outliers", r.outliers, 0);
+
+	return failures > 0 ? 1 : 0;
+}
@@ -1,7 +1,10 @@
 #include <assert.h>
 #include <string.h>
 
+#include <algorithm>
+
 #include "commandbuffer.h"
+#include "transfer.h"
 
 enum
 {
@@ -57,7 +60,7 @@ bool write_queries(cVkQueryPool* pool, uint32_t firstQuery, uint32_t queryCount,
 void reset_command_buffer(cVkCommandBuffer* cmdbuf, bool release_resource)
 {
 	cmdbuf->flags = 0;
-	cmdbuf->commands.clear();
+	cmdbuf->commands.reset(release_resource);
 #ifndef FAST
 	cmdbuf->count.clear();
 	cmdbuf->count.resize(ENUM_MAX_COMMANDS);
@@ -65,99 +68,255 @@ void reset_command_buffer(cVkCommandBuffer* cmdbuf, bool release_resource)
 #endif
 }
 
-void execute_command_buffer_command(const cVkCommand& cmd, cVkCmdState& cmdstate, bool primary)
+#ifndef FAST
+/// Work done by the draws of a draw command
+struct DrawWork
 {
-#ifndef FAST // TBD - should only envelop the statistics part, but keep here until the comparing by string is gone
-	// Touch all bound resources to update access information
-	for (auto r : cmd.bindings)
+	long draws = 0;
+	long vertices = 0; ///< vertices or indices, per instance
+	long instanced_vertices = 0; ///< vertices or indices, over all instances
+};
+
+/// Read the parameters of an indirect draw, as the buffers hold them right now.
+static DrawWork indirect_draw_work(const cVkPayloadIndirect* payload, bool indexed)
+{
+	assert(payload && payload->buffer->memory);
+	uint32_t drawCount = payload->drawCount;
+	if (payload->countBuffer)
 	{
-		touch(r);
+		assert(payload->countBuffer->memory);
+		const char* count = payload->countBuffer->memory->ptr + payload->countBuffer->memoryOffset + payload->countBufferOffset;
+		drawCount = std::min(*reinterpret_cast<const uint32_t*>(count), drawCount);
 	}
+	assert(drawCount <= 1 || payload->stride >= (indexed ? sizeof(VkDrawIndexedIndirectCommand) : sizeof(VkDrawIndirectCommand)));
+	const char* ptr = payload->buffer->memory->ptr + payload->buffer->memoryOffset + payload->offset;
+	DrawWork work;
+	work.draws = drawCount;
+	for (unsigned i = 0; i < drawCount; i++, ptr += payload->stride)
+	{
+		uint32_t vertexCount, instanceCount;
+		if (indexed)
+		{
+			const VkDrawIndexedIndirectCommand* params = reinterpret_cast<const VkDrawIndexedIndirectCommand*>(ptr);
+			vertexCount = params->indexCount;
+			instanceCount = params->instanceCount;
+		}
+		else
+		{
+			const VkDrawIndirectCommand* params = reinterpret_cast<const VkDrawIndirectCommand*>(ptr);
+			vertexCount = params->vertexCount;
+			instanceCount = params->instanceCount;
+		}
+		work.vertices += vertexCount;
+		work.instanced_vertices += (long)vertexCount * instanceCount;
+	}
+	return work;
+}
 
-	uint64_t* queryData = nullptr;
-	if (cmdstate.queryPool)
+/// Work done by a draw command
+static DrawWork draw_work(const cVkCommand& cmd)
+{
+	DrawWork work;
+	switch (cmd.name)
 	{
-		queryData = &cmdstate.queryPool->data[cmdstate.queryPool->stride * cmdstate.query];
+	case ENUM_vkCmdDraw:
+	case ENUM_vkCmdDrawIndexed:
+		work.draws = cmd.count.metrics[1];
+		work.vertices = cmd.count.metrics[2];
+		work.instanced_vertices = cmd.count.metrics[2] * cmd.count.metrics[3];
+		break;
+	case ENUM_vkCmdDrawIndirect:
+	case ENUM_vkCmdDrawIndirectCount:
+	case ENUM_vkCmdDrawIndirectCountKHR:
+		work = indirect_draw_work(cmd.payload<cVkPayloadIndirect>(), false);
+		break;
+	default:
+		work = indirect_draw_work(cmd.payload<cVkPayloadIndirect>(), true);
+		break;
+	}
+	return work;
+}
+
+/// Workgroups launched by a dispatch command
+static long dispatch_workgroups(const cVkCommand& cmd)
+{
+	if (cmd.name != ENUM_vkCmdDispatchIndirect) return cmd.count.metrics[2];
+	const cVkPayloadIndirect* payload = cmd.payload<cVkPayloadIndirect>();
+	assert(payload && payload->buffer->memory);
+	const VkDispatchIndirectCommand* params = reinterpret_cast<const VkDispatchIndirectCommand*>(payload->buffer->memory->ptr + payload->buffer->memoryOffset + payload->offset);
+	return (long)params->x * params->y * params->z;
+}
+
+/// Touch the bound pipeline and descriptor sets and everything they use
+static void touch_bound_state(const cVkCmdState& cmdstate)
+{
+	touch(cmdstate.pipeline);
+	for (unsigned i = 0; i < cmdstate.descriptorSetCount; ++i)
+	{
+		cVkDescriptorSet* target_set = *(cmdstate.descriptorSets + i);
+		if (target_set) target_set->log_usage();
+	}
+	touch(cmdstate.pipeline->layout);
+	touch(cmdstate.pipeline->renderPass);
+}
+
+static void log_dispatch_usage(const cVkCmdState& cmdstate, long workgroups)
+{
+	cmdstate.pipeline->count.dispatches++;
+	cmdstate.pipeline->count.workgroups += workgroups;
+	for (cVkPipelineStage& stage : cmdstate.pipeline->stages)
+	{
+		if (stage.stage == VK_SHADER_STAGE_COMPUTE_BIT && stage.module)
+		{
+			stage.module->count.dispatches++;
+			touch(stage.module);
+		}
+	}
+	touch_bound_state(cmdstate);
+}
+
+static void log_draw_usage(const cVkCmdState& cmdstate, const DrawWork& work)
+{
+	cmdstate.pipeline->count.draws += work.draws;
+	cmdstate.pipeline->count.vertices += work.vertices;
+	for (cVkPipelineStage& stage : cmdstate.pipeline->stages)
+	{
+		if (stage.module)
+		{
+			stage.module->count.draws += work.draws;
+			stage.module->count.vertices += work.vertices;
+			touch(stage.module);
+		}
+	}
+	touch_bound_state(cmdstate);
+}
+
+static void log_command_usage(const cVkCommand& cmd, cVkCmdState& cmdstate)
+{
+	cVkBase* const* bindings = cmd.bindings();
+	for (unsigned i = 0; i < cmd.binding_count; i++)
+	{
+		touch(bindings[i]);
 	}
 
 	switch (cmd.name)
 	{
 	case ENUM_vkCmdBindPipeline:
-		cmdstate.pipeline = (cVkPipeline*)cmd.bindings[0];
+		cmdstate.pipeline = (cVkPipeline*)bindings[0];
 		break;
 	case ENUM_vkCmdBindDescriptorSets:
-		cmdstate.descriptorSets = (cVkDescriptorSet**)(cmd.bindings.data() + 1);
-		cmdstate.descriptorSetCount = cmd.bindings.size() - 1;
+		cmdstate.descriptorSets = (cVkDescriptorSet* const*)(bindings + 1);
+		cmdstate.descriptorSetCount = cmd.binding_count - 1;
 		break;
 	case ENUM_vkCmdDispatch:
+	case ENUM_vkCmdDispatchBase:
+	case ENUM_vkCmdDispatchBaseKHR:
 	case ENUM_vkCmdDispatchIndirect:
 		assert(cmdstate.pipeline);
-		cmdstate.pipeline->count.dispatches++;
-		touch(cmdstate.pipeline);
-		for (cVkPipelineStage& stage : cmdstate.pipeline->stages)
+		log_dispatch_usage(cmdstate, dispatch_workgroups(cmd));
+		break;
+	case ENUM_vkCmdDraw:
+	case ENUM_vkCmdDrawIndexed:
+	case ENUM_vkCmdDrawIndirect:
+	case ENUM_vkCmdDrawIndexedIndirect:
+	case ENUM_vkCmdDrawIndirectCount:
+	case ENUM_vkCmdDrawIndexedIndirectCount:
+	case ENUM_vkCmdDrawIndirectCountKHR:
+	case ENUM_vkCmdDrawIndexedIndirectCountKHR:
+		assert(cmdstate.pipeline);
+		log_draw_usage(cmdstate, draw_work(cmd));
+		break;
+	case ENUM_vkCmdExecuteCommands:
+		for (unsigned i = 0; i < cmd.binding_count; i++)
 		{
-			if (stage.stage == VK_SHADER_STAGE_COMPUTE_BIT && stage.module)
+			const cVkCommandBuffer* buffer = reinterpret_cast<const cVkCommandBuffer*>(bindings[i]);
+			for (const cVkCommand& secondary_cmd : buffer->commands)
 			{
-				stage.module->count.dispatches++;
-				touch(stage.module);
+				log_command_usage(secondary_cmd, cmdstate);
 			}
 		}
-		for (unsigned i = 0; i < cmdstate.descriptorSetCount; ++i)
-		{
-			cVkDescriptorSet* target_set = *(cmdstate.descriptorSets + i);
-			if (target_set == nullptr) continue;
+		break;
+	default:
+		break;
+	}
+}
+#endif
 
-			for (cVkDescriptorSetLayoutBinding& state_binding : target_set->state_bindings)
-			{
-				state_binding.log_usage();
-			}
+void log_command_buffer_usage(const cVkCommandBuffer* cmdbuf)
+{
+#ifndef FAST
+	cVkCmdState cmdstate;
+	for (const cVkCommand& cmd : cmdbuf->commands)
+	{
+		log_command_usage(cmd, cmdstate);
+	}
+#endif
+}
+
+void execute_command_buffer_command(const cVkCommand& cmd, cVkCmdState& cmdstate, bool primary)
+{
+#ifndef FAST // TBD - should only envelop the statistics part, but keep here until the comparing by string is gone
+	// Touch all bound resources to update access information
+	cVkBase* const* bindings = cmd.bindings();
+	if (cmdstate.track_usage)
+	{
+		for (unsigned i = 0; i < cmd.binding_count; i++)
+		{
+			touch(bindings[i]);
 		}
+	}
 
-		touch(cmdstate.pipeline->layout);
-		touch(cmdstate.pipeline->renderPass);
+	uint64_t* queryData = nullptr;
+	if (cmdstate.queryPool)
+	{
+		queryData = &cmdstate.queryPool->data[cmdstate.queryPool->stride * cmdstate.query];
+	}
+
+	switch (cmd.name)
+	{
+	case ENUM_vkCmdBindPipeline:
+		cmdstate.pipeline = (cVkPipeline*)bindings[0];
+		break;
+	case ENUM_vkCmdBindDescriptorSets:
+		cmdstate.descriptorSets = (cVkDescriptorSet* const*)(bindings + 1);
+		cmdstate.descriptorSetCount = cmd.binding_count - 1;
+		break;
+	case ENUM_vkCmdDispatch:
+	case ENUM_vkCmdDispatchBase:
+	case ENUM_vkCmdDispatchBaseKHR:
+	case ENUM_vkCmdDispatchIndirect:
+	{
+		assert(cmdstate.pipeline);
+		const long workgroups = dispatch_workgroups(cmd);
+		cmdstate.dispatches++;
+		cmdstate.workgroups += workgroups;
+		if (cmdstate.track_usage) log_dispatch_usage(cmdstate, workgroups);
 
 		if (queryData)
 		{
-			queryData[STATISTIC_COMPUTE_SHADER_INVOCATIONS]++;
+			// we do not know the workgroup size, so count one invocation per workgroup
+			queryData[STATISTIC_COMPUTE_SHADER_INVOCATIONS] += workgroups;
 		}
 		break;
+	}
 	case ENUM_vkCmdDraw:
 	case ENUM_vkCmdDrawIndexed:
 	case ENUM_vkCmdDrawIndirect:
 	case ENUM_vkCmdDrawIndexedIndirect:
+	case ENUM_vkCmdDrawIndirectCount:
+	case ENUM_vkCmdDrawIndexedIndirectCount:
+	case ENUM_vkCmdDrawIndirectCountKHR:
+	case ENUM_vkCmdDrawIndexedIndirectCountKHR:
 	{
-		// TBD: multiply counting by instancing...
 		assert(cmdstate.pipeline);
-		// do metrics counting for various involved components
-		cmdstate.pipeline->count.draws += cmd.count.metrics[1];
-		cmdstate.pipeline->count.vertices += cmd.count.metrics[2];
-		touch(cmdstate.pipeline);
-		for (cVkPipelineStage& stage : cmdstate.pipeline->stages)
-		{
-			if (stage.module)
-			{
-				stage.module->count.draws += cmd.count.metrics[1];
-				stage.module->count.vertices += cmd.count.metrics[2];
-				touch(stage.module);
-			}
-		}
-		for (unsigned i = 0; i < cmdstate.descriptorSetCount; ++i)
-		{
-			cVkDescriptorSet* target_set = *(cmdstate.descriptorSets + i);
-			if (target_set == nullptr) continue;
-
-			for (cVkDescriptorSetLayoutBinding& state_binding : target_set->state_bindings)
-			{
-				state_binding.log_usage();
-			}
-		}
-
-		touch(cmdstate.pipeline->layout);
-		touch(cmdstate.pipeline->renderPass);
+		const DrawWork work = draw_work(cmd);
+		cmdstate.draws += work.draws;
+		cmdstate.vertices += work.vertices;
+		if (cmdstate.track_usage) log_draw_usage(cmdstate, work);
 
 		if (queryData)
 		{
-			const int verts = cmd.count.metrics[2] * cmd.count.metrics[3];
+			const long verts = work.instanced_vertices;
 			queryData[STATISTIC_INPUT_ASSEMBLY_VERTICES] += verts;
 			queryData[STATISTIC_INPUT_ASSEMBLY_PRIMITIVES] += verts / 3;
 			// "count the number of vertex shader invocations"
@@ -172,14 +331,14 @@ void execute_command_buffer_command(const cVkCommand& cmd, cVkCmdState& cmdstate
 	case ENUM_vkCmdBeginQuery:
 	case ENUM_vkCmdEndQuery:
 	{
-		cVkPayloadQuery* q = (cVkPayloadQuery*)cmd.payload;
+		const cVkPayloadQuery* q = cmd.payload<cVkPayloadQuery>();
 		cmdstate.queryPool = q->queryPool;
 		cmdstate.query = q->query;
 		break;
 	}
 	case ENUM_vkCmdCopyQueryPoolResults:
 	{
-		cVkPayloadCopyQuery* q = (cVkPayloadCopyQuery*)cmd.payload;
+		const cVkPayloadCopyQuery* q = cmd.payload<cVkPayloadCopyQuery>();
 		void* pData = q->dstBuffer->memory->ptr + q->dstBuffer->memoryOffset + q->dstOffset;
 		size_t dataSize = q->dstBuffer->memory->allocationSize;
 		write_queries(q->queryPool, q->firstQuery, q->queryCount, dataSize, q->stride, pData, q->flags);
@@ -187,8 +346,8 @@ void execute_command_buffer_command(const cVkCommand& cmd, cVkCmdState& cmdstate
 	}
 	case ENUM_vkCmdResetQueryPool:
 	{
-		cVkQueryPool* qp = (cVkQueryPool*)cmd.bindings[0];
-		const cVkPayloadQueryReset* payload = (cVkPayloadQueryReset*)cmd.payload;
+		cVkQueryPool* qp = (cVkQueryPool*)bindings[0];
+		const cVkPayloadQueryReset* payload = cmd.payload<cVkPayloadQueryReset>();
 		assert(payload->firstQuery + payload->queryCount <= qp->data.size());
 		for (unsigned i = payload->firstQuery; i < payload->firstQuery + payload->queryCount; i++)
 		{
@@ -201,21 +360,94 @@ void execute_command_buffer_command(const cVkCommand& cmd, cVkCmdState& cmdstate
 	case ENUM_vkCmdCopyBuffer2:
 	case ENUM_vkCmdCopyBuffer2KHR:
 	{
-		const cVkPayloadCopyBuffer* payload = (const cVkPayloadCopyBuffer*)cmd.payload;
+		const cVkPayloadCopyBuffer* payload = cmd.payload<cVkPayloadCopyBuffer>();
 		assert(payload);
 		assert(payload->srcBuffer);
 		assert(payload->dstBuffer);
 		assert(payload->srcBuffer->memory);
 		assert(payload->dstBuffer->memory);
-		for (const VkBufferCopy& region : payload->regions)
+		for (uint32_t i = 0; i < payload->regionCount; i++)
 		{
+			const VkBufferCopy& region = payload->regions()[i];
 			assert(region.srcOffset + region.size <= payload->srcBuffer->size);
 			assert(region.dstOffset + region.size <= payload->dstBuffer->size);
 			assert(payload->srcBuffer->memoryOffset + region.srcOffset + region.size <= payload->srcBuffer->memory->allocationSize);
 			assert(payload->dstBuffer->memoryOffset + region.dstOffset + region.size <= payload->dstBuffer->memory->allocationSize);
 			const char* src = payload->srcBuffer->memory->ptr + payload->srcBuffer->memoryOffset + region.srcOffset;
 			char* dst = payload->dstBuffer->memory->ptr + payload->dstBuffer->memoryOffset + region.dstOffset;
-			memmove(dst, src, region.size);
+			transfer_copy(dst, src, region.size);
+			cmdstate.bytes_copied += region.size;
+		}
+		break;
+	}
+	case ENUM_vkCmdFillBuffer:
+	{
+		const cVkPayloadFillBuffer* payload = cmd.payload<cVkPayloadFillBuffer>();
+		assert(payload);
+		assert(payload->dstBuffer->memory);
+		const cVkBuffer* buffer = payload->dstBuffer;
+		const VkDeviceSize size = (payload->size == VK_WHOLE_SIZE) ? (buffer->size - payload->dstOffset) & ~(VkDeviceSize)3 : payload->size;
+		assert(payload->dstOffset + size <= buffer->size);
+		transfer_fill(buffer->memory->ptr + buffer->memoryOffset + payload->dstOffset, size, payload->data);
+		cmdstate.bytes_copied += size;
+		break;
+	}
+	case ENUM_vkCmdUpdateBuffer:
+	{
+		const cVkPayloadUpdateBuffer* payload = cmd.payload<cVkPayloadUpdateBuffer>();
+		assert(payload);
+		assert(payload->dstBuffer->memory);
+		const cVkBuffer* buffer = payload->dstBuffer;
+		assert(payload->dstOffset + payload->dataSize <= buffer->size);
+		transfer_copy(buffer->memory->ptr + buffer->memoryOffset + payload->dstOffset, payload->data(), payload->dataSize);
+		cmdstate.bytes_copied += payload->dataSize;
+		break;
+	}
+	case ENUM_vkCmdCopyImage:
+	case ENUM_vkCmdCopyImage2:
+	case ENUM_vkCmdCopyImage2KHR:
+	{
+		const cVkPayloadCopyImage* payload = cmd.payload<cVkPayloadCopyImage>();
+		assert(payload);
+		for (uint32_t i = 0; i < payload->regionCount; i++)
+		{
+			cmdstate.bytes_copied += transfer_image_to_image(payload->srcImage, payload->dstImage, payload->regions()[i]);
+		}
+		break;
+	}
+	case ENUM_vkCmdCopyBufferToImage:
+	case ENUM_vkCmdCopyBufferToImage2:
+	case ENUM_vkCmdCopyBufferToImage2KHR:
+	{
+		const cVkPayloadCopyBufferImage* payload = cmd.payload<cVkPayloadCopyBufferImage>();
+		assert(payload);
+		for (uint32_t i = 0; i < payload->regionCount; i++)
+		{
+			cmdstate.bytes_copied += transfer_buffer_to_image(payload->buffer, payload->image, payload->regions()[i]);
+		}
+		break;
+	}
+	case ENUM_vkCmdCopyImageToBuffer:
+	case ENUM_vkCmdCopyImageToBuffer2:
+	case ENUM_vkCmdCopyImageToBuffer2KHR:
+	{
+		const cVkPayloadCopyBufferImage* payload = cmd.payload<cVkPayloadCopyBufferImage>();
+		assert(payload);
+		for (uint32_t i = 0; i < payload->regionCount; i++)
+		{
+			cmdstate.bytes_copied += transfer_image_to_buffer(payload->image, payload->buffer, payload->regions()[i]);
+		}
+		break;
+	}
+	case ENUM_vkCmdBlitImage:
+	case ENUM_vkCmdBlitImage2:
+	case ENUM_vkCmdBlitImage2KHR:
+	{
+		const cVkPayloadBlitImage* payload = cmd.payload<cVkPayloadBlitImage>();
+		assert(payload);
+		for (uint32_t i = 0; i < payload->regionCount; i++)
+		{
+			cmdstate.bytes_copied += transfer_blit(payload->srcImage, payload->dstImage, payload->regions()[i]);
 		}
 		break;
 	}
@@ -223,7 +455,7 @@ void execute_command_buffer_command(const cVkCommand& cmd, cVkCmdState& cmdstate
 	case ENUM_vkCmdSetEvent2:
 	case ENUM_vkCmdSetEvent2KHR:
 	{
-		cVkEvent* event = (cVkEvent*)cmd.bindings[0];
+		cVkEvent* event = (cVkEvent*)bindings[0];
 		event->signalled = true;
 		break;
 	}
@@ -231,7 +463,7 @@ void execute_command_buffer_command(const cVkCommand& cmd, cVkCmdState& cmdstate
 	case ENUM_vkCmdResetEvent2:
 	case ENUM_vkCmdResetEvent2KHR:
 	{
-		cVkEvent* event = (cVkEvent*)cmd.bindings[0];
+		cVkEvent* event = (cVkEvent*)bindings[0];
 		event->signalled = false;
 		break;
 	}
@@ -239,8 +471,8 @@ void execute_command_buffer_command(const cVkCommand& cmd, cVkCmdState& cmdstate
 	case ENUM_vkCmdWriteTimestamp2:
 	case ENUM_vkCmdWriteTimestamp2KHR:
 	{
-		cVkQueryPool* qp = (cVkQueryPool*)cmd.bindings[0];
-		const cVkPayloadQuery* payload = (const cVkPayloadQuery*)cmd.payload;
+		cVkQueryPool* qp = (cVkQueryPool*)bindings[0];
+		const cVkPayloadQuery* payload = cmd.payload<cVkPayloadQuery>();
 		assert(payload);
 		assert(payload->query < qp->data.size());
 		qp->data[payload->query] = cVkBase::current_frame;
@@ -254,9 +486,9 @@ void execute_command_buffer_command(const cVkCommand& cmd, cVkCmdState& cmdstate
 			ELOG("Trying to execute a secondary command buffer inside a secondary command buffer!");
 			return;
 		}
-		for (const cVkBase* secondary_cmd_buffer : cmd.bindings)
+		for (unsigned i = 0; i < cmd.binding_count; i++)
 		{
-			const cVkCommandBuffer* buffer = reinterpret_cast<const cVkCommandBuffer*>(secondary_cmd_buffer);
+			const cVkCommandBuffer* buffer = reinterpret_cast<const cVkCommandBuffer*>(bindings[i]);
 			// inherits state? but not overwrites?
 			for (const cVkCommand& secondary_cmd : buffer->commands)
 			{
@@ -267,13 +499,13 @@ void execute_command_buffer_command(const cVkCommand& cmd, cVkCmdState& cmdstate
 	}
 	case ENUM_vkCmdWriteAccelerationStructuresPropertiesKHR:
 	{
-		cVkQueryPool* qp = (cVkQueryPool*)cmd.bindings[0];
-		const cVkPayloadWriteAccelerationStructuresPropertiesKHR* payload = (cVkPayloadWriteAccelerationStructuresPropertiesKHR*)cmd.payload;
+		cVkQueryPool* qp = (cVkQueryPool*)bindings[0];
+		const cVkPayloadWriteAccelerationStructuresPropertiesKHR* payload = cmd.payload<cVkPayloadWriteAccelerationStructuresPropertiesKHR>();
 		for (unsigned i = 0; i < payload->accelerationStructureCount; i++)
 		{
 			const unsigned query_index = payload->firstQuery + i;
 			if (query_index >= qp->data.size()) break;
-			const uint64_t value = (i < payload->sizes.size() && payload->sizes[i] != 0) ? payload->sizes[i] : 1;
+			const uint64_t value = (payload->sizes()[i] != 0) ? payload->sizes()[i] : 1;
 			qp->data[query_index] = value;
 			qp->availability[query_index] = true;
 		}
@@ -281,8 +513,8 @@ void execute_command_buffer_command(const cVkCommand& cmd, cVkCmdState& cmdstate
 	}
 	case ENUM_vkCmdWriteMicromapsPropertiesEXT:
 	{
-		cVkQueryPool* qp = (cVkQueryPool*)cmd.bindings[0];
-		const cVkPayloadWriteMicromapsPropertiesEXT* payload = (cVkPayloadWriteMicromapsPropertiesEXT*)cmd.payload;
+		cVkQueryPool* qp = (cVkQueryPool*)bindings[0];
+		const cVkPayloadWriteMicromapsPropertiesEXT* payload = cmd.payload<cVkPayloadWriteMicromapsPropertiesEXT>();
 		for (unsigned i = payload->firstQuery; i < payload->micromapCount; i++)
 		{
 			qp->data[i] = 1;
@@ -4,6 +4,8 @@
 #include "util.h"
 
 void execute_command_buffer_command(const cVkCommand& cmd, cVkCmdState& cmdstate, bool primary);
+/// Do the usage tracking that executing the command buffer would do, without executing it.
+void log_command_buffer_usage(const cVkCommandBuffer* cmdbuf);
 void reset_command_buffer(cVkCommandBuffer* cmdbuf, bool release_resource);
 bool write_queries(cVkQueryPool* queryPool, uint32_t firstQuery, uint32_t queryCount,
                    size_t dataSize, VkDeviceSize stride, void* pData, VkQueryResultFlags flags);
@@ -0,0 +1,171 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "device_memory.h"
+
+// Allocations up to 64 pages are taken from slabs, in power of two size classes.
+static constexpr int size_classes = 7;
+// Allocations at least this large are aligned to it, and use transparent huge pages. Smaller
+// allocations do not, since asking for huge pages can stall on memory compaction, which is not
+// worth it for memory that is often only partly written to.
+static constexpr size_t huge_page_size = 2 * 1024 * 1024;
+// Slabs are at least this large, and hold at least min_slab_blocks blocks. They are aligned to
+// their size, so that we can find the slab of a block, and unmapped again once all their blocks
+// are free, unless they are the only free space left in their size class.
+static constexpr size_t min_slab_size = 2 * 1024 * 1024;
+static constexpr size_t min_slab_blocks = 8;
+
+static size_t page_size = 4096;
+static bool pooling = true;
+
+struct DeviceMemoryPool
+{
+	std::mutex mutex;
+	std::vector<char*> free_blocks[size_classes];
+	std::unordered_map<char*, size_t> slab_used[size_classes]; // number of blocks in use in each slab, by slab start
+};
+
+static DeviceMemoryPool pools[VK_MAX_MEMORY_TYPES];
+
+static inline size_t round_up(size_t value, size_t alignment) { return (value + alignment - 1) / alignment * alignment; }
+
+void device_memory_init()
+{
+	page_size = sysconf(_SC_PAGESIZE);
+	pooling = get_env_int("CHAMELEON_MEMORY_POOL", 1) != 0;
+}
+
+/// Size class for an allocation, or -1 if it is too large for the slabs.
+static int size_class(VkDeviceSize size)
+{
+	size_t class_size = page_size;
+	for (int i = 0; i < size_classes; i++, class_size *= 2)
+	{
+		if (size <= class_size) return i;
+	}
+	return -1;
+}
+
+static char* map_pages(size_t size)
+{
+	char* ptr = static_cast<char*>(mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+	return (ptr == MAP_FAILED) ? nullptr : ptr;
+}
+
+/// Map anonymous memory aligned to the given power of two.
+static char* map_aligned_pages(size_t size, size_t alignment)
+{
+	// Map more than we need, and trim the ends to get the alignment
+	const size_t mapped_size = size + alignment;
+	char* mapped = static_cast<char*>(mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+	if (mapped == MAP_FAILED) return nullptr;
+	char* ptr = reinterpret_cast<char*>(round_up(reinterpret_cast<uintptr_t>(mapped), alignment));
+	if (ptr > mapped) munmap(mapped, ptr - mapped);
+	if (mapped + mapped_size > ptr + size) munmap(ptr + size, mapped + mapped_size - (ptr + size));
+	return ptr;
+}
+
+/// Map anonymous memory aligned to a huge page, and ask for it to be backed by huge pages.
+static char* map_huge_pages(size_t size)
+{
+	char* ptr = map_aligned_pages(size, huge_page_size);
+	if (ptr) madvise(ptr, size, MADV_HUGEPAGE);
+	return ptr;
+}
+
+static inline size_t slab_size(int index) { return std::max(min_slab_size, (page_size << index) * min_slab_blocks); }
+
+static inline char* slab_of(char* ptr, int index)
+{
+	return reinterpret_cast<char*>(reinterpret_cast<uintptr_t>(ptr) & ~(uintptr_t)(slab_size(index) - 1));
+}
+
+char* device_memory_alloc(uint32_t memoryTypeIndex, VkDeviceSize size)
+{
+	assert(memoryTypeIndex < VK_MAX_MEMORY_TYPES);
+	size = round_up(size, page_size);
+	if (!pooling)
+	{
+		char* ptr = nullptr;
+		if (posix_memalign((void**)&ptr, page_size, size) != 0) return nullptr;
+		return ptr;
+	}
+
+	const int index = size_class(size);
+	if (index < 0)
+	{
+		// Large allocations are mapped on their own, and only backed by memory once they are touched
+		return (size < huge_page_size) ? map_pages(size) : map_huge_pages(size);
+	}
+
+	DeviceMemoryPool& pool = pools[memoryTypeIndex];
+	std::lock_guard<std::mutex> lock(pool.mutex);
+	std::vector<char*>& free_blocks = pool.free_blocks[index];
+	if (free_blocks.empty())
+	{
+		const size_t block_size = page_size << index;
+		const size_t size = slab_size(index);
+		char* slab = map_aligned_pages(size, size);
+		if (!slab) return nullptr;
+		// Slabs are aligned like huge pages, but we do not want them for the reasons given above
+		madvise(slab, size, MADV_NOHUGEPAGE);
+		// Hand out blocks from the start of the slab first
+		for (size_t offset = size; offset > 0; offset -= block_size)
+		{
+			free_blocks.push_back(slab + offset - block_size);
+		}
+	}
+	char* ptr = free_blocks.back();
+	free_blocks.pop_back();
+	pool.slab_used[index][slab_of(ptr, index)]++;
+	return ptr;
+}
+
+void device_memory_free(uint32_t memoryTypeIndex, char* ptr, VkDeviceSize size)
+{
+	if (!ptr) return;
+	assert(memoryTypeIndex < VK_MAX_MEMORY_TYPES);
+	size = round_up(size, page_size);
+	if (!pooling)
+	{
+		free(ptr);
+		return;
+	}
+
+	const int index = size_class(size);
+	if (index < 0)
+	{
+		munmap(ptr, size);
+		return;
+	}
+
+	// Blocks are kept for reuse, but we let the kernel reclaim the memory behind larger ones
+	if (index >= size_classes - 2) madvise(ptr, size, MADV_DONTNEED);
+	DeviceMemoryPool& pool = pools[memoryTypeIndex];
+	std::lock_guard<std::mutex> lock(pool.mutex);
+	std::vector<char*>& free_blocks = pool.free_blocks[index];
+	free_blocks.push_back(ptr);
+	char* const slab = slab_of(ptr, index);
+	auto used = pool.slab_used[index].find(slab);
+	assert(used != pool.slab_used[index].end() && used->second > 0);
+	if (--used->second > 0) return;
+
+	// The slab is empty. Unmap it if there is free space in other slabs, otherwise keep it for
+	// the next allocation but give its memory back to the kernel.
+	const size_t total = slab_size(index);
+	const size_t blocks = total / (page_size << index);
+	if (free_blocks.size() > blocks)
+	{
+		free_blocks.erase(std::remove_if(free_blocks.begin(), free_blocks.end(), [&](char* block) { return block >= slab && block < slab + total; }), free_blocks.end());
+		pool.slab_used[index].erase(used);
+		munmap(slab, total);
+	}
+	else madvise(slab, total, MADV_DONTNEED);
+}
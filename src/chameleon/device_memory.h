@@ -0,0 +1,17 @@
+#pragma once
+
+// Backing store for device memory allocations. Small allocations are carved out of slabs kept
+// in per memory type pools, which are released again once empty, and large ones are mapped
+// directly, with transparent huge pages where the kernel allows them.
+
+#include "vulkan_defs.h"
+
+/// Read configuration from the environment. Call once, before any memory is allocated.
+void device_memory_init();
+
+/// Allocate memory for a VkDeviceMemory. It is aligned to at least the page size, and no other
+/// allocation shares any of its pages. Returns null if we are out of memory.
+char* device_memory_alloc(uint32_t memoryTypeIndex, VkDeviceSize size);
+
+/// Free memory returned by device_memory_alloc(), with the same memory type and size.
+void device_memory_free(uint32_t memoryTypeIndex, char* ptr, VkDeviceSize size);
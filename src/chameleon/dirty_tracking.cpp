@@ -0,0 +1,227 @@
+#include <assert.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <mutex>
+
+#include "dirty_tracking.h"
+#include "frame_metrics.h"
+#include "transfer.h"
+
+/// A tracked allocation. These live in a fixed table that the fault handler searches without
+/// taking any locks, since neither locks nor the heap may be used in a signal handler. Changes
+/// to a slot are made under regions_mutex and bracketed by making its sequence number odd, so
+/// that the handler can tell that what it read may be inconsistent.
+struct DirtyRegion
+{
+	std::atomic_uint32_t sequence { 0 };
+	std::atomic_uintptr_t start { 0 }; ///< start address, or zero for a free slot
+	std::atomic_size_t pages { 0 };
+	size_t capacity = 0; ///< words in the bit arrays, which are kept for reuse when the slot is freed
+	std::unique_ptr<std::atomic_uint64_t[]> dirty; ///< pages written by the application this frame
+	std::unique_ptr<std::atomic_uint64_t[]> writable; ///< pages not write protected, written by the application or the device
+	std::atomic_bool any_writable { false };
+	cVkDeviceMemory* memory = nullptr;
+};
+
+bool dirty_tracking = false;
+
+static size_t page_size = 4096;
+static struct sigaction previous_action;
+
+static constexpr unsigned max_regions = 4096;
+/// Serializes changes to the table. The fault handler never takes it.
+static std::mutex regions_mutex;
+static DirtyRegion regions[max_regions];
+/// All slots in use are below this. Never decreases, so the handler can read it at any time.
+static std::atomic_uint region_count { 0 };
+
+static inline size_t bit_words(size_t pages) { return (pages + 63) / 64; }
+static inline void set_bit(std::atomic_uint64_t* bits, size_t i) { bits[i / 64].fetch_or(1ull << (i % 64), std::memory_order_relaxed); }
+
+static void fault_handler(int sig, siginfo_t* info, void* context)
+{
+	if (info->si_code == SEGV_ACCERR)
+	{
+		const uintptr_t address = reinterpret_cast<uintptr_t>(info->si_addr);
+		const unsigned count = region_count.load(std::memory_order_acquire);
+		for (unsigned i = 0; i < count; i++)
+		{
+			DirtyRegion& region = regions[i];
+			const uint32_t sequence = region.sequence.load(std::memory_order_acquire);
+			const uintptr_t start = region.start.load(std::memory_order_relaxed);
+			const size_t pages = region.pages.load(std::memory_order_relaxed);
+			if (start == 0 || address < start || address >= start + pages * page_size) continue;
+			std::atomic_thread_fence(std::memory_order_acquire);
+			// A slot only changes while the memory it covers is being mapped or freed, which the
+			// application cannot be writing to at the same time, so it is stable from here on.
+			if ((sequence & 1) || region.sequence.load(std::memory_order_relaxed) != sequence) continue;
+			const size_t page = (address - start) / page_size;
+			if (!device_work_thread) set_bit(region.dirty.get(), page);
+			set_bit(region.writable.get(), page);
+			region.any_writable.store(true, std::memory_order_relaxed);
+			mprotect(reinterpret_cast<void*>(start + page * page_size), page_size, PROT_READ | PROT_WRITE);
+			return; // the write is retried, and now succeeds
+		}
+	}
+
+	// Not one of ours, so hand it on
+	if (previous_action.sa_flags & SA_SIGINFO)
+	{
+		previous_action.sa_sigaction(sig, info, context);
+	}
+	else if (previous_action.sa_handler != SIG_DFL && previous_action.sa_handler != SIG_IGN)
+	{
+		previous_action.sa_handler(sig);
+	}
+	else
+	{
+		signal(sig, SIG_DFL); // fault again on return, and crash as usual
+	}
+}
+
+void dirty_tracking_init()
+{
+	if (get_env_int("CHAMELEON_DIRTY_TRACKING", 0) == 0 || dirty_tracking) return;
+	page_size = sysconf(_SC_PAGESIZE);
+	struct sigaction action = {};
+	action.sa_sigaction = fault_handler;
+	action.sa_flags = SA_SIGINFO;
+	sigemptyset(&action.sa_mask);
+	if (sigaction(SIGSEGV, &action, &previous_action) != 0)
+	{
+		ELOG("Could not install fault handler for dirty tracking");
+		return;
+	}
+	dirty_tracking = true;
+}
+
+size_t dirty_tracking_page_size()
+{
+	return page_size;
+}
+
+/// Find the slot of a tracked allocation. Must be called with regions_mutex held.
+static DirtyRegion* find_region(const void* ptr)
+{
+	const unsigned count = region_count.load(std::memory_order_relaxed);
+	for (unsigned i = 0; i < count; i++)
+	{
+		if (regions[i].start.load(std::memory_order_relaxed) == reinterpret_cast<uintptr_t>(ptr)) return &regions[i];
+	}
+	return nullptr;
+}
+
+void dirty_tracking_map(cVkDeviceMemory* mem)
+{
+	if (!dirty_tracking || mem->dirty_tracked || !mem->ptr) return;
+	std::lock_guard<std::mutex> lock(regions_mutex);
+	DirtyRegion* region = find_region(nullptr); // a free slot
+	if (!region)
+	{
+		const unsigned index = region_count.load(std::memory_order_relaxed);
+		if (index == max_regions)
+		{
+			ELOG("Too many mapped allocations for dirty tracking, not tracking %p", mem->ptr);
+			return;
+		}
+		region = &regions[index];
+	}
+	const size_t pages = (mem->allocationSize + page_size - 1) / page_size;
+	region->sequence.fetch_add(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	if (region->capacity < bit_words(pages))
+	{
+		region->capacity = bit_words(pages);
+		region->dirty.reset(new std::atomic_uint64_t[region->capacity]);
+		region->writable.reset(new std::atomic_uint64_t[region->capacity]);
+	}
+	for (size_t i = 0; i < bit_words(pages); i++)
+	{
+		region->dirty[i].store(0, std::memory_order_relaxed);
+		region->writable[i].store(0, std::memory_order_relaxed);
+	}
+	region->memory = mem;
+	region->any_writable.store(false, std::memory_order_relaxed);
+	region->pages.store(pages, std::memory_order_relaxed);
+	region->start.store(reinterpret_cast<uintptr_t>(mem->ptr), std::memory_order_relaxed);
+	region->sequence.fetch_add(1, std::memory_order_release);
+	if (region == &regions[region_count.load(std::memory_order_relaxed)]) region_count.fetch_add(1, std::memory_order_release);
+	mprotect(mem->ptr, pages * page_size, PROT_READ);
+	mem->dirty_tracked = true;
+}
+
+/// Record the dirty pages of a region for the frame, and clear them. Returns the number of dirty pages.
+static uint32_t record_dirty_pages(DirtyRegion& region, int frame)
+{
+	uint32_t count = 0;
+	const size_t words = bit_words(region.pages.load(std::memory_order_relaxed));
+	for (size_t i = 0; i < words; i++)
+	{
+		count += std::popcount(region.dirty[i].exchange(0, std::memory_order_relaxed));
+	}
+	if (count > 0) region.memory->dirty_pages.push_back({ frame, count });
+	return count;
+}
+
+void dirty_tracking_free(cVkDeviceMemory* mem, int frame)
+{
+	if (!mem->dirty_tracked) return;
+	std::lock_guard<std::mutex> lock(regions_mutex);
+	DirtyRegion* region = find_region(mem->ptr);
+	assert(region);
+	frame_metrics_add(FRAME_METRIC_DIRTY_PAGES, record_dirty_pages(*region, frame));
+	mprotect(mem->ptr, region->pages.load(std::memory_order_relaxed) * page_size, PROT_READ | PROT_WRITE);
+	region->sequence.fetch_add(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	region->start.store(0, std::memory_order_relaxed);
+	region->memory = nullptr;
+	region->sequence.fetch_add(1, std::memory_order_release);
+	mem->dirty_tracked = false;
+}
+
+void dirty_tracking_end_frame(int frame)
+{
+	if (!dirty_tracking) return;
+	std::lock_guard<std::mutex> lock(regions_mutex);
+	long total = 0;
+	const unsigned count = region_count.load(std::memory_order_relaxed);
+	for (unsigned i = 0; i < count; i++)
+	{
+		DirtyRegion& region = regions[i];
+		const uintptr_t start = region.start.load(std::memory_order_relaxed);
+		if (start == 0 || !region.any_writable.exchange(false, std::memory_order_relaxed)) continue;
+		total += record_dirty_pages(region, frame);
+		// Protect runs of consecutive writable pages with one call each. A page that faults in
+		// the meantime is made writable again by the handler, and caught at the next frame end.
+		const size_t pages = region.pages.load(std::memory_order_relaxed);
+		size_t first = 0;
+		size_t run = 0;
+		for (size_t word = 0; word < bit_words(pages); word++)
+		{
+			const uint64_t bits = region.writable[word].exchange(0, std::memory_order_relaxed);
+			if (bits == 0 && run == 0) continue;
+			for (size_t bit = 0; bit < 64; bit++)
+			{
+				const size_t page = word * 64 + bit;
+				if (page < pages && (bits & (1ull << bit)))
+				{
+					if (run == 0) first = page;
+					run++;
+				}
+				else if (run > 0)
+				{
+					mprotect(reinterpret_cast<void*>(start + first * page_size), run * page_size, PROT_READ);
+					run = 0;
+				}
+			}
+		}
+		if (run > 0) mprotect(reinterpret_cast<void*>(start + first * page_size), run * page_size, PROT_READ);
+	}
+	frame_metrics_add(FRAME_METRIC_DIRTY_PAGES, total);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+// Opt-in tracking of how many pages of mapped device memory the application writes to in each
+// frame. Mapped memory is write protected, and the first write to each page in a frame is caught
+// as a fault, which marks the page as dirty and makes it writable until the end of the frame.
+// System calls that write into protected pages, like read() or recv(), fail with EFAULT instead
+// of faulting, which is why this is opt-in.
+
+#include "vulkan_defs.h"
+
+extern bool dirty_tracking;
+
+/// Enable tracking if CHAMELEON_DIRTY_TRACKING is set. Call once, before any memory is allocated.
+void dirty_tracking_init();
+
+/// Size of the pages that we track. Tracked allocations must be aligned to and a multiple of it,
+/// so that protecting them does not affect any other memory.
+size_t dirty_tracking_page_size();
+
+/// Start tracking an allocation, if it is not tracked already. Called when it is mapped.
+void dirty_tracking_map(cVkDeviceMemory* mem);
+
+/// Stop tracking an allocation, and record the pages written since the last frame ended.
+/// Called before its memory is freed.
+void dirty_tracking_free(cVkDeviceMemory* mem, int frame);
+
+/// Record the pages written to in each tracked allocation in the frame that just ended, and
+/// write protect them all again.
+void dirty_tracking_end_frame(int frame);
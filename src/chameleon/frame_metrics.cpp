@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <mutex>
+#include <string>
+
+#include "frame_metrics.h"
+
+// Frames are collected in a fixed size buffer and written out in batches when it fills up, so
+// that a present does not normally do any file I/O.
+static constexpr int pending_size = 256;
+
+static const char* metric_names[FRAME_METRIC_MAX] = { "submits", "command_buffers", "draws", "vertices", "dispatches",
+                                                      "workgroups", "bytes_copied", "allocations", "allocated_bytes", "dirty_pages" };
+static const char* object_names[FRAME_OBJECT_MAX] = { "device_memory", "buffers", "buffer_views", "images", "image_views",
+                                                      "samplers", "descriptor_sets", "framebuffers", "pipelines",
+                                                      "shader_modules", "command_buffers", "fences", "semaphores" };
+
+struct FrameRow
+{
+	int frame;
+	long counters[FRAME_METRIC_MAX];
+	long live[FRAME_OBJECT_MAX];
+};
+
+FrameMetrics frame_metrics;
+
+static std::mutex pending_mutex;
+static FrameRow pending[pending_size];
+static int pending_count = 0;
+static std::string filename;
+static FILE* fp = nullptr; // closed when an instance is destroyed, and reopened for appending if more frames follow
+
+void frame_metrics_init()
+{
+	const char* path = getenv("CHAMELEON_FRAME_METRICS");
+	if (!path || !path[0] || frame_metrics.enabled) return;
+	filename = path;
+	fp = fopen(path, "w");
+	if (!fp)
+	{
+		ELOG("Could not open frame metrics file %s", path);
+		return;
+	}
+	fprintf(fp, "frame");
+	for (const char* name : metric_names) fprintf(fp, ",%s", name);
+	for (const char* name : object_names) fprintf(fp, ",live_%s", name);
+	fprintf(fp, "\n");
+	frame_metrics.enabled = true;
+}
+
+/// Must be called with pending_mutex held.
+static void write_pending()
+{
+	if (pending_count == 0) return;
+	if (!fp) fp = fopen(filename.c_str(), "a");
+	if (!fp)
+	{
+		ELOG("Could not reopen frame metrics file %s", filename.c_str());
+		pending_count = 0;
+		return;
+	}
+	for (int i = 0; i < pending_count; i++)
+	{
+		const FrameRow& row = pending[i];
+		fprintf(fp, "%d", row.frame);
+		for (long v : row.counters) fprintf(fp, ",%ld", v);
+		for (long v : row.live) fprintf(fp, ",%ld", v);
+		fprintf(fp, "\n");
+	}
+	pending_count = 0;
+}
+
+void frame_metrics_end_frame(int frame)
+{
+	if (!frame_metrics.enabled) return;
+	std::lock_guard<std::mutex> lock(pending_mutex);
+	FrameRow& row = pending[pending_count++];
+	row.frame = frame;
+	for (int i = 0; i < FRAME_METRIC_MAX; i++) row.counters[i] = frame_metrics.counters[i].exchange(0, std::memory_order_relaxed);
+	for (int i = 0; i < FRAME_OBJECT_MAX; i++) row.live[i] = frame_metrics.live[i].load(std::memory_order_relaxed);
+	if (pending_count == pending_size) write_pending();
+}
+
+void frame_metrics_flush()
+{
+	if (!frame_metrics.enabled) return;
+	std::lock_guard<std::mutex> lock(pending_mutex);
+	write_pending();
+	if (fp) fclose(fp);
+	fp = nullptr;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+// Per-frame time series of workload counters, written out as CSV alongside the report.
+
+#include <atomic>
+
+#include "vulkan_defs.h"
+
+/// Counters that are summed up over each frame and reset at present
+enum frame_metric
+{
+	FRAME_METRIC_SUBMITS,
+	FRAME_METRIC_COMMAND_BUFFERS,
+	FRAME_METRIC_DRAWS,
+	FRAME_METRIC_VERTICES,
+	FRAME_METRIC_DISPATCHES,
+	FRAME_METRIC_WORKGROUPS,
+	FRAME_METRIC_BYTES_COPIED,
+	FRAME_METRIC_ALLOCATIONS,
+	FRAME_METRIC_ALLOCATED_BYTES,
+	FRAME_METRIC_DIRTY_PAGES,
+	FRAME_METRIC_MAX
+};
+
+/// Object types that we sample the number of live objects of at present
+enum frame_object
+{
+	FRAME_OBJECT_DEVICE_MEMORY,
+	FRAME_OBJECT_BUFFERS,
+	FRAME_OBJECT_BUFFER_VIEWS,
+	FRAME_OBJECT_IMAGES,
+	FRAME_OBJECT_IMAGE_VIEWS,
+	FRAME_OBJECT_SAMPLERS,
+	FRAME_OBJECT_DESCRIPTOR_SETS,
+	FRAME_OBJECT_FRAMEBUFFERS,
+	FRAME_OBJECT_PIPELINES,
+	FRAME_OBJECT_SHADER_MODULES,
+	FRAME_OBJECT_COMMAND_BUFFERS,
+	FRAME_OBJECT_FENCES,
+	FRAME_OBJECT_SEMAPHORES,
+	FRAME_OBJECT_MAX
+};
+
+struct FrameMetrics
+{
+	bool enabled = false;
+	std::atomic_long counters[FRAME_METRIC_MAX] {};
+	std::atomic_long live[FRAME_OBJECT_MAX] {}; // kept even when not enabled, for vkGetLiveObjectCountsCHAMELEON
+};
+
+extern FrameMetrics frame_metrics;
+
+static inline int frame_object_index(VkObjectType type)
+{
+	switch (type)
+	{
+	case VK_OBJECT_TYPE_DEVICE_MEMORY: return FRAME_OBJECT_DEVICE_MEMORY;
+	case VK_OBJECT_TYPE_BUFFER: return FRAME_OBJECT_BUFFERS;
+	case VK_OBJECT_TYPE_BUFFER_VIEW: return FRAME_OBJECT_BUFFER_VIEWS;
+	case VK_OBJECT_TYPE_IMAGE: return FRAME_OBJECT_IMAGES;
+	case VK_OBJECT_TYPE_IMAGE_VIEW: return FRAME_OBJECT_IMAGE_VIEWS;
+	case VK_OBJECT_TYPE_SAMPLER: return FRAME_OBJECT_SAMPLERS;
+	case VK_OBJECT_TYPE_DESCRIPTOR_SET: return FRAME_OBJECT_DESCRIPTOR_SETS;
+	case VK_OBJECT_TYPE_FRAMEBUFFER: return FRAME_OBJECT_FRAMEBUFFERS;
+	case VK_OBJECT_TYPE_PIPELINE: return FRAME_OBJECT_PIPELINES;
+	case VK_OBJECT_TYPE_SHADER_MODULE: return FRAME_OBJECT_SHADER_MODULES;
+	case VK_OBJECT_TYPE_COMMAND_BUFFER: return FRAME_OBJECT_COMMAND_BUFFERS;
+	case VK_OBJECT_TYPE_FENCE: return FRAME_OBJECT_FENCES;
+	case VK_OBJECT_TYPE_SEMAPHORE: return FRAME_OBJECT_SEMAPHORES;
+	default: return -1;
+	}
+}
+
+/// The inverse of frame_object_index()
+static constexpr VkObjectType frame_object_types[FRAME_OBJECT_MAX] = {
+	VK_OBJECT_TYPE_DEVICE_MEMORY, VK_OBJECT_TYPE_BUFFER, VK_OBJECT_TYPE_BUFFER_VIEW, VK_OBJECT_TYPE_IMAGE,
+	VK_OBJECT_TYPE_IMAGE_VIEW, VK_OBJECT_TYPE_SAMPLER, VK_OBJECT_TYPE_DESCRIPTOR_SET, VK_OBJECT_TYPE_FRAMEBUFFER,
+	VK_OBJECT_TYPE_PIPELINE, VK_OBJECT_TYPE_SHADER_MODULE, VK_OBJECT_TYPE_COMMAND_BUFFER, VK_OBJECT_TYPE_FENCE,
+	VK_OBJECT_TYPE_SEMAPHORE,
+};
+
+/// Add to a counter of the current frame. Cheap enough to call from any hot path.
+static inline void frame_metrics_add(frame_metric metric, long value)
+{
+	if (frame_metrics.enabled) frame_metrics.counters[metric].fetch_add(value, std::memory_order_relaxed);
+}
+
+/// Track an object of the given type being created (delta 1) or destroyed (delta -1). Always counted,
+/// since test harnesses ask for the live counts to find leaks.
+static inline void frame_metrics_object(VkObjectType type, int delta)
+{
+	const int index = frame_object_index(type);
+	if (index >= 0) frame_metrics.live[index].fetch_add(delta, std::memory_order_relaxed);
+}
+
+/// Enable collection if CHAMELEON_FRAME_METRICS is set. Call once, before any objects are created.
+void frame_metrics_init();
+
+/// Store the counters of the frame that just ended in the pending buffer and reset them. The
+/// pending buffer is written out to disk whenever it fills up.
+void frame_metrics_end_frame(int frame);
+
+/// Write out all frames stored in the pending buffer so far and close the file. Frames that
+/// come after this are appended to it.
+void frame_metrics_flush();
@@ -0,0 +1,299 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <filesystem>
+#include <vector>
+
+#include "gpu_profile.h"
+
+// -- File format
+//
+// A profile is a header followed by a sequence of variable sized records, each starting
+// at an 8 byte aligned offset. All values are stored in native byte order and layout, so
+// the header records everything that layout depends on, and a profile from a different
+// build is rejected and rebuilt.
+//
+// Records are, in order: extensions (version, name length, name), features and extended
+// properties (sType, size, structure), formats (format, properties) and queue families.
+// The host image copy properties are followed by their source and destination layout arrays.
+
+static constexpr char profile_magic[8] = { 'C', 'H', 'M', 'G', 'P', 'U', 0, 0 };
+static constexpr uint32_t profile_version = 1;
+static constexpr size_t profile_alignment = 8;
+
+struct ProfileHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t vulkan_header_version;
+	uint64_t key;
+	uint64_t size; ///< total file size
+	uint32_t extension_count;
+	uint32_t feature_count;
+	uint32_t property_count;
+	uint32_t format_count;
+	uint32_t queue_family_count;
+	VkPhysicalDeviceProperties properties;
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	VkPhysicalDeviceRayTracingPipelinePropertiesKHR rayTracingPipelineProperties;
+	VkPhysicalDeviceAccelerationStructurePropertiesKHR accelerationStructureProperties;
+};
+
+struct ProfileStructure
+{
+	uint32_t sType;
+	uint32_t size;
+};
+
+struct ProfileFormat
+{
+	uint32_t format;
+	VkFormatProperties properties;
+};
+
+static inline size_t align_up(size_t offset) { return (offset + profile_alignment - 1) & ~(profile_alignment - 1); }
+
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t size)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+static bool hash_file(uint64_t& hash, const std::string& path)
+{
+	FILE* fp = fopen(path.c_str(), "rb");
+	if (!fp) return false;
+	char buffer[64 * 1024];
+	size_t size;
+	while ((size = fread(buffer, 1, sizeof(buffer), fp)) > 0) hash = fnv1a(hash, buffer, size);
+	fclose(fp);
+	hash = fnv1a(hash, "\0", 1); // separate the files
+	return true;
+}
+
+std::string gpu_profile_cache_dir()
+{
+	// Off unless asked for, since we should not write outside the build tree behind the back of test runs
+	const char* dir = getenv("CHAMELEON_GPU_CACHE");
+	if (!dir || !dir[0] || strcmp(dir, "0") == 0) return std::string();
+	if (strcmp(dir, "1") != 0) return std::string(dir);
+	const char* xdg = getenv("XDG_CACHE_HOME");
+	if (xdg && xdg[0]) return std::string(xdg) + "/chameleon";
+	const char* home = getenv("HOME");
+	if (home && home[0]) return std::string(home) + "/.cache/chameleon";
+	return std::string();
+}
+
+uint64_t gpu_profile_key(const std::string& gpu_path, const std::string& gpu_override_path)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	const uint32_t version[] = { profile_version, VK_HEADER_VERSION_COMPLETE, (uint32_t)sizeof(ProfileHeader) };
+	hash = fnv1a(hash, version, sizeof(version));
+	if (!hash_file(hash, gpu_path) || !hash_file(hash, gpu_override_path)) return 0;
+	return hash;
+}
+
+static std::string profile_path(const std::string& cache_dir, uint64_t key)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "gpu-%016llx.bin", (unsigned long long)key);
+	return cache_dir + "/" + name;
+}
+
+bool load_gpu_profile(cVkPhysicalDevice& gpu, const std::string& cache_dir, uint64_t key)
+{
+	if (cache_dir.empty() || key == 0) return false;
+	const std::string path = profile_path(cache_dir, key);
+	const int fd = open(path.c_str(), O_RDONLY);
+	if (fd == -1) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ProfileHeader))
+	{
+		close(fd);
+		return false;
+	}
+	// Private writable mapping, so that we can patch pointers in it without touching the file
+	char* data = (char*)mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) return false;
+	const ProfileHeader* header = reinterpret_cast<const ProfileHeader*>(data);
+	if (memcmp(header->magic, profile_magic, sizeof(profile_magic)) != 0 || header->version != profile_version
+	    || header->vulkan_header_version != VK_HEADER_VERSION_COMPLETE || header->key != key || header->size != (uint64_t)st.st_size)
+	{
+		ELOG("Ignoring invalid GPU profile %s", path.c_str());
+		munmap(data, st.st_size);
+		return false;
+	}
+
+	gpu.properties = header->properties;
+	gpu.memoryProperties = header->memoryProperties;
+	gpu.rayTracingPipelineProperties = header->rayTracingPipelineProperties;
+	gpu.rayTracingPipelineProperties.pNext = nullptr;
+	gpu.accelerationStructureProperties = header->accelerationStructureProperties;
+	gpu.accelerationStructureProperties.pNext = nullptr;
+
+	size_t offset = align_up(sizeof(ProfileHeader));
+	for (uint32_t i = 0; i < header->extension_count; i++)
+	{
+		const uint32_t* record = reinterpret_cast<const uint32_t*>(data + offset);
+		gpu.extensions[std::string(reinterpret_cast<const char*>(record + 2), record[1])] = record[0];
+		offset = align_up(offset + 2 * sizeof(uint32_t) + record[1]);
+	}
+	auto read_structures = [&](std::map<VkStructureType, std::pair<void*, size_t>>& map, uint32_t count)
+	{
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const ProfileStructure* record = reinterpret_cast<const ProfileStructure*>(data + offset);
+			VkBaseOutStructure* structure = reinterpret_cast<VkBaseOutStructure*>(data + offset + sizeof(ProfileStructure));
+			structure->pNext = nullptr;
+			offset += sizeof(ProfileStructure) + record->size;
+			if (record->sType == VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_PROPERTIES)
+			{
+				VkPhysicalDeviceHostImageCopyProperties* property = reinterpret_cast<VkPhysicalDeviceHostImageCopyProperties*>(structure);
+				property->pCopySrcLayouts = reinterpret_cast<VkImageLayout*>(data + offset);
+				offset += property->copySrcLayoutCount * sizeof(VkImageLayout);
+				property->pCopyDstLayouts = reinterpret_cast<VkImageLayout*>(data + offset);
+				offset += property->copyDstLayoutCount * sizeof(VkImageLayout);
+			}
+			map[(VkStructureType)record->sType] = { structure, record->size };
+			offset = align_up(offset);
+		}
+	};
+	read_structures(gpu.features, header->feature_count);
+	read_structures(gpu.extendedProperties, header->property_count);
+	for (uint32_t i = 0; i < header->format_count; i++)
+	{
+		const ProfileFormat* record = reinterpret_cast<const ProfileFormat*>(data + offset);
+		gpu.formats[(VkFormat)record->format] = record->properties;
+		offset = align_up(offset + sizeof(ProfileFormat));
+	}
+	for (uint32_t i = 0; i < header->queue_family_count; i++)
+	{
+		gpu.queueFamilies.push_back(*reinterpret_cast<const VkQueueFamilyProperties*>(data + offset));
+		offset = align_up(offset + sizeof(VkQueueFamilyProperties));
+	}
+	assert(offset == header->size);
+
+	gpu.profile_mapping = data;
+	gpu.profile_mapping_size = st.st_size;
+	return true;
+}
+
+void save_gpu_profile(const cVkPhysicalDevice& gpu, const std::string& cache_dir, uint64_t key)
+{
+	if (cache_dir.empty() || key == 0) return;
+
+	std::vector<char> data(align_up(sizeof(ProfileHeader)), 0);
+	auto append = [&data](const void* ptr, size_t size)
+	{
+		const char* bytes = static_cast<const char*>(ptr);
+		data.insert(data.end(), bytes, bytes + size);
+	};
+	auto align = [&data]() { data.resize(align_up(data.size()), 0); };
+
+	for (const auto& extension : gpu.extensions)
+	{
+		const uint32_t record[] = { extension.second, (uint32_t)extension.first.size() };
+		append(record, sizeof(record));
+		append(extension.first.data(), extension.first.size());
+		align();
+	}
+	auto write_structures = [&](const std::map<VkStructureType, std::pair<void*, size_t>>& map)
+	{
+		for (const auto& pair : map)
+		{
+			const ProfileStructure record = { (uint32_t)pair.first, (uint32_t)pair.second.second };
+			append(&record, sizeof(record));
+			append(pair.second.first, pair.second.second);
+			if (pair.first == VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_PROPERTIES)
+			{
+				const VkPhysicalDeviceHostImageCopyProperties* property = static_cast<const VkPhysicalDeviceHostImageCopyProperties*>(pair.second.first);
+				if (property->copySrcLayoutCount) append(property->pCopySrcLayouts, property->copySrcLayoutCount * sizeof(VkImageLayout));
+				if (property->copyDstLayoutCount) append(property->pCopyDstLayouts, property->copyDstLayoutCount * sizeof(VkImageLayout));
+			}
+			align();
+		}
+	};
+	write_structures(gpu.features);
+	write_structures(gpu.extendedProperties);
+	for (const auto& format : gpu.formats)
+	{
+		const ProfileFormat record = { (uint32_t)format.first, format.second };
+		append(&record, sizeof(record));
+		align();
+	}
+	for (const VkQueueFamilyProperties& family : gpu.queueFamilies)
+	{
+		append(&family, sizeof(family));
+		align();
+	}
+
+	ProfileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, profile_magic, sizeof(profile_magic));
+	header.version = profile_version;
+	header.vulkan_header_version = VK_HEADER_VERSION_COMPLETE;
+	header.key = key;
+	header.size = data.size();
+	header.extension_count = gpu.extensions.size();
+	header.feature_count = gpu.features.size();
+	header.property_count = gpu.extendedProperties.size();
+	header.format_count = gpu.formats.size();
+	header.queue_family_count = gpu.queueFamilies.size();
+	header.properties = gpu.properties;
+	header.memoryProperties = gpu.memoryProperties;
+	header.rayTracingPipelineProperties = gpu.rayTracingPipelineProperties;
+	header.accelerationStructureProperties = gpu.accelerationStructureProperties;
+	memcpy(data.data(), &header, sizeof(header));
+
+	// Write to a temporary file and rename it into place, so that concurrent runs never see
+	// a partially written profile.
+	std::error_code error;
+	std::filesystem::create_directories(cache_dir, error);
+	const std::string path = profile_path(cache_dir, key);
+	const std::string tmp_path = path + ".tmp" + _to_string(getpid());
+	FILE* fp = fopen(tmp_path.c_str(), "wb");
+	if (!fp)
+	{
+		XLOG("could not write GPU profile %s", tmp_path.c_str());
+		return;
+	}
+	const bool written = fwrite(data.data(), data.size(), 1, fp) == 1;
+	if (fclose(fp) != 0 || !written || rename(tmp_path.c_str(), path.c_str()) != 0)
+	{
+		XLOG("could not write GPU profile %s", path.c_str());
+		unlink(tmp_path.c_str());
+	}
+}
+
+void free_gpu_profile(cVkPhysicalDevice& gpu)
+{
+	if (gpu.profile_mapping)
+	{
+		munmap(gpu.profile_mapping, gpu.profile_mapping_size);
+		gpu.profile_mapping = nullptr;
+	}
+	else
+	{
+		for (auto& elt: gpu.features)
+		{
+			free(elt.second.first);
+		}
+		for (auto& elt: gpu.extendedProperties)
+		{
+			free(elt.second.first);
+		}
+	}
+	gpu.features.clear();
+	gpu.extendedProperties.clear();
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+// Binary cache of parsed GPU definitions, so that we do not need to parse the GPU JSON
+// files on every vkCreateInstance().
+
+#include "vulkan_defs.h"
+
+#include <string>
+
+/// Directory to store compiled GPU profiles in, or an empty string if caching is disabled, which is
+/// the default.
+std::string gpu_profile_cache_dir();
+
+/// Cache key for the given GPU definition files. Depends on the contents of the files, not their names.
+uint64_t gpu_profile_key(const std::string& gpu_path, const std::string& gpu_override_path);
+
+/// Load a compiled GPU profile from the cache. The file is memory mapped, and the feature and
+/// property structures of the GPU point directly into it. Returns false on a cache miss.
+bool load_gpu_profile(cVkPhysicalDevice& gpu, const std::string& cache_dir, uint64_t key);
+
+/// Write a compiled GPU profile for a GPU that was loaded from JSON into the cache.
+void save_gpu_profile(const cVkPhysicalDevice& gpu, const std::string& cache_dir, uint64_t key);
+
+/// Release the feature and property structures of the GPU, however they were loaded.
+void free_gpu_profile(cVkPhysicalDevice& gpu);
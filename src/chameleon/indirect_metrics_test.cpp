@@ -0,0 +1,157 @@
+// Check that indirect draws and dispatches count towards the work totals of the command buffer
+// that they are recorded into, as written to the Chameleon report.
+
+#include <fstream>
+
+#include "vulkan_common.h"
+#include "json/json.h"
+
+static void expect(const Json::Value& work, const char* name, Json::Int64 expected)
+{
+	if (work[name].asInt64() != expected)
+	{
+		ELOG("Expected %s to be %lld, but it is %lld", name, (long long)expected, (long long)work[name].asInt64());
+		exit(1);
+	}
+}
+
+/// Find the work of the only command buffer with any
+static Json::Value find_work(const Json::Value& report)
+{
+	Json::Value found;
+	for (const Json::Value& physical : report["physical_devices"])
+	{
+		for (const Json::Value& device : physical["devices"])
+		{
+			for (const Json::Value& pool : device["command_pools"])
+			{
+				for (const Json::Value& cmdbuf : pool["command_buffers"])
+				{
+					if (!cmdbuf.isMember("work")) continue;
+					if (!found.isNull())
+					{
+						ELOG("More than one command buffer with draw or dispatch work");
+						exit(1);
+					}
+					found = cmdbuf["work"];
+				}
+			}
+		}
+	}
+	return found;
+}
+
+int main(int argc, char** argv)
+{
+	const char* report_name = getenv("CHAMELEON_REPORT");
+	if (!report_name)
+	{
+		ELOG("CHAMELEON_REPORT must be set");
+		return 1;
+	}
+
+	vulkan_req_t reqs;
+	reqs.apiVersion = VK_API_VERSION_1_2;
+	reqs.minApiVersion = VK_API_VERSION_1_2;
+	reqs.reqfeat12.drawIndirectCount = VK_TRUE;
+	vulkan_setup_t vulkan = test_init(argc, argv, "chameleon_indirect_metrics", reqs);
+
+	VkBufferCreateInfo bufferinfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO, nullptr };
+	bufferinfo.size = 4096;
+	bufferinfo.usage = VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+	bufferinfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkResult result = vkCreateBuffer(vulkan.device, &bufferinfo, nullptr, &buffer);
+	check(result);
+	VkMemoryRequirements req;
+	vkGetBufferMemoryRequirements(vulkan.device, buffer, &req);
+	VkMemoryAllocateInfo meminfo = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO, nullptr };
+	meminfo.memoryTypeIndex = get_device_memory_type(req.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	meminfo.allocationSize = req.size;
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	result = vkAllocateMemory(vulkan.device, &meminfo, nullptr, &memory);
+	check(result);
+	result = vkBindBufferMemory(vulkan.device, buffer, memory, 0);
+	check(result);
+
+	// Two draws of three vertices and two instances each, then a count of one draw, then a 2x3x4 dispatch
+	char* ptr = nullptr;
+	result = vkMapMemory(vulkan.device, memory, 0, VK_WHOLE_SIZE, 0, (void**)&ptr);
+	check(result);
+	VkDrawIndirectCommand* draws = reinterpret_cast<VkDrawIndirectCommand*>(ptr);
+	draws[0] = { 3, 2, 0, 0 };
+	draws[1] = { 3, 2, 0, 0 };
+	*reinterpret_cast<uint32_t*>(ptr + 256) = 1;
+	*reinterpret_cast<VkDispatchIndirectCommand*>(ptr + 512) = { 2, 3, 4 };
+	vkUnmapMemory(vulkan.device, memory);
+
+	// Chameleon does not look at shaders or render passes when recording, so a bare pipeline is
+	// enough to get a topology for the primitive count.
+	VkPipelineInputAssemblyStateCreateInfo assembly = { VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO, nullptr };
+	assembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	VkGraphicsPipelineCreateInfo pipelineinfo = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO, nullptr };
+	pipelineinfo.pInputAssemblyState = &assembly;
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	result = vkCreateGraphicsPipelines(vulkan.device, VK_NULL_HANDLE, 1, &pipelineinfo, nullptr, &pipeline);
+	check(result);
+
+	VkCommandPool cmdpool = VK_NULL_HANDLE;
+	VkCommandPoolCreateInfo cmdcreateinfo = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO, nullptr };
+	cmdcreateinfo.queueFamilyIndex = vulkan.queue_family_index;
+	result = vkCreateCommandPool(vulkan.device, &cmdcreateinfo, nullptr, &cmdpool);
+	check(result);
+	VkCommandBufferAllocateInfo allocinfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO, nullptr };
+	allocinfo.commandBufferCount = 1;
+	allocinfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocinfo.commandPool = cmdpool;
+	VkCommandBuffer cmd = VK_NULL_HANDLE;
+	result = vkAllocateCommandBuffers(vulkan.device, &allocinfo, &cmd);
+	check(result);
+	VkCommandBufferBeginInfo begininfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO, nullptr };
+	result = vkBeginCommandBuffer(cmd, &begininfo);
+	check(result);
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+	vkCmdDrawIndirect(cmd, buffer, 0, 2, sizeof(VkDrawIndirectCommand));
+	vkCmdDrawIndirectCount(cmd, buffer, 0, buffer, 256, 2, sizeof(VkDrawIndirectCommand));
+	vkCmdDispatchIndirect(cmd, buffer, 512);
+	result = vkEndCommandBuffer(cmd);
+	check(result);
+
+	vkDestroyCommandPool(vulkan.device, cmdpool, nullptr);
+	vkDestroyPipeline(vulkan.device, pipeline, nullptr);
+	vkDestroyBuffer(vulkan.device, buffer, nullptr);
+	testFreeMemory(vulkan, memory);
+	test_done(vulkan); // writes the report
+
+	Json::Value report;
+	for (int instance_id = 0; instance_id < 16 && report.isNull(); instance_id++)
+	{
+		std::ifstream file(std::string(report_name) + "_" + _to_string(instance_id) + ".json");
+		if (!file) continue;
+		Json::CharReaderBuilder builder;
+		std::string errors;
+		if (!Json::parseFromStream(builder, file, &report, &errors))
+		{
+			ELOG("Could not parse the report: %s", errors.c_str());
+			return 1;
+		}
+	}
+	if (report.isNull())
+	{
+		ELOG("No report found at %s_<instance>.json", report_name);
+		return 1;
+	}
+	const Json::Value work = find_work(report);
+	if (work.isNull())
+	{
+		ELOG("No command buffer with draw or dispatch work in the report");
+		return 1;
+	}
+	expect(work, "draws", 3);
+	expect(work, "vertices", 9);
+	expect(work, "instances", 6);
+	expect(work, "primitives", 3);
+	expect(work, "dispatches", 1);
+	expect(work, "workgroups", 24);
+	return 0;
+}
@@ -0,0 +1,206 @@
+#pragma once
+
+// Concurrent, pointer-stable container for Chameleon's tracked Vulkan objects.
+
+#include <assert.h>
+#include <atomic>
+#include <bit>
+#include <new>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+
+/// Storage for objects that we hand out pointers to as Vulkan handles. Objects are never
+/// moved once created, so handles stay valid for the whole run. Creation is lock-free and
+/// may happen from any number of threads at once: a slot is reserved with an atomic bump
+/// of the slot index, and the storage is split into segments of doubling size that are
+/// installed with a compare-and-swap the first time a slot in them is reserved.
+///
+/// Objects that are erased have their slots put on a lock-free free list (a tagged
+/// Treiber stack) and reused by later creations.
+///
+/// Iteration visits objects in slot order (which is creation order for a single thread
+/// as long as nothing has been erased), and skips slots that are reserved but still under
+/// construction, or that have been erased.
+template<typename T>
+class ObjectTable
+{
+	static constexpr size_t first_segment_size = 64;
+	static constexpr size_t max_segments = 40;
+
+	struct Segment
+	{
+		T* items;
+		std::atomic_bool* ready;
+		std::atomic_uint32_t* next_free;
+	};
+
+	std::atomic<Segment*> segments[max_segments] = {};
+	/// Next slot index to hand out
+	std::atomic_size_t next { 0 };
+	/// Number of fully constructed objects
+	std::atomic_size_t count { 0 };
+	/// Free list head. Upper 32 bits are a tag against ABA problems, lower 32 bits the slot + 1.
+	std::atomic_uint64_t free_head { 0 };
+
+	static inline size_t segment_index(size_t slot) { return std::bit_width(slot / first_segment_size + 1) - 1; }
+	static inline size_t segment_start(size_t segment) { return first_segment_size * ((size_t(1) << segment) - 1); }
+	static inline size_t segment_size(size_t segment) { return first_segment_size << segment; }
+
+	Segment* get_segment(size_t segment)
+	{
+		assert(segment < max_segments);
+		Segment* s = segments[segment].load(std::memory_order_acquire);
+		if (s) return s;
+		const size_t size = segment_size(segment);
+		Segment* fresh = new Segment;
+		fresh->items = static_cast<T*>(::operator new(sizeof(T) * size, std::align_val_t(alignof(T))));
+		fresh->ready = new std::atomic_bool[size]();
+		fresh->next_free = new std::atomic_uint32_t[size]();
+		if (segments[segment].compare_exchange_strong(s, fresh, std::memory_order_acq_rel, std::memory_order_acquire))
+		{
+			return fresh;
+		}
+		// another thread beat us to it
+		::operator delete(fresh->items, std::align_val_t(alignof(T)));
+		delete[] fresh->ready;
+		delete[] fresh->next_free;
+		delete fresh;
+		return s;
+	}
+
+	std::atomic_uint32_t& next_free(size_t slot)
+	{
+		const size_t seg = segment_index(slot);
+		return segments[seg].load(std::memory_order_acquire)->next_free[slot - segment_start(seg)];
+	}
+
+	/// Returns a recycled slot, or SIZE_MAX if there are none.
+	size_t pop_free()
+	{
+		uint64_t head = free_head.load(std::memory_order_acquire);
+		while (head & 0xffffffff)
+		{
+			const size_t slot = (head & 0xffffffff) - 1;
+			const uint64_t next_head = ((head >> 32) + 1) << 32 | next_free(slot).load(std::memory_order_relaxed);
+			if (free_head.compare_exchange_weak(head, next_head, std::memory_order_acq_rel, std::memory_order_acquire))
+			{
+				return slot;
+			}
+		}
+		return SIZE_MAX;
+	}
+
+	void push_free(size_t slot)
+	{
+		uint64_t head = free_head.load(std::memory_order_acquire);
+		uint64_t next_head;
+		do
+		{
+			next_free(slot).store(head & 0xffffffff, std::memory_order_relaxed);
+			next_head = ((head >> 32) + 1) << 32 | (slot + 1);
+		} while (!free_head.compare_exchange_weak(head, next_head, std::memory_order_acq_rel, std::memory_order_acquire));
+	}
+
+	size_t find_slot(const T* v) const
+	{
+		for (size_t i = 0; i < max_segments; i++)
+		{
+			Segment* s = segments[i].load(std::memory_order_acquire);
+			if (s && v >= s->items && v < s->items + segment_size(i)) return segment_start(i) + (v - s->items);
+		}
+		return SIZE_MAX;
+	}
+
+	T* slot_ptr(size_t slot) const
+	{
+		const size_t seg = segment_index(slot);
+		Segment* s = segments[seg].load(std::memory_order_acquire);
+		if (!s || !s->ready[slot - segment_start(seg)].load(std::memory_order_acquire)) return nullptr;
+		return &s->items[slot - segment_start(seg)];
+	}
+
+public:
+	template<typename V, typename Table>
+	class Iterator
+	{
+		Table* table;
+		size_t slot;
+
+		void skip() { while (slot < table->next.load(std::memory_order_acquire) && !table->slot_ptr(slot)) slot++; }
+
+	public:
+		Iterator(Table* _table, size_t _slot, bool at_end) : table(_table), slot(_slot) { if (!at_end) skip(); }
+		V& operator*() const { return *table->slot_ptr(slot); }
+		V* operator->() const { return table->slot_ptr(slot); }
+		Iterator& operator++() { slot++; skip(); return *this; }
+		// objects may be created while iterating, so never step past the end marker
+		bool operator!=(const Iterator& other) const { return slot < other.slot; }
+		bool operator==(const Iterator& other) const { return !(*this != other); }
+	};
+	using iterator = Iterator<T, ObjectTable<T>>;
+	using const_iterator = Iterator<const T, const ObjectTable<T>>;
+
+	ObjectTable() {}
+
+	ObjectTable(const ObjectTable& other)
+	{
+		for (const T& v : other) emplace(v);
+	}
+
+	ObjectTable& operator=(const ObjectTable&) = delete;
+
+	~ObjectTable()
+	{
+		for (size_t i = 0; i < max_segments; i++)
+		{
+			Segment* s = segments[i].load();
+			if (!s) continue;
+			for (size_t j = 0; j < segment_size(i); j++)
+			{
+				if (s->ready[j]) s->items[j].~T();
+			}
+			::operator delete(s->items, std::align_val_t(alignof(T)));
+			delete[] s->ready;
+			delete[] s->next_free;
+			delete s;
+		}
+	}
+
+	/// Create a new object in the table. Safe to call from multiple threads.
+	template<typename... Args>
+	T& emplace(Args&&... args)
+	{
+		size_t slot = pop_free();
+		if (slot == SIZE_MAX) slot = next.fetch_add(1, std::memory_order_relaxed);
+		const size_t seg = segment_index(slot);
+		Segment* s = get_segment(seg);
+		T* v = new (&s->items[slot - segment_start(seg)]) T(std::forward<Args>(args)...);
+		s->ready[slot - segment_start(seg)].store(true, std::memory_order_release);
+		count.fetch_add(1, std::memory_order_relaxed);
+		return *v;
+	}
+
+	/// Destroy an object and make its slot available for reuse. The object must not be
+	/// accessed afterwards. Safe to call concurrently with creation, but not with
+	/// erasing the same object twice.
+	void erase(T& v)
+	{
+		const size_t slot = find_slot(&v);
+		assert(slot != SIZE_MAX);
+		const size_t seg = segment_index(slot);
+		segments[seg].load(std::memory_order_acquire)->ready[slot - segment_start(seg)].store(false, std::memory_order_release);
+		v.~T();
+		count.fetch_sub(1, std::memory_order_relaxed);
+		if (slot < UINT32_MAX) push_free(slot); // larger slots are never recycled
+	}
+
+	/// Number of fully constructed objects in the table.
+	size_t size() const { return count.load(std::memory_order_relaxed); }
+	bool empty() const { return size() == 0; }
+
+	iterator begin() { return iterator(this, 0, false); }
+	iterator end() { return iterator(this, next.load(std::memory_order_acquire), true); }
+	const_iterator begin() const { return const_iterator(this, 0, false); }
+	const_iterator end() const { return const_iterator(this, next.load(std::memory_order_acquire), true); }
+};
@@ -0,0 +1,49 @@
+// Check that a streamed Chameleon JSON report is byte-identical to what jsoncpp would have written for the same
+// data, by parsing it into a Json::Value and serializing that again with toStyledString().
+
+#include <stdio.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "json/json.h"
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		fprintf(stderr, "Usage: %s <report.json> ...\n", argv[0]);
+		return 1;
+	}
+	int failed = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		std::ifstream input(argv[i], std::ios::binary);
+		std::stringstream contents;
+		contents << input.rdbuf();
+		const std::string streamed = contents.str();
+		Json::Value value;
+		Json::CharReaderBuilder builder;
+		std::string errors;
+		std::istringstream parse_input(streamed);
+		if (!input || !Json::parseFromStream(builder, parse_input, &value, &errors))
+		{
+			fprintf(stderr, "Could not parse %s: %s\n", argv[i], errors.c_str());
+			failed++;
+			continue;
+		}
+		const std::string styled = value.toStyledString();
+		if (styled == streamed)
+		{
+			printf("%s: identical (%u bytes)\n", argv[i], (unsigned)streamed.size());
+			continue;
+		}
+		size_t offset = 0;
+		while (offset < styled.size() && offset < streamed.size() && styled[offset] == streamed[offset]) offset++;
+		const size_t from = offset > 40 ? offset - 40 : 0;
+		fprintf(stderr, "%s: differs from toStyledString() at byte %u\nstreamed: ...%s\nexpected: ...%s\n", argv[i], (unsigned)offset,
+		        streamed.substr(from, 80).c_str(), styled.substr(from, 80).c_str());
+		failed++;
+	}
+	return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,259 @@
+#include <assert.h>
+#include <string.h>
+
+#include "report_writer.h"
+
+// jsoncpp writes arrays on a single line if they only contain scalars and fit within this margin
+static constexpr size_t right_margin = 74;
+static constexpr size_t flush_size = 64 * 1024;
+
+JsonReportWriter::JsonReportWriter(FILE* _fp) : fp(_fp)
+{
+	// The indentation, whether a container that is the value of an object member starts
+	// on a new line, and whether short arrays are written on a single line differ between
+	// jsoncpp versions, so ask the one we link.
+	Json::Value probe;
+	probe["a"]["b"] = 1;
+	probe["c"].append(1);
+	const std::string styled = probe.toStyledString();
+	const size_t quote = styled.find('"');
+	assert(quote != std::string::npos && quote >= 2);
+	indent_unit = styled.substr(2, quote - 2);
+	break_before_container = styled[styled.find(':', quote) + 2] == '\n';
+	single_line_arrays = styled.find("[ 1 ]") != std::string::npos;
+}
+
+std::string JsonReportWriter::indent(int depth) const
+{
+	std::string retval;
+	for (int i = 0; i < depth; i++) retval += indent_unit;
+	return retval;
+}
+
+void JsonReportWriter::flush_if_full()
+{
+	if (buffer.size() < flush_size) return;
+	if (fwrite(buffer.data(), 1, buffer.size(), fp) != buffer.size()) failed = true;
+	buffer.clear();
+}
+
+bool JsonReportWriter::finish()
+{
+	assert(stack.empty());
+	if (!buffer.empty() && fwrite(buffer.data(), 1, buffer.size(), fp) != buffer.size()) failed = true;
+	buffer.clear();
+	return !failed;
+}
+
+void JsonReportWriter::open(Frame& frame)
+{
+	if (frame.opened) return;
+	frame.opened = true;
+	if (frame.member && break_before_container)
+	{
+		frame.out->push_back('\n');
+		frame.out->append(indent(frame.depth));
+	}
+	frame.out->push_back(frame.array ? '[' : '{');
+}
+
+void JsonReportWriter::write_member(Frame& frame, const std::string& name, const std::string& text)
+{
+	open(frame);
+	frame.out->append(frame.written++ ? ",\n" : "\n");
+	frame.out->append(indent(frame.depth + 1));
+	frame.out->append(Json::valueToQuotedString(name.c_str()));
+	frame.out->append(" : ");
+	frame.out->append(text);
+}
+
+std::string* JsonReportWriter::begin_value(bool container)
+{
+	if (stack.empty()) return &buffer;
+	Frame& top = stack.back();
+	if (!top.array)
+	{
+		assert(has_key);
+		has_key = false;
+		if (streaming)
+		{
+			streaming = false;
+			return top.out; // stream_key() already wrote out the key
+		}
+		std::string& slot = top.pending[next_key];
+		slot.clear();
+		return &slot;
+	}
+	if (!top.multiline && top.elements.empty() && container)
+	{
+		// Arrays of non-empty containers are always written on multiple lines, so
+		// there is no need to collect the elements first.
+		top.multiline = true;
+		open(top);
+	}
+	if (top.multiline)
+	{
+		top.out->append(top.written++ ? ",\n" : "\n");
+		top.out->append(indent(top.depth + 1));
+		return top.out;
+	}
+	top.elements.emplace_back();
+	return &top.elements.back();
+}
+
+void JsonReportWriter::scalar(const std::string& text)
+{
+	std::string* out = begin_value(false);
+	out->append(text);
+	if (stack.empty()) buffer.push_back('\n');
+	flush_if_full();
+}
+
+void JsonReportWriter::begin_object()
+{
+	Frame frame;
+	frame.array = false;
+	frame.depth = stack.empty() ? 0 : stack.back().depth + 1;
+	frame.member = !stack.empty() && !stack.back().array;
+	frame.out = begin_value(true);
+	stack.push_back(std::move(frame));
+}
+
+void JsonReportWriter::begin_array()
+{
+	Frame frame;
+	frame.array = true;
+	frame.depth = stack.empty() ? 0 : stack.back().depth + 1;
+	frame.member = !stack.empty() && !stack.back().array;
+	frame.out = begin_value(true);
+	stack.push_back(std::move(frame));
+}
+
+void JsonReportWriter::key(const std::string& name)
+{
+	assert(!stack.empty() && !stack.back().array && !has_key);
+	assert(stack.back().floor.empty() || name > stack.back().floor);
+	next_key = name;
+	has_key = true;
+}
+
+void JsonReportWriter::stream_key(const std::string& name)
+{
+	assert(!stack.empty() && !stack.back().array && !has_key);
+	Frame& top = stack.back();
+	assert(top.floor.empty() || name > top.floor);
+	auto it = top.pending.begin();
+	for (; it != top.pending.end() && it->first < name; ++it) write_member(top, it->first, it->second);
+	top.pending.erase(top.pending.begin(), it);
+	assert(top.pending.count(name) == 0);
+	write_member(top, name, std::string());
+	top.floor = name;
+	has_key = true;
+	streaming = true;
+	flush_if_full();
+}
+
+void JsonReportWriter::end_object()
+{
+	assert(!stack.empty() && !stack.back().array && !has_key);
+	Frame& frame = stack.back();
+	for (const auto& pair : frame.pending) write_member(frame, pair.first, pair.second);
+	const bool empty = (frame.written == 0);
+	if (empty) frame.out->append("{}");
+	else
+	{
+		frame.out->push_back('\n');
+		frame.out->append(indent(frame.depth));
+		frame.out->push_back('}');
+	}
+	end_container(empty);
+}
+
+void JsonReportWriter::end_array()
+{
+	assert(!stack.empty() && stack.back().array);
+	Frame& frame = stack.back();
+	const bool empty = (frame.written == 0 && frame.elements.empty());
+	if (frame.multiline)
+	{
+		assert(frame.nested); // otherwise jsoncpp could have put it on a single line
+	}
+	else if (empty)
+	{
+		frame.out->append("[]");
+	}
+	else
+	{
+		size_t length = 4 + (frame.elements.size() - 1) * 2; // '[ ' + ', ' * n + ' ]'
+		for (const std::string& element : frame.elements) length += element.size();
+		if (!single_line_arrays || frame.nested || frame.elements.size() * 3 >= right_margin || length >= right_margin)
+		{
+			open(frame);
+			for (const std::string& element : frame.elements)
+			{
+				frame.out->append(frame.written++ ? ",\n" : "\n");
+				frame.out->append(indent(frame.depth + 1));
+				frame.out->append(element);
+			}
+		}
+		else
+		{
+			frame.out->append("[ ");
+			for (size_t i = 0; i < frame.elements.size(); i++)
+			{
+				if (i > 0) frame.out->append(", ");
+				frame.out->append(frame.elements[i]);
+			}
+			frame.out->append(" ]");
+		}
+	}
+	if (frame.opened)
+	{
+		frame.out->push_back('\n');
+		frame.out->append(indent(frame.depth));
+		frame.out->push_back(']');
+	}
+	end_container(empty);
+}
+
+void JsonReportWriter::end_container(bool empty)
+{
+	stack.pop_back();
+	if (stack.empty()) buffer.push_back('\n');
+	else if (!empty && stack.back().array) stack.back().nested = true;
+	flush_if_full();
+}
+
+void CborReportWriter::head(int major, uint64_t argument)
+{
+	const char type = (char)(major << 5);
+	int bytes = 0;
+	if (argument < 24) { buffer.push_back(type | (char)argument); return; }
+	else if (argument <= 0xff) { buffer.push_back(type | 24); bytes = 1; }
+	else if (argument <= 0xffff) { buffer.push_back(type | 25); bytes = 2; }
+	else if (argument <= 0xffffffff) { buffer.push_back(type | 26); bytes = 4; }
+	else { buffer.push_back(type | 27); bytes = 8; }
+	for (int i = bytes - 1; i >= 0; i--) buffer.push_back((char)(argument >> (i * 8))); // big endian
+}
+
+void CborReportWriter::value(double v)
+{
+	uint64_t bits;
+	memcpy(&bits, &v, sizeof(bits));
+	buffer.push_back((char)0xfb);
+	for (int i = 7; i >= 0; i--) buffer.push_back((char)(bits >> (i * 8)));
+}
+
+void CborReportWriter::flush_if_full()
+{
+	if (buffer.size() < flush_size) return;
+	if (fwrite(buffer.data(), 1, buffer.size(), fp) != buffer.size()) failed = true;
+	buffer.clear();
+}
+
+bool CborReportWriter::finish()
+{
+	if (!buffer.empty() && fwrite(buffer.data(), 1, buffer.size(), fp) != buffer.size()) failed = true;
+	buffer.clear();
+	return !failed;
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+// Streaming writers for the overview report.
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "json/json.h"
+
+/// SAX-style writer for the overview report. The report is written out while we walk the
+/// object tables, instead of building the whole document in memory first.
+///
+/// Object members may be given in any order, since the JSON writer collects them and writes
+/// them out sorted by key when the object ends (this is the order jsoncpp writes them in).
+/// Members that can get large, like lists of objects, should instead be started with
+/// stream_key(). It writes out the collected members that sort before it, and then writes
+/// the member value out directly as it is produced. All members that sort before a streamed
+/// member must be given before it, and later streamed members must sort after it.
+///
+/// The value() overloads mirror the constructors of Json::Value, so that a value is written
+/// out exactly as it would have been when assigned to a Json::Value.
+class ReportWriter
+{
+public:
+	virtual ~ReportWriter() {}
+
+	virtual void begin_object() = 0;
+	virtual void end_object() = 0;
+	virtual void begin_array() = 0;
+	virtual void end_array() = 0;
+	/// Set the key of the next object member
+	virtual void key(const std::string& name) = 0;
+	/// Set the key of the next object member, and write it out as it comes. See above.
+	virtual void stream_key(const std::string& name) = 0;
+	virtual void value(Json::Int v) = 0;
+	virtual void value(Json::UInt v) = 0;
+	virtual void value(Json::Int64 v) = 0;
+	virtual void value(Json::UInt64 v) = 0;
+	virtual void value(double v) = 0;
+	virtual void value(bool v) = 0;
+	virtual void value(const char* v) = 0;
+	virtual void value(const std::string& v) = 0;
+	virtual void null() = 0;
+
+	template<typename T>
+	void member(const std::string& name, T v) { key(name); value(v); }
+
+	/// Write out anything still buffered. Returns false if writing failed.
+	virtual bool finish() = 0;
+};
+
+/// Writes the report as JSON, byte-identical to what Json::Value::toStyledString() would
+/// produce for the same document.
+class JsonReportWriter : public ReportWriter
+{
+public:
+	JsonReportWriter(FILE* _fp);
+
+	void begin_object() override;
+	void end_object() override;
+	void begin_array() override;
+	void end_array() override;
+	void key(const std::string& name) override;
+	void stream_key(const std::string& name) override;
+	void value(Json::Int v) override { scalar(Json::valueToString((Json::LargestInt)v)); }
+	void value(Json::UInt v) override { scalar(Json::valueToString((Json::LargestUInt)v)); }
+	void value(Json::Int64 v) override { scalar(Json::valueToString((Json::LargestInt)v)); }
+	void value(Json::UInt64 v) override { scalar(Json::valueToString((Json::LargestUInt)v)); }
+	void value(double v) override { scalar(Json::valueToString(v)); }
+	void value(bool v) override { scalar(v ? "true" : "false"); }
+	void value(const char* v) override { if (v) scalar(Json::valueToQuotedString(v)); else null(); }
+	void value(const std::string& v) override { scalar(Json::valueToQuotedString(v.c_str())); }
+	void null() override { scalar("null"); }
+	bool finish() override;
+
+private:
+	struct Frame
+	{
+		bool array;
+		int depth;
+		bool member; ///< value of an object member, rather than an array element or the root
+		std::string* out; ///< where the text of this value goes
+		bool opened = false; ///< opening bracket has been written
+		size_t written = 0; ///< members or elements written out so far
+
+		// Objects
+		std::map<std::string, std::string> pending; ///< members not written out yet, keyed by name
+		std::string floor; ///< key of the last streamed member
+
+		// Arrays
+		bool multiline = false; ///< elements are containers, so write them out as they come
+		std::vector<std::string> elements; ///< otherwise collect them to decide on the layout
+		bool nested = false; ///< one of the collected elements is a non-empty container
+	};
+
+	std::string* begin_value(bool container);
+	void scalar(const std::string& text);
+	void end_container(bool empty);
+	void open(Frame& frame);
+	void write_member(Frame& frame, const std::string& name, const std::string& text);
+	std::string indent(int depth) const;
+	void flush_if_full();
+
+	FILE* fp;
+	bool failed = false;
+	std::string buffer; ///< text not yet written to the file
+	std::vector<Frame> stack;
+	std::string next_key;
+	bool has_key = false;
+	bool streaming = false;
+	// Layout details that changed between jsoncpp versions, taken from the linked jsoncpp
+	std::string indent_unit;
+	bool break_before_container = false;
+	bool single_line_arrays = true;
+};
+
+/// Writes the report as CBOR (RFC 8949), using indefinite length maps and arrays so that it
+/// can be fully streamed. Members are written in the order they are given.
+class CborReportWriter : public ReportWriter
+{
+public:
+	CborReportWriter(FILE* _fp) : fp(_fp) {}
+
+	void begin_object() override { buffer.push_back((char)0xbf); }
+	void end_object() override { buffer.push_back((char)0xff); flush_if_full(); }
+	void begin_array() override { buffer.push_back((char)0x9f); }
+	void end_array() override { buffer.push_back((char)0xff); flush_if_full(); }
+	void key(const std::string& name) override { value(name); }
+	void stream_key(const std::string& name) override { value(name); }
+	void value(Json::Int v) override { value((Json::Int64)v); }
+	void value(Json::UInt v) override { head(0, v); }
+	void value(Json::Int64 v) override { if (v < 0) head(1, (uint64_t)(-(v + 1))); else head(0, v); }
+	void value(Json::UInt64 v) override { head(0, v); }
+	void value(double v) override;
+	void value(bool v) override { buffer.push_back(v ? (char)0xf5 : (char)0xf4); }
+	void value(const char* v) override { if (v) value(std::string(v)); else null(); }
+	void value(const std::string& v) override { head(3, v.size()); buffer += v; flush_if_full(); }
+	void null() override { buffer.push_back((char)0xf6); }
+	bool finish() override;
+
+private:
+	void head(int major, uint64_t argument);
+	void flush_if_full();
+
+	FILE* fp;
+	bool failed = false;
+	std::string buffer;
+};
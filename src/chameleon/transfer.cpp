@@ -0,0 +1,501 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "transfer.h"
+
+// Transfers at least this large are split across the transfer threads, in pieces of about
+// the grain size.
+static constexpr VkDeviceSize parallel_threshold = 4 * 1024 * 1024;
+static constexpr VkDeviceSize parallel_grain = 1024 * 1024;
+
+// -- Formats and image layout
+
+struct FormatRange
+{
+	VkFormat first;
+	VkFormat last;
+	cVkFormatInfo info;
+};
+
+static const FormatRange format_ranges[] =
+{
+	{ VK_FORMAT_R4G4_UNORM_PACK8, VK_FORMAT_R4G4_UNORM_PACK8, { 1, 1, 1 } },
+	{ VK_FORMAT_R4G4B4A4_UNORM_PACK16, VK_FORMAT_A1R5G5B5_UNORM_PACK16, { 2, 1, 1 } },
+	{ VK_FORMAT_R8_UNORM, VK_FORMAT_R8_SRGB, { 1, 1, 1 } },
+	{ VK_FORMAT_R8G8_UNORM, VK_FORMAT_R8G8_SRGB, { 2, 1, 1 } },
+	{ VK_FORMAT_R8G8B8_UNORM, VK_FORMAT_B8G8R8_SRGB, { 3, 1, 1 } },
+	{ VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_A2B10G10R10_SINT_PACK32, { 4, 1, 1 } },
+	{ VK_FORMAT_R16_UNORM, VK_FORMAT_R16_SFLOAT, { 2, 1, 1 } },
+	{ VK_FORMAT_R16G16_UNORM, VK_FORMAT_R16G16_SFLOAT, { 4, 1, 1 } },
+	{ VK_FORMAT_R16G16B16_UNORM, VK_FORMAT_R16G16B16_SFLOAT, { 6, 1, 1 } },
+	{ VK_FORMAT_R16G16B16A16_UNORM, VK_FORMAT_R16G16B16A16_SFLOAT, { 8, 1, 1 } },
+	{ VK_FORMAT_R32_UINT, VK_FORMAT_R32_SFLOAT, { 4, 1, 1 } },
+	{ VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32_SFLOAT, { 8, 1, 1 } },
+	{ VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32_SFLOAT, { 12, 1, 1 } },
+	{ VK_FORMAT_R32G32B32A32_UINT, VK_FORMAT_R32G32B32A32_SFLOAT, { 16, 1, 1 } },
+	{ VK_FORMAT_R64_UINT, VK_FORMAT_R64_SFLOAT, { 8, 1, 1 } },
+	{ VK_FORMAT_R64G64_UINT, VK_FORMAT_R64G64_SFLOAT, { 16, 1, 1 } },
+	{ VK_FORMAT_R64G64B64_UINT, VK_FORMAT_R64G64B64_SFLOAT, { 24, 1, 1 } },
+	{ VK_FORMAT_R64G64B64A64_UINT, VK_FORMAT_R64G64B64A64_SFLOAT, { 32, 1, 1 } },
+	{ VK_FORMAT_B10G11R11_UFLOAT_PACK32, VK_FORMAT_E5B9G9R9_UFLOAT_PACK32, { 4, 1, 1 } },
+	{ VK_FORMAT_D16_UNORM, VK_FORMAT_D16_UNORM, { 2, 1, 1 } },
+	{ VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D32_SFLOAT, { 4, 1, 1 } },
+	{ VK_FORMAT_S8_UINT, VK_FORMAT_S8_UINT, { 1, 1, 1 } },
+	// Combined depth/stencil formats store both aspects in one texel, padded to a power of two
+	{ VK_FORMAT_D16_UNORM_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT, { 4, 1, 1 } },
+	{ VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D32_SFLOAT_S8_UINT, { 8, 1, 1 } },
+	{ VK_FORMAT_BC1_RGB_UNORM_BLOCK, VK_FORMAT_BC1_RGBA_SRGB_BLOCK, { 8, 4, 4 } },
+	{ VK_FORMAT_BC2_UNORM_BLOCK, VK_FORMAT_BC3_SRGB_BLOCK, { 16, 4, 4 } },
+	{ VK_FORMAT_BC4_UNORM_BLOCK, VK_FORMAT_BC4_SNORM_BLOCK, { 8, 4, 4 } },
+	{ VK_FORMAT_BC5_UNORM_BLOCK, VK_FORMAT_BC7_SRGB_BLOCK, { 16, 4, 4 } },
+	{ VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK, VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK, { 8, 4, 4 } },
+	{ VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK, VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK, { 16, 4, 4 } },
+	{ VK_FORMAT_EAC_R11_UNORM_BLOCK, VK_FORMAT_EAC_R11_SNORM_BLOCK, { 8, 4, 4 } },
+	{ VK_FORMAT_EAC_R11G11_UNORM_BLOCK, VK_FORMAT_EAC_R11G11_SNORM_BLOCK, { 16, 4, 4 } },
+	{ VK_FORMAT_A4R4G4B4_UNORM_PACK16, VK_FORMAT_A4B4G4R4_UNORM_PACK16, { 2, 1, 1 } },
+};
+
+/// Block dimensions of the ASTC formats, in the order of their format enums
+static const uint32_t astc_blocks[14][2] = { { 4, 4 }, { 5, 4 }, { 5, 5 }, { 6, 5 }, { 6, 6 }, { 8, 5 }, { 8, 6 },
+                                             { 8, 8 }, { 10, 5 }, { 10, 6 }, { 10, 8 }, { 10, 10 }, { 12, 10 }, { 12, 12 } };
+
+cVkFormatInfo format_info(VkFormat format)
+{
+	for (const FormatRange& range : format_ranges)
+	{
+		if (format >= range.first && format <= range.last) return range.info;
+	}
+	if (format >= VK_FORMAT_ASTC_4x4_UNORM_BLOCK && format <= VK_FORMAT_ASTC_12x12_SRGB_BLOCK)
+	{
+		const uint32_t* dims = astc_blocks[(format - VK_FORMAT_ASTC_4x4_UNORM_BLOCK) / 2]; // UNORM and SRGB pairs
+		return { 16, dims[0], dims[1] };
+	}
+	if (format >= VK_FORMAT_ASTC_4x4_SFLOAT_BLOCK && format <= VK_FORMAT_ASTC_12x12_SFLOAT_BLOCK)
+	{
+		const uint32_t* dims = astc_blocks[format - VK_FORMAT_ASTC_4x4_SFLOAT_BLOCK];
+		return { 16, dims[0], dims[1] };
+	}
+	return { 4, 1, 1 };
+}
+
+static inline uint32_t mip_dimension(uint32_t size, uint32_t level) { return std::max(1u, size >> level); }
+static inline uint32_t blocks(uint32_t texels, uint32_t block_size) { return (texels + block_size - 1) / block_size; }
+
+VkSubresourceLayout image_subresource_layout(VkFormat format, const VkExtent3D& extent, uint32_t arrayLayers, uint32_t mipLevel, uint32_t arrayLayer)
+{
+	const cVkFormatInfo info = format_info(format);
+	VkSubresourceLayout layout = {};
+	for (uint32_t level = 0; level <= mipLevel; level++)
+	{
+		layout.rowPitch = (VkDeviceSize)blocks(mip_dimension(extent.width, level), info.block_width) * info.size;
+		layout.depthPitch = layout.rowPitch * blocks(mip_dimension(extent.height, level), info.block_height);
+		layout.arrayPitch = layout.depthPitch * mip_dimension(extent.depth, level);
+		if (level < mipLevel) layout.offset += layout.arrayPitch * arrayLayers;
+	}
+	layout.offset += layout.arrayPitch * arrayLayer;
+	layout.size = layout.arrayPitch;
+	return layout;
+}
+
+VkDeviceSize image_size(VkFormat format, const VkExtent3D& extent, uint32_t mipLevels, uint32_t arrayLayers)
+{
+	const uint32_t levels = std::max(1u, mipLevels);
+	const VkSubresourceLayout last = image_subresource_layout(format, extent, arrayLayers, levels - 1, 0);
+	return last.offset + last.arrayPitch * arrayLayers;
+}
+
+// -- Transfer threads
+
+thread_local bool device_work_thread = false;
+
+/// Small pool of threads that large transfers are split across. The thread that asks for
+/// the work takes part in it as well. It can be used from multiple threads at once.
+class TransferPool
+{
+public:
+	TransferPool(unsigned count)
+	{
+		for (unsigned i = 0; i < count; i++) threads.emplace_back(&TransferPool::worker, this);
+	}
+
+	~TransferPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stop = true;
+		}
+		cond.notify_all();
+		for (std::thread& t : threads) t.join();
+	}
+
+	bool empty() const { return threads.empty(); }
+
+	/// Call fn(first, last) for consecutive ranges of at most grain items, until all count items are done.
+	void run(size_t count, size_t grain, const std::function<void(size_t, size_t)>& fn)
+	{
+		Job job { &fn, count, grain, (count + grain - 1) / grain };
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(&job);
+		}
+		cond.notify_all();
+		work(job);
+		std::unique_lock<std::mutex> lock(mutex);
+		done_cond.wait(lock, [&job] { return job.done == job.pieces && job.users == 0; });
+		auto it = std::find(jobs.begin(), jobs.end(), &job);
+		if (it != jobs.end()) jobs.erase(it);
+	}
+
+private:
+	struct Job
+	{
+		const std::function<void(size_t, size_t)>* fn;
+		size_t count;
+		size_t grain;
+		size_t pieces;
+		std::atomic<size_t> next { 0 };
+		size_t done = 0; ///< pieces finished, protected by the mutex
+		int users = 0; ///< pool threads working on it, protected by the mutex
+	};
+
+	void work(Job& job)
+	{
+		size_t piece;
+		while ((piece = job.next.fetch_add(1)) < job.pieces)
+		{
+			const size_t first = piece * job.grain;
+			(*job.fn)(first, std::min(job.count, first + job.grain));
+			std::lock_guard<std::mutex> lock(mutex);
+			if (++job.done == job.pieces) done_cond.notify_all();
+		}
+	}
+
+	void worker()
+	{
+		device_work_thread = true;
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true)
+		{
+			cond.wait(lock, [this] { return stop || !jobs.empty(); });
+			if (stop) return;
+			Job* job = jobs.front();
+			if (job->next.load() >= job->pieces)
+			{
+				jobs.pop_front(); // all pieces are taken
+				continue;
+			}
+			job->users++;
+			lock.unlock();
+			work(*job);
+			lock.lock();
+			if (--job->users == 0) done_cond.notify_all();
+		}
+	}
+
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::condition_variable done_cond;
+	std::deque<Job*> jobs;
+	bool stop = false;
+};
+
+static TransferPool& transfer_pool()
+{
+	static TransferPool pool(std::max(0, get_env_int("CHAMELEON_TRANSFER_THREADS", std::min(4u, std::thread::hardware_concurrency() / 2))));
+	return pool;
+}
+
+/// Call fn(first, last) over count items, split across the transfer threads if there are any.
+static void parallel_for(size_t count, size_t grain, const std::function<void(size_t, size_t)>& fn)
+{
+	TransferPool& pool = transfer_pool();
+	if (pool.empty() || count <= grain) fn(0, count);
+	else pool.run(count, grain, fn);
+}
+
+// -- Kernels
+
+static void fill_kernel(char* dst, size_t size, uint32_t data)
+{
+	const uint8_t byte = data & 0xff;
+	if (data == byte * 0x01010101u) // including the common case of zero
+	{
+		memset(dst, byte, size);
+		return;
+	}
+	size_t i = 0;
+#if defined(__SSE2__)
+	// Write single words until we are 16 byte aligned, then whole vectors
+	while (i + 4 <= size && ((uintptr_t)(dst + i) & 15)) { memcpy(dst + i, &data, 4); i += 4; }
+	const __m128i v = _mm_set1_epi32((int)data);
+	for (; i + 64 <= size; i += 64)
+	{
+		_mm_store_si128((__m128i*)(dst + i), v);
+		_mm_store_si128((__m128i*)(dst + i + 16), v);
+		_mm_store_si128((__m128i*)(dst + i + 32), v);
+		_mm_store_si128((__m128i*)(dst + i + 48), v);
+	}
+	for (; i + 16 <= size; i += 16) _mm_store_si128((__m128i*)(dst + i), v);
+#elif defined(__ARM_NEON)
+	const uint32x4_t v = vdupq_n_u32(data);
+	for (; i + 64 <= size; i += 64)
+	{
+		vst1q_u32((uint32_t*)(dst + i), v);
+		vst1q_u32((uint32_t*)(dst + i + 16), v);
+		vst1q_u32((uint32_t*)(dst + i + 32), v);
+		vst1q_u32((uint32_t*)(dst + i + 48), v);
+	}
+	for (; i + 16 <= size; i += 16) vst1q_u32((uint32_t*)(dst + i), v);
+#endif
+	for (; i + 4 <= size; i += 4) memcpy(dst + i, &data, 4);
+}
+
+void transfer_fill(char* dst, VkDeviceSize size, uint32_t data)
+{
+	assert(size % 4 == 0);
+	if (size < parallel_threshold) fill_kernel(dst, size, data);
+	else parallel_for(size, parallel_grain, [dst, data](size_t first, size_t last) { fill_kernel(dst + first, last - first, data); });
+}
+
+void transfer_copy(char* dst, const char* src, VkDeviceSize size)
+{
+	// The C library already picks the best vectorized copy for the CPU we run on
+	if (size < parallel_threshold) memcpy(dst, src, size);
+	else parallel_for(size, parallel_grain, [dst, src](size_t first, size_t last) { memcpy(dst + first, src + first, last - first); });
+}
+
+// -- Image copies
+
+/// A box of texel blocks in memory
+struct Surface
+{
+	char* ptr; ///< first block of the box
+	VkDeviceSize block_stride; ///< bytes between blocks in a row
+	VkDeviceSize row_pitch;
+	VkDeviceSize slice_pitch; ///< bytes between depth slices
+	VkDeviceSize layer_pitch; ///< bytes between array layers
+};
+
+/// The bytes of an aspect of a texel, and how large that texel is in a buffer
+struct AspectInfo
+{
+	uint32_t offset;
+	uint32_t bytes;
+	uint32_t buffer_size;
+};
+
+static AspectInfo aspect_info(VkFormat format, VkImageAspectFlags aspect)
+{
+	const bool stencil = (aspect == VK_IMAGE_ASPECT_STENCIL_BIT);
+	switch (format)
+	{
+	case VK_FORMAT_D16_UNORM_S8_UINT: return stencil ? AspectInfo{ 2, 1, 1 } : AspectInfo{ 0, 2, 2 };
+	case VK_FORMAT_D24_UNORM_S8_UINT: return stencil ? AspectInfo{ 3, 1, 1 } : AspectInfo{ 0, 3, 4 };
+	case VK_FORMAT_D32_SFLOAT_S8_UINT: return stencil ? AspectInfo{ 4, 1, 1 } : AspectInfo{ 0, 4, 4 };
+	default:
+	{
+		const uint32_t size = format_info(format).size;
+		return { 0, size, size };
+	}
+	}
+}
+
+static uint32_t layer_count(const cVkImage* image, const VkImageSubresourceLayers& subresource)
+{
+	if (subresource.layerCount == VK_REMAINING_ARRAY_LAYERS) return image->arrayLayers - subresource.baseArrayLayer;
+	return subresource.layerCount;
+}
+
+static bool has_memory(const cVkImage* image) { return image->memory && image->memory->ptr; }
+static bool has_memory(const cVkBuffer* buffer) { return buffer->memory && buffer->memory->ptr; }
+
+/// Surface for a box of an image subresource starting at the given texel offset
+static Surface image_surface(const cVkImage* image, const VkImageSubresourceLayers& subresource, const VkOffset3D& offset, uint32_t aspect_offset)
+{
+	const cVkFormatInfo info = format_info(image->format);
+	const VkSubresourceLayout layout = image_subresource_layout(image->format, image->extent, image->arrayLayers, subresource.mipLevel, subresource.baseArrayLayer);
+	assert(offset.x >= 0 && offset.y >= 0 && offset.z >= 0);
+	assert(subresource.baseArrayLayer + layer_count(image, subresource) <= std::max(1u, image->arrayLayers));
+	assert(layout.offset + layout.arrayPitch * layer_count(image, subresource) <= image->memory->allocationSize - image->memoryOffset);
+	Surface surface;
+	surface.block_stride = info.size;
+	surface.row_pitch = layout.rowPitch;
+	surface.slice_pitch = layout.depthPitch;
+	surface.layer_pitch = layout.arrayPitch;
+	surface.ptr = image->memory->ptr + image->memoryOffset + layout.offset + offset.z * layout.depthPitch
+	              + (offset.y / info.block_height) * layout.rowPitch + (offset.x / info.block_width) * info.size + aspect_offset;
+	return surface;
+}
+
+/// Surface for the buffer side of a buffer/image copy, with the box size in blocks
+static Surface buffer_surface(const cVkBuffer* buffer, const VkBufferImageCopy& region, const cVkFormatInfo& info, const AspectInfo& aspect,
+                              uint32_t width, uint32_t height, uint32_t layers)
+{
+	const uint32_t row_length = blocks(region.bufferRowLength ? region.bufferRowLength : region.imageExtent.width, info.block_width);
+	const uint32_t image_height = blocks(region.bufferImageHeight ? region.bufferImageHeight : region.imageExtent.height, info.block_height);
+	Surface surface;
+	surface.block_stride = aspect.buffer_size;
+	surface.row_pitch = (VkDeviceSize)row_length * aspect.buffer_size;
+	surface.slice_pitch = surface.row_pitch * image_height;
+	surface.layer_pitch = surface.slice_pitch * region.imageExtent.depth;
+	surface.ptr = buffer->memory->ptr + buffer->memoryOffset + region.bufferOffset;
+	assert(region.bufferOffset + surface.layer_pitch * (layers - 1) + surface.slice_pitch * (region.imageExtent.depth - 1)
+	       + surface.row_pitch * (height - 1) + (VkDeviceSize)width * aspect.buffer_size <= buffer->size);
+	(void)width;
+	(void)height;
+	(void)layers;
+	return surface;
+}
+
+/// Copy the given bytes of each block in a box of blocks from one surface to another
+static VkDeviceSize copy_box(const Surface& src, const Surface& dst, uint32_t bytes, uint32_t width, uint32_t height, uint32_t depth, uint32_t layers)
+{
+	const size_t rows = (size_t)height * depth * layers;
+	const VkDeviceSize row_bytes = (VkDeviceSize)width * bytes;
+	const bool packed = (src.block_stride == bytes && dst.block_stride == bytes);
+	auto copy_rows = [&](size_t first, size_t last)
+	{
+		for (size_t r = first; r < last; r++)
+		{
+			const size_t y = r % height;
+			const size_t z = (r / height) % depth;
+			const size_t layer = r / ((size_t)height * depth);
+			const char* s = src.ptr + layer * src.layer_pitch + z * src.slice_pitch + y * src.row_pitch;
+			char* d = dst.ptr + layer * dst.layer_pitch + z * dst.slice_pitch + y * dst.row_pitch;
+			if (packed)
+			{
+				memcpy(d, s, row_bytes);
+				continue;
+			}
+			for (uint32_t x = 0; x < width; x++) memcpy(d + x * dst.block_stride, s + x * src.block_stride, bytes);
+		}
+	};
+	const VkDeviceSize total = row_bytes * rows;
+	if (total >= parallel_threshold) parallel_for(rows, std::max<size_t>(1, parallel_grain / row_bytes), copy_rows);
+	else copy_rows(0, rows);
+	return total;
+}
+
+VkDeviceSize transfer_buffer_to_image(const cVkBuffer* buffer, cVkImage* image, const VkBufferImageCopy& region)
+{
+	if (!has_memory(buffer) || !has_memory(image)) return 0;
+	const cVkFormatInfo info = format_info(image->format);
+	const AspectInfo aspect = aspect_info(image->format, region.imageSubresource.aspectMask);
+	const uint32_t width = blocks(region.imageExtent.width, info.block_width);
+	const uint32_t height = blocks(region.imageExtent.height, info.block_height);
+	const uint32_t layers = layer_count(image, region.imageSubresource);
+	if (width == 0 || height == 0 || region.imageExtent.depth == 0 || layers == 0) return 0;
+	const Surface src = buffer_surface(buffer, region, info, aspect, width, height, layers);
+	const Surface dst = image_surface(image, region.imageSubresource, region.imageOffset, aspect.offset);
+	return copy_box(src, dst, aspect.bytes, width, height, region.imageExtent.depth, layers);
+}
+
+VkDeviceSize transfer_image_to_buffer(const cVkImage* image, cVkBuffer* buffer, const VkBufferImageCopy& region)
+{
+	if (!has_memory(buffer) || !has_memory(image)) return 0;
+	const cVkFormatInfo info = format_info(image->format);
+	const AspectInfo aspect = aspect_info(image->format, region.imageSubresource.aspectMask);
+	const uint32_t width = blocks(region.imageExtent.width, info.block_width);
+	const uint32_t height = blocks(region.imageExtent.height, info.block_height);
+	const uint32_t layers = layer_count(image, region.imageSubresource);
+	if (width == 0 || height == 0 || region.imageExtent.depth == 0 || layers == 0) return 0;
+	const Surface src = image_surface(image, region.imageSubresource, region.imageOffset, aspect.offset);
+	const Surface dst = buffer_surface(buffer, region, info, aspect, width, height, layers);
+	return copy_box(src, dst, aspect.bytes, width, height, region.imageExtent.depth, layers);
+}
+
+VkDeviceSize transfer_image_to_image(const cVkImage* src, cVkImage* dst, const VkImageCopy& region)
+{
+	if (!has_memory(src) || !has_memory(dst)) return 0;
+	// The extent is given in texels of the source image. Size compatible formats may have
+	// different block dimensions, eg when copying between a compressed and an uncompressed
+	// image, but always the same number of blocks.
+	const cVkFormatInfo info = format_info(src->format);
+	const AspectInfo src_aspect = aspect_info(src->format, region.srcSubresource.aspectMask);
+	const AspectInfo dst_aspect = aspect_info(dst->format, region.dstSubresource.aspectMask);
+	assert(src_aspect.bytes == dst_aspect.bytes);
+	const uint32_t width = blocks(region.extent.width, info.block_width);
+	const uint32_t height = blocks(region.extent.height, info.block_height);
+	const uint32_t layers = layer_count(src, region.srcSubresource);
+	if (width == 0 || height == 0 || region.extent.depth == 0 || layers == 0) return 0;
+	const Surface from = image_surface(src, region.srcSubresource, region.srcOffset, src_aspect.offset);
+	const Surface to = image_surface(dst, region.dstSubresource, region.dstOffset, dst_aspect.offset);
+	return copy_box(from, to, std::min(src_aspect.bytes, dst_aspect.bytes), width, height, region.extent.depth, layers);
+}
+
+// -- Blits
+
+static bool is_rgba8(VkFormat format) { return format >= VK_FORMAT_R8G8B8A8_UNORM && format <= VK_FORMAT_R8G8B8A8_SRGB; }
+static bool is_bgra8(VkFormat format) { return format >= VK_FORMAT_B8G8R8A8_UNORM && format <= VK_FORMAT_B8G8R8A8_SRGB; }
+
+/// Source coordinate for the center of destination texel d, for a blit of [s0, s1) to [d0, d1)
+static int32_t blit_coordinate(int32_t d, int32_t d0, int32_t d1, int32_t s0, int32_t s1)
+{
+	const double t = (d + 0.5 - d0) / (double)(d1 - d0);
+	const int32_t s = (int32_t)floor(s0 + t * (s1 - s0));
+	return std::clamp(s, std::min(s0, s1), std::max(s0, s1) - 1);
+}
+
+VkDeviceSize transfer_blit(const cVkImage* src, cVkImage* dst, const VkImageBlit& region)
+{
+	if (!has_memory(src) || !has_memory(dst)) return 0;
+	const bool swap = (is_rgba8(src->format) && is_bgra8(dst->format)) || (is_bgra8(src->format) && is_rgba8(dst->format));
+	if (src->format != dst->format && !swap && !(is_rgba8(src->format) && is_rgba8(dst->format)) && !(is_bgra8(src->format) && is_bgra8(dst->format)))
+	{
+		return 0; // would need format conversion
+	}
+	const cVkFormatInfo info = format_info(src->format);
+	if (info.block_width != 1 || info.block_height != 1) return 0; // not allowed for compressed formats
+
+	const VkOffset3D* s = region.srcOffsets;
+	const VkOffset3D* d = region.dstOffsets;
+	if (s[0].x == s[1].x || s[0].y == s[1].y || s[0].z == s[1].z || d[0].x == d[1].x || d[0].y == d[1].y || d[0].z == d[1].z) return 0;
+	const int32_t x0 = std::min(d[0].x, d[1].x);
+	const int32_t y0 = std::min(d[0].y, d[1].y);
+	const int32_t z0 = std::min(d[0].z, d[1].z);
+	const uint32_t width = std::abs(d[1].x - d[0].x);
+	const uint32_t height = std::abs(d[1].y - d[0].y);
+	const uint32_t depth = std::abs(d[1].z - d[0].z);
+	const uint32_t layers = layer_count(src, region.srcSubresource);
+	const Surface from = image_surface(src, region.srcSubresource, VkOffset3D{ 0, 0, 0 }, 0);
+	const Surface to = image_surface(dst, region.dstSubresource, VkOffset3D{ x0, y0, z0 }, 0);
+
+	auto blit_rows = [&](size_t first, size_t last)
+	{
+		for (size_t r = first; r < last; r++)
+		{
+			const int32_t y = r % height;
+			const int32_t z = (r / height) % depth;
+			const size_t layer = r / ((size_t)height * depth);
+			const int32_t sy = blit_coordinate(y0 + y, d[0].y, d[1].y, s[0].y, s[1].y);
+			const int32_t sz = blit_coordinate(z0 + z, d[0].z, d[1].z, s[0].z, s[1].z);
+			const char* src_row = from.ptr + layer * from.layer_pitch + sz * from.slice_pitch + sy * from.row_pitch;
+			char* dst_row = to.ptr + layer * to.layer_pitch + z * to.slice_pitch + y * to.row_pitch;
+			for (uint32_t x = 0; x < width; x++)
+			{
+				const int32_t sx = blit_coordinate(x0 + x, d[0].x, d[1].x, s[0].x, s[1].x);
+				char* texel = dst_row + x * to.block_stride;
+				memcpy(texel, src_row + sx * from.block_stride, info.size);
+				if (swap) std::swap(texel[0], texel[2]);
+			}
+		}
+	};
+	const size_t rows = (size_t)height * depth * layers;
+	const VkDeviceSize row_bytes = (VkDeviceSize)width * info.size;
+	if (row_bytes * rows >= parallel_threshold) parallel_for(rows, std::max<size_t>(1, parallel_grain / row_bytes), blit_rows);
+	else blit_rows(0, rows);
+	return row_bytes * rows;
+}
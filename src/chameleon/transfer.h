@@ -0,0 +1,48 @@
+#pragma once
+
+// Transfer engine that executes buffer and image copies, fills and updates on the fake
+// device memory, and the memory layout of images that it works on.
+
+#include "vulkan_defs.h"
+
+/// Size and dimensions of the texel blocks of a format. For uncompressed formats a block
+/// is a single texel.
+struct cVkFormatInfo
+{
+	uint32_t size; ///< bytes per block
+	uint32_t block_width;
+	uint32_t block_height;
+};
+
+/// Block information for a format. Formats we do not know about are treated as having
+/// 4 byte texels, as Chameleon did for all formats before.
+cVkFormatInfo format_info(VkFormat format);
+
+/// Memory layout of a subresource of an image, relative to the start of the image. All
+/// images use the same linear layout, regardless of tiling: rows of blocks, then depth slices,
+/// then array layers, with all the layers of a mip level stored before the next mip level.
+VkSubresourceLayout image_subresource_layout(VkFormat format, const VkExtent3D& extent, uint32_t arrayLayers, uint32_t mipLevel, uint32_t arrayLayer);
+
+/// Size of an image with all its mip levels and array layers, in the layout above.
+VkDeviceSize image_size(VkFormat format, const VkExtent3D& extent, uint32_t mipLevels, uint32_t arrayLayers);
+
+/// Set on threads while they write to device memory on behalf of the device, rather than of
+/// the application, so that dirty tracking can tell the two apart.
+extern thread_local bool device_work_thread;
+
+/// Fill memory with a repeated 32-bit value. Size must be a multiple of 4.
+void transfer_fill(char* dst, VkDeviceSize size, uint32_t data);
+
+/// Copy memory that does not overlap. Large copies are split across the transfer threads.
+void transfer_copy(char* dst, const char* src, VkDeviceSize size);
+
+// The functions below return the number of bytes written. Regions that involve an image
+// without any memory bound to it, like a swapchain image, are skipped.
+
+VkDeviceSize transfer_buffer_to_image(const cVkBuffer* buffer, cVkImage* image, const VkBufferImageCopy& region);
+VkDeviceSize transfer_image_to_buffer(const cVkImage* image, cVkBuffer* buffer, const VkBufferImageCopy& region);
+VkDeviceSize transfer_image_to_image(const cVkImage* src, cVkImage* dst, const VkImageCopy& region);
+
+/// Blits with nearest filtering, also when linear filtering is asked for. Only blits between
+/// images of the same format, or between 8-bit RGBA and BGRA formats, are executed.
+VkDeviceSize transfer_blit(const cVkImage* src, cVkImage* dst, const VkImageBlit& region);
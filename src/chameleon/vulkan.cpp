@@ -8,12 +8,21 @@
 
 #include <bitset>
 #include <algorithm>
+#include <chrono>
+#include <mutex>
 
 #include "util.h"
 #include "vulkan_defs.h"
 #include "vulkan_print.h"
 #include "vulkan_auto.h"
 #include "commandbuffer.h"
+#include "gpu_profile.h"
+#include "frame_metrics.h"
+#include "dirty_tracking.h"
+#include "transfer.h"
+#include "device_memory.h"
+#include "include/vulkan_ext.h"
+#include "src/checksum.h"
 #include "vkjson.h"
 
 /// Used to turn on writing report files to disk
@@ -55,6 +64,27 @@ static void report_device_memory(cVkDevice* dev, const cVkDeviceMemory* memory,
 	}
 }
 
+/// Account for memory allocated from a heap. Returns false, and accounts for nothing, if the heap
+/// does not have enough memory left.
+static bool reserve_heap_memory(cVkPhysicalDevice* pdevice, uint32_t heapIndex, VkDeviceSize size)
+{
+	std::atomic<VkDeviceSize>& usage = pdevice->heap_usage.usage[heapIndex];
+	const VkDeviceSize limit = pdevice->memoryProperties.memoryHeaps[heapIndex].size;
+	VkDeviceSize current = usage.load(std::memory_order_relaxed);
+	do
+	{
+		if (heap_limits && size > limit - std::min(current, limit)) return false;
+	} while (!usage.compare_exchange_weak(current, current + size, std::memory_order_relaxed));
+	return true;
+}
+
+static void release_heap_memory(cVkPhysicalDevice* pdevice, uint32_t heapIndex, VkDeviceSize size)
+{
+	const VkDeviceSize previous = pdevice->heap_usage.usage[heapIndex].fetch_sub(size, std::memory_order_relaxed);
+	assert(previous >= size);
+	(void)previous;
+}
+
 // -- Extensions
 // extension name, and last checked extension update version from the extension registry
 
@@ -101,6 +131,9 @@ thread_local long thread_id = thread_count++;
 /// If we initialize multiple instances, then the frame count is not individual for
 /// each of them. This is intentional.
 std::atomic_int cVkBase::current_frame;
+#ifndef FAST
+std::mutex touch_locks[64];
+#endif
 
 /// Count and distinguish between different instances, in case an implementation creates
 /// multiple instances. (Not sure in what use cases it would ever do this, though.)
@@ -115,6 +148,22 @@ static bool store_allocations = false;
 /// Keep track of last global UID number used.
 std::atomic_int cVkBase::last_uid;
 
+/// Free destroyed objects after this many frames. Zero means keep them forever.
+static int reclaim_frames = 0;
+
+/// Execute queue submissions on a worker thread per queue instead of inside vkQueueSubmit.
+static bool async_queues = false;
+
+/// Expose the VK_ARM_trace_helpers extension, regardless of the GPU definition.
+static bool trace_helpers = false;
+
+/// Fail allocations that would use more of a memory heap than the GPU definition says it has.
+static bool heap_limits = true;
+
+/// Only return functions from vkGetDeviceProcAddr if the device supports their core version or enabled their extension.
+static bool proc_gating = false;
+static void queue_worker(cVkQueue* queue);
+
 
 // -- Helpers
 // Helper function names are always lowercase and underscore separated
@@ -127,7 +176,7 @@ std::atomic_int cVkBase::last_uid;
 #define NHANDLE "%llu"
 #endif
 
-#define ENTRY(_name) count_ ## _name++;
+#define ENTRY(_name) thread_call_counters.increment(FUNC_ ## _name);
 
 #define instance_cast(c) ccast<cVkInstance, VkInstance>(c)
 #define physicaldevice_cast(c) ccast<cVkPhysicalDevice, VkPhysicalDevice>(c)
@@ -147,7 +196,7 @@ std::atomic_int cVkBase::last_uid;
 	ccast<cVkCommandBuffer, VkCommandBuffer>(_c); \
 	assert(p->state == cVkCommandBuffer::Recording); \
         vk_command _cmd = ENUM_ ## _name; \
-	p->commands.push_back(cVkCommand(_cmd, _metrics)); \
+	p->commands.record(_cmd, _metrics); \
 	p->count[ENUM_ ## _name] += _metrics; \
 	p->sum += _metrics;
 #else
@@ -155,7 +204,7 @@ std::atomic_int cVkBase::last_uid;
 	ccast<cVkCommandBuffer, VkCommandBuffer>(_c); \
 	assert(p->state == cVkCommandBuffer::Recording); \
         vk_command _cmd = ENUM_ ## _name; \
-	p->commands.push_back(cVkCommand(_cmd, _metrics));
+	p->commands.record(_cmd, _metrics);
 #endif
 #define buffer_cast(c) ccast<cVkBuffer, VkBuffer>(c)
 #define bufferview_cast(c) ccast<cVkBufferView, VkBufferView>(c)
@@ -194,6 +243,9 @@ static inline T& owner_create(std::list<T>& list, U* ptr, const VkAllocationCall
 	(void)c;
 	list.emplace_back();
 	touch(&list.back());
+#ifndef FAST
+	frame_metrics_object(list.back().object_type, 1);
+#endif
 	if (ptr)
 	{
 		*ptr = reinterpret_cast<U>(&list.back());
@@ -201,6 +253,23 @@ static inline T& owner_create(std::list<T>& list, U* ptr, const VkAllocationCall
 	return list.back();
 }
 
+/// As above, for objects owned by a device, which may be created from multiple threads at once.
+template<typename T, typename U> // T = cVk, U = Vk
+static inline T& owner_create(ObjectTable<T>& table, U* ptr, const VkAllocationCallbacks* c)
+{
+	(void)c;
+	T& obj = table.emplace();
+	touch(&obj);
+#ifndef FAST
+	frame_metrics_object(obj.object_type, 1);
+#endif
+	if (ptr)
+	{
+		*ptr = reinterpret_cast<U>(&obj);
+	}
+	return obj;
+}
+
 template<typename T, typename U> // T = cVk, U = Vk
 static inline T* destroy(U ptr, const VkAllocationCallbacks* c)
 {
@@ -209,12 +278,72 @@ static inline T* destroy(U ptr, const VkAllocationCallbacks* c)
 	if (p)
 	{
 		touch(p);
-		p->destroyed = true;
+#ifndef FAST
+		if (!p->destroyed) frame_metrics_object(p->object_type, -1);
+#endif
+		// Publish the frame before the flag, for reclaimable() on other threads
 		p->destroyed_frame = p->current_frame;
+		std::atomic_ref<bool>(p->destroyed).store(true, std::memory_order_release);
 	}
 	return p;
 }
 
+/// Free a descriptor set, which then no longer keeps the resources written into it around
+static void destroy_descriptor_set(cVkDescriptorSet* set)
+{
+	destroy<cVkDescriptorSet, VkDescriptorSet>(reinterpret_cast<VkDescriptorSet>(set), nullptr);
+	if (set) set->release_resources();
+}
+
+template<typename T>
+static inline bool reclaimable(const T& v)
+{
+	if (reclaim_frames <= 0 || !std::atomic_ref<bool>(const_cast<bool&>(v.destroyed)).load(std::memory_order_acquire)) return false;
+	if (std::atomic_ref<uint32_t>(const_cast<uint32_t&>(v.references)).load(std::memory_order_acquire) > 0) return false;
+	return v.destroyed_frame + reclaim_frames <= v.current_frame;
+}
+
+/// Let go of the objects that this one kept from being reclaimed
+static inline void release_held(const cVkBase&) {}
+static inline void release_held(const cVkImageView& v) { if (v.image) hold(v.image, -1); }
+
+/// Free the reclaimable objects in a table, calling fold() on each of them first so that
+/// any information we need for the report can be kept. Must be called with the device's
+/// reclaim_mutex held.
+template<typename T, typename F>
+static void reclaim_table(cVkDevice* dev, ObjectTable<T>& table, F fold)
+{
+	for (T& v : table)
+	{
+		if (!reclaimable(v)) continue;
+#ifndef FAST
+		{
+			std::lock_guard<std::mutex> lock(touch_lock(dev)); // other threads may be touching the device
+			v.update(dev);
+		}
+		fold(v);
+#endif
+		release_held(v);
+		table.erase(v);
+	}
+}
+
+/// Free destroyed objects of the types that are typically created and destroyed every frame.
+/// Views go first, so that the objects they held can be freed in the same pass.
+static void reclaim_destroyed(cVkDevice* dev)
+{
+	std::lock_guard<std::mutex> lock(dev->reclaim_mutex);
+	reclaim_table(dev, dev->bufferViews, [dev](const cVkBufferView& v) { dev->reclaimed.bufferViews++; });
+	reclaim_table(dev, dev->buffers, [dev](const cVkBuffer& v) { dev->reclaimed.buffers[cVkBufferSummary(v)]++; });
+	reclaim_table(dev, dev->imageViews, [dev](const cVkImageView& v) { dev->reclaimed.imageViews[cVkImageViewSummary(v)]++; });
+	reclaim_table(dev, dev->images, [dev](const cVkImage& v) { dev->reclaimed.images[cVkImageSummary(v)]++; });
+	reclaim_table(dev, dev->framebuffers, [dev](const cVkFramebuffer& v)
+	{
+		dev->reclaimed.framebuffers++;
+		v.accessed_by_thread.for_each([dev](long t) { dev->reclaimed.accessed_by_thread[t]++; });
+	});
+}
+
 #define TBD_UNSUPPORTED printf("%s is not yet supported!\n", __FUNCTION__);
 
 
@@ -245,19 +374,138 @@ static void maybe_enable_logging()
 	}
 }
 
-static PFN_vkVoidFunction lookup_raw_proc(const char* pName)
+// -- VK_ARM_trace_helpers
+// These are not in the Vulkan registry, so they are not in the generated function map.
+
+/// Checksum the given memory for an assert. If we were given the contents it should have, we return
+/// the checksum of those instead, since we cannot generate the contents of buffers written by shaders.
+static VkResult assert_checksum(const unsigned char* ptr, VkDeviceSize size, const void* pData, uint32_t* checksum, const char* comment)
 {
-	if (!pName) return nullptr;
+	uint32_t value = adler32_update(1, ptr, size);
+	if (pData)
+	{
+		const uint32_t expected = adler32_update(1, static_cast<const unsigned char*>(pData), size);
+		if (expected != value) XLOG("checksum for %s is %08x, but asserted contents have %08x", comment ? comment : "assert", value, expected);
+		value = expected;
+	}
+	XLOG("checksum=%08x", value);
+	if (checksum) *checksum = value;
+	return VK_SUCCESS;
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL vkAssertBufferARM(VkDevice device, const VkUpdateBufferInfoARM* pInfo, uint32_t* checksum, const char* comment)
+{
+	CLOG("device=%p, pInfo=%p, checksum=%p, comment=%s", device, pInfo, checksum, comment ? comment : "(null)");
+	assert(pInfo && pInfo->sType == VK_STRUCTURE_TYPE_UPDATE_BUFFER_INFO_ARM);
+	const cVkBuffer* buffer = buffer_cast(pInfo->dstBuffer);
+	assert(buffer->memory);
+	assert(pInfo->dstOffset <= buffer->size);
+	const VkDeviceSize size = (pInfo->dataSize == VK_WHOLE_SIZE) ? buffer->size - pInfo->dstOffset : pInfo->dataSize;
+	const unsigned char* ptr = reinterpret_cast<const unsigned char*>(buffer->memory->ptr + buffer->memoryOffset + pInfo->dstOffset);
+	return assert_checksum(ptr, size, pInfo->pData, checksum, comment);
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL vkAssertMemoryARM(VkDevice device, const VkUpdateMemoryInfoARM* pInfo, uint32_t* checksum, const char* comment)
+{
+	CLOG("device=%p, pInfo=%p, checksum=%p, comment=%s", device, pInfo, checksum, comment ? comment : "(null)");
+	assert(pInfo && pInfo->sType == VK_STRUCTURE_TYPE_UPDATE_MEMORY_INFO_ARM && pInfo->pDstRange);
+	// Our device addresses are host pointers
+	const VkDeviceSize size = (pInfo->dataSize == VK_WHOLE_SIZE) ? pInfo->pDstRange->size : pInfo->dataSize;
+	const unsigned char* ptr = reinterpret_cast<const unsigned char*>(pInfo->pDstRange->address);
+	return assert_checksum(ptr, size, pInfo->pData, checksum, comment);
+}
+
+static VKAPI_ATTR void VKAPI_CALL vkCmdUpdateBuffer2ARM(VkCommandBuffer commandBuffer, const VkUpdateBufferInfoARM* pInfo)
+{
+	assert(pInfo && pInfo->sType == VK_STRUCTURE_TYPE_UPDATE_BUFFER_INFO_ARM);
+	vkCmdUpdateBuffer(commandBuffer, pInfo->dstBuffer, pInfo->dstOffset, pInfo->dataSize, pInfo->pData);
+}
+
+static VKAPI_ATTR void VKAPI_CALL vkCmdUpdateMemory2ARM(VkCommandBuffer commandBuffer, const VkUpdateMemoryInfoARM* pInfo)
+{
+	assert(pInfo && pInfo->sType == VK_STRUCTURE_TYPE_UPDATE_MEMORY_INFO_ARM);
+	vkCmdUpdateMemoryKHR(commandBuffer, pInfo->pDstRange, pInfo->dstFlags, pInfo->dataSize, pInfo->pData);
+}
+
+static PFN_vkVoidFunction lookup_trace_helpers_proc(const char* pName)
+{
+	if (strcmp(pName, "vkAssertBufferARM") == 0) return (PFN_vkVoidFunction)vkAssertBufferARM;
+	if (strcmp(pName, "vkAssertMemoryARM") == 0) return (PFN_vkVoidFunction)vkAssertMemoryARM;
+	if (strcmp(pName, "vkCmdUpdateBuffer2ARM") == 0) return (PFN_vkVoidFunction)vkCmdUpdateBuffer2ARM;
+	if (strcmp(pName, "vkCmdUpdateMemory2ARM") == 0) return (PFN_vkVoidFunction)vkCmdUpdateMemory2ARM;
 
-	auto it = function_map.find(pName);
-	if (it != function_map.end())
+	return nullptr;
+}
+
+#ifndef FAST
+static VKAPI_ATTR void VKAPI_CALL vkGetLiveObjectCountsCHAMELEON(VkDevice device, uint32_t* pCount, VkObjectType* pTypes, int64_t* pLive)
+{
+	(void)device;
+	if (!pTypes || !pLive)
+	{
+		*pCount = FRAME_OBJECT_MAX;
+		return;
+	}
+	*pCount = std::min<uint32_t>(*pCount, FRAME_OBJECT_MAX);
+	for (uint32_t i = 0; i < *pCount; i++)
 	{
-		return it->second;
+		pTypes[i] = frame_object_types[i];
+		pLive[i] = frame_metrics.live[i].load(std::memory_order_relaxed);
 	}
+}
+#endif
 
+/// Functions that only Chameleon has, for test harnesses. Not in the light build, which does not count objects.
+static PFN_vkVoidFunction lookup_chameleon_proc(const char* pName)
+{
+#ifndef FAST
+	if (strcmp(pName, "vkGetLiveObjectCountsCHAMELEON") == 0) return (PFN_vkVoidFunction)vkGetLiveObjectCountsCHAMELEON;
+#else
+	(void)pName;
+#endif
 	return nullptr;
 }
 
+static PFN_vkVoidFunction lookup_raw_proc(const char* pName)
+{
+	if (!pName) return nullptr;
+
+	const vk_proc_entry* entry = lookup_proc(pName);
+	if (entry) return entry->proc;
+
+	PFN_vkVoidFunction proc = trace_helpers ? lookup_trace_helpers_proc(pName) : nullptr;
+	if (proc) return proc;
+
+	return lookup_chameleon_proc(pName);
+}
+
+static PFN_vkVoidFunction lookup_device_proc(const cVkDevice* dev, const char* pName)
+{
+	if (!pName) return nullptr;
+
+	const vk_proc_entry* entry = lookup_proc(pName);
+	if (entry) return dev->procs_enabled[entry - proc_table] ? entry->proc : nullptr;
+
+	PFN_vkVoidFunction proc = trace_helpers ? lookup_trace_helpers_proc(pName) : nullptr;
+	if (proc) return proc;
+
+	return lookup_chameleon_proc(pName);
+}
+
+/// Whether vkGetDeviceProcAddr should return a function for a device with this version and these extensions.
+static bool is_device_proc_enabled(const vk_proc_entry& entry, uint32_t api_version, const std::vector<std::string>& extensions)
+{
+	if (!entry.name) return false;
+	if (!proc_gating) return true;
+	if (entry.version == 0 && !entry.extensions) return true; // provided by an instance extension
+	if (entry.version != 0 && entry.version <= api_version) return true;
+	for (const char* const* extension = entry.extensions; extension && *extension; extension++)
+	{
+		if (std::find(extensions.begin(), extensions.end(), *extension) != extensions.end()) return true;
+	}
+	return false;
+}
+
 static PFN_vkVoidFunction lookup_global_proc(const char* pName)
 {
 	if (!pName) return nullptr;
@@ -325,9 +573,9 @@ VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL vkGetDeviceProcAddr(
 	ENTRY(vkGetDeviceProcAddr);
 	CLOG("instance=%p, pName=%s", device, pName ? pName : "(null)");
 
-	if (device) (void)device_cast(device);
+	const cVkDevice* dev = device ? device_cast(device) : nullptr;
 
-	PFN_vkVoidFunction proc = lookup_raw_proc(pName);
+	PFN_vkVoidFunction proc = dev ? lookup_device_proc(dev, pName) : lookup_raw_proc(pName);
 	if (proc) return proc;
 	XLOG("Asked for unsupported device function: %s", pName ? pName : "(null)");
 	return nullptr;
@@ -677,10 +925,6 @@ static void loadGpu(cVkPhysicalDevice& gpu, const std::string& gpu_path, const s
 		gpu.queueFamilies.emplace_back();
 		readVkQueueFamilyProperties(queueFamilyRoot, gpu.queueFamilies.back());
 	}
-
-	// Create one display
-
-	gpu.displays.emplace_back(); 
 }
 
 VKAPI_ATTR VkResult VKAPI_CALL vkCreateInstance(
@@ -709,6 +953,16 @@ VKAPI_ATTR VkResult VKAPI_CALL vkCreateInstance(
 		{
 			store_allocations = true;
 		}
+		reclaim_frames = get_env_int("CHAMELEON_RECLAIM", 0);
+		async_queues = get_env_int("CHAMELEON_ASYNC_QUEUES", 0) != 0;
+		device_memory_init();
+		trace_helpers = get_env_int("CHAMELEON_TRACE_HELPERS", 0) != 0;
+		heap_limits = get_env_int("CHAMELEON_HEAP_LIMITS", 1) != 0;
+		proc_gating = get_env_int("CHAMELEON_PROC_GATING", 0) != 0;
+#ifndef FAST
+		frame_metrics_init();
+		dirty_tracking_init();
+#endif
 	}
 
 #ifndef FAST
@@ -738,16 +992,29 @@ VKAPI_ATTR VkResult VKAPI_CALL vkCreateInstance(
 	}
 
 	cVkInstance *instance = new cVkInstance;
-#ifndef FAST
-	instance->accessed_by_thread.insert(thread_id);
-	instance->used_in_frame.insert(instance->current_frame);
-	instance->used_in_frame_transitive.insert(instance->current_frame);
-#endif
+	touch(instance);
 
 	cVkPhysicalDevice gpu;
-	loadGpu(gpu, gpu_path, gpu_override_path);
+	const std::string profile_cache_dir = gpu_profile_cache_dir();
+	const uint64_t profile_key = profile_cache_dir.empty() ? 0 : gpu_profile_key(gpu_path, gpu_override_path);
+	if (load_gpu_profile(gpu, profile_cache_dir, profile_key))
+	{
+		XLOG("loaded compiled GPU profile %016llx from %s", (unsigned long long)profile_key, profile_cache_dir.c_str());
+	}
+	else
+	{
+		loadGpu(gpu, gpu_path, gpu_override_path);
+		save_gpu_profile(gpu, profile_cache_dir, profile_key);
+	}
+	if (trace_helpers)
+	{
+		gpu.extensions[VK_ARM_TRACE_HELPERS_EXTENSION_NAME] = 1;
+	}
+
+	// Create one display
+	gpu.displays.emplace_back();
 
-	instance->GPUs.emplace_back(gpu);
+	instance->GPUs.emplace_back(std::move(gpu));
 
 	for (unsigned i = 0; i < pCreateInfo->enabledLayerCount; i++)
 	{
@@ -789,18 +1056,12 @@ VKAPI_ATTR void VKAPI_CALL vkDestroyInstance(
 		std::string callstats_name = std::string(report_name) + "_callstats.csv";
 		save_counts(callstats_name.c_str());
 	}
+	frame_metrics_flush();
 #endif
 
 	for (cVkPhysicalDevice& gpu: cinstance->GPUs)
 	{
-		for (auto& elt: gpu.features)
-		{
-			free(elt.second.first);
-		}
-		for (auto& elt: gpu.extendedProperties)
-		{
-			free(elt.second.first);
-		}
+		free_gpu_profile(gpu);
 	}
 
 	delete cinstance;
@@ -950,6 +1211,23 @@ static void commonGetPhysicalDeviceMemoryProperties(
 	*pMemoryProperties = device->memoryProperties;
 }
 
+/// Fill in the memory budget, if asked for. We are the only user of our heaps, so the budget is
+/// the whole heap, and usage is exactly what has been allocated from it.
+static void commonGetPhysicalDeviceMemoryBudget(
+    VkPhysicalDevice                            physicalDevice,
+    VkPhysicalDeviceMemoryProperties2*          pMemoryProperties)
+{
+	VkPhysicalDeviceMemoryBudgetPropertiesEXT* budget = (VkPhysicalDeviceMemoryBudgetPropertiesEXT*)find_extension(pMemoryProperties, VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT);
+	if (!budget) return;
+	cVkPhysicalDevice* device = physicaldevice_cast(physicalDevice);
+	for (unsigned i = 0; i < VK_MAX_MEMORY_HEAPS; i++)
+	{
+		const bool valid = i < device->memoryProperties.memoryHeapCount;
+		budget->heapBudget[i] = valid ? device->memoryProperties.memoryHeaps[i].size : 0;
+		budget->heapUsage[i] = valid ? device->heap_usage.usage[i].load(std::memory_order_relaxed) : 0;
+	}
+}
+
 VKAPI_ATTR void VKAPI_CALL vkGetPhysicalDeviceMemoryProperties(
     VkPhysicalDevice                            physicalDevice,
     VkPhysicalDeviceMemoryProperties*           pMemoryProperties)
@@ -997,15 +1275,16 @@ VKAPI_ATTR VkResult VKAPI_CALL vkCreateDevice(
 		assert(q.sType == VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO);
 		for (unsigned j = 0; j < q.queueCount; j++, index++)
 		{
-			dev.queues.emplace_back();
-			cVkQueue& queue = dev.queues.back();
+			cVkQueue& queue = dev.queues.emplace();
 			queue.device = &dev;
 			queue.index = index;
 			queue.priority = q.pQueuePriorities[j];
-			dev.queue_ptrs.push_back(reinterpret_cast<VkQueue>(&dev.queues.back()));
+			dev.queue_ptrs.push_back(reinterpret_cast<VkQueue>(&queue));
+			if (async_queues) queue.worker = std::thread(queue_worker, &queue);
 		}
 	}
 
+	dev.physical = pdevice;
 	for (unsigned i = 0; i < pdevice->memoryProperties.memoryTypeCount; i++)
 	{
 		dev.memoryTypeBits |= 1 << i;
@@ -1039,6 +1318,10 @@ VKAPI_ATTR VkResult VKAPI_CALL vkCreateDevice(
 		XLOG("requested device extension: %s", pCreateInfo->ppEnabledExtensionNames[i]);
 		dev.enabledExtensions.push_back(pCreateInfo->ppEnabledExtensionNames[i]);
 	}
+	for (unsigned i = 0; i < PROC_TABLE_SIZE; i++)
+	{
+		dev.procs_enabled[i] = is_device_proc_enabled(proc_table[i], pdevice->properties.apiVersion, dev.enabledExtensions);
+	}
 	XLOG("created device %p", *pDevice);
 
 	return VK_SUCCESS;
@@ -1053,7 +1336,20 @@ VKAPI_ATTR void VKAPI_CALL vkDestroyDevice(
 
 	(void)pAllocator; // ignored
 	cVkDevice* dev = device_cast(device);
-	if (dev) dev->destroyed = true;
+	if (!dev) return;
+	dev->destroyed = true;
+	for (cVkQueue& queue : dev->queues)
+	{
+		if (!queue.worker.joinable()) continue;
+		queue.ring.push(nullptr);
+		queue.worker.join();
+	}
+	// Memory that was never freed goes back to the heaps along with the device
+	for (unsigned i = 0; i < dev->physical->memoryProperties.memoryTypeCount; i++)
+	{
+		const uint64_t leaked = dev->memory_allocated[i].exchange(0);
+		if (leaked > 0) release_heap_memory(dev->physical, dev->physical->memoryProperties.memoryTypes[i].heapIndex, leaked);
+	}
 }
 
 VKAPI_ATTR VkResult VKAPI_CALL vkEnumerateInstanceExtensionProperties(
@@ -1168,7 +1464,27 @@ static void update_stageflag_usage(cVkQueue* q, uint64_t flags)
 #endif
 }
 
-static void internalQueueSubmit(cVkQueue* q, VkCommandBuffer cmdbuffer)
+static void execute_command_buffer(const cVkCommandBuffer* cmdbuf, bool track_usage)
+{
+	cVkCmdState cmdstate;
+	cmdstate.track_usage = track_usage;
+	const bool was_device_work_thread = device_work_thread;
+	device_work_thread = true;
+	for (const cVkCommand& cmd : cmdbuf->commands)
+	{
+		execute_command_buffer_command(cmd, cmdstate, true);
+	}
+	device_work_thread = was_device_work_thread;
+#ifndef FAST
+	frame_metrics_add(FRAME_METRIC_DRAWS, cmdstate.draws);
+	frame_metrics_add(FRAME_METRIC_VERTICES, cmdstate.vertices);
+	frame_metrics_add(FRAME_METRIC_DISPATCHES, cmdstate.dispatches);
+	frame_metrics_add(FRAME_METRIC_WORKGROUPS, cmdstate.workgroups);
+	frame_metrics_add(FRAME_METRIC_BYTES_COPIED, cmdstate.bytes_copied);
+#endif
+}
+
+static void internalQueueSubmit(cVkQueue* q, cVkPendingSubmission& submission, VkCommandBuffer cmdbuffer)
 {
 	cVkCommandBuffer* cmdbuf = commandbuffer_cast(cmdbuffer);
 
@@ -1180,37 +1496,48 @@ static void internalQueueSubmit(cVkQueue* q, VkCommandBuffer cmdbuffer)
 	}
 
 	update_stageflag_usage(q, cmdbuf->maxStageFlags);
+	frame_metrics_add(FRAME_METRIC_COMMAND_BUFFERS, 1);
 #endif
 
-	// Execute commands immediately
-	cVkCmdState cmdstate;
-	for (const cVkCommand& cmd : cmdbuf->commands)
+	// Execute commands immediately, unless the queue's worker thread does it later. The worker
+	// does not track usage, since it would race with application threads touching the same
+	// objects, so do that here. Indirect parameters are then read before earlier submissions
+	// have executed, which can make the counted work differ from what actually runs.
+	if (!async_queues) execute_command_buffer(cmdbuf, true);
+	else log_command_buffer_usage(cmdbuf);
+
+	// Keep the command buffers pending until the submission is retired
+	submission.commandbuffers.push_back(cmdbuf);
+}
+
+static bool semaphore_wait_satisfied(const cVkSemaphoreOperation& wait)
+{
+	if (wait.semaphore->type == VK_SEMAPHORE_TYPE_TIMELINE)
 	{
-		execute_command_buffer_command(cmd, cmdstate, true);
+		return wait.semaphore->value >= wait.value;
 	}
-
-	// Store references to commandbuffers until results presented
-	q->commandbuffers.push_back(cmdbuf);
+	assert(wait.semaphore->type == VK_SEMAPHORE_TYPE_BINARY);
+	return wait.semaphore->binary_signalled;
 }
 
-static bool submission_waits_satisfied(const cVkPendingSubmission& submission)
+/// Move the queues that are waiting for values of this semaphore that have now been reached
+/// over to the ready list.
+static void wake_semaphore_waiters(cVkSemaphore* semaphore, std::vector<cVkQueue*>& ready)
 {
-	for (const cVkSemaphoreOperation& wait : submission.waits)
+	while (!semaphore->waiters.empty())
 	{
-		if (wait.semaphore->type == VK_SEMAPHORE_TYPE_TIMELINE)
-		{
-			if (wait.semaphore->value < wait.value) return false;
-		}
-		else
-		{
-			assert(wait.semaphore->type == VK_SEMAPHORE_TYPE_BINARY);
-			if (!wait.semaphore->binary_signalled) return false;
-		}
+		const cVkSemaphore::Waiter& first = semaphore->waiters.front();
+		if (semaphore->type == VK_SEMAPHORE_TYPE_TIMELINE && semaphore->value < first.value) break;
+		if (semaphore->type == VK_SEMAPHORE_TYPE_BINARY && !semaphore->binary_signalled) break;
+		first.queue->blocked = false;
+		ready.push_back(first.queue);
+		std::pop_heap(semaphore->waiters.begin(), semaphore->waiters.end(), std::greater<cVkSemaphore::Waiter>());
+		semaphore->waiters.pop_back();
 	}
-	return true;
 }
 
-static void complete_submission(cVkPendingSubmission& submission)
+/// Unsignal the binary semaphores that the submission waited on, as it starts executing.
+static void consume_submission_waits(cVkPendingSubmission& submission)
 {
 	for (const cVkSemaphoreOperation& wait : submission.waits)
 	{
@@ -1220,6 +1547,11 @@ static void complete_submission(cVkPendingSubmission& submission)
 			wait.semaphore->binary_signalled = false;
 		}
 	}
+}
+
+/// Make the signals of the submission, as it finishes executing.
+static void complete_submission(cVkPendingSubmission& submission, std::vector<cVkQueue*>& ready)
+{
 	for (const cVkSemaphoreOperation& signal : submission.signals)
 	{
 		if (signal.semaphore->type == VK_SEMAPHORE_TYPE_TIMELINE)
@@ -1233,32 +1565,132 @@ static void complete_submission(cVkPendingSubmission& submission)
 			assert(!signal.semaphore->binary_signalled);
 			signal.semaphore->binary_signalled = true;
 		}
+		wake_semaphore_waiters(signal.semaphore, ready);
+	}
+	// Command buffers leave the pending state once no submission of them is left
+	for (cVkCommandBuffer* cmdbuf : submission.commandbuffers)
+	{
+		assert(cmdbuf->state == cVkCommandBuffer::Pending && cmdbuf->pending_submissions > 0);
+		if (--cmdbuf->pending_submissions > 0) continue;
+		cmdbuf->state = (cmdbuf->flags & VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT) ? cVkCommandBuffer::Invalid : cVkCommandBuffer::Executable;
 	}
 	if (submission.fence) submission.fence->signalled.store(true);
 }
 
-static void retire_pending_submissions(cVkDevice* device)
+/// Retire submissions from the front of each ready queue until each one hits a wait that is
+/// not yet satisfied, at which point the queue is registered as a waiter on that semaphore.
+/// Retiring can signal semaphores that make more queues ready, so this continues until no
+/// queue is ready anymore. With CHAMELEON_ASYNC_QUEUES, submissions whose waits are satisfied
+/// are instead handed to the queue's worker thread, which retires them once executed. Must be
+/// called with the device's sync_mutex held.
+static void retire_ready_queues(cVkDevice* device, std::vector<cVkQueue*>& ready)
 {
-	bool progressed;
-	do
+	bool progressed = false;
+	while (!ready.empty())
 	{
-		progressed = false;
-		for (cVkQueue& queue : device->queues)
+		cVkQueue* queue = ready.back();
+		ready.pop_back();
+		while (queue->handed < queue->pendingSubmissions.size() && queue->handed < cVkSubmissionRing::capacity)
 		{
-			while (!queue.pendingSubmissions.empty() && submission_waits_satisfied(queue.pendingSubmissions.front()))
+			cVkPendingSubmission& submission = *std::next(queue->pendingSubmissions.begin(), queue->handed);
+			auto blocker = std::find_if_not(submission.waits.cbegin(), submission.waits.cend(), semaphore_wait_satisfied);
+			if (blocker != submission.waits.cend())
 			{
-				complete_submission(queue.pendingSubmissions.front());
-				queue.pendingSubmissions.pop_front();
-				progressed = true;
+				const uint64_t value = blocker->semaphore->type == VK_SEMAPHORE_TYPE_TIMELINE ? blocker->value : 0;
+				blocker->semaphore->waiters.push_back({ value, queue });
+				std::push_heap(blocker->semaphore->waiters.begin(), blocker->semaphore->waiters.end(), std::greater<cVkSemaphore::Waiter>());
+				queue->blocked = true;
+				break;
+			}
+			consume_submission_waits(submission);
+			if (async_queues)
+			{
+				queue->ring.push(&submission);
+				queue->handed++;
+				continue;
 			}
+			complete_submission(submission, ready);
+			queue->pendingSubmissions.pop_front();
+			progressed = true;
 		}
-	} while (progressed);
+	}
+	if (progressed) device->sync_cond.notify_all();
+}
+
+/// Worker thread body for CHAMELEON_ASYNC_QUEUES. A null submission tells it to exit.
+static void queue_worker(cVkQueue* queue)
+{
+	while (cVkPendingSubmission* submission = queue->ring.pop())
+	{
+		for (const cVkCommandBuffer* cmdbuf : submission->commandbuffers)
+		{
+			execute_command_buffer(cmdbuf, false);
+		}
+
+		std::lock_guard<std::mutex> lock(queue->device->sync_mutex);
+		std::vector<cVkQueue*> ready;
+		if (!queue->blocked) ready.push_back(queue); // otherwise a signal will make it ready
+		complete_submission(*submission, ready);
+		assert(submission == &queue->pendingSubmissions.front());
+		queue->pendingSubmissions.pop_front();
+		queue->handed--;
+		retire_ready_queues(queue->device, ready);
+		queue->device->sync_cond.notify_all();
+	}
+}
+
+/// Retire whatever a host-side semaphore signal has unblocked. Must be called with the
+/// device's sync_mutex held.
+static void semaphore_signalled(cVkDevice* device, cVkSemaphore* semaphore)
+{
+	std::vector<cVkQueue*> ready;
+	wake_semaphore_waiters(semaphore, ready);
+	retire_ready_queues(device, ready);
+	device->sync_cond.notify_all();
 }
 
 static void enqueue_submission(cVkQueue* queue, cVkPendingSubmission& submission)
 {
-	queue->pendingSubmissions.push_back(submission);
-	retire_pending_submissions(queue->device);
+#ifndef FAST
+	frame_metrics_add(FRAME_METRIC_SUBMITS, 1);
+#endif
+	std::lock_guard<std::mutex> lock(queue->device->sync_mutex);
+	for (cVkCommandBuffer* cmdbuf : submission.commandbuffers)
+	{
+		cmdbuf->state = cVkCommandBuffer::Pending;
+		cmdbuf->pending_submissions++;
+	}
+	queue->pendingSubmissions.push_back(std::move(submission));
+	// If the queue is blocked, it will be looked at again once that is signalled.
+	if (!queue->blocked)
+	{
+		std::vector<cVkQueue*> ready { queue };
+		retire_ready_queues(queue->device, ready);
+	}
+}
+
+/// Signal a fence from the host side, outside of any queue submission.
+static void signal_fence(cVkDevice* device, cVkFence* fence)
+{
+	std::lock_guard<std::mutex> lock(device->sync_mutex);
+	fence->signalled.store(true);
+	device->sync_cond.notify_all();
+}
+
+/// Block until pred() is true or the timeout (in nanoseconds) has passed. Must be called with
+/// the device's sync_mutex held. Returns the final value of pred().
+template<typename Pred>
+static bool wait_on_device(cVkDevice* device, std::unique_lock<std::mutex>& lock, uint64_t timeout, Pred pred)
+{
+	if (pred()) return true;
+	if (timeout == 0) return false;
+	if (timeout == UINT64_MAX)
+	{
+		device->sync_cond.wait(lock, pred);
+		return true;
+	}
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::nanoseconds(std::min<uint64_t>(timeout, INT64_MAX / 2));
+	return device->sync_cond.wait_until(lock, deadline, pred);
 }
 
 VKAPI_ATTR VkResult VKAPI_CALL vkQueueSubmit(
@@ -1302,7 +1734,7 @@ VKAPI_ATTR VkResult VKAPI_CALL vkQueueSubmit(
 
 		for (unsigned j = 0; j < pSubmits[i].commandBufferCount; j++)
 		{
-			internalQueueSubmit(q, pSubmits[i].pCommandBuffers[j]);
+			internalQueueSubmit(q, submission, pSubmits[i].pCommandBuffers[j]);
 		}
 
 		// Signal execution complete
@@ -1322,7 +1754,7 @@ VKAPI_ATTR VkResult VKAPI_CALL vkQueueSubmit(
 		enqueue_submission(q, submission);
 	}
 
-	if (submitCount == 0 && submit_fence) submit_fence->signalled.store(true);
+	if (submitCount == 0 && submit_fence) signal_fence(device, submit_fence);
 
 	return VK_SUCCESS;
 }
@@ -1333,7 +1765,8 @@ VKAPI_ATTR VkResult VKAPI_CALL vkQueueWaitIdle(
 	ENTRY(vkQueueWaitIdle);
 	CLOG("queue=%p", queue);
 	cVkQueue* q = queue_cast(queue);
-	retire_pending_submissions(q->device);
+	std::unique_lock<std::mutex> lock(q->device->sync_mutex);
+	if (async_queues) wait_on_device(q->device, lock, UINT64_MAX, [q]() { return q->pendingSubmissions.empty(); });
 	assert(q->pendingSubmissions.empty());
 	return VK_SUCCESS;
 }
@@ -1344,8 +1777,10 @@ VKAPI_ATTR VkResult VKAPI_CALL vkDeviceWaitIdle(
 	ENTRY(vkDeviceWaitIdle);
 	CLOG("device=%p", device);
 	cVkDevice* dev = device_cast(device);
-	retire_pending_submissions(dev);
-	for (const cVkQueue& queue : dev->queues) assert(queue.pendingSubmissions.empty());
+	std::unique_lock<std::mutex> lock(dev->sync_mutex);
+	auto idle = [dev]() { return std::all_of(dev->queues.begin(), dev->queues.end(), [](const cVkQueue& queue) { return queue.pendingSubmissions.empty(); }); };
+	if (async_queues) wait_on_device(dev, lock, UINT64_MAX, idle);
+	assert(idle());
 	return VK_SUCCESS;
 }
 
@@ -1365,22 +1800,32 @@ VKAPI_ATTR VkResult VKAPI_CALL vkAllocateMemory(
 	memory.allocationSize = pAllocateInfo->allocationSize;
 	memory.memoryTypeIndex = pAllocateInfo->memoryTypeIndex;
 	memory.heapIndex = dev->memory_type_heap_index[pAllocateInfo->memoryTypeIndex];
-	const int ret = posix_memalign((void**)&memory.ptr, 4096, memory.allocationSize);
-	if (ret != 0)
+	if (!reserve_heap_memory(dev->physical, memory.heapIndex, memory.allocationSize))
+	{
+		report_device_memory(dev, &memory, VK_NULL_HANDLE, VK_DEVICE_MEMORY_REPORT_EVENT_TYPE_ALLOCATION_FAILED_EXT);
+		return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+	}
+	memory.ptr = device_memory_alloc(memory.memoryTypeIndex, memory.allocationSize);
+	if (!memory.ptr)
 	{
-		memory.ptr = nullptr;
+		release_heap_memory(dev->physical, memory.heapIndex, memory.allocationSize);
+		report_device_memory(dev, &memory, VK_NULL_HANDLE, VK_DEVICE_MEMORY_REPORT_EVENT_TYPE_ALLOCATION_FAILED_EXT);
 		return VK_ERROR_OUT_OF_HOST_MEMORY;
 	}
-	dev->deviceMemory.push_back(memory);
-#ifndef FAST
-	dev->memory_allocated[memory.memoryTypeIndex] += memory.allocationSize;
+	cVkDeviceMemory& stored = dev->deviceMemory.emplace(memory);
+	const uint64_t allocated = dev->memory_allocated[memory.memoryTypeIndex].fetch_add(memory.allocationSize, std::memory_order_relaxed) + memory.allocationSize;
 	// did we reach a new allocation record for this memory type?
-	dev->memory_highest[memory.memoryTypeIndex] = std::max(dev->memory_highest[memory.memoryTypeIndex], dev->memory_allocated[memory.memoryTypeIndex]);
+	uint64_t highest = dev->memory_highest[memory.memoryTypeIndex].load(std::memory_order_relaxed);
+	while (allocated > highest && !dev->memory_highest[memory.memoryTypeIndex].compare_exchange_weak(highest, allocated, std::memory_order_relaxed)) {}
+#ifndef FAST
+	frame_metrics_add(FRAME_METRIC_ALLOCATIONS, 1);
+	frame_metrics_add(FRAME_METRIC_ALLOCATED_BYTES, memory.allocationSize);
+	frame_metrics_object(VK_OBJECT_TYPE_DEVICE_MEMORY, 1);
 #endif
 	VkMemoryDedicatedAllocateInfo* mda = (VkMemoryDedicatedAllocateInfo*)find_extension(pAllocateInfo, VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO);
 	(void)mda; // ignored for now
-	*pMemory = reinterpret_cast<VkDeviceMemory>(&dev->deviceMemory.back());
-	report_device_memory(dev, &dev->deviceMemory.back(), *pMemory, VK_DEVICE_MEMORY_REPORT_EVENT_TYPE_ALLOCATE_EXT);
+	*pMemory = reinterpret_cast<VkDeviceMemory>(&stored);
+	report_device_memory(dev, &stored, *pMemory, VK_DEVICE_MEMORY_REPORT_EVENT_TYPE_ALLOCATE_EXT);
 	return VK_SUCCESS;
 }
 
@@ -1394,15 +1839,18 @@ VKAPI_ATTR void VKAPI_CALL vkFreeMemory(
 
 	cVkDevice* dev = device_cast(device);
 	auto* mem = destroy<cVkDeviceMemory, VkDeviceMemory>(memory, pAllocator);
+	if (!mem) return;
 	report_device_memory(dev, mem, memory, VK_DEVICE_MEMORY_REPORT_EVENT_TYPE_FREE_EXT);
-	if (mem && !store_allocations)
-	{
-		free(mem->ptr);
-		mem->ptr = nullptr;
 #ifndef FAST
-		dev->memory_allocated[mem->memoryTypeIndex] -= mem->allocationSize;
-		assert(dev->memory_allocated[mem->memoryTypeIndex] >= 0);
+	dirty_tracking_free(mem, mem->destroyed_frame);
 #endif
+	// Stored allocations keep their contents for dumping, but no longer count against the heap
+	dev->memory_allocated[mem->memoryTypeIndex].fetch_sub(mem->allocationSize, std::memory_order_relaxed);
+	release_heap_memory(dev->physical, mem->heapIndex, mem->allocationSize);
+	if (!store_allocations)
+	{
+		device_memory_free(mem->memoryTypeIndex, mem->ptr, mem->allocationSize);
+		mem->ptr = nullptr;
 	}
 }
 
@@ -1422,6 +1870,9 @@ VKAPI_ATTR VkResult VKAPI_CALL vkMapMemory(
 	cVkDeviceMemory* mem = devicememory_cast(memory);
 	*ppData = mem->ptr + offset;
 	mem->mapped = true;
+#ifndef FAST
+	dirty_tracking_map(mem);
+#endif
 	return VK_SUCCESS;
 }
 
@@ -1655,7 +2106,7 @@ VKAPI_ATTR VkResult VKAPI_CALL vkQueueBindSparse(
 		if (i + 1 == bindInfoCount) submission.fence = cfence;
 		enqueue_submission(q, submission);
 	}
-	if (bindInfoCount == 0 && cfence) cfence->signalled.store(true);
+	if (bindInfoCount == 0 && cfence) signal_fence(device, cfence);
 	return VK_SUCCESS;
 }
 
@@ -1743,27 +2194,19 @@ VKAPI_ATTR VkResult VKAPI_CALL vkWaitForFences(
 	CLOG("device=%p, fenceCount=%u, pFences=%p, waitAll=%s, timeout=%llu", device, fenceCount, pFences, bool2str(waitAll), (unsigned long long)timeout);
 
 	cVkDevice* dev = device_cast(device);
+	std::vector<cVkFence*> fences(fenceCount);
 	for (unsigned i = 0; i < fenceCount; i++)
 	{
-		cVkFence* fence = fence_cast(pFences[i]);
-
-		while (!fence_is_signalled(fence) && timeout)
-		{
-			retire_pending_submissions(dev);
-			timeout--;
-		}
-		if (!fence_is_signalled(fence))
-		{
-			return VK_TIMEOUT;
-		}
-
-		if (!waitAll)
-		{
-			return VK_SUCCESS;
-		}
+		fences[i] = fence_cast(pFences[i]);
 	}
+	auto done = [&]()
+	{
+		if (waitAll) return std::all_of(fences.cbegin(), fences.cend(), fence_is_signalled);
+		return std::any_of(fences.cbegin(), fences.cend(), fence_is_signalled);
+	};
 
-	return VK_SUCCESS;
+	std::unique_lock<std::mutex> lock(dev->sync_mutex);
+	return wait_on_device(dev, lock, timeout, done) ? VK_SUCCESS : VK_TIMEOUT;
 }
 
 VKAPI_ATTR VkResult VKAPI_CALL vkCreateSemaphore(
@@ -2033,7 +2476,7 @@ VKAPI_ATTR VkResult VKAPI_CALL vkCreateImage(
 	p.usage = pCreateInfo->usage;
 	p.sharingMode = pCreateInfo->sharingMode;
 	p.initialLayout = pCreateInfo->initialLayout;
-	p.size = (VkDeviceSize)p.extent.width * p.extent.height * p.arrayLayers * p.samples * 4u;
+	p.size = image_size(p.format, p.extent, p.mipLevels, p.arrayLayers) * p.samples;
 	if (p.sharingMode == VK_SHARING_MODE_CONCURRENT)
 	{
 		p.queueFamilyIndices.resize(pCreateInfo->queueFamilyIndexCount);
@@ -2069,19 +2512,7 @@ VKAPI_ATTR void VKAPI_CALL vkGetImageSubresourceLayout(
 	cVkDevice* dev = device_cast(device);
 	cVkImage* img = image_cast(image);
 
-	pLayout->offset = img->memoryOffset;
-	if (img->memory)
-	{
-		pLayout->size = img->memory->allocationSize;
-	}
-	else
-	{
-		// 4 * 4 = 32-bit/sample with RGBA channels
-		pLayout->size = img->extent.width * img->extent.height * img->extent.depth * 4 * 4;
-	}
-	pLayout->rowPitch = img->extent.width * 4;
-	pLayout->depthPitch = pLayout->rowPitch * img->extent.height;
-	pLayout->arrayPitch = pLayout->depthPitch * img->extent.depth;
+	*pLayout = image_subresource_layout(img->format, img->extent, img->arrayLayers, pSubresource->mipLevel, pSubresource->arrayLayer);
 }
 
 VKAPI_ATTR VkResult VKAPI_CALL vkCreateImageView(
@@ -2098,6 +2529,7 @@ VKAPI_ATTR VkResult VKAPI_CALL vkCreateImageView(
 	cVkImageView& p = owner_create<cVkImageView, VkImageView>(dev->imageViews, pView, pAllocator);
 	p.flags = pCreateInfo->flags;
 	p.image = image_cast(pCreateInfo->image);
+	if (p.image) hold(p.image, 1); // see cVkDescriptorSet::log_usage()
 	p.viewType = pCreateInfo->viewType;
 	p.format = pCreateInfo->format;
 	p.components = pCreateInfo->components;
@@ -2250,7 +2682,8 @@ VKAPI_ATTR VkResult VKAPI_CALL vkCreateGraphicsPipelines(
 		cVkPipeline& p = owner_create<cVkPipeline, VkPipeline>(dev->pipelines, &pPipelines[i], pAllocator);
 		if (cache)
 		{
-			cache->pipelines[&dev->pipelines.back()] = true;
+			std::lock_guard<std::mutex> lock(cache->pipelines_mutex);
+			cache->pipelines[&p] = true;
 			p.cache = cache;
 		}
 		p.flags = pCreateInfos[i].flags;
@@ -2375,6 +2808,11 @@ VKAPI_ATTR VkResult VKAPI_CALL vkCreateGraphicsPipelines(
 		p.layout = pipelinelayout_cast(pCreateInfos[i].layout);
 		p.renderPass = renderpass_cast(pCreateInfos[i].renderPass);
 		p.subpass = pCreateInfos[i].subpass;
+#ifndef FAST
+		// The touch in owner_create() came before the stages were set up, and further touches
+		// in this frame and thread return early, so propagate usage to the shader modules here
+		p.log_usage();
+#endif
 	}
 	return VK_SUCCESS;
 }
@@ -2398,7 +2836,8 @@ VKAPI_ATTR VkResult VKAPI_CALL vkCreateComputePipelines(
 		cVkPipeline& p = owner_create<cVkPipeline, VkPipeline>(dev->pipelines, &pPipelines[i], pAllocator);
 		if (cache)
 		{
-			cache->pipelines[&dev->pipelines.back()] = true;
+			std::lock_guard<std::mutex> lock(cache->pipelines_mutex);
+			cache->pipelines[&p] = true;
 			p.cache = cache;
 		}
 		p.flags = pCreateInfos[i].flags;
@@ -2431,6 +2870,9 @@ VKAPI_ATTR VkResult VKAPI_CALL vkCreateComputePipelines(
 				p.stages[0].specializationMap.push_back(pCreateInfos[i].stage.pSpecializationInfo->pMapEntries[k]);
 			}
 		}
+#ifndef FAST
+		p.log_usage(); // see vkCreateGraphicsPipelines
+#endif
 	}
 	return VK_SUCCESS;
 }
@@ -2457,6 +2899,7 @@ VKAPI_ATTR void VKAPI_CALL vkDestroyPipeline(
 	}
 	if (pipe && pipe->cache)
 	{
+		std::lock_guard<std::mutex> lock(pipe->cache->pipelines_mutex);
 		pipe->cache->pipelines[pipe] = false;
 	}
 	destroy<cVkPipeline, VkPipeline>(pipeline, pAllocator);
@@ -2556,6 +2999,9 @@ VKAPI_ATTR VkResult VKAPI_CALL vkCreateDescriptorSetLayout(
 			}
 		}
 	}
+#ifndef FAST
+	p.log_usage(); // see vkCreateGraphicsPipelines
+#endif
 	return VK_SUCCESS;
 }
 
@@ -2599,6 +3045,13 @@ VKAPI_ATTR void VKAPI_CALL vkDestroyDescriptorPool(
 	CLOG("device=%p, descriptorPool=" NHANDLE ", pAllocator=%p", device, descriptorPool, pAllocator);
 
 	cVkDevice* dev = device_cast(device);
+	cVkDescriptorPool* pool = descriptorpool_cast(descriptorPool);
+	if (!pool) return;
+	// Sets that are still allocated go away with their pool
+	for (auto& set : pool->sets)
+	{
+		if (!set.destroyed) destroy_descriptor_set(&set);
+	}
 	destroy<cVkDescriptorPool, VkDescriptorPool>(descriptorPool, pAllocator);
 }
 
@@ -2614,7 +3067,7 @@ VKAPI_ATTR VkResult VKAPI_CALL vkResetDescriptorPool(
 	cVkDescriptorPool* pool = descriptorpool_cast(descriptorPool);
 	for (auto& set : pool->sets)
 	{
-		destroy<cVkDescriptorSet, VkDescriptorSet>(reinterpret_cast<VkDescriptorSet>(&set), nullptr);
+		destroy_descriptor_set(&set);
 	}
 	pool->sets.clear();
 	return VK_SUCCESS;
@@ -2637,10 +3090,7 @@ VKAPI_ATTR VkResult VKAPI_CALL vkAllocateDescriptorSets(
 		pDescriptorSets[i] = 0;
 		cVkDescriptorSetLayout* wanted_layout = descriptorsetlayout_cast(pAllocateInfo->pSetLayouts[i]);
 		cVkDescriptorSet& set = owner_create<cVkDescriptorSet, VkDescriptorSet>(pool->sets, &pDescriptorSets[i], nullptr);
-		set.layout = wanted_layout;
-
-		// This is not spec specific, we use a copy of the layout to track the current values of the descriptor set
-		set.state_bindings = wanted_layout->bindings;
+		set.set_layout(wanted_layout);
 	}
 	return VK_SUCCESS;
 }
@@ -2657,7 +3107,18 @@ VKAPI_ATTR VkResult VKAPI_CALL vkFreeDescriptorSets(
 	cVkDevice* dev = device_cast(device);
 	for (unsigned i = 0; i < descriptorSetCount; i++)
 	{
-		destroy<cVkDescriptorSet, VkDescriptorSet>(pDescriptorSets[i], nullptr);
+		destroy_descriptor_set(reinterpret_cast<cVkDescriptorSet*>(pDescriptorSets[i]));
+	}
+	if (reclaim_frames > 0)
+	{
+		// the application must synchronize access to the pool here, so this is a safe place to free sets
+		cVkDescriptorPool* pool = descriptorpool_cast(descriptorPool);
+		pool->sets.remove_if([pool](cVkDescriptorSet& set)
+		{
+			if (!reclaimable(set)) return false;
+			set.update(pool);
+			return true;
+		});
 	}
 	return VK_SUCCESS;
 }
@@ -2864,6 +3325,18 @@ VKAPI_ATTR void VKAPI_CALL vkDestroyCommandPool(
 	CLOG("device=%p, commandPool=" NHANDLE ", pAllocator=%p", device, commandPool, pAllocator);
 
 	cVkDevice* dev = device_cast(device);
+	cVkCommandPool* pool = commandpool_cast(commandPool);
+	if (!pool) return;
+	// Command buffers that are still allocated go away with their pool, see vkFreeCommandBuffers
+	for (auto& cmdbuf : pool->commandBuffers)
+	{
+		if (cmdbuf.destroyed) continue;
+#ifndef FAST
+		frame_metrics_object(VK_OBJECT_TYPE_COMMAND_BUFFER, -1);
+#endif
+		cmdbuf.destroyed = true;
+		cmdbuf.destroyed_frame = cmdbuf.current_frame;
+	}
 	destroy<cVkCommandPool, VkCommandPool>(commandPool, pAllocator);
 }
 
@@ -2908,6 +3381,9 @@ VKAPI_ATTR VkResult VKAPI_CALL vkAllocateCommandBuffers(
 		buffer.level = pAllocateInfo->level;
 		pool->commandBuffers.push_back(buffer);
 		pCommandBuffers[i] = reinterpret_cast<VkCommandBuffer>(&pool->commandBuffers.back());
+#ifndef FAST
+		frame_metrics_object(VK_OBJECT_TYPE_COMMAND_BUFFER, 1);
+#endif
 	}
 	return VK_SUCCESS;
 }
@@ -2925,6 +3401,9 @@ VKAPI_ATTR void VKAPI_CALL vkFreeCommandBuffers(
 	for (unsigned i = 0; i < commandBufferCount; i++)
 	{
 		cVkCommandBuffer* buffer = commandbuffer_cast(pCommandBuffers[i]);
+#ifndef FAST
+		if (!buffer->destroyed) frame_metrics_object(VK_OBJECT_TYPE_COMMAND_BUFFER, -1);
+#endif
 		buffer->destroyed = true;
 	}
 }
@@ -2938,7 +3417,7 @@ VKAPI_ATTR VkResult VKAPI_CALL vkBeginCommandBuffer(
 	cVkCommandBuffer* buffer = commandbuffer_cast(commandBuffer);
 	assert(buffer->state != cVkCommandBuffer::Recording);
 	assert(buffer->state != cVkCommandBuffer::Pending);
-	reset_command_buffer(buffer, true);
+	reset_command_buffer(buffer, false);
 	buffer->flags = pBeginInfo->flags;
 	buffer->state = cVkCommandBuffer::Recording;
 	if (pBeginInfo->pInheritanceInfo)
@@ -2990,7 +3469,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdBindPipeline(
 
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdBindPipeline, commandBuffer, MetricUnit(1));
 	p->currently_bound_pipeline = pipeline_cast(pipeline);
-	p->commands.back().bindings.push_back(pipeline_cast(pipeline));
+	p->commands.bind(pipeline_cast(pipeline));
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdSetViewport(
@@ -3108,10 +3587,10 @@ VKAPI_ATTR void VKAPI_CALL vkCmdBindDescriptorSets(
 	       commandBuffer, pipelineBindPoint, layout, firstSet, descriptorSetCount, pDescriptorSets, dynamicOffsetCount, pDynamicOffsets);
 
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdBindDescriptorSets, commandBuffer, MetricUnit(1, descriptorSetCount, dynamicOffsetCount));
-	p->commands.back().bindings.push_back(pipelinelayout_cast(layout));
+	p->commands.bind(pipelinelayout_cast(layout));
 	for (unsigned i = 0; i < descriptorSetCount; i++)
 	{
-		p->commands.back().bindings.push_back(descriptorset_cast(pDescriptorSets[i]));
+		p->commands.bind(descriptorset_cast(pDescriptorSets[i]));
 	}
 }
 
@@ -3125,7 +3604,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdBindIndexBuffer(
 	CMDLOG("commandBuffer=%p, buffer=" NHANDLE ", offset=%llu, indexType=%u", commandBuffer, buffer, (unsigned long long)offset, indexType);
 
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdBindIndexBuffer, commandBuffer, MetricUnit(1));
-	p->commands.back().bindings.push_back(buffer_cast(buffer));
+	p->commands.bind(buffer_cast(buffer));
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdBindVertexBuffers(
@@ -3141,7 +3620,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdBindVertexBuffers(
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdBindVertexBuffers, commandBuffer, MetricUnit(1, bindingCount));
 	for (unsigned i = 0; i < bindingCount; i++)
 	{
-		p->commands.back().bindings.push_back(buffer_cast(pBuffers[i]));
+		p->commands.bind(buffer_cast(pBuffers[i]));
 	}
 }
 
@@ -3242,25 +3721,53 @@ VKAPI_ATTR void VKAPI_CALL vkCmdDrawIndexed(
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdDrawIndexed, commandBuffer, MetricUnit(1, 1, indexCount, instanceCount, get_primitive_count(commandBuffer, indexCount)));
 }
 
-static MetricUnit indirect_draw(
-    VkCommandBuffer                             commandBuffer,
-    cVkBuffer*                                  pbuf,
-    VkDeviceSize                                offset,
-    uint32_t                                    drawCount,
-    uint32_t                                    stride)
+/// Estimate the work of an indirect draw for the per-command buffer statistics, from the parameters
+/// in the buffers when it is recorded. The work that is actually done is counted when it is executed.
+static MetricUnit indirect_draw_estimate(VkCommandBuffer commandBuffer, const cVkBuffer* pbuf, VkDeviceSize offset, const cVkBuffer* cbuf, VkDeviceSize countBufferOffset, uint32_t drawCount, uint32_t stride, bool indexed)
 {
-	assert(drawCount <= 1 || stride >= sizeof(VkDrawIndirectCommand));
+#ifndef FAST
+	if (!pbuf->memory || (cbuf && !cbuf->memory)) return MetricUnit(1);
+	if (cbuf)
+	{
+		const char* count = cbuf->memory->ptr + cbuf->memoryOffset + countBufferOffset;
+		drawCount = std::min(*reinterpret_cast<const uint32_t*>(count), drawCount);
+	}
 	const char* ptr = pbuf->memory->ptr + pbuf->memoryOffset + offset;
-	int instance_count = 0;
-	int vertex_count = 0;
-	for (unsigned i = 0; i < drawCount; i++)
+	long vertices = 0;
+	long instances = 0;
+	for (unsigned i = 0; i < drawCount; i++, ptr += stride)
 	{
-		VkDrawIndirectCommand* params = (VkDrawIndirectCommand*)ptr;
-		vertex_count += params->vertexCount;
-		instance_count += params->instanceCount;
-		ptr += stride;
+		if (indexed)
+		{
+			const VkDrawIndexedIndirectCommand* params = reinterpret_cast<const VkDrawIndexedIndirectCommand*>(ptr);
+			vertices += params->indexCount;
+			instances += params->instanceCount;
+		}
+		else
+		{
+			const VkDrawIndirectCommand* params = reinterpret_cast<const VkDrawIndirectCommand*>(ptr);
+			vertices += params->vertexCount;
+			instances += params->instanceCount;
+		}
 	}
-	return MetricUnit(1, drawCount, vertex_count, instance_count, get_primitive_count(commandBuffer, vertex_count));
+	return MetricUnit(1, drawCount, vertices, instances, get_primitive_count(commandBuffer, vertices));
+#else
+	return MetricUnit(1);
+#endif
+}
+
+/// Record where the parameters of an indirect draw or dispatch are, to be read when it is executed
+static void indirect_payload(cVkCommandBuffer* p, cVkBuffer* pbuf, VkDeviceSize offset, cVkBuffer* cbuf, VkDeviceSize countBufferOffset, uint32_t drawCount, uint32_t stride)
+{
+	p->commands.bind(pbuf);
+	if (cbuf) p->commands.bind(cbuf);
+	cVkPayloadIndirect* payload = p->commands.payload<cVkPayloadIndirect>();
+	payload->buffer = pbuf;
+	payload->offset = offset;
+	payload->countBuffer = cbuf;
+	payload->countBufferOffset = countBufferOffset;
+	payload->drawCount = drawCount;
+	payload->stride = stride;
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdDrawIndirect(
@@ -3273,31 +3780,10 @@ VKAPI_ATTR void VKAPI_CALL vkCmdDrawIndirect(
 	ENTRY(vkCmdDrawIndirect);
 	CMDLOG("commandBuffer=%p, buffer=" NHANDLE ", offset=%llu, drawCount=%u, stride=%u", commandBuffer, buffer, (unsigned long long)offset, drawCount, stride);
 
-	// TBD - move counting into command buffer implementation, since buffer contents could change
 	cVkBuffer* pbuf = buffer_cast(buffer);
-	cVkCommandBuffer* p = commandbuffer_command(vkCmdDrawIndirect, commandBuffer, indirect_draw(commandBuffer, pbuf, offset, drawCount, stride));
-	p->commands.back().bindings.push_back(pbuf);
-}
-
-static MetricUnit indirect_draw_indexed(
-    VkCommandBuffer                             commandBuffer,
-    cVkBuffer*                                  pbuf,
-    VkDeviceSize                                offset,
-    uint32_t                                    drawCount,
-    uint32_t                                    stride)
-{
-	assert(drawCount <= 1 || stride >= sizeof(VkDrawIndexedIndirectCommand));
-	const char* ptr = pbuf->memory->ptr + pbuf->memoryOffset + offset;;
-	int instance_count = 0;
-	int index_count = 0;
-	for (unsigned i = 0; i < drawCount; i++)
-	{
-		VkDrawIndexedIndirectCommand* params = (VkDrawIndexedIndirectCommand*)ptr;
-		instance_count += params->instanceCount;
-		index_count += params->indexCount;
-		ptr += stride;
-	}
-	return MetricUnit(1, drawCount, index_count, instance_count, get_primitive_count(commandBuffer, index_count));
+	const MetricUnit estimate = indirect_draw_estimate(commandBuffer, pbuf, offset, nullptr, 0, drawCount, stride, false);
+	cVkCommandBuffer* p = commandbuffer_command(vkCmdDrawIndirect, commandBuffer, estimate);
+	indirect_payload(p, pbuf, offset, nullptr, 0, drawCount, stride);
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdDrawIndexedIndirect(
@@ -3310,10 +3796,10 @@ VKAPI_ATTR void VKAPI_CALL vkCmdDrawIndexedIndirect(
 	ENTRY(vkCmdDrawIndexedIndirect);
 	CMDLOG("commandBuffer=%p, buffer=" NHANDLE ", offset=%llu, drawCount=%u, stride=%u", commandBuffer, buffer, (unsigned long long)offset, drawCount, stride);
 
-	// TBD - move counting into command buffer implementation, since buffer contents could change
 	cVkBuffer* pbuf = buffer_cast(buffer);
-	cVkCommandBuffer* p = commandbuffer_command(vkCmdDrawIndexedIndirect, commandBuffer, indirect_draw_indexed(commandBuffer, pbuf, offset, drawCount, stride));
-	p->commands.back().bindings.push_back(pbuf);
+	const MetricUnit estimate = indirect_draw_estimate(commandBuffer, pbuf, offset, nullptr, 0, drawCount, stride, true);
+	cVkCommandBuffer* p = commandbuffer_command(vkCmdDrawIndexedIndirect, commandBuffer, estimate);
+	indirect_payload(p, pbuf, offset, nullptr, 0, drawCount, stride);
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdDispatch(
@@ -3325,7 +3811,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdDispatch(
 	ENTRY(vkCmdDispatch);
 	CMDLOG("commandBuffer=%p, x=%u, y=%u, z=%u", commandBuffer, x, y, z);
 
-	cVkCommandBuffer* p = commandbuffer_command(vkCmdDispatch, commandBuffer, MetricUnit(1));
+	cVkCommandBuffer* p = commandbuffer_command(vkCmdDispatch, commandBuffer, MetricUnit(1, 1, (long)x * y * z));
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdDispatchIndirect(
@@ -3336,11 +3822,17 @@ VKAPI_ATTR void VKAPI_CALL vkCmdDispatchIndirect(
 	ENTRY(vkCmdDispatchIndirect);
 	CMDLOG("commandBuffer=%p, buffer=" NHANDLE ", offset=%llu", commandBuffer, buffer, (unsigned long long)offset);
 
-	cVkCommandBuffer* p = commandbuffer_command(vkCmdDispatchIndirect, commandBuffer, MetricUnit(1));
-	cVkBuffer* cbuf = buffer_cast(buffer);
-	p->commands.back().bindings.push_back(cbuf);
-	const char* ptr = cbuf->memory->ptr + cbuf->memoryOffset + offset;;
-	const VkDispatchIndirectCommand* params = (VkDispatchIndirectCommand*)ptr; // contains x, y, z
+	cVkBuffer* pbuf = buffer_cast(buffer);
+	MetricUnit estimate(1); // as for indirect draws, the actual work is counted when executed
+#ifndef FAST
+	if (pbuf->memory)
+	{
+		const VkDispatchIndirectCommand* params = reinterpret_cast<const VkDispatchIndirectCommand*>(pbuf->memory->ptr + pbuf->memoryOffset + offset);
+		estimate = MetricUnit(1, 1, (long)params->x * params->y * params->z);
+	}
+#endif
+	cVkCommandBuffer* p = commandbuffer_command(vkCmdDispatchIndirect, commandBuffer, estimate);
+	indirect_payload(p, pbuf, offset, nullptr, 0, 1, sizeof(VkDispatchIndirectCommand));
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdCopyBuffer(
@@ -3357,13 +3849,103 @@ VKAPI_ATTR void VKAPI_CALL vkCmdCopyBuffer(
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdCopyBuffer, commandBuffer, MetricUnit(1, regionCount));
 	cVkBuffer* src = buffer_cast(srcBuffer);
 	cVkBuffer* dst = buffer_cast(dstBuffer);
-	p->commands.back().bindings.push_back(src);
-	p->commands.back().bindings.push_back(dst);
-	cVkPayloadCopyBuffer* payload = new cVkPayloadCopyBuffer;
+	p->commands.bind(src);
+	p->commands.bind(dst);
+	cVkPayloadCopyBuffer* payload = p->commands.payload<cVkPayloadCopyBuffer>(regionCount * sizeof(VkBufferCopy));
 	payload->srcBuffer = src;
 	payload->dstBuffer = dst;
-	payload->regions.assign(pRegions, pRegions + regionCount);
-	p->commands.back().payload = payload;
+	payload->regionCount = regionCount;
+	memcpy(payload->regions(), pRegions, regionCount * sizeof(VkBufferCopy));
+}
+
+static cVkPayloadCopyImage* record_copy_image(cVkCommandBuffer* p, VkImage srcImage, VkImage dstImage, uint32_t regionCount)
+{
+	cVkImage* src = image_cast(srcImage);
+	cVkImage* dst = image_cast(dstImage);
+	p->commands.bind(src);
+	p->commands.bind(dst);
+	cVkPayloadCopyImage* payload = p->commands.payload<cVkPayloadCopyImage>(regionCount * sizeof(VkImageCopy));
+	payload->srcImage = src;
+	payload->dstImage = dst;
+	payload->regionCount = regionCount;
+	return payload;
+}
+
+static cVkPayloadCopyBufferImage* record_copy_buffer_image(cVkCommandBuffer* p, cVkBuffer* buffer, cVkImage* image, uint32_t regionCount)
+{
+	cVkPayloadCopyBufferImage* payload = p->commands.payload<cVkPayloadCopyBufferImage>(regionCount * sizeof(VkBufferImageCopy));
+	payload->buffer = buffer;
+	payload->image = image;
+	payload->regionCount = regionCount;
+	return payload;
+}
+
+static cVkPayloadBlitImage* record_blit_image(cVkCommandBuffer* p, VkImage srcImage, VkImage dstImage, uint32_t regionCount, VkFilter filter)
+{
+	cVkImage* src = image_cast(srcImage);
+	cVkImage* dst = image_cast(dstImage);
+	p->commands.bind(src);
+	p->commands.bind(dst);
+	cVkPayloadBlitImage* payload = p->commands.payload<cVkPayloadBlitImage>(regionCount * sizeof(VkImageBlit));
+	payload->srcImage = src;
+	payload->dstImage = dst;
+	payload->filter = filter;
+	payload->regionCount = regionCount;
+	return payload;
+}
+
+static void record_copy_image2(cVkCommandBuffer* p, const VkCopyImageInfo2* pCopyImageInfo)
+{
+	cVkPayloadCopyImage* payload = record_copy_image(p, pCopyImageInfo->srcImage, pCopyImageInfo->dstImage, pCopyImageInfo->regionCount);
+	for (uint32_t i = 0; i < pCopyImageInfo->regionCount; i++)
+	{
+		const VkImageCopy2& r = pCopyImageInfo->pRegions[i];
+		payload->regions()[i] = { r.srcSubresource, r.srcOffset, r.dstSubresource, r.dstOffset, r.extent };
+	}
+}
+
+static void record_copy_buffer_to_image2(cVkCommandBuffer* p, const VkCopyBufferToImageInfo2* pCopyBufferToImageInfo)
+{
+	cVkBuffer* src = buffer_cast(pCopyBufferToImageInfo->srcBuffer);
+	cVkImage* dst = image_cast(pCopyBufferToImageInfo->dstImage);
+	p->commands.bind(src);
+	p->commands.bind(dst);
+	cVkPayloadCopyBufferImage* payload = record_copy_buffer_image(p, src, dst, pCopyBufferToImageInfo->regionCount);
+	for (uint32_t i = 0; i < pCopyBufferToImageInfo->regionCount; i++)
+	{
+		const VkBufferImageCopy2& r = pCopyBufferToImageInfo->pRegions[i];
+		payload->regions()[i] = { r.bufferOffset, r.bufferRowLength, r.bufferImageHeight, r.imageSubresource, r.imageOffset, r.imageExtent };
+	}
+}
+
+static void record_copy_image_to_buffer2(cVkCommandBuffer* p, const VkCopyImageToBufferInfo2* pCopyImageToBufferInfo)
+{
+	cVkImage* src = image_cast(pCopyImageToBufferInfo->srcImage);
+	cVkBuffer* dst = buffer_cast(pCopyImageToBufferInfo->dstBuffer);
+	p->commands.bind(src);
+	p->commands.bind(dst);
+	cVkPayloadCopyBufferImage* payload = record_copy_buffer_image(p, dst, src, pCopyImageToBufferInfo->regionCount);
+	for (uint32_t i = 0; i < pCopyImageToBufferInfo->regionCount; i++)
+	{
+		const VkBufferImageCopy2& r = pCopyImageToBufferInfo->pRegions[i];
+		payload->regions()[i] = { r.bufferOffset, r.bufferRowLength, r.bufferImageHeight, r.imageSubresource, r.imageOffset, r.imageExtent };
+	}
+}
+
+static void record_blit_image2(cVkCommandBuffer* p, const VkBlitImageInfo2* pBlitImageInfo)
+{
+	cVkPayloadBlitImage* payload = record_blit_image(p, pBlitImageInfo->srcImage, pBlitImageInfo->dstImage, pBlitImageInfo->regionCount, pBlitImageInfo->filter);
+	for (uint32_t i = 0; i < pBlitImageInfo->regionCount; i++)
+	{
+		const VkImageBlit2& r = pBlitImageInfo->pRegions[i];
+		VkImageBlit& region = payload->regions()[i];
+		region.srcSubresource = r.srcSubresource;
+		region.srcOffsets[0] = r.srcOffsets[0];
+		region.srcOffsets[1] = r.srcOffsets[1];
+		region.dstSubresource = r.dstSubresource;
+		region.dstOffsets[0] = r.dstOffsets[0];
+		region.dstOffsets[1] = r.dstOffsets[1];
+	}
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdCopyImage(
@@ -3380,8 +3962,8 @@ VKAPI_ATTR void VKAPI_CALL vkCmdCopyImage(
 	       commandBuffer, srcImage, srcImageLayout, dstImage, dstImageLayout, regionCount, pRegions);
 
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdCopyImage, commandBuffer, MetricUnit(1, regionCount));
-	p->commands.back().bindings.push_back(image_cast(srcImage));
-	p->commands.back().bindings.push_back(image_cast(dstImage));
+	cVkPayloadCopyImage* payload = record_copy_image(p, srcImage, dstImage, regionCount);
+	memcpy(payload->regions(), pRegions, regionCount * sizeof(VkImageCopy));
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdBlitImage(
@@ -3399,8 +3981,8 @@ VKAPI_ATTR void VKAPI_CALL vkCmdBlitImage(
 	       commandBuffer, srcImage, srcImageLayout, dstImage, dstImageLayout, regionCount, pRegions, filter);
 
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdBlitImage, commandBuffer, MetricUnit(1, regionCount));
-	p->commands.back().bindings.push_back(image_cast(srcImage));
-	p->commands.back().bindings.push_back(image_cast(dstImage));
+	cVkPayloadBlitImage* payload = record_blit_image(p, srcImage, dstImage, regionCount, filter);
+	memcpy(payload->regions(), pRegions, regionCount * sizeof(VkImageBlit));
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdCopyBufferToImage(
@@ -3416,8 +3998,12 @@ VKAPI_ATTR void VKAPI_CALL vkCmdCopyBufferToImage(
 	       commandBuffer, srcBuffer, dstImage, dstImageLayout, regionCount, pRegions);
 
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdCopyBufferToImage, commandBuffer, MetricUnit(1, regionCount));
-	p->commands.back().bindings.push_back(buffer_cast(srcBuffer));
-	p->commands.back().bindings.push_back(image_cast(dstImage));
+	cVkBuffer* src = buffer_cast(srcBuffer);
+	cVkImage* dst = image_cast(dstImage);
+	p->commands.bind(src);
+	p->commands.bind(dst);
+	cVkPayloadCopyBufferImage* payload = record_copy_buffer_image(p, src, dst, regionCount);
+	memcpy(payload->regions(), pRegions, regionCount * sizeof(VkBufferImageCopy));
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdCopyImageToBuffer(
@@ -3433,8 +4019,12 @@ VKAPI_ATTR void VKAPI_CALL vkCmdCopyImageToBuffer(
 	       commandBuffer, srcImage, srcImageLayout, dstBuffer, regionCount, pRegions);
 
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdCopyImageToBuffer, commandBuffer, MetricUnit(1, regionCount));
-	p->commands.back().bindings.push_back(image_cast(srcImage));
-	p->commands.back().bindings.push_back(buffer_cast(dstBuffer));
+	cVkImage* src = image_cast(srcImage);
+	cVkBuffer* dst = buffer_cast(dstBuffer);
+	p->commands.bind(src);
+	p->commands.bind(dst);
+	cVkPayloadCopyBufferImage* payload = record_copy_buffer_image(p, dst, src, regionCount);
+	memcpy(payload->regions(), pRegions, regionCount * sizeof(VkBufferImageCopy));
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdUpdateBuffer(
@@ -3449,7 +4039,13 @@ VKAPI_ATTR void VKAPI_CALL vkCmdUpdateBuffer(
 	       commandBuffer, dstBuffer, (unsigned long long)dstOffset, (unsigned long long)dataSize, pData);
 
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdUpdateBuffer, commandBuffer, MetricUnit(1));
-	p->commands.back().bindings.push_back(buffer_cast(dstBuffer));
+	cVkBuffer* dst = buffer_cast(dstBuffer);
+	p->commands.bind(dst);
+	cVkPayloadUpdateBuffer* payload = p->commands.payload<cVkPayloadUpdateBuffer>(dataSize);
+	payload->dstBuffer = dst;
+	payload->dstOffset = dstOffset;
+	payload->dataSize = dataSize;
+	memcpy(payload->data(), pData, dataSize);
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdFillBuffer(
@@ -3464,7 +4060,13 @@ VKAPI_ATTR void VKAPI_CALL vkCmdFillBuffer(
 	       commandBuffer, dstBuffer, (unsigned long long)dstOffset, (unsigned long long)size, data);
 
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdFillBuffer, commandBuffer, MetricUnit(1));
-	p->commands.back().bindings.push_back(buffer_cast(dstBuffer));
+	cVkBuffer* dst = buffer_cast(dstBuffer);
+	p->commands.bind(dst);
+	cVkPayloadFillBuffer* payload = p->commands.payload<cVkPayloadFillBuffer>();
+	payload->dstBuffer = dst;
+	payload->dstOffset = dstOffset;
+	payload->size = size;
+	payload->data = data;
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdClearColorImage(
@@ -3480,7 +4082,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdClearColorImage(
 	       commandBuffer, image, imageLayout, pColor, rangeCount, pRanges);
 
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdClearColorImage, commandBuffer, MetricUnit(1, rangeCount));
-	p->commands.back().bindings.push_back(image_cast(image));
+	p->commands.bind(image_cast(image));
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdClearDepthStencilImage(
@@ -3496,7 +4098,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdClearDepthStencilImage(
 	       commandBuffer, image, imageLayout, pDepthStencil, rangeCount, pRanges);
 
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdClearDepthStencilImage, commandBuffer, MetricUnit(1, rangeCount));
-	p->commands.back().bindings.push_back(image_cast(image));
+	p->commands.bind(image_cast(image));
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdClearAttachments(
@@ -3527,8 +4129,8 @@ VKAPI_ATTR void VKAPI_CALL vkCmdResolveImage(
 	       commandBuffer, srcImage, srcImageLayout, dstImage, dstImageLayout, regionCount, pRegions);
 
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdResolveImage, commandBuffer, MetricUnit(1, regionCount));
-	p->commands.back().bindings.push_back(image_cast(srcImage));
-	p->commands.back().bindings.push_back(image_cast(dstImage));
+	p->commands.bind(image_cast(srcImage));
+	p->commands.bind(image_cast(dstImage));
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdSetEvent(
@@ -3540,7 +4142,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdSetEvent(
 	CMDLOG("commandBuffer=%p, event=" NHANDLE ", stageMask=%u", commandBuffer, event, stageMask);
 
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdSetEvent, commandBuffer, MetricUnit(1));
-	p->commands.back().bindings.push_back(event_cast(event));
+	p->commands.bind(event_cast(event));
 	p->maxStageFlags |= stageMask;
 }
 
@@ -3553,7 +4155,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdResetEvent(
 	CMDLOG("commandBuffer=%p, event=" NHANDLE ", stageMask=%u", commandBuffer, event, stageMask);
 
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdResetEvent, commandBuffer, MetricUnit(1));
-	p->commands.back().bindings.push_back(event_cast(event));
+	p->commands.bind(event_cast(event));
 	p->maxStageFlags |= stageMask;
 }
 
@@ -3579,7 +4181,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdWaitEvents(
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdWaitEvents, commandBuffer, MetricUnit(1, eventCount, memoryBarrierCount + bufferMemoryBarrierCount + imageMemoryBarrierCount));
 	for (uint32_t i = 0; i < eventCount; i++)
 	{
-		p->commands.back().bindings.push_back(event_cast(pEvents[i]));
+		p->commands.bind(event_cast(pEvents[i]));
 	}
 	p->maxStageFlags |= srcStageMask;
 	p->maxStageFlags |= dstStageMask;
@@ -3618,12 +4220,11 @@ VKAPI_ATTR void VKAPI_CALL vkCmdBeginQuery(
 
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdBeginQuery, commandBuffer, MetricUnit(1));
 	cVkQueryPool* qp = querypool_cast(queryPool);
-	p->commands.back().bindings.push_back(qp);
-	cVkPayloadQuery* payload = new cVkPayloadQuery;
+	p->commands.bind(qp);
+	cVkPayloadQuery* payload = p->commands.payload<cVkPayloadQuery>();
 	payload->queryPool = qp;
 	payload->query = query;
 	payload->flags = flags;
-	p->commands.back().payload = payload;
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdEndQuery(
@@ -3636,12 +4237,11 @@ VKAPI_ATTR void VKAPI_CALL vkCmdEndQuery(
 
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdEndQuery, commandBuffer, MetricUnit(1));
 	cVkQueryPool* qp = querypool_cast(queryPool);
-	p->commands.back().bindings.push_back(qp);
-	cVkPayloadQuery* payload = new cVkPayloadQuery;
+	p->commands.bind(qp);
+	cVkPayloadQuery* payload = p->commands.payload<cVkPayloadQuery>();
 	payload->queryPool = nullptr;
 	payload->query = 0;
 	payload->flags = 0;
-	p->commands.back().payload = payload;
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdResetQueryPool(
@@ -3654,11 +4254,10 @@ VKAPI_ATTR void VKAPI_CALL vkCmdResetQueryPool(
 	CMDLOG("commandBuffer=%p, queryPool=" NHANDLE ", firstQuery=%u, queryCount=%u", commandBuffer, queryPool, firstQuery, queryCount);
 
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdResetQueryPool, commandBuffer, MetricUnit(1, queryCount));
-	p->commands.back().bindings.push_back(querypool_cast(queryPool));
-	cVkPayloadQueryReset* payload = new cVkPayloadQueryReset;
+	p->commands.bind(querypool_cast(queryPool));
+	cVkPayloadQueryReset* payload = p->commands.payload<cVkPayloadQueryReset>();
 	payload->firstQuery = firstQuery;
 	payload->queryCount = queryCount;
-	p->commands.back().payload = payload;
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdWriteTimestamp(
@@ -3672,11 +4271,10 @@ VKAPI_ATTR void VKAPI_CALL vkCmdWriteTimestamp(
 
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdWriteTimestamp, commandBuffer, MetricUnit(1));
 	cVkQueryPool* qp = querypool_cast(queryPool);
-	p->commands.back().bindings.push_back(qp);
-	cVkPayloadQuery* payload = new cVkPayloadQuery;
+	p->commands.bind(qp);
+	cVkPayloadQuery* payload = p->commands.payload<cVkPayloadQuery>();
 	payload->queryPool = qp;
 	payload->query = query;
-	p->commands.back().payload = payload;
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdCopyQueryPoolResults(
@@ -3695,8 +4293,8 @@ VKAPI_ATTR void VKAPI_CALL vkCmdCopyQueryPoolResults(
 
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdCopyQueryPoolResults, commandBuffer, MetricUnit(1, queryCount));
 	cVkQueryPool* qp = querypool_cast(queryPool);
-	p->commands.back().bindings.push_back(qp);
-	cVkPayloadCopyQuery* payload = new cVkPayloadCopyQuery;
+	p->commands.bind(qp);
+	cVkPayloadCopyQuery* payload = p->commands.payload<cVkPayloadCopyQuery>();
 	payload->queryPool = qp;
 	payload->firstQuery = firstQuery;
 	payload->queryCount = queryCount;
@@ -3704,7 +4302,6 @@ VKAPI_ATTR void VKAPI_CALL vkCmdCopyQueryPoolResults(
 	payload->dstOffset = dstOffset;
 	payload->stride = stride;
 	payload->flags = flags;
-	p->commands.back().payload = payload;
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdPushConstants(
@@ -3720,7 +4317,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdPushConstants(
 	       commandBuffer, layout, stageFlags, offset, size, pValues);
 
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdPushConstants, commandBuffer, MetricUnit(1));
-	p->commands.back().bindings.push_back(pipelinelayout_cast(layout));
+	p->commands.bind(pipelinelayout_cast(layout));
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdBeginRenderPass(
@@ -3764,7 +4361,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdExecuteCommands(
 	for (unsigned i = 0; i < commandBufferCount; i++)
 	{
 		cVkCommandBuffer* secondary = commandbuffer_cast(pCommandBuffers[i]);
-		p->commands.back().bindings.push_back(secondary);
+		p->commands.bind(secondary);
 
 		// Add secondary commandbuffer's counts to primary commandbuffer
 		for (unsigned j = 0; j < p->count.size(); j++)
@@ -3856,7 +4453,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdDispatchBase(
 	ENTRY(vkCmdDispatchBase);
 	CMDLOG("commandBuffer=%p ...", commandBuffer);
 	TBD_UNSUPPORTED;
-	cVkCommandBuffer* p = commandbuffer_command(vkCmdDispatchBase, commandBuffer, MetricUnit(1));
+	cVkCommandBuffer* p = commandbuffer_command(vkCmdDispatchBase, commandBuffer, MetricUnit(1, 1, (long)groupCountX * groupCountY * groupCountZ));
 }
 
 static VkResult commonEnumeratePhysicalDeviceGroups(
@@ -4140,8 +4737,8 @@ VKAPI_ATTR void VKAPI_CALL vkGetPhysicalDeviceMemoryProperties2(
 {
 	ENTRY(vkGetPhysicalDeviceMemoryProperties2);
 	pMemoryProperties->sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
-	pMemoryProperties->pNext = nullptr;
 	commonGetPhysicalDeviceMemoryProperties(physicalDevice, &pMemoryProperties->memoryProperties);
+	commonGetPhysicalDeviceMemoryBudget(physicalDevice, pMemoryProperties);
 }
 
 VKAPI_ATTR void VKAPI_CALL vkGetPhysicalDeviceSparseImageFormatProperties2(
@@ -4437,7 +5034,12 @@ VKAPI_ATTR void VKAPI_CALL vkDestroySwapchainKHR(
 	CLOG("device=%p, swapchain=" NHANDLE ", pAllocator=%p", device, swapchain, pAllocator);
 
 	cVkDevice* dev = device_cast(device);
-	destroy<cVkSwapchainKHR, VkSwapchainKHR>(swapchain, pAllocator);
+	cVkSwapchainKHR* chain = destroy<cVkSwapchainKHR, VkSwapchainKHR>(swapchain, pAllocator);
+	if (chain)
+	{
+		// Its images go with it
+		for (cVkImage* image : chain->images) destroy<cVkImage, VkImage>(reinterpret_cast<VkImage>(image), pAllocator);
+	}
 }
 
 VKAPI_ATTR VkResult VKAPI_CALL vkGetSwapchainImagesKHR(
@@ -4495,14 +5097,16 @@ static VkResult internalAcquireNextImage(cVkDevice* dev, cVkSwapchainKHR* chain,
 		{
 			cVkSemaphore* acquired = semaphore_cast(semaphore);
 			assert(acquired->type == VK_SEMAPHORE_TYPE_BINARY);
+			std::lock_guard<std::mutex> lock(dev->sync_mutex);
 			assert(!acquired->binary_signalled);
 			acquired->binary_signalled = true;
+			semaphore_signalled(dev, acquired);
 		}
 		if (fence != VK_NULL_HANDLE)
 		{
 			cVkFence* acquired = fence_cast(fence);
 			assert(!fence_is_signalled(acquired));
-			acquired->signalled.store(true);
+			signal_fence(dev, acquired);
 		}
 		return VK_SUCCESS;
 	}
@@ -4535,6 +5139,9 @@ VKAPI_ATTR VkResult VKAPI_CALL vkQueuePresentKHR(
 	{
 		cVkSemaphore* wait = semaphore_cast(pPresentInfo->pWaitSemaphores[i]);
 		assert(wait->type == VK_SEMAPHORE_TYPE_BINARY);
+		std::unique_lock<std::mutex> lock(c->device->sync_mutex);
+		// With worker threads, the submission that signals it may not have been executed yet
+		if (async_queues) wait_on_device(c->device, lock, UINT64_MAX, [wait]() { return wait->binary_signalled; });
 		assert(wait->binary_signalled);
 		wait->binary_signalled = false;
 	}
@@ -4546,9 +5153,13 @@ VKAPI_ATTR VkResult VKAPI_CALL vkQueuePresentKHR(
 		assert(swapchain->imageStates.at(image_index) == cVkSwapchainKHR::Acquired);
 		swapchain->imageStates.at(image_index) = cVkSwapchainKHR::Available;
 		if (pPresentInfo->pResults) pPresentInfo->pResults[i] = VK_SUCCESS;
-		c->commandbuffers.clear();
 	}
+#ifndef FAST
+	dirty_tracking_end_frame(c->current_frame);
+	frame_metrics_end_frame(c->current_frame);
+#endif
 	c->current_frame++;
+	if (reclaim_frames > 0) reclaim_destroyed(c->device);
 
 	return VK_SUCCESS;
 }
@@ -5079,7 +5690,8 @@ VKAPI_ATTR void VKAPI_CALL vkCmdDebugMarkerBeginEXT(
 
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdDebugMarkerBeginEXT, commandBuffer, MetricUnit(1));
 	assert(pMarkerInfo->sType == VK_STRUCTURE_TYPE_DEBUG_MARKER_MARKER_INFO_EXT);
-	p->commands.back().payload = new cVkPayloadMarker(pMarkerInfo->pMarkerName);
+	const size_t length = strlen(pMarkerInfo->pMarkerName) + 1;
+	memcpy(p->commands.payload<cVkPayloadMarker>(length)->marker_name(), pMarkerInfo->pMarkerName, length);
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdDebugMarkerEndEXT(
@@ -5100,7 +5712,8 @@ VKAPI_ATTR void VKAPI_CALL vkCmdDebugMarkerInsertEXT(
 
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdDebugMarkerInsertEXT, commandBuffer, MetricUnit(1));
 	assert(pMarkerInfo->sType == VK_STRUCTURE_TYPE_DEBUG_MARKER_MARKER_INFO_EXT);
-	p->commands.back().payload = new cVkPayloadMarker(pMarkerInfo->pMarkerName);
+	const size_t length = strlen(pMarkerInfo->pMarkerName) + 1;
+	memcpy(p->commands.payload<cVkPayloadMarker>(length)->marker_name(), pMarkerInfo->pMarkerName, length);
 }
 
 // VK_EXT_transform_feedback extension
@@ -5187,12 +5800,11 @@ VKAPI_ATTR void VKAPI_CALL vkCmdDrawIndirectCount(
 	CMDLOG("commandBuffer=%p, buffer=" NHANDLE ", offset=%llu, countBuffer=" NHANDLE ", countBufferOffset=%llu, maxDrawCount=%u, stride=%u",
 	       commandBuffer, buffer, (unsigned long long)offset, countBuffer, (unsigned long long)countBufferOffset, maxDrawCount, stride);
 
-	cVkBuffer* cbuf = buffer_cast(countBuffer);
-	uint32_t drawCount = *reinterpret_cast<uint32_t *>(cbuf->memory->ptr + cbuf->memoryOffset + countBufferOffset);
 	cVkBuffer* pbuf = buffer_cast(buffer);
-	cVkCommandBuffer* p = commandbuffer_command(vkCmdDrawIndirectCount, commandBuffer, indirect_draw(commandBuffer, pbuf, offset, drawCount, stride));
-	p->commands.back().bindings.push_back(pbuf);
-	p->commands.back().bindings.push_back(cbuf);
+	cVkBuffer* cbuf = buffer_cast(countBuffer);
+	const MetricUnit estimate = indirect_draw_estimate(commandBuffer, pbuf, offset, cbuf, countBufferOffset, maxDrawCount, stride, false);
+	cVkCommandBuffer* p = commandbuffer_command(vkCmdDrawIndirectCount, commandBuffer, estimate);
+	indirect_payload(p, pbuf, offset, cbuf, countBufferOffset, maxDrawCount, stride);
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdDrawIndexedIndirectCount(
@@ -5208,12 +5820,11 @@ VKAPI_ATTR void VKAPI_CALL vkCmdDrawIndexedIndirectCount(
 	CMDLOG("commandBuffer=%p, buffer=" NHANDLE ", offset=%llu, countBuffer=" NHANDLE ", countBufferOffset=%llu, maxDrawCount=%u, stride=%u",
 	       commandBuffer, buffer, (unsigned long long)offset, countBuffer, (unsigned long long)countBufferOffset, maxDrawCount, stride);
 
-	cVkBuffer* cbuf = buffer_cast(countBuffer);
-	uint32_t drawCount = *reinterpret_cast<uint32_t *>(cbuf->memory->ptr + cbuf->memoryOffset + countBufferOffset);
 	cVkBuffer* pbuf = buffer_cast(buffer);
-	cVkCommandBuffer* p = commandbuffer_command(vkCmdDrawIndexedIndirectCount, commandBuffer, indirect_draw_indexed(commandBuffer, pbuf, offset, drawCount, stride));
-	p->commands.back().bindings.push_back(pbuf);
-	p->commands.back().bindings.push_back(cbuf);
+	cVkBuffer* cbuf = buffer_cast(countBuffer);
+	const MetricUnit estimate = indirect_draw_estimate(commandBuffer, pbuf, offset, cbuf, countBufferOffset, maxDrawCount, stride, true);
+	cVkCommandBuffer* p = commandbuffer_command(vkCmdDrawIndexedIndirectCount, commandBuffer, estimate);
+	indirect_payload(p, pbuf, offset, cbuf, countBufferOffset, maxDrawCount, stride);
 }
 
 // VK_KHR_draw_indirect_count extension
@@ -5231,13 +5842,11 @@ VKAPI_ATTR void VKAPI_CALL vkCmdDrawIndirectCountKHR(
 	CMDLOG("commandBuffer=%p, buffer=" NHANDLE ", offset=%llu, countBuffer=" NHANDLE ", countBufferOffset=%llu, maxDrawCount=%u, stride=%u",
 	       commandBuffer, buffer, (unsigned long long)offset, countBuffer, (unsigned long long)countBufferOffset, maxDrawCount, stride);
 
-	// TBD - move counting into command buffer implementation, since buffer contents could change
-	cVkBuffer* cbuf = buffer_cast(countBuffer);
-	uint32_t drawCount = *reinterpret_cast<uint32_t *>(cbuf->memory->ptr + cbuf->memoryOffset + countBufferOffset);
 	cVkBuffer* pbuf = buffer_cast(buffer);
-	cVkCommandBuffer* p = commandbuffer_command(vkCmdDrawIndirectCountKHR, commandBuffer, indirect_draw(commandBuffer, pbuf, offset, drawCount, stride));
-	p->commands.back().bindings.push_back(pbuf);
-	p->commands.back().bindings.push_back(cbuf);
+	cVkBuffer* cbuf = buffer_cast(countBuffer);
+	const MetricUnit estimate = indirect_draw_estimate(commandBuffer, pbuf, offset, cbuf, countBufferOffset, maxDrawCount, stride, false);
+	cVkCommandBuffer* p = commandbuffer_command(vkCmdDrawIndirectCountKHR, commandBuffer, estimate);
+	indirect_payload(p, pbuf, offset, cbuf, countBufferOffset, maxDrawCount, stride);
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdDrawIndexedIndirectCountKHR(
@@ -5253,13 +5862,11 @@ VKAPI_ATTR void VKAPI_CALL vkCmdDrawIndexedIndirectCountKHR(
 	CMDLOG("commandBuffer=%p, buffer=" NHANDLE ", offset=%llu, countBuffer=" NHANDLE ", countBufferOffset=%llu, maxDrawCount=%u, stride=%u",
 	       commandBuffer, buffer, (unsigned long long)offset, countBuffer, (unsigned long long)countBufferOffset, maxDrawCount, stride);
 
-	// TBD - move counting into command buffer implementation, since buffer contents could change
-	cVkBuffer* cbuf = buffer_cast(countBuffer);
-	uint32_t drawCount = *reinterpret_cast<uint32_t *>(cbuf->memory->ptr + cbuf->memoryOffset + countBufferOffset);
 	cVkBuffer* pbuf = buffer_cast(buffer);
-	cVkCommandBuffer* p = commandbuffer_command(vkCmdDrawIndexedIndirectCountKHR, commandBuffer, indirect_draw_indexed(commandBuffer, pbuf, offset, drawCount, stride));
-	p->commands.back().bindings.push_back(pbuf);
-	p->commands.back().bindings.push_back(cbuf);
+	cVkBuffer* cbuf = buffer_cast(countBuffer);
+	const MetricUnit estimate = indirect_draw_estimate(commandBuffer, pbuf, offset, cbuf, countBufferOffset, maxDrawCount, stride, true);
+	cVkCommandBuffer* p = commandbuffer_command(vkCmdDrawIndexedIndirectCountKHR, commandBuffer, estimate);
+	indirect_payload(p, pbuf, offset, cbuf, countBufferOffset, maxDrawCount, stride);
 }
 
 // VK_KHR_get_physical_device_properties2 extension
@@ -5331,8 +5938,8 @@ VKAPI_ATTR void VKAPI_CALL vkGetPhysicalDeviceMemoryProperties2KHR(
 {
 	ENTRY(vkGetPhysicalDeviceMemoryProperties2KHR);
 	pMemoryProperties->sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
-	pMemoryProperties->pNext = nullptr;
 	commonGetPhysicalDeviceMemoryProperties(physicalDevice, &pMemoryProperties->memoryProperties);
+	commonGetPhysicalDeviceMemoryBudget(physicalDevice, pMemoryProperties);
 }
 
 VKAPI_ATTR void VKAPI_CALL vkGetPhysicalDeviceSparseImageFormatProperties2KHR(
@@ -5734,7 +6341,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdDispatchBaseKHR(
 	CMDLOG("commandBuffer=%p, baseGroupX=%u, baseGroupY=%u, baseGroupZ=%u, groupCountX=%u, groupCountY=%u, groupCountZ=%u",
 	       commandBuffer, baseGroupX, baseGroupY, baseGroupZ, groupCountX, groupCountY, groupCountZ);
 
-	cVkCommandBuffer* p = commandbuffer_command(vkCmdDispatchBaseKHR, commandBuffer, MetricUnit(1)); // TBD should not be 1
+	cVkCommandBuffer* p = commandbuffer_command(vkCmdDispatchBaseKHR, commandBuffer, MetricUnit(1, 1, (long)groupCountX * groupCountY * groupCountZ));
 }
 
 // VK_KHR_external_memory_capabilities extension
@@ -6854,20 +7461,25 @@ static VkResult internalWaitSemaphores(
     uint64_t                                    timeout)
 {
 	cVkDevice* dev = device_cast(device);
-	do
+	std::vector<cVkSemaphore*> semaphores(pWaitInfo->semaphoreCount);
+	for (uint32_t i = 0; i < pWaitInfo->semaphoreCount; i++)
+	{
+		semaphores[i] = semaphore_cast(pWaitInfo->pSemaphores[i]);
+		assert(semaphores[i]->type == VK_SEMAPHORE_TYPE_TIMELINE);
+	}
+	auto done = [&]()
 	{
 		bool success = true;
 		for (uint32_t i = 0; i < pWaitInfo->semaphoreCount; i++)
 		{
-			cVkSemaphore* c = semaphore_cast(pWaitInfo->pSemaphores[i]);
-			assert(c->type == VK_SEMAPHORE_TYPE_TIMELINE);
-			if (c->value >= pWaitInfo->pValues[i] && (pWaitInfo->flags & VK_SEMAPHORE_WAIT_ANY_BIT_KHR)) return VK_SUCCESS;
-			if (c->value < pWaitInfo->pValues[i]) success = false;
+			if (semaphores[i]->value >= pWaitInfo->pValues[i] && (pWaitInfo->flags & VK_SEMAPHORE_WAIT_ANY_BIT_KHR)) return true;
+			if (semaphores[i]->value < pWaitInfo->pValues[i]) success = false;
 		}
-		if (timeout) timeout--;
-		if (success) return VK_SUCCESS;
-	} while (timeout);
-	return VK_TIMEOUT;
+		return success;
+	};
+
+	std::unique_lock<std::mutex> lock(dev->sync_mutex);
+	return wait_on_device(dev, lock, timeout, done) ? VK_SUCCESS : VK_TIMEOUT;
 }
 
 VKAPI_ATTR VkResult VKAPI_CALL vkWaitSemaphores(
@@ -6884,9 +7496,10 @@ static VkResult internalSignalSemaphore(VkDevice device, const VkSemaphoreSignal
 	cVkDevice* dev = device_cast(device);
 	cVkSemaphore* semaphore = semaphore_cast(pSignalInfo->semaphore);
 	assert(semaphore->type == VK_SEMAPHORE_TYPE_TIMELINE);
+	std::lock_guard<std::mutex> lock(dev->sync_mutex);
 	assert(pSignalInfo->value > semaphore->value);
 	semaphore->value = pSignalInfo->value;
-	retire_pending_submissions(dev);
+	semaphore_signalled(dev, semaphore);
 	return VK_SUCCESS;
 }
 
@@ -7085,18 +7698,17 @@ VKAPI_ATTR void VKAPI_CALL vkCmdWriteAccelerationStructuresPropertiesKHR(
 
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdWriteAccelerationStructuresPropertiesKHR, commandBuffer, MetricUnit(1, accelerationStructureCount));
 	cVkQueryPool* qp = querypool_cast(queryPool);
-	p->commands.back().bindings.push_back(qp);
-	cVkPayloadWriteAccelerationStructuresPropertiesKHR* payload = new cVkPayloadWriteAccelerationStructuresPropertiesKHR;
+	p->commands.bind(qp);
+	cVkPayloadWriteAccelerationStructuresPropertiesKHR* payload =
+		p->commands.payload<cVkPayloadWriteAccelerationStructuresPropertiesKHR>(accelerationStructureCount * sizeof(VkDeviceSize));
 	payload->accelerationStructureCount = accelerationStructureCount;
 	payload->firstQuery = firstQuery;
-	payload->sizes.reserve(accelerationStructureCount);
 	for (unsigned i = 0; i < accelerationStructureCount; i++)
 	{
 		cVkAccelerationStructureKHR* acc = accelerationstructure_cast(pAccelerationStructures[i]);
 		const uint64_t size = acc ? acc->memorySize : 1;
-		payload->sizes.push_back(std::max<uint64_t>(size / 2, 1));
+		payload->sizes()[i] = std::max<uint64_t>(size / 2, 1);
 	}
-	p->commands.back().payload = payload;
 }
 
 VKAPI_ATTR void VKAPI_CALL vkGetDeviceAccelerationStructureCompatibilityKHR(
@@ -7177,7 +7789,8 @@ VKAPI_ATTR VkResult VKAPI_CALL vkCreateRayTracingPipelinesKHR(
 		cVkPipeline& p = owner_create<cVkPipeline, VkPipeline>(dev->pipelines, &pPipelines[i], pAllocator);
 		if (cache)
 		{
-			cache->pipelines[&dev->pipelines.back()] = true;
+			std::lock_guard<std::mutex> lock(cache->pipelines_mutex);
+			cache->pipelines[&p] = true;
 			p.cache = cache;
 		}
 		p.flags = pCreateInfos[i].flags;
@@ -7225,6 +7838,9 @@ VKAPI_ATTR VkResult VKAPI_CALL vkCreateRayTracingPipelinesKHR(
 			}
 		}
 		p.layout = pipelinelayout_cast(pCreateInfos[i].layout);
+#ifndef FAST
+		p.log_usage(); // see vkCreateGraphicsPipelines
+#endif
 	}
 
 	if (deferredOperation == VK_NULL_HANDLE)
@@ -7452,17 +8068,16 @@ VKAPI_ATTR void VKAPI_CALL vkCmdCopyBuffer2KHR(
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdCopyBuffer2KHR, commandBuffer, MetricUnit(1, pCopyBufferInfo->regionCount));
 	cVkBuffer* src = buffer_cast(pCopyBufferInfo->srcBuffer);
 	cVkBuffer* dst = buffer_cast(pCopyBufferInfo->dstBuffer);
-	p->commands.back().bindings.push_back(src);
-	p->commands.back().bindings.push_back(dst);
-	cVkPayloadCopyBuffer* payload = new cVkPayloadCopyBuffer;
+	p->commands.bind(src);
+	p->commands.bind(dst);
+	cVkPayloadCopyBuffer* payload = p->commands.payload<cVkPayloadCopyBuffer>(pCopyBufferInfo->regionCount * sizeof(VkBufferCopy));
 	payload->srcBuffer = src;
 	payload->dstBuffer = dst;
-	payload->regions.reserve(pCopyBufferInfo->regionCount);
+	payload->regionCount = pCopyBufferInfo->regionCount;
 	for (uint32_t i = 0; i < pCopyBufferInfo->regionCount; i++)
 	{
-		payload->regions.push_back({ pCopyBufferInfo->pRegions[i].srcOffset, pCopyBufferInfo->pRegions[i].dstOffset, pCopyBufferInfo->pRegions[i].size });
+		payload->regions()[i] = { pCopyBufferInfo->pRegions[i].srcOffset, pCopyBufferInfo->pRegions[i].dstOffset, pCopyBufferInfo->pRegions[i].size };
 	}
-	p->commands.back().payload = payload;
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdCopyImage2KHR(
@@ -7470,7 +8085,8 @@ VKAPI_ATTR void VKAPI_CALL vkCmdCopyImage2KHR(
     const VkCopyImageInfo2KHR*                  pCopyImageInfo)
 {
 	ENTRY(vkCmdCopyImage2KHR);
-	TBD_UNSUPPORTED;
+	cVkCommandBuffer* p = commandbuffer_command(vkCmdCopyImage2KHR, commandBuffer, MetricUnit(1, pCopyImageInfo->regionCount));
+	record_copy_image2(p, pCopyImageInfo);
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdCopyBufferToImage2KHR(
@@ -7478,7 +8094,8 @@ VKAPI_ATTR void VKAPI_CALL vkCmdCopyBufferToImage2KHR(
     const VkCopyBufferToImageInfo2KHR*          pCopyBufferToImageInfo)
 {
 	ENTRY(vkCmdCopyBufferToImage2KHR);
-	TBD_UNSUPPORTED;
+	cVkCommandBuffer* p = commandbuffer_command(vkCmdCopyBufferToImage2KHR, commandBuffer, MetricUnit(1, pCopyBufferToImageInfo->regionCount));
+	record_copy_buffer_to_image2(p, pCopyBufferToImageInfo);
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdCopyImageToBuffer2KHR(
@@ -7486,7 +8103,8 @@ VKAPI_ATTR void VKAPI_CALL vkCmdCopyImageToBuffer2KHR(
     const VkCopyImageToBufferInfo2KHR*          pCopyImageToBufferInfo)
 {
 	ENTRY(vkCmdCopyImageToBuffer2KHR);
-	TBD_UNSUPPORTED;
+	cVkCommandBuffer* p = commandbuffer_command(vkCmdCopyImageToBuffer2KHR, commandBuffer, MetricUnit(1, pCopyImageToBufferInfo->regionCount));
+	record_copy_image_to_buffer2(p, pCopyImageToBufferInfo);
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdBlitImage2KHR(
@@ -7494,7 +8112,8 @@ VKAPI_ATTR void VKAPI_CALL vkCmdBlitImage2KHR(
     const VkBlitImageInfo2KHR*                  pBlitImageInfo)
 {
 	ENTRY(vkCmdBlitImage2KHR);
-	TBD_UNSUPPORTED;
+	cVkCommandBuffer* p = commandbuffer_command(vkCmdBlitImage2KHR, commandBuffer, MetricUnit(1, pBlitImageInfo->regionCount));
+	record_blit_image2(p, pBlitImageInfo);
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdResolveImage2KHR(
@@ -7684,7 +8303,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdSetEvent2KHR(
 {
 	ENTRY(vkCmdSetEvent2KHR);
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdSetEvent2KHR, commandBuffer, MetricUnit(1, pDependencyInfo->memoryBarrierCount + pDependencyInfo->bufferMemoryBarrierCount + pDependencyInfo->imageMemoryBarrierCount));
-	p->commands.back().bindings.push_back(event_cast(event));
+	p->commands.bind(event_cast(event));
 	update_dependency_info_stage_flags(p, pDependencyInfo);
 }
 
@@ -7695,7 +8314,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdResetEvent2KHR(
 {
 	ENTRY(vkCmdResetEvent2KHR);
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdResetEvent2KHR, commandBuffer, MetricUnit(1));
-	p->commands.back().bindings.push_back(event_cast(event));
+	p->commands.bind(event_cast(event));
 	p->maxStageFlags |= stageMask;
 }
 
@@ -7709,7 +8328,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdWaitEvents2KHR(
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdWaitEvents2KHR, commandBuffer, MetricUnit(1, eventCount));
 	for (uint32_t i = 0; i < eventCount; i++)
 	{
-		p->commands.back().bindings.push_back(event_cast(pEvents[i]));
+		p->commands.bind(event_cast(pEvents[i]));
 		update_dependency_info_stage_flags(p, &pDependencyInfos[i]);
 	}
 }
@@ -7753,11 +8372,10 @@ VKAPI_ATTR void VKAPI_CALL vkCmdWriteTimestamp2KHR(
 	ENTRY(vkCmdWriteTimestamp2KHR);
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdWriteTimestamp2KHR, commandBuffer, MetricUnit(1));
 	cVkQueryPool* qp = querypool_cast(queryPool);
-	p->commands.back().bindings.push_back(qp);
-	cVkPayloadQuery* payload = new cVkPayloadQuery;
+	p->commands.bind(qp);
+	cVkPayloadQuery* payload = p->commands.payload<cVkPayloadQuery>();
 	payload->queryPool = qp;
 	payload->query = query;
-	p->commands.back().payload = payload;
 	p->maxStageFlags |= stage;
 }
 
@@ -7789,7 +8407,7 @@ VkResult internalQueueSubmit2(
 
 		for (unsigned j = 0; j < pSubmits[i].commandBufferInfoCount; j++)
 		{
-			internalQueueSubmit(q, pSubmits[i].pCommandBufferInfos[j].commandBuffer);
+			internalQueueSubmit(q, submission, pSubmits[i].pCommandBufferInfos[j].commandBuffer);
 		}
 
 		// Signal execution complete
@@ -7803,7 +8421,7 @@ VkResult internalQueueSubmit2(
 		enqueue_submission(q, submission);
 	}
 
-	if (submitCount == 0 && submit_fence) submit_fence->signalled.store(true);
+	if (submitCount == 0 && submit_fence) signal_fence(q->device, submit_fence);
 
 	return VK_SUCCESS;
 }
@@ -8040,7 +8658,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdSetEvent2(
 {
 	ENTRY(vkCmdSetEvent2);
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdSetEvent2, commandBuffer, MetricUnit(1, pDependencyInfo->memoryBarrierCount + pDependencyInfo->bufferMemoryBarrierCount + pDependencyInfo->imageMemoryBarrierCount));
-	p->commands.back().bindings.push_back(event_cast(event));
+	p->commands.bind(event_cast(event));
 	update_dependency_info_stage_flags(p, pDependencyInfo);
 }
 
@@ -8051,7 +8669,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdResetEvent2(
 {
 	ENTRY(vkCmdResetEvent2);
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdResetEvent2, commandBuffer, MetricUnit(1));
-	p->commands.back().bindings.push_back(event_cast(event));
+	p->commands.bind(event_cast(event));
 	p->maxStageFlags |= stageMask;
 }
 
@@ -8065,7 +8683,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdWaitEvents2(
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdWaitEvents2, commandBuffer, MetricUnit(1, eventCount));
 	for (uint32_t i = 0; i < eventCount; i++)
 	{
-		p->commands.back().bindings.push_back(event_cast(pEvents[i]));
+		p->commands.bind(event_cast(pEvents[i]));
 		update_dependency_info_stage_flags(p, &pDependencyInfos[i]);
 	}
 }
@@ -8087,11 +8705,10 @@ VKAPI_ATTR void VKAPI_CALL vkCmdWriteTimestamp2(
 	ENTRY(vkCmdWriteTimestamp2);
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdWriteTimestamp2, commandBuffer, MetricUnit(1));
 	cVkQueryPool* qp = querypool_cast(queryPool);
-	p->commands.back().bindings.push_back(qp);
-	cVkPayloadQuery* payload = new cVkPayloadQuery;
+	p->commands.bind(qp);
+	cVkPayloadQuery* payload = p->commands.payload<cVkPayloadQuery>();
 	payload->queryPool = qp;
 	payload->query = query;
-	p->commands.back().payload = payload;
 	p->maxStageFlags |= stage;
 }
 
@@ -8113,17 +8730,16 @@ VKAPI_ATTR void VKAPI_CALL vkCmdCopyBuffer2(
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdCopyBuffer2, commandBuffer, MetricUnit(1, pCopyBufferInfo->regionCount));
 	cVkBuffer* src = buffer_cast(pCopyBufferInfo->srcBuffer);
 	cVkBuffer* dst = buffer_cast(pCopyBufferInfo->dstBuffer);
-	p->commands.back().bindings.push_back(src);
-	p->commands.back().bindings.push_back(dst);
-	cVkPayloadCopyBuffer* payload = new cVkPayloadCopyBuffer;
+	p->commands.bind(src);
+	p->commands.bind(dst);
+	cVkPayloadCopyBuffer* payload = p->commands.payload<cVkPayloadCopyBuffer>(pCopyBufferInfo->regionCount * sizeof(VkBufferCopy));
 	payload->srcBuffer = src;
 	payload->dstBuffer = dst;
-	payload->regions.reserve(pCopyBufferInfo->regionCount);
+	payload->regionCount = pCopyBufferInfo->regionCount;
 	for (uint32_t i = 0; i < pCopyBufferInfo->regionCount; i++)
 	{
-		payload->regions.push_back({ pCopyBufferInfo->pRegions[i].srcOffset, pCopyBufferInfo->pRegions[i].dstOffset, pCopyBufferInfo->pRegions[i].size });
+		payload->regions()[i] = { pCopyBufferInfo->pRegions[i].srcOffset, pCopyBufferInfo->pRegions[i].dstOffset, pCopyBufferInfo->pRegions[i].size };
 	}
-	p->commands.back().payload = payload;
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdCopyImage2(
@@ -8131,7 +8747,8 @@ VKAPI_ATTR void VKAPI_CALL vkCmdCopyImage2(
     const VkCopyImageInfo2*                     pCopyImageInfo)
 {
 	ENTRY(vkCmdCopyImage2);
-	TBD_UNSUPPORTED;
+	cVkCommandBuffer* p = commandbuffer_command(vkCmdCopyImage2, commandBuffer, MetricUnit(1, pCopyImageInfo->regionCount));
+	record_copy_image2(p, pCopyImageInfo);
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdCopyBufferToImage2(
@@ -8139,7 +8756,8 @@ VKAPI_ATTR void VKAPI_CALL vkCmdCopyBufferToImage2(
     const VkCopyBufferToImageInfo2*             pCopyBufferToImageInfo)
 {
 	ENTRY(vkCmdCopyBufferToImage2);
-	TBD_UNSUPPORTED;
+	cVkCommandBuffer* p = commandbuffer_command(vkCmdCopyBufferToImage2, commandBuffer, MetricUnit(1, pCopyBufferToImageInfo->regionCount));
+	record_copy_buffer_to_image2(p, pCopyBufferToImageInfo);
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdCopyImageToBuffer2(
@@ -8147,7 +8765,8 @@ VKAPI_ATTR void VKAPI_CALL vkCmdCopyImageToBuffer2(
     const VkCopyImageToBufferInfo2*             pCopyImageToBufferInfo)
 {
 	ENTRY(vkCmdCopyImageToBuffer2);
-	TBD_UNSUPPORTED;
+	cVkCommandBuffer* p = commandbuffer_command(vkCmdCopyImageToBuffer2, commandBuffer, MetricUnit(1, pCopyImageToBufferInfo->regionCount));
+	record_copy_image_to_buffer2(p, pCopyImageToBufferInfo);
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdBlitImage2(
@@ -8155,7 +8774,8 @@ VKAPI_ATTR void VKAPI_CALL vkCmdBlitImage2(
     const VkBlitImageInfo2*                     pBlitImageInfo)
 {
 	ENTRY(vkCmdBlitImage2);
-	TBD_UNSUPPORTED;
+	cVkCommandBuffer* p = commandbuffer_command(vkCmdBlitImage2, commandBuffer, MetricUnit(1, pBlitImageInfo->regionCount));
+	record_blit_image2(p, pBlitImageInfo);
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdResolveImage2(
@@ -8477,7 +9097,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdSetDescriptorBufferOffsetsEXT(
 {
 	ENTRY(vkCmdSetDescriptorBufferOffsetsEXT);
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdSetDescriptorBufferOffsetsEXT, commandBuffer, MetricUnit(1, setCount));
-	p->commands.back().bindings.push_back(pipelinelayout_cast(layout));
+	p->commands.bind(pipelinelayout_cast(layout));
 	(void)pipelineBindPoint;
 	(void)firstSet;
 	(void)pBufferIndices;
@@ -8684,6 +9304,9 @@ VKAPI_ATTR VkResult VKAPI_CALL vkMapMemory2KHR(
 	cVkDeviceMemory* mem = devicememory_cast(pMemoryMapInfo->memory);
 	*ppData = mem->ptr + pMemoryMapInfo->offset;
 	mem->mapped = true;
+#ifndef FAST
+	dirty_tracking_map(mem);
+#endif
 	return VK_SUCCESS;
 }
 
@@ -8755,11 +9378,10 @@ VKAPI_ATTR void VKAPI_CALL vkCmdWriteMicromapsPropertiesEXT(
 	
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdWriteMicromapsPropertiesEXT, commandBuffer, MetricUnit(1, micromapCount));
 	cVkQueryPool* qp = querypool_cast(queryPool);
-	p->commands.back().bindings.push_back(qp);
-	cVkPayloadWriteMicromapsPropertiesEXT* payload = new cVkPayloadWriteMicromapsPropertiesEXT;
+	p->commands.bind(qp);
+	cVkPayloadWriteMicromapsPropertiesEXT* payload = p->commands.payload<cVkPayloadWriteMicromapsPropertiesEXT>();
 	payload->micromapCount = micromapCount;
 	payload->firstQuery = firstQuery;
-	p->commands.back().payload = payload;
 }
 
 VKAPI_ATTR VkResult VKAPI_CALL vkCreateMicromapEXT(
@@ -9750,7 +10372,7 @@ static void commonCmdBindIndexBuffer2(VkCommandBuffer commandBuffer, VkBuffer bu
 	       commandBuffer, buffer, (unsigned long long)offset, (unsigned long long)size, indexType);
 
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdBindIndexBuffer2, commandBuffer, MetricUnit(1));
-	p->commands.back().bindings.push_back(buffer_cast(buffer));
+	p->commands.bind(buffer_cast(buffer));
 }
 
 static void commonGetImageSubresourceLayout2(VkDevice device, VkImage image, const VkImageSubresource2* pSubresource, VkSubresourceLayout2* pLayout)
@@ -9758,23 +10380,12 @@ static void commonGetImageSubresourceLayout2(VkDevice device, VkImage image, con
 	cVkDevice* cdevice = device_cast(device);
 	cVkImage* cimage = image_cast(image);
 	(void)cdevice;
-	(void)pSubresource;
 
 	if (!pLayout)
 		return;
 
-	pLayout->subresourceLayout.offset = cimage->memoryOffset;
-	if (cimage->memory)
-	{
-		pLayout->subresourceLayout.size = cimage->memory->allocationSize;
-	}
-	else
-	{
-		pLayout->subresourceLayout.size = cimage->extent.width * cimage->extent.height * cimage->extent.depth * 4 * 4;
-	}
-	pLayout->subresourceLayout.rowPitch = cimage->extent.width * 4;
-	pLayout->subresourceLayout.depthPitch = pLayout->subresourceLayout.rowPitch * cimage->extent.height;
-	pLayout->subresourceLayout.arrayPitch = pLayout->subresourceLayout.depthPitch * cimage->extent.depth;
+	const VkImageSubresource& subresource = pSubresource->imageSubresource;
+	pLayout->subresourceLayout = image_subresource_layout(cimage->format, cimage->extent, cimage->arrayLayers, subresource.mipLevel, subresource.arrayLayer);
 }
 
 static cVkBuffer* find_buffer_by_device_address(cVkDevice* cdevice, VkDeviceAddress address)
@@ -9803,12 +10414,9 @@ static void commonGetDeviceImageSubresourceLayout(VkDevice device, const VkDevic
 	if (!pLayout || !pInfo || !pInfo->pCreateInfo)
 		return;
 
-	const VkExtent3D& extent = pInfo->pCreateInfo->extent;
-	pLayout->subresourceLayout.offset = 0;
-	pLayout->subresourceLayout.size = extent.width * extent.height * extent.depth * 4 * 4;
-	pLayout->subresourceLayout.rowPitch = extent.width * 4;
-	pLayout->subresourceLayout.depthPitch = pLayout->subresourceLayout.rowPitch * extent.height;
-	pLayout->subresourceLayout.arrayPitch = pLayout->subresourceLayout.depthPitch * extent.depth;
+	const VkImageCreateInfo* info = pInfo->pCreateInfo;
+	const VkImageSubresource& subresource = pInfo->pSubresource->imageSubresource;
+	pLayout->subresourceLayout = image_subresource_layout(info->format, info->extent, info->arrayLayers, subresource.mipLevel, subresource.arrayLayer);
 }
 
 VKAPI_ATTR void VKAPI_CALL vkCmdBindIndexBuffer2KHR(
@@ -9891,7 +10499,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdCopyMemoryToImageKHR(
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdCopyMemoryToImageKHR, commandBuffer, MetricUnit(1, pCopyMemoryInfo ? pCopyMemoryInfo->regionCount : 0));
 	if (pCopyMemoryInfo)
 	{
-		p->commands.back().bindings.push_back(image_cast(pCopyMemoryInfo->image));
+		p->commands.bind(image_cast(pCopyMemoryInfo->image));
 	}
 	TBD_UNSUPPORTED;
 }
@@ -9904,7 +10512,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdCopyImageToMemoryKHR(
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdCopyImageToMemoryKHR, commandBuffer, MetricUnit(1, pCopyMemoryInfo ? pCopyMemoryInfo->regionCount : 0));
 	if (pCopyMemoryInfo)
 	{
-		p->commands.back().bindings.push_back(image_cast(pCopyMemoryInfo->image));
+		p->commands.bind(image_cast(pCopyMemoryInfo->image));
 	}
 	TBD_UNSUPPORTED;
 }
@@ -9950,7 +10558,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdCopyQueryPoolResultsToMemoryKHR(
 {
 	ENTRY(vkCmdCopyQueryPoolResultsToMemoryKHR);
 	cVkCommandBuffer* p = commandbuffer_command(vkCmdCopyQueryPoolResultsToMemoryKHR, commandBuffer, MetricUnit(1, queryCount));
-	p->commands.back().bindings.push_back(querypool_cast(queryPool));
+	p->commands.bind(querypool_cast(queryPool));
 	(void)firstQuery;
 	(void)pDstRange;
 	(void)dstFlags;
@@ -11186,7 +11794,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdBeginShaderInstrumentationARM(
 	cVkCommandBuffer* p = commandbuffer_cast(commandBuffer);
 	commandbuffer_command(vkCmdBeginShaderInstrumentationARM, commandBuffer, MetricUnit(1));
 	cVkShaderInstrumentationARM* cshaderInstrumentationARM = shaderinstrumentationarm_cast(instrumentation);
-	p->commands.back().bindings.push_back(cshaderInstrumentationARM);
+	p->commands.bind(cshaderInstrumentationARM);
 	TBD_UNSUPPORTED;
 }
 
@@ -177,7 +177,7 @@ void cVkDevice::update(cVkBase* parent)
 	cVkBase::update(parent);
 }
 
-void cVkPipeline::_log_usage()
+void cVkPipeline::log_usage()
 {
 	// Set shader usage flags
 	for (cVkPipelineStage& pipeline_stage : stages)
@@ -186,83 +186,115 @@ void cVkPipeline::_log_usage()
 	}
 }
 
-void cVkDescriptorSetLayoutBinding::log_usage()
+void cVkDescriptorSetLayout::log_usage()
 {
-	switch (descriptorType)
+	for (const cVkDescriptorSetLayoutBinding& binding : bindings)
 	{
-	case VK_DESCRIPTOR_TYPE_PARTITIONED_ACCELERATION_STRUCTURE_NV:
-	case VK_DESCRIPTOR_TYPE_TENSOR_ARM:
-		// TBD
-		break;
-	case VK_DESCRIPTOR_TYPE_SAMPLER:
-	case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
-		if (immutableSamplers.size() > 0)
+		for (VkSampler sampler : binding.immutableSamplers)
+		{
+			// This calls touch, no need to do anything else
+			ccast<cVkSampler, VkSampler>(sampler);
+		}
+	}
+}
+
+void cVkDescriptorSet::set_layout(cVkDescriptorSetLayout* new_layout)
+{
+	layout = new_layout;
+	// This is not spec specific, we use a copy of the layout to track the current values of the descriptor set
+	state_bindings = new_layout->bindings;
+#ifndef FAST
+	for (const cVkDescriptorSetLayoutBinding& binding : state_bindings)
+	{
+		for (VkSampler sampler : binding.immutableSamplers)
+		{
+			if (sampler == VK_NULL_HANDLE) continue;
+			cVkBase* resource = reinterpret_cast<cVkBase*>(sampler);
+			if (resources[resource]++ == 0) hold(resource, 1);
+		}
+	}
+#endif
+}
+
+void cVkDescriptorSet::log_usage()
+{
+#ifndef FAST
+	// Resources are only tracked per frame and per thread, like in touch()
+	const int frame = current_frame.load(std::memory_order_relaxed);
+	if (resources_touched_frame == frame && resources_touched_thread == thread_id) return;
+	resources_touched_frame = frame;
+	resources_touched_thread = thread_id;
+	for (const auto& pair : resources)
+	{
+		touch(pair.first);
+		if (pair.first->object_type == VK_OBJECT_TYPE_IMAGE_VIEW)
 		{
-			assert(immutableSamplers.size() >= descriptorCount);
-			for (unsigned j = 0; j < descriptorCount; j++)
-			{
-				if (immutableSamplers[j] == VK_NULL_HANDLE) continue;
-				// These call touch, no need to do anything else
-				ccast<cVkSampler, VkSampler>(immutableSamplers[j]);
-			}
+			touch(static_cast<cVkImageView*>(pair.first)->image);
 		}
+	}
+#endif
+}
+
+void cVkDescriptorSet::release_resources()
+{
+#ifndef FAST
+	for (const auto& pair : resources) hold(pair.first, -1);
+	resources.clear();
+	resources_touched_frame = -1;
+#endif
+}
+
+/// Add or remove a reference to a resource. The set holds each resource while it has any
+/// references to it, so that it is not reclaimed while we may still touch it.
+static inline void reference(std::unordered_map<cVkBase*, uint32_t>& resources, cVkBase* resource, int delta)
+{
+	if (!resource) return;
+	if (delta > 0)
+	{
+		if (resources[resource]++ == 0) hold(resource, 1);
+		return;
+	}
+	auto it = resources.find(resource);
+	assert(it != resources.end());
+	if (--it->second > 0) return;
+	resources.erase(it);
+	hold(resource, -1);
+}
+
+void cVkDescriptorSet::reference_descriptor(const cVkDescriptorSetLayoutBinding& binding, VkDescriptorType type, uint32_t element, int delta)
+{
+	switch (type)
+	{
+	case VK_DESCRIPTOR_TYPE_SAMPLER:
+	case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
 	case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
 	case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
 	case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
-		if (pImageInfo.size() > 0)
+	{
+		const VkDescriptorImageInfo& info = binding.pImageInfo.at(element);
+		// The sampler is ignored for other types, and for bindings with immutable samplers
+		if ((type == VK_DESCRIPTOR_TYPE_SAMPLER || type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER) && binding.immutableSamplers.empty())
+		{
+			reference(resources, reinterpret_cast<cVkBase*>(info.sampler), delta);
+		}
+		// Images are touched through their views
+		if (type != VK_DESCRIPTOR_TYPE_SAMPLER)
 		{
-			assert(pImageInfo.size() >= descriptorCount);
-			for (unsigned j = 0; j < descriptorCount; j++)
-			{
-				if (pImageInfo[j].imageView == VK_NULL_HANDLE) continue;
-				// These call touch, no need to do anything else
-				ccast<cVkSampler, VkSampler>(pImageInfo[j].sampler);
-				ccast<cVkImageView, VkImageView>(pImageInfo[j].imageView);
-				cVkImageView* image_view = ccast<cVkImageView, VkImageView>(pImageInfo[j].imageView);
-				touch(image_view->image);
-			}
+			reference(resources, reinterpret_cast<cVkBase*>(info.imageView), delta);
 		}
 		break;
+	}
 	case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
 	case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
 	case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC:
 	case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC:
-		if (pBufferInfo.size() > 0)
-		{
-			assert(pBufferInfo.size() >= descriptorCount);
-			for (unsigned j = 0; j < descriptorCount; j++)
-			{
-				if (pBufferInfo[j].buffer == VK_NULL_HANDLE) continue;
-				// This calls touch, no need to do anything else
-				ccast<cVkBuffer, VkBuffer>(pBufferInfo[j].buffer);
-			}
-		}
+		reference(resources, reinterpret_cast<cVkBase*>(binding.pBufferInfo.at(element).buffer), delta);
 		break;
 	case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
 	case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER:
-		if (pTexelBufferView.size() > 0)
-		{
-			assert(pTexelBufferView.size() >= descriptorCount);
-			for (unsigned j = 0; j < descriptorCount; j++)
-			{
-				if (pTexelBufferView[j] == VK_NULL_HANDLE) continue;
-				// This calls touch, no need to do anything else
-				ccast<cVkBufferView, VkBufferView>(pTexelBufferView[j]);
-			}
-		}
-		break;
-	case VK_DESCRIPTOR_TYPE_INLINE_UNIFORM_BLOCK: // Provided by VK_VERSION_1_3
-		break;
-	case VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR: // Provided by VK_KHR_acceleration_structure
-		break;
-	case VK_DESCRIPTOR_TYPE_MUTABLE_EXT: // Provided by VK_EXT_mutable_descriptor_type
-		break;
-	case VK_DESCRIPTOR_TYPE_BLOCK_MATCH_IMAGE_QCOM: // Provided by VK_QCOM_image_processing
-	case VK_DESCRIPTOR_TYPE_SAMPLE_WEIGHT_IMAGE_QCOM: // Provided by VK_QCOM_image_processing
-		break;
-	case VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_NV: // Provided by VK_NV_ray_tracing
+		reference(resources, reinterpret_cast<cVkBase*>(binding.pTexelBufferView.at(element)), delta);
 		break;
-	case VK_DESCRIPTOR_TYPE_MAX_ENUM:
+	default: // nothing that we track
 		break;
 	}
 }
@@ -4,13 +4,23 @@
 // for tracking Vulkan state.
 
 #include "util.h"
+#include "object_table.h"
 
 #include <algorithm>
 #include <atomic>
+#include <bit>
+#include <bitset>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <string.h>
 #include <vector>
 #include <list> // need to use linked lists since we return pointers to contents _and_ add stuff
 #include <string>
 #include <map>
+#include <unordered_map>
 #include <unordered_set>
 #include <vulkan/vk_icd.h>
 #include <functional>
@@ -49,10 +59,104 @@ struct cVkFramebuffer;
 struct cVkPipelineCache;
 struct cVkQueryPool;
 struct cVkBuffer;
+struct cVkImage;
 struct cVkDeviceMemory;
 struct cVkDescriptorSet;
 struct cVkSamplerYcbcrConversion;
 
+/// Compact set of frame numbers, stored as sorted runs of consecutive frames. Objects are
+/// usually used in long streaks of frames, and frames are added in increasing order, so
+/// adding a frame is almost always just extending or appending the last run.
+struct FrameSet
+{
+	struct Run
+	{
+		int first;
+		int last; // inclusive
+	};
+	std::vector<Run> runs;
+
+	void insert(int frame)
+	{
+		if (runs.empty() || frame > runs.back().last + 1) { runs.push_back({ frame, frame }); return; }
+		if (frame == runs.back().last + 1) { runs.back().last = frame; return; }
+		if (frame >= runs.back().first) return;
+		merge_run({ frame, frame }); // out of order
+	}
+
+	bool contains(int frame) const
+	{
+		auto it = std::upper_bound(runs.cbegin(), runs.cend(), frame, [](int f, const Run& r) { return f < r.first; });
+		return it != runs.cbegin() && frame <= (it - 1)->last;
+	}
+
+	bool empty() const { return runs.empty(); }
+
+	template<typename T>
+	bool intersects(const T& frames) const
+	{
+		for (const int f : frames) if (contains(f)) return true;
+		return false;
+	}
+
+	void merge(const FrameSet& other)
+	{
+		for (const Run& r : other.runs) merge_run(r);
+	}
+
+private:
+	void merge_run(Run r)
+	{
+		auto it = std::lower_bound(runs.begin(), runs.end(), r.first, [](const Run& a, int f) { return a.last + 1 < f; });
+		auto end = it;
+		while (end != runs.end() && end->first <= r.last + 1)
+		{
+			r.first = std::min(r.first, end->first);
+			r.last = std::max(r.last, end->last);
+			++end;
+		}
+		it = runs.erase(it, end);
+		runs.insert(it, r);
+	}
+};
+
+/// Set of thread IDs. Our thread IDs are small sequential numbers, so the first 64 of them
+/// are kept in a bitmask, and any others in a (normally empty) list. The bitmask is accessed
+/// atomically, so that lookups in it need no lock; inserts must still be serialized.
+struct ThreadSet
+{
+	uint64_t mask = 0;
+	std::vector<long> overflow;
+
+	bool contains(long t) const
+	{
+		if (t >= 0 && t < 64) return contains_masked(t);
+		return std::find(overflow.cbegin(), overflow.cend(), t) != overflow.cend();
+	}
+
+	/// As contains(), but safe to call while another thread inserts. Always false for
+	/// thread IDs that do not fit in the bitmask.
+	bool contains_masked(long t) const
+	{
+		return t >= 0 && t < 64 && (std::atomic_ref<uint64_t>(const_cast<uint64_t&>(mask)).load(std::memory_order_relaxed) & (uint64_t(1) << t));
+	}
+
+	void insert(long t)
+	{
+		if (t >= 0 && t < 64) std::atomic_ref<uint64_t>(mask).fetch_or(uint64_t(1) << t, std::memory_order_relaxed);
+		else if (!contains(t)) overflow.push_back(t);
+	}
+
+	size_t size() const { return std::popcount(mask) + overflow.size(); }
+
+	template<typename F>
+	void for_each(F f) const
+	{
+		for (uint64_t m = mask; m; m &= m - 1) f((long)std::countr_zero(m));
+		for (long t : overflow) f(t);
+	}
+};
+
 struct cVkBase
 {
 	VK_LOADER_DATA loader_data; // required for dispatchable objects by the loader/ICD interface
@@ -72,18 +176,25 @@ struct cVkBase
 	const void* pTag = nullptr;
 	size_t tagSize = 0;
 	uint64_t tagName = 0;
+	/// Last frame this object was touched in, so that repeated touches within a frame are cheap
+	int touched_frame = -1;
 	/// Log thread accesses
-	std::unordered_set<long> accessed_by_thread;
+	ThreadSet accessed_by_thread;
 	/// Log frame usage
-	std::unordered_set<int> used_in_frame;
+	FrameSet used_in_frame;
 	/// Log frame usage - transitive
-	std::unordered_set<int> used_in_frame_transitive;
+	FrameSet used_in_frame_transitive;
 	/// Unique ID for object for cross-object linking in dumped data
 	static std::atomic_int last_uid;
 	/// This object's UID
 	int uid = last_uid++;
-	/// We have no real deletion, so we can track everything
+	/// Destroyed objects are kept around so that we can track everything, unless
+	/// CHAMELEON_RECLAIM is set. Set with std::atomic_ref, since a present on another
+	/// thread may be looking for objects to reclaim.
 	bool destroyed = false;
+	/// Number of descriptor sets and image views that refer to this object and may follow the
+	/// reference when they are used, so it must not be reclaimed yet. Changed through hold().
+	uint32_t references = 0;
 	/// Private data
 	std::map<VkPrivateDataSlot, uint64_t> slots;
 
@@ -91,20 +202,22 @@ struct cVkBase
 	void update(cVkBase* parent)
 	{
 #ifndef FAST
-		parent->used_in_frame_transitive.insert(used_in_frame_transitive.cbegin(), used_in_frame_transitive.cend());
+		parent->used_in_frame_transitive.merge(used_in_frame_transitive);
 #endif
 	}
 
-	// Helper function for user defined actions that should happen when touch(..) is called on this object
-	// Can't use polymorphism here, as the vtable pointer will mess up the ICD_LOADER_MAGIC field on some compilers
-	std::function<void()> log_usage;
-
 	cVkBase()
 	{
 		set_loader_magic_value(this);
 	}
 };
 
+/// Keep (delta = 1) or stop keeping (delta = -1) an object from being reclaimed
+static inline void hold(cVkBase* v, int delta)
+{
+	std::atomic_ref<uint32_t>(v->references).fetch_add((uint32_t)delta, std::memory_order_acq_rel);
+}
+
 struct cVkSamplerYcbcrConversion : cVkBase
 {
 };
@@ -148,11 +261,13 @@ struct cVkPayload // _not_ based on cVkBase
 	// nothing
 };
 
+// Payloads are stored inline in the command stream, so they must be trivially destructible.
+// Variable length data is stored directly after the payload struct.
+
 struct cVkPayloadMarker : cVkPayload // _not_ based on VkBase
 {
-	std::string marker_name;
-
-	cVkPayloadMarker(const std::string& _name) : marker_name(_name) {}
+	const char* marker_name() const { return reinterpret_cast<const char*>(this + 1); }
+	char* marker_name() { return reinterpret_cast<char*>(this + 1); }
 };
 
 struct cVkPayloadQuery : cVkPayload // _not_ based on VkBase
@@ -183,14 +298,70 @@ struct cVkPayloadCopyBuffer : cVkPayload
 {
 	cVkBuffer* srcBuffer = nullptr;
 	cVkBuffer* dstBuffer = nullptr;
-	std::vector<VkBufferCopy> regions;
+	uint32_t regionCount = 0;
+
+	const VkBufferCopy* regions() const { return reinterpret_cast<const VkBufferCopy*>(this + 1); }
+	VkBufferCopy* regions() { return reinterpret_cast<VkBufferCopy*>(this + 1); }
+};
+
+struct cVkPayloadFillBuffer : cVkPayload
+{
+	cVkBuffer* dstBuffer = nullptr;
+	VkDeviceSize dstOffset = 0;
+	VkDeviceSize size = 0;
+	uint32_t data = 0;
+};
+
+struct cVkPayloadUpdateBuffer : cVkPayload
+{
+	cVkBuffer* dstBuffer = nullptr;
+	VkDeviceSize dstOffset = 0;
+	VkDeviceSize dataSize = 0;
+
+	const char* data() const { return reinterpret_cast<const char*>(this + 1); }
+	char* data() { return reinterpret_cast<char*>(this + 1); }
+};
+
+struct cVkPayloadCopyImage : cVkPayload
+{
+	cVkImage* srcImage = nullptr;
+	cVkImage* dstImage = nullptr;
+	uint32_t regionCount = 0;
+
+	const VkImageCopy* regions() const { return reinterpret_cast<const VkImageCopy*>(this + 1); }
+	VkImageCopy* regions() { return reinterpret_cast<VkImageCopy*>(this + 1); }
+};
+
+/// For copies in both directions between a buffer and an image
+struct cVkPayloadCopyBufferImage : cVkPayload
+{
+	cVkBuffer* buffer = nullptr;
+	cVkImage* image = nullptr;
+	uint32_t regionCount = 0;
+
+	const VkBufferImageCopy* regions() const { return reinterpret_cast<const VkBufferImageCopy*>(this + 1); }
+	VkBufferImageCopy* regions() { return reinterpret_cast<VkBufferImageCopy*>(this + 1); }
+};
+
+struct cVkPayloadBlitImage : cVkPayload
+{
+	cVkImage* srcImage = nullptr;
+	cVkImage* dstImage = nullptr;
+	VkFilter filter = VK_FILTER_NEAREST;
+	uint32_t regionCount = 0;
+
+	const VkImageBlit* regions() const { return reinterpret_cast<const VkImageBlit*>(this + 1); }
+	VkImageBlit* regions() { return reinterpret_cast<VkImageBlit*>(this + 1); }
 };
 
 struct cVkPayloadWriteAccelerationStructuresPropertiesKHR : cVkPayload
 {
 	uint32_t accelerationStructureCount = 0;
 	uint32_t firstQuery = 0;
-	std::vector<VkDeviceSize> sizes; // per-AS result payload (e.g. compacted sizes)
+
+	/// Per-AS result payload (e.g. compacted sizes), accelerationStructureCount entries
+	const VkDeviceSize* sizes() const { return reinterpret_cast<const VkDeviceSize*>(this + 1); }
+	VkDeviceSize* sizes() { return reinterpret_cast<VkDeviceSize*>(this + 1); }
 };
 
 struct cVkPayloadWriteMicromapsPropertiesEXT : cVkPayload
@@ -199,29 +370,205 @@ struct cVkPayloadWriteMicromapsPropertiesEXT : cVkPayload
 	uint32_t firstQuery = 0;
 };
 
+/// Indirect draws and dispatches. Their parameters are read from the buffers when the command
+/// is executed, since commands executed before it may write them.
+struct cVkPayloadIndirect : cVkPayload
+{
+	cVkBuffer* buffer = nullptr;
+	VkDeviceSize offset = 0;
+	cVkBuffer* countBuffer = nullptr; ///< if set, the draw count is read from it, up to drawCount
+	VkDeviceSize countBufferOffset = 0;
+	uint32_t drawCount = 0;
+	uint32_t stride = 0;
+};
+
+/// Header of a recorded command in a cVkCommandStream. It is directly followed by its
+/// resource bindings, and then by its data payload, if any.
 struct cVkCommand // _not_ based on cVkBase
 {
-	/// Name of command (same as name of function called to set the command).
-	std::vector<cVkBase*> bindings;
-	/// Data payload
-	cVkPayload* payload = nullptr;
-	/// Lifetime counter
-	MetricUnit count;
 	/// Type of command
 	vk_command name;
+	/// Number of resource bindings
+	uint32_t binding_count = 0;
+	/// Size of the whole record in bytes, including bindings and payload
+	uint32_t size = sizeof(cVkCommand);
+	/// Offset of the data payload from the start of the record, or zero if there is none
+	uint32_t payload_offset = 0;
+	/// Lifetime counter
+	MetricUnit count;
 
-	cVkCommand(vk_command _name, MetricUnit _count) { name = _name; count = _count; }
+	cVkCommand(vk_command _name, MetricUnit _count) : name(_name), count(_count) {}
 
-	~cVkCommand() { delete payload; }
+	cVkBase* const* bindings() const { return reinterpret_cast<cVkBase* const*>(this + 1); }
+	template<typename T> const T* payload() const { return payload_offset ? reinterpret_cast<const T*>(reinterpret_cast<const char*>(this) + payload_offset) : nullptr; }
+};
+
+/// Linear arena of recorded commands. Commands are written back to back into large memory
+/// chunks, so recording a command usually involves no memory allocation at all, and resetting
+/// only rewinds the write position.
+class cVkCommandStream
+{
+	static constexpr size_t chunk_size = 64 * 1024;
+	static constexpr size_t alignment = 8;
+
+	struct Chunk
+	{
+		char* data = nullptr;
+		size_t capacity = 0;
+		size_t used = 0;
+	};
+
+	std::vector<Chunk> chunks;
+	/// Chunk that we are currently writing to
+	size_t current = 0;
+	/// Offset of the last command in the current chunk
+	size_t last_offset = 0;
+	/// Number of commands recorded
+	size_t command_count = 0;
+
+	static inline size_t align(size_t bytes) { return (bytes + alignment - 1) & ~(alignment - 1); }
+
+	cVkCommand* last() { return reinterpret_cast<cVkCommand*>(chunks[current].data + last_offset); }
+
+	/// Make sure that we have a chunk with room for this many bytes, and return its index.
+	size_t find_chunk(size_t from, size_t bytes)
+	{
+		while (from < chunks.size() && chunks[from].capacity - chunks[from].used < bytes) from++;
+		if (from == chunks.size())
+		{
+			Chunk chunk;
+			chunk.capacity = std::max(chunk_size, bytes);
+			chunk.data = new char[chunk.capacity];
+			chunks.push_back(chunk);
+		}
+		return from;
+	}
+
+	/// Grow the last command by this many bytes and return a pointer to the new space.
+	char* grow(size_t bytes)
+	{
+		assert(command_count > 0);
+		bytes = align(bytes);
+		if (chunks[current].capacity - chunks[current].used < bytes)
+		{
+			// move the command to a chunk with more room
+			const size_t old_size = last()->size;
+			const size_t next = find_chunk(current + 1, old_size + bytes);
+			memcpy(chunks[next].data + chunks[next].used, last(), old_size);
+			chunks[current].used -= old_size;
+			last_offset = chunks[next].used;
+			chunks[next].used += old_size;
+			current = next;
+		}
+		char* ptr = chunks[current].data + chunks[current].used;
+		chunks[current].used += bytes;
+		last()->size += bytes;
+		return ptr;
+	}
+
+public:
+	class Iterator
+	{
+		const std::vector<Chunk>* chunks;
+		size_t chunk;
+		size_t offset;
+
+		void skip() { while (chunk < chunks->size() && offset >= (*chunks)[chunk].used) { chunk++; offset = 0; } }
+
+	public:
+		Iterator(const std::vector<Chunk>* _chunks, size_t _chunk) : chunks(_chunks), chunk(_chunk), offset(0) { skip(); }
+		const cVkCommand& operator*() const { return *reinterpret_cast<const cVkCommand*>((*chunks)[chunk].data + offset); }
+		Iterator& operator++() { offset += (**this).size; skip(); return *this; }
+		bool operator!=(const Iterator& other) const { return chunk != other.chunk || offset != other.offset; }
+	};
+
+	cVkCommandStream() {}
+
+	cVkCommandStream(const cVkCommandStream& other) : current(other.current), last_offset(other.last_offset), command_count(other.command_count)
+	{
+		for (const Chunk& c : other.chunks)
+		{
+			Chunk chunk = c;
+			chunk.data = new char[chunk.capacity];
+			memcpy(chunk.data, c.data, c.used);
+			chunks.push_back(chunk);
+		}
+	}
+
+	cVkCommandStream& operator=(const cVkCommandStream&) = delete;
+
+	~cVkCommandStream()
+	{
+		for (Chunk& c : chunks) delete[] c.data;
+	}
+
+	/// Start recording a new command.
+	cVkCommand& record(vk_command name, MetricUnit count)
+	{
+		const size_t bytes = align(sizeof(cVkCommand));
+		current = find_chunk(current, bytes);
+		last_offset = chunks[current].used;
+		chunks[current].used += bytes;
+		command_count++;
+		return *new (last()) cVkCommand(name, count);
+	}
+
+	/// Add a resource binding to the last recorded command. Must be done before adding a payload.
+	void bind(cVkBase* binding)
+	{
+		assert(last()->payload_offset == 0);
+		*reinterpret_cast<cVkBase**>(grow(sizeof(cVkBase*))) = binding;
+		last()->binding_count++;
+	}
+
+	/// Add a data payload to the last recorded command, with room for extra bytes of variable length data after it.
+	template<typename T>
+	T* payload(size_t extra = 0)
+	{
+		static_assert(std::is_trivially_destructible_v<T> && alignof(T) <= alignment);
+		assert(last()->payload_offset == 0);
+		const uint32_t offset = last()->size;
+		T* ptr = new (grow(sizeof(T) + extra)) T();
+		last()->payload_offset = offset;
+		return ptr;
+	}
+
+	/// Forget all recorded commands. Memory is kept for reuse unless release_resources is set.
+	void reset(bool release_resources)
+	{
+		for (Chunk& c : chunks) c.used = 0;
+		if (release_resources && chunks.size() > 1)
+		{
+			for (size_t i = 1; i < chunks.size(); i++) delete[] chunks[i].data;
+			chunks.resize(1);
+		}
+		current = 0;
+		last_offset = 0;
+		command_count = 0;
+	}
+
+	size_t size() const { return command_count; }
+
+	Iterator begin() const { return Iterator(&chunks, 0); }
+	Iterator end() const { return Iterator(&chunks, chunks.size()); }
 };
 
 struct cVkCmdState // _not_ based on cVkBase
 {
 	cVkPipeline* pipeline = nullptr;
 	cVkQueryPool* queryPool = nullptr;
-	cVkDescriptorSet** descriptorSets = nullptr;
+	cVkDescriptorSet* const* descriptorSets = nullptr;
 	uint32_t descriptorSetCount = 0;
 	uint32_t query = 0;
+	// Work done by the executed commands, for the per-frame metrics
+	long draws = 0;
+	long vertices = 0;
+	long dispatches = 0;
+	long workgroups = 0;
+	long bytes_copied = 0;
+	/// Whether to touch used objects and count work against them. Off for queue worker threads,
+	/// since application threads touch the same objects; the submitting thread does it instead.
+	bool track_usage = true;
 };
 
 struct cVkDescriptorUpdateTemplate : cVkBase
@@ -242,6 +589,8 @@ struct cVkCommandBuffer : cVkBase
 	cVkDevice* device = nullptr;
 	VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_MAX_ENUM;
 	State state = Initial;
+	/// Submissions of this command buffer that have not retired yet. Protected by the device's sync_mutex.
+	uint32_t pending_submissions = 0;
 	struct
 	{
 		cVkRenderPass* renderPass = nullptr;
@@ -251,7 +600,7 @@ struct cVkCommandBuffer : cVkBase
 		VkQueryControlFlags queryFlags = 0;
 		VkQueryPipelineStatisticFlags pipelineStatistics = 0;
 	} secondary;
-	std::list<cVkCommand> commands;
+	cVkCommandStream commands;
 	VkPipelineStageFlags2 maxStageFlags = 0;
 
 	/// Breakdown of actions in the commandbuffer. Secondary command buffers are not counted.
@@ -293,6 +642,16 @@ struct cVkCommandPool : cVkBase
 	}
 };
 
+/// Memory allocated from each heap of a physical device, by all of its devices. Copying it
+/// gives a fresh, empty count, so that the physical device stays copyable.
+struct cVkHeapUsage
+{
+	std::atomic<VkDeviceSize> usage[VK_MAX_MEMORY_HEAPS] = {};
+
+	cVkHeapUsage() {}
+	cVkHeapUsage(const cVkHeapUsage&) {}
+};
+
 struct cVkPhysicalDevice : cVkBase
 {
 	std::map<std::string, uint32_t> extensions;
@@ -300,6 +659,7 @@ struct cVkPhysicalDevice : cVkBase
 	std::map<VkStructureType, std::pair<void*, size_t>> extendedProperties;
 	VkPhysicalDeviceProperties properties = { 0 };
 	VkPhysicalDeviceMemoryProperties memoryProperties = { 0 };
+	cVkHeapUsage heap_usage;
 	VkPhysicalDeviceRayTracingPipelinePropertiesKHR rayTracingPipelineProperties = {
 		VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR,
 		nullptr,
@@ -328,6 +688,9 @@ struct cVkPhysicalDevice : cVkBase
 	std::list<VkQueueFamilyProperties> queueFamilies;
 	std::list<cVkDevice> devices;
 	std::list<cVkDisplayKHR> displays;
+	/// Compiled GPU profile that features and extendedProperties point into, if loaded from the cache
+	void* profile_mapping = nullptr;
+	size_t profile_mapping_size = 0;
 
 	void update(cVkBase* parent);
 
@@ -380,6 +743,40 @@ struct cVkPendingSubmission
 	std::vector<cVkSemaphoreOperation> waits;
 	std::vector<cVkSemaphoreOperation> signals;
 	cVkFence* fence = nullptr;
+	/// Command buffers in this submission. They are in the pending state until it retires.
+	std::vector<cVkCommandBuffer*> commandbuffers;
+};
+
+/// Lock-free single-producer, single-consumer ring of submissions handed over to a queue's
+/// worker thread. Producers are serialized by the device's sync_mutex. The consumer sleeps
+/// on the tail index when the ring is empty.
+struct cVkSubmissionRing
+{
+	static constexpr size_t capacity = 64;
+	cVkPendingSubmission* items[capacity];
+	std::atomic_size_t head { 0 }; ///< next item to pop, only written by the consumer
+	std::atomic_size_t tail { 0 }; ///< next item to push, only written by the producer
+
+	/// Caller must make sure the ring is not full.
+	void push(cVkPendingSubmission* submission)
+	{
+		const size_t t = tail.load(std::memory_order_relaxed);
+		assert(t - head.load(std::memory_order_acquire) < capacity);
+		items[t % capacity] = submission;
+		tail.store(t + 1, std::memory_order_release);
+		tail.notify_one();
+	}
+
+	/// Blocks until there is something to pop.
+	cVkPendingSubmission* pop()
+	{
+		const size_t h = head.load(std::memory_order_relaxed);
+		size_t t;
+		while ((t = tail.load(std::memory_order_acquire)) == h) tail.wait(t, std::memory_order_acquire);
+		cVkPendingSubmission* submission = items[h % capacity];
+		head.store(h + 1, std::memory_order_release);
+		return submission;
+	}
 };
 
 struct cVkQueue : cVkBase
@@ -387,9 +784,17 @@ struct cVkQueue : cVkBase
 	cVkDevice* device = nullptr;
 	int index = -1;
 	float priority = 0.0f;
-	std::vector<cVkCommandBuffer*> commandbuffers;
 	std::list<cVkPendingSubmission> pendingSubmissions;
 	std::map<int, int> stageflag_usage; // mapping flag bit -> usage counter
+	/// Oldest unfinished submission is blocked on a semaphore, and we are in its waiter list
+	bool blocked = false;
+
+	// Only used with CHAMELEON_ASYNC_QUEUES
+	/// Executes our submissions once their waits are satisfied
+	std::thread worker;
+	cVkSubmissionRing ring;
+	/// Number of submissions at the front of pendingSubmissions that are handed to the worker
+	size_t handed = 0;
 
 	cVkQueue()
 	{
@@ -405,6 +810,10 @@ struct cVkDeviceMemory : cVkBase
 	uint32_t heapIndex = 0;
 	char* ptr = nullptr;
 	bool mapped = false;
+	bool dirty_tracked = false;
+	/// Frames in which the application wrote to this memory, with the number of pages it wrote
+	/// to in each. Only collected with dirty tracking.
+	std::vector<std::pair<int, uint32_t>> dirty_pages;
 
 	cVkDeviceMemory()
 	{
@@ -495,6 +904,17 @@ struct cVkSemaphore : cVkBase
 	VkSemaphoreType type = VK_SEMAPHORE_TYPE_MAX_ENUM;
 	bool binary_signalled = false;
 
+	struct Waiter
+	{
+		uint64_t value; // always zero for binary semaphores
+		cVkQueue* queue;
+		bool operator>(const Waiter& other) const { return value > other.value; }
+	};
+	/// Queues whose oldest pending submission is blocked on this semaphore. Kept as a min-heap
+	/// on the awaited value, so that a signal only needs to look at the waiters it releases.
+	/// Protected by the device's sync_mutex.
+	std::vector<Waiter> waiters;
+
 	cVkSemaphore()
 	{
 		object_type = VK_OBJECT_TYPE_SEMAPHORE;
@@ -642,8 +1062,6 @@ struct cVkDescriptorSetLayoutBinding // _not_ based on cVkBase
 	std::vector<VkDescriptorBufferInfo> pBufferInfo;
 	std::vector<VkBufferView> pTexelBufferView;
 	std::vector<VkSampler> immutableSamplers;
-
-	void log_usage();
 };
 
 struct cVkDescriptorSetLayout : cVkBase
@@ -655,16 +1073,10 @@ struct cVkDescriptorSetLayout : cVkBase
 	{
 		object_type = VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT;
 		debug_object_type = VK_DEBUG_REPORT_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT_EXT;
-		log_usage = std::bind(&cVkDescriptorSetLayout::_log_usage, this);
 	}
 
-	void _log_usage()
-	{
-		for (auto& binding : bindings)
-		{
-			binding.log_usage();
-		}
-	}
+	/// Touch the immutable samplers, called when the layout is created and when it is touched
+	void log_usage();
 };
 
 struct cVkPipelineBinary : cVkBase
@@ -804,6 +1216,7 @@ struct cVkPipeline : cVkBase
 		long draws = 0;
 		long vertices = 0;
 		long dispatches = 0;
+		long workgroups = 0;
 	} count;
 
 	void update(cVkBase* parent);
@@ -812,10 +1225,10 @@ struct cVkPipeline : cVkBase
 	{
 		object_type = VK_OBJECT_TYPE_PIPELINE;
 		debug_object_type = VK_DEBUG_REPORT_OBJECT_TYPE_PIPELINE_EXT;
-		log_usage = std::bind(&cVkPipeline::_log_usage, this);
 	}
 
-	void _log_usage();
+	/// Set shader usage flags, called when the pipeline is created and when it is touched
+	void log_usage();
 };
 
 struct cVkPipelineCache : cVkBase
@@ -826,6 +1239,8 @@ struct cVkPipelineCache : cVkBase
 
 	/// pipeline in cache, bool if active or not (ie destroyed)
 	std::map<cVkPipeline*, bool> pipelines;
+	/// Pipelines may be created with the same cache from several threads at once
+	std::mutex pipelines_mutex;
 
 	void update(cVkBase* parent);
 
@@ -851,6 +1266,12 @@ struct cVkDescriptorSet : cVkBase
 {
 	cVkDescriptorSetLayout* layout;
 	std::vector<cVkDescriptorSetLayoutBinding> state_bindings;
+	/// Resources referenced by the descriptors, with the number of references to each. Kept up
+	/// to date as descriptors are written, so that using the set does not need to walk them.
+	std::unordered_map<cVkBase*, uint32_t> resources;
+	/// Frame and thread that the resources were last touched in, so that repeated use is cheap
+	int resources_touched_frame = -1;
+	long resources_touched_thread = 0;
 
 	cVkDescriptorSet()
 	{
@@ -858,6 +1279,32 @@ struct cVkDescriptorSet : cVkBase
 		debug_object_type = VK_DEBUG_REPORT_OBJECT_TYPE_DESCRIPTOR_SET_EXT;
 	}
 
+	/// Start out with the bindings of the layout, and reference its immutable samplers.
+	void set_layout(cVkDescriptorSetLayout* new_layout);
+
+	/// Touch all referenced resources, called when the set is used by a draw or dispatch.
+	void log_usage();
+
+	/// Drop all references to resources, called when the set is freed.
+	void release_resources();
+
+	/// Add (delta = 1) or remove (delta = -1) the references of one descriptor.
+	void reference_descriptor(const cVkDescriptorSetLayoutBinding& binding, VkDescriptorType type, uint32_t element, int delta);
+
+	/// Overwrite one descriptor, and move its references from the old to the new resources.
+	template<typename T>
+	void write_descriptor(cVkDescriptorSetLayoutBinding& binding, std::vector<T>& values, VkDescriptorType type, uint32_t element, const T& value)
+	{
+#ifndef FAST
+		reference_descriptor(binding, type, element, -1);
+#endif
+		values[element] = value;
+#ifndef FAST
+		reference_descriptor(binding, type, element, 1);
+		resources_touched_frame = -1;
+#endif
+	}
+
 	void handle_write(const VkWriteDescriptorSet* descriptor_write)
 	{
 		for (cVkDescriptorSetLayoutBinding& layout_binding : state_bindings) {
@@ -883,8 +1330,10 @@ struct cVkDescriptorSet : cVkBase
 				}
 				for (unsigned j = 0; j < descriptor_write->descriptorCount; j++)
 				{
-					if (descriptor_write->pImageInfo[j].imageView == VK_NULL_HANDLE) continue;
-					layout_binding.pImageInfo[j + descriptor_write->dstArrayElement] = descriptor_write->pImageInfo[j];
+					const VkDescriptorImageInfo& info = descriptor_write->pImageInfo[j];
+					const bool empty = (descriptor_write->descriptorType == VK_DESCRIPTOR_TYPE_SAMPLER) ? info.sampler == VK_NULL_HANDLE : info.imageView == VK_NULL_HANDLE;
+					if (empty) continue;
+					write_descriptor(layout_binding, layout_binding.pImageInfo, descriptor_write->descriptorType, j + descriptor_write->dstArrayElement, info);
 				}
 				break;
 			case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
@@ -899,7 +1348,7 @@ struct cVkDescriptorSet : cVkBase
 				for (unsigned j = 0; j < descriptor_write->descriptorCount; j++)
 				{
 					if (descriptor_write->pBufferInfo[j].buffer == VK_NULL_HANDLE) continue;
-					layout_binding.pBufferInfo[j + descriptor_write->dstArrayElement] = descriptor_write->pBufferInfo[j];
+					write_descriptor(layout_binding, layout_binding.pBufferInfo, descriptor_write->descriptorType, j + descriptor_write->dstArrayElement, descriptor_write->pBufferInfo[j]);
 				}
 				break;
 			case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
@@ -912,7 +1361,7 @@ struct cVkDescriptorSet : cVkBase
 				for (unsigned j = 0; j < descriptor_write->descriptorCount; j++)
 				{
 					if (descriptor_write->pTexelBufferView[j] == VK_NULL_HANDLE) continue;
-					layout_binding.pTexelBufferView[j + descriptor_write->dstArrayElement] = descriptor_write->pTexelBufferView[j];
+					write_descriptor(layout_binding, layout_binding.pTexelBufferView, descriptor_write->descriptorType, j + descriptor_write->dstArrayElement, descriptor_write->pTexelBufferView[j]);
 				}
 
 				break;
@@ -1060,44 +1509,97 @@ struct cVkMicromapEXT : cVkBase
 {
 };
 
+/// Compact copies of the reported properties of objects that have been reclaimed, see
+/// CHAMELEON_RECLAIM. Reclaimed objects with identical properties share one entry.
+struct cVkBufferSummary
+{
+	VkBufferCreateFlags flags;
+	VkBufferUsageFlags usage;
+	VkSharingMode sharingMode;
+	VkDeviceSize size;
+	VkDeviceSize memoryOffset;
+
+	cVkBufferSummary(const cVkBuffer& v) : flags(v.flags), usage(v.usage), sharingMode(v.sharingMode), size(v.size), memoryOffset(v.memoryOffset) {}
+	auto operator<=>(const cVkBufferSummary&) const = default;
+};
+
+struct cVkImageSummary
+{
+	VkImageCreateFlags flags;
+	VkImageType imageType;
+	VkFormat format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t depth;
+	VkSampleCountFlagBits samples;
+	VkImageTiling tiling;
+	VkImageUsageFlags usage;
+	VkSharingMode sharingMode;
+	uint32_t mipLevels;
+	uint32_t arrayLayers;
+
+	cVkImageSummary(const cVkImage& v) : flags(v.flags), imageType(v.imageType), format(v.format), width(v.extent.width), height(v.extent.height),
+		depth(v.extent.depth), samples(v.samples), tiling(v.tiling), usage(v.usage), sharingMode(v.sharingMode), mipLevels(v.mipLevels), arrayLayers(v.arrayLayers) {}
+	auto operator<=>(const cVkImageSummary&) const = default;
+};
+
+struct cVkImageViewSummary
+{
+	VkImageViewCreateFlags flags;
+	VkImageViewType viewType;
+	VkFormat format;
+
+	cVkImageViewSummary(const cVkImageView& v) : flags(v.flags), viewType(v.viewType), format(v.format) {}
+	auto operator<=>(const cVkImageViewSummary&) const = default;
+};
+
 struct cVkDevice : cVkBase
 {
-	std::list<cVkCommandPool> commandPools;
-	std::list<cVkQueue> queues;
+	/// Protects queue submission state, that is the pending submissions of our queues and the
+	/// semaphore and fence signals they make
+	std::mutex sync_mutex;
+	/// Notified under sync_mutex whenever a fence or semaphore is signalled
+	std::condition_variable sync_cond;
+
+	// Objects may be created from any thread, so these need to be thread-safe
+	ObjectTable<cVkCommandPool> commandPools;
+	ObjectTable<cVkQueue> queues;
 	std::vector<VkQueue> queue_ptrs; // quick lookup table
-	std::list<cVkDeviceMemory> deviceMemory;
-	std::list<cVkSwapchainKHR> swapchains;
-	std::list<cVkFence> fences;
-	std::list<cVkSemaphore> semaphores;
-	std::list<cVkEvent> events;
-	std::list<cVkImage> images;
-	std::list<cVkImageView> imageViews;
-	std::list<cVkBuffer> buffers;
-	std::list<cVkBufferView> bufferViews;
-	std::list<cVkQueryPool> queryPools;
-	std::list<cVkShaderModule> shaderModules;
-	std::list<cVkPipelineCache> pipelineCaches;
-	std::list<cVkPipelineLayout> pipelineLayouts;
-	std::list<cVkSampler> samplers;
-	std::list<cVkDescriptorSetLayout> descriptorSetLayouts;
-	std::list<cVkRenderPass> renderpasses;
-	std::list<cVkDescriptorPool> descriptorPools;
-	std::list<cVkFramebuffer> framebuffers;
-	std::list<cVkPipeline> pipelines;
-	std::list<cVkDescriptorUpdateTemplate> descriptorupdatetemplates;
-	std::list<cVkAccelerationStructureKHR> accelerationStructures;
-	std::list<cVkMicromapEXT> micromaps;
-	std::list<cVkWeights> weights;
-	std::list<cVkTensor> tensors;
+	ObjectTable<cVkDeviceMemory> deviceMemory;
+	ObjectTable<cVkSwapchainKHR> swapchains;
+	ObjectTable<cVkFence> fences;
+	ObjectTable<cVkSemaphore> semaphores;
+	ObjectTable<cVkEvent> events;
+	ObjectTable<cVkImage> images;
+	ObjectTable<cVkImageView> imageViews;
+	ObjectTable<cVkBuffer> buffers;
+	ObjectTable<cVkBufferView> bufferViews;
+	ObjectTable<cVkQueryPool> queryPools;
+	ObjectTable<cVkShaderModule> shaderModules;
+	ObjectTable<cVkPipelineCache> pipelineCaches;
+	ObjectTable<cVkPipelineLayout> pipelineLayouts;
+	ObjectTable<cVkSampler> samplers;
+	ObjectTable<cVkDescriptorSetLayout> descriptorSetLayouts;
+	ObjectTable<cVkRenderPass> renderpasses;
+	ObjectTable<cVkDescriptorPool> descriptorPools;
+	ObjectTable<cVkFramebuffer> framebuffers;
+	ObjectTable<cVkPipeline> pipelines;
+	ObjectTable<cVkDescriptorUpdateTemplate> descriptorupdatetemplates;
+	ObjectTable<cVkAccelerationStructureKHR> accelerationStructures;
+	ObjectTable<cVkMicromapEXT> micromaps;
+	ObjectTable<cVkWeights> weights;
+	ObjectTable<cVkTensor> tensors;
 #ifdef VK_ARM_SHADER_INSTRUMENTATION_SPEC_VERSION
-	std::list<cVkShaderInstrumentationARM> shaderInstrumentations;
+	ObjectTable<cVkShaderInstrumentationARM> shaderInstrumentations;
 #endif
-	std::list<cVkTensorView> tensorviews;
-	std::list<cVkDataGraphPipelineSession> dataGraphPipelineSessions;
-	std::list<cVkSamplerYcbcrConversion> samplerycbcrconversions;
-	std::list<cVkPrivateDataSlot> slots;
+	ObjectTable<cVkTensorView> tensorviews;
+	ObjectTable<cVkDataGraphPipelineSession> dataGraphPipelineSessions;
+	ObjectTable<cVkSamplerYcbcrConversion> samplerycbcrconversions;
+	ObjectTable<cVkPrivateDataSlot> slots;
 
 	std::vector<std::string> enabledExtensions;
+	/// Which entries in proc_table vkGetDeviceProcAddr returns for this device
+	std::bitset<PROC_TABLE_SIZE> procs_enabled;
 	VkPhysicalDeviceDescriptorBufferPropertiesEXT descriptorBufferProperties = {
 		VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_PROPERTIES_EXT
 	};
@@ -1106,13 +1608,29 @@ struct cVkDevice : cVkBase
 
 	uint32_t memoryTypeBits = 0;
 
+	/// Physical device that this device was created from, which tracks its memory heap usage
+	cVkPhysicalDevice* physical = nullptr;
 	/// Amount of each type of memory that is currently allocated.
-	std::map<uint32_t, uint64_t> memory_allocated;
+	std::atomic_uint64_t memory_allocated[VK_MAX_MEMORY_TYPES] = {};
 	/// Highest amount of each type of memory that has ever been allocated.
-	std::map<uint32_t, uint64_t> memory_highest;
+	std::atomic_uint64_t memory_highest[VK_MAX_MEMORY_TYPES] = {};
 	std::map<uint32_t, uint32_t> memory_type_heap_index;
 	std::vector<cVkDeviceMemoryReportCallback> memory_report_callbacks;
 
+	/// Protects reclaimed, and makes sure only one thread at a time frees destroyed objects
+	std::mutex reclaim_mutex;
+	/// Statistics for objects that have been freed, so that we can still report on them
+	struct
+	{
+		std::map<cVkBufferSummary, uint64_t> buffers;
+		std::map<cVkImageSummary, uint64_t> images;
+		std::map<cVkImageViewSummary, uint64_t> imageViews;
+		uint64_t bufferViews = 0;
+		uint64_t framebuffers = 0;
+		/// Thread accesses of reclaimed objects that are reported with their thread accesses
+		std::map<long, uint64_t> accessed_by_thread;
+	} reclaimed;
+
 	cVkDevice()
 	{
 		object_type = VK_OBJECT_TYPE_DEVICE;
@@ -1121,6 +1639,15 @@ struct cVkDevice : cVkBase
 };
 
 #ifndef FAST
+/// Serializes usage tracking updates of objects, which can be touched from any thread. Striped by
+/// object address, so that a lock is shared by few objects, and the objects need not hold one each.
+extern std::mutex touch_locks[64];
+
+static inline std::mutex& touch_lock(const cVkBase* v)
+{
+	return touch_locks[(reinterpret_cast<uintptr_t>(v) * UINT64_C(0x9E3779B97F4A7C15)) >> 58];
+}
+
 static inline void touch(cVkBase* v)
 {
 	// cVkShaderModule can be used after being destroyed, because
@@ -1129,12 +1656,23 @@ static inline void touch(cVkBase* v)
 	//assert(!v || !v->destroyed);
 	if (v)
 	{
-		v->accessed_by_thread.insert(thread_id);
-		v->used_in_frame.insert(v->current_frame);
-		v->used_in_frame_transitive.insert(v->current_frame);
-		if (v->log_usage)
+		const int frame = v->current_frame.load(std::memory_order_relaxed);
+		// Usage is only tracked per frame and per thread, so anything after the first touch
+		// from this thread in this frame has nothing new to record. This check needs no lock.
+		if (std::atomic_ref<int>(v->touched_frame).load(std::memory_order_relaxed) == frame && v->accessed_by_thread.contains_masked(thread_id)) return;
+		{
+			std::lock_guard<std::mutex> lock(touch_lock(v));
+			std::atomic_ref<int>(v->touched_frame).store(frame, std::memory_order_relaxed);
+			v->accessed_by_thread.insert(thread_id);
+			v->used_in_frame.insert(frame);
+			v->used_in_frame_transitive.insert(frame);
+		}
+		// Objects with usage that follows from their own
+		switch (v->object_type)
 		{
-			v->log_usage();
+		case VK_OBJECT_TYPE_PIPELINE: static_cast<cVkPipeline*>(v)->log_usage(); break;
+		case VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT: static_cast<cVkDescriptorSetLayout*>(v)->log_usage(); break;
+		default: break;
 		}
 	}
 }
@@ -15,6 +15,8 @@
 
 #include "util.h"
 #include "vulkan_print.h"
+#include "report_writer.h"
+#include "dirty_tracking.h"
 #include "vulkan_auto.h"
 #include "vkjson.h"
 #include "tostring.h"
@@ -46,51 +48,56 @@ std::unordered_set<int> get_env_ints(const char* name)
 	return retval;
 }
 
-static Json::Value json_base(const cVkBase& base)
+static void count_thread_accesses(const cVkBase& base)
 {
-	Json::Value json;
-	json["frame_created"] = base.created_frame;
-	if (!deterministic) json["accessed_by_threads"] = Json::arrayValue;
-	json["uid"] = base.uid;
+	base.accessed_by_thread.for_each([&](long t) { threads[t]++; });
+}
+
+static void json_base(ReportWriter& out, const cVkBase& base)
+{
+	out.member("frame_created", base.created_frame);
+	out.member("uid", base.uid);
 	if (frames_of_interest.size() > 0)
 	{
-		json["frames_of_interest_usage"] = naive_intersect(base.used_in_frame, frames_of_interest);
-		json["frames_of_interest_involved"] = naive_intersect(base.used_in_frame_transitive, frames_of_interest);
+		out.member("frames_of_interest_usage", base.used_in_frame.intersects(frames_of_interest));
+		out.member("frames_of_interest_involved", base.used_in_frame_transitive.intersects(frames_of_interest));
+	}
+	count_thread_accesses(base);
+	out.key("accessed_by_threads");
+	if (deterministic)
+	{
+		out.value((int)base.accessed_by_thread.size()); // just the number of threads accessing, not their non-deterministic IDs
 	}
-	int hits = 0;
-	for (const auto& t : base.accessed_by_thread)
+	else
 	{
-		if (!deterministic) json["accessed_by_threads"].append((Json::Value::UInt64)t);
-		threads[t]++;
-		hits++;
+		out.begin_array();
+		base.accessed_by_thread.for_each([&](long t) { out.value((Json::Value::UInt64)t); });
+		out.end_array();
 	}
-	if (deterministic) json["accessed_by_threads"] = hits; // just the number of threads accessing, not their non-deterministic IDs
 	if (base.destroyed_frame != -1)
 	{
-		json["frame_destroyed"] = base.destroyed_frame;
+		out.member("frame_destroyed", base.destroyed_frame);
 	}
 	if (!base.marker_name.empty())
 	{
-		json["name"] = base.marker_name;
+		out.member("name", base.marker_name);
 	}
 	if (base.tagName != 0)
 	{
-		json["tag_name"] = (Json::Value::UInt64)base.tagName;
+		out.member("tag_name", (Json::Value::UInt64)base.tagName);
 	}
-	return json;
 }
 
-static void append_if_relevant(Json::Value& dst, const Json::Value& src, const cVkBase& base, int verbosity_level = 0)
+/// Whether to list an object in the report. Objects that are left out still need to have
+/// their thread accesses counted.
+static bool is_relevant(const cVkBase& base, int verbosity_level = 0)
 {
-	bool used = naive_intersect(base.used_in_frame_transitive, frames_of_interest);
+	bool used = base.used_in_frame_transitive.intersects(frames_of_interest);
 	if (frames_of_interest.size() > 0) // if limiting by frame, bump verbosity requirement
 	{
 		verbosity_level += 1;
 	}
-	if (verbose > verbosity_level || used)
-	{
-		dst.append(src);
-	}
+	return verbose > verbosity_level || used;
 }
 
 void write_file(const std::string& filename, const void *buffer, size_t size)
@@ -129,556 +136,817 @@ static std::string set_to_comma_string(const std::unordered_set<T>& a)
 	return retval;
 }
 
-static Json::Value histogram_to_json(const std::map<std::string, uint64_t>& histogram)
+template<typename T>
+static uint64_t map_total(const std::map<T, uint64_t>& counts)
 {
-	Json::Value histogramv;
-	for (const auto& pair : histogram)
-	{
-		histogramv[pair.first] = (Json::Value::UInt64)pair.second;
-	}
-	return histogramv;
+	uint64_t total = 0;
+	for (const auto& pair : counts) total += pair.second;
+	return total;
 }
 
-static Json::Value histogram_to_json(const std::map<uint64_t, uint64_t>& histogram)
+/// Histograms are keyed by the raw values and only converted to names here. Different values
+/// may share a name, so those are merged. An empty histogram is written as null.
+template<typename T, typename F>
+static void write_histogram(ReportWriter& out, const char* name, const std::map<T, uint64_t>& histogram, F to_name)
 {
-	Json::Value histogramv;
-	for (const auto& pair : histogram)
+	out.key(name);
+	if (histogram.empty())
 	{
-		histogramv[_to_string(pair.first)] = (Json::Value::UInt64)pair.second;
+		out.null();
+		return;
 	}
-	return histogramv;
+	std::map<std::string, uint64_t> named;
+	for (const auto& pair : histogram) named[to_name(pair.first)] += pair.second;
+	out.begin_object();
+	for (const auto& pair : named) out.member(pair.first, (Json::Value::UInt64)pair.second);
+	out.end_object();
 }
 
-void json_overview(const std::string& report_name, cVkInstance* instance, bool hw_info)
+static void write_histogram(ReportWriter& out, const char* name, const std::map<uint64_t, uint64_t>& histogram)
 {
-	instance->update(); // update transitive information
-	int dump_shaders = get_env_int("CHAMELEON_SHADERDUMP", 0);
-	verbose = get_env_int("CHAMELEON_VERBOSITY", 0); // verbosity level
-	frames_of_interest = get_env_ints("CHAMELEON_FRAMES");
-	Json::Value result = json_base(*instance);
-	Json::Value chameleon_settings;
-	chameleon_settings["verbosity"] = verbose;
-	chameleon_settings["dump_shaders"] = dump_shaders;
-	if (frames_of_interest.size() > 0)
+	write_histogram(out, name, histogram, [](uint64_t v) { return _to_string(v); });
+}
+
+static std::string bool_name(VkBool32 v)
+{
+	return v ? "true" : "false";
+}
+
+struct image_size
+{
+	uint32_t width;
+	uint32_t height;
+	uint32_t depth;
+	auto operator<=>(const image_size&) const = default;
+};
+
+static std::string image_size_name(const image_size& s)
+{
+	return std::to_string(s.width) + "x" + std::to_string(s.height) + "x" + std::to_string(s.depth);
+}
+
+static void json_pipeline(ReportWriter& out, const cVkPipeline& pipe)
+{
+	out.begin_object();
+	json_base(out, pipe);
+	out.member("flags", VkPipelineCreateFlags_to_string(pipe.flags));
+	if (pipe.layout) out.member("layout", pipe.layout->uid);
+	if (pipe.renderPass) out.member("renderpass", pipe.renderPass->uid);
+	out.member("draws", (Json::Value::UInt64)pipe.count.draws);
+	out.member("dispatches", (Json::Value::UInt64)pipe.count.dispatches);
+	out.member("workgroups", (Json::Value::UInt64)pipe.count.workgroups);
+	out.member("vertices", (Json::Value::UInt64)pipe.count.vertices);
+	if (pipe.subpass != UINT32_MAX) out.member("subpass", pipe.subpass);
+	out.key("stages");
+	out.begin_array();
+	for (const cVkPipelineStage &stage : pipe.stages)
+	{
+		out.begin_object(); // not based on cVkBase
+		out.member("flags", VkPipelineShaderStageCreateFlags_to_string(stage.flags));
+		out.member("stage", VkShaderStageFlags_to_string(stage.stage));
+		if (stage.module)
+		{
+			out.member("module", stage.module->uid);
+		}
+		out.member("name", stage.name);
+		out.member("specialization_data", !stage.specializationData.empty());
+		out.member("specialization_map_count", (int)stage.specializationMap.size());
+		out.end_object();
+	}
+	out.end_array();
+	if (pipe.vertexInputState.enabled)
 	{
-		chameleon_settings["frames_of_interest"] = set_to_comma_string(frames_of_interest);
+		out.key("vertex_input_state");
+		out.begin_object();
+		out.member("flags", VkPipelineVertexInputStateCreateFlags_to_string(pipe.vertexInputState.flags));
+		out.member("vertex_binding_descriptions_count", (int)pipe.vertexInputState.vertexBindingDescriptions.size());
+		out.member("vertex_attribute_descriptions_count", (int)pipe.vertexInputState.vertexAttributeDescriptions.size());
+		out.end_object();
 	}
-	const char* source = getenv("CHAMELEON_SOURCE");
-	if (source) result["source"] = source;
-	int priority = get_env_int("CHAMELEON_PRIORITY", -1);
-	if (priority != -1) result["priority"] = priority;
-	result["chameleon_settings"] = chameleon_settings;
-	result["instances"] = (unsigned)instance->instance_counter;
-	result["instance"] = instance->instance_id;
-	result["physical_devices"] = Json::arrayValue;
-	result["surfaces"] = Json::arrayValue;
-	result["displays"] = Json::arrayValue;
-	result["enabled_instance_extensions"] = Json::arrayValue;
-	for (const std::string& extension : instance->enabledExtensions)
+	if (pipe.vertexInputAssemblyState.enabled)
 	{
-		result["enabled_instance_extensions"].append(extension);
+		out.key("vertex_assembly_state");
+		out.begin_object();
+		out.member("flags", VkPipelineInputAssemblyStateCreateFlags_to_string(pipe.vertexInputAssemblyState.flags));
+		out.member("topology", VkPrimitiveTopology_to_string(pipe.vertexInputAssemblyState.topology));
+		out.member("primitive_restart_enable", pipe.vertexInputAssemblyState.primitiveRestartEnable);
+		out.end_object();
 	}
-	for (cVkPhysicalDevice& pdev : instance->GPUs)
+	if (pipe.tessellationState.enabled)
 	{
-		Json::Value pdv = json_base(pdev);
-		pdv["device_name"] = pdev.properties.deviceName;
-		pdv["android_hw_level"] = android_hw_level(*reinterpret_cast<VkPhysicalDeviceFeatures*>(pdev.features[VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2].first));
-		pdv["gpu_path"] = getenv("CHAMELEON_GPU");
-		pdv["devices"] = Json::arrayValue;
-		for (cVkDevice& dev : pdev.devices)
+		out.key("tessellation_state");
+		out.begin_object();
+		out.member("flags", VkPipelineTessellationStateCreateFlags_to_string(pipe.tessellationState.flags));
+		out.member("patchControlPoints", pipe.tessellationState.patchControlPoints);
+		out.end_object();
+	}
+	if (pipe.viewportState.enabled)
+	{
+		out.key("viewport_state");
+		out.begin_object();
+		out.member("flags", VkPipelineViewportStateCreateFlags_to_string(pipe.viewportState.flags));
+		out.member("viewports_count", (int)pipe.viewportState.viewports.size());
+		out.member("scissors_count", (int)pipe.viewportState.scissors.size());
+		out.end_object();
+	}
+	if (pipe.rasterizationState.enabled)
+	{
+		out.key("rasterization_state");
+		out.begin_object();
+		out.member("flags", VkPipelineRasterizationStateCreateFlags_to_string(pipe.rasterizationState.flags));
+		out.member("depthClampEnable", pipe.rasterizationState.depthClampEnable);
+		out.member("rasterizerDiscardEnable", pipe.rasterizationState.rasterizerDiscardEnable);
+		out.member("polygonMode", VkPolygonMode_to_string(pipe.rasterizationState.polygonMode));
+		out.member("cullMode", VkCullModeFlags_to_string(pipe.rasterizationState.cullMode));
+		out.member("frontFace", VkFrontFace_to_string(pipe.rasterizationState.frontFace));
+		out.member("depthBiasEnable", pipe.rasterizationState.depthBiasEnable);
+		out.member("depthBiasConstantFactor", pipe.rasterizationState.depthBiasConstantFactor);
+		out.member("depthBiasClamp", pipe.rasterizationState.depthBiasClamp);
+		out.member("depthBiasSlopeFactor", pipe.rasterizationState.depthBiasSlopeFactor);
+		out.member("lineWidth", pipe.rasterizationState.lineWidth);
+		out.end_object();
+	}
+	if (pipe.multisampleState.enabled)
+	{
+		out.key("multisample_state");
+		out.begin_object();
+		out.member("flags", VkPipelineMultisampleStateCreateFlags_to_string(pipe.multisampleState.flags));
+		out.member("rasterizationSamples", pipe.multisampleState.rasterizationSamples);
+		out.member("sampleShadingEnable", pipe.multisampleState.sampleShadingEnable);
+		out.member("minSampleShading", pipe.multisampleState.minSampleShading);
+		out.member("pSampleMask", "TBD"); // FIXME
+		out.member("alphaToCoverageEnable", pipe.multisampleState.alphaToCoverageEnable);
+		out.member("alphaToOneEnable", pipe.multisampleState.alphaToOneEnable);
+		out.end_object();
+	}
+	if (pipe.pipelineColorBlendState.enabled)
+	{
+		out.key("pipeline_color_blend_state");
+		out.begin_object();
+		out.member("flags", VkPipelineColorBlendStateCreateFlags_to_string(pipe.pipelineColorBlendState.flags));
+		out.member("logicOpEnable", pipe.pipelineColorBlendState.logicOpEnable);
+		out.member("logicOp", VkLogicOp_to_string(pipe.pipelineColorBlendState.logicOp));
+		out.member("attachments_count", (int)pipe.pipelineColorBlendState.attachments.size());
+		// TBD write out colorblendattachments
+		out.key("blendConstants");
+		out.begin_array();
+		for (int i = 0; i < 4; i++) out.value(pipe.pipelineColorBlendState.blendConstants[i]);
+		out.end_array();
+		out.end_object();
+	}
+	if (pipe.dynamicState.enabled)
+	{
+		out.key("dynamic_state");
+		out.begin_object();
+		out.member("flags", VkPipelineDynamicStateCreateFlags_to_string(pipe.dynamicState.flags));
+		out.member("states_count", (int)pipe.dynamicState.states.size());
+		out.end_object();
+	}
+	out.end_object();
+}
+
+/// Draw and dispatch work recorded into a command buffer, as estimated when it was recorded
+static void json_command_buffer_work(ReportWriter& out, const cVkCommandBuffer& b)
+{
+	static const vk_command draw_commands[] = { ENUM_vkCmdDraw, ENUM_vkCmdDrawIndexed, ENUM_vkCmdDrawIndirect, ENUM_vkCmdDrawIndexedIndirect,
+		ENUM_vkCmdDrawIndirectCount, ENUM_vkCmdDrawIndexedIndirectCount, ENUM_vkCmdDrawIndirectCountKHR, ENUM_vkCmdDrawIndexedIndirectCountKHR };
+	static const vk_command dispatch_commands[] = { ENUM_vkCmdDispatch, ENUM_vkCmdDispatchBase, ENUM_vkCmdDispatchBaseKHR, ENUM_vkCmdDispatchIndirect };
+	MetricUnit draws;
+	MetricUnit dispatches;
+	for (vk_command c : draw_commands) draws += b.count[c];
+	for (vk_command c : dispatch_commands) dispatches += b.count[c];
+	if (draws.metrics[0] == 0 && dispatches.metrics[0] == 0) return;
+	out.key("work");
+	out.begin_object();
+	out.member("draws", (Json::Value::Int64)draws.metrics[1]);
+	out.member("vertices", (Json::Value::Int64)draws.metrics[2]);
+	out.member("instances", (Json::Value::Int64)draws.metrics[3]);
+	out.member("primitives", (Json::Value::Int64)draws.metrics[4]);
+	out.member("dispatches", (Json::Value::Int64)dispatches.metrics[1]);
+	out.member("workgroups", (Json::Value::Int64)dispatches.metrics[2]);
+	out.end_object();
+}
+
+static void json_command_pool(ReportWriter& out, const cVkCommandPool& q)
+{
+	std::map<uint64_t, uint64_t> call_histogram;
+	std::map<vk_command, uint64_t> counter_histogram;
+	std::map<VkCommandBufferUsageFlags, uint64_t> usageflag_histogram;
+	std::map<VkPipelineStageFlags, uint64_t> stageflag_histogram;
+	for (const cVkCommandBuffer& b : q.commandBuffers)
+	{
+		call_histogram[b.sum.metrics[0]]++;
+		for (uint32_t i = 0; i < 32; i++) if ((1 << i) & b.flags) usageflag_histogram[1 << i]++;
+		for (uint32_t i = 0; i < 32; i++) if ((1 << i) & b.maxStageFlags) stageflag_histogram[1 << i]++;
+		for (int i = 0; i < ENUM_MAX_COMMANDS; i++)
 		{
-			Json::Value dv = json_base(dev);
-			dv["enabled_device_extensions"] = Json::arrayValue;
-			for (const std::string& extension : dev.enabledExtensions)
-			{
-				dv["enabled_device_extensions"].append(extension);
-			}
-			dv["device_memory_allocations"] = (Json::Value::UInt64)dev.deviceMemory.size();
-			dv["device_memory_max_allocated"] = Json::arrayValue;
-			for (const auto& pair : dev.memory_highest)
-			{
-				Json::Value v;
-				v["memory_type_index"] = pair.first; // TBD, add what type of memory this is
-				v["max_memory_allocated"] = (Json::Value::UInt64)pair.second;
-				dv["device_memory_max_allocated"].append(v);
-			}
-			dv["fences_count"] = (Json::Value::UInt64)dev.fences.size();
-			dv["swapchains"] = Json::arrayValue;
-			for (const cVkSwapchainKHR& q : dev.swapchains)
-			{
-				Json::Value chain = json_base(q);
-				chain["images"] = (Json::Value::UInt64)q.images.size();
-				chain["clipped"] = q.clipped;
-				chain["present_mode"] = VkPresentModeKHR_to_string(q.presentMode);
-				chain["image_format"] = VkFormat_to_string(q.imageFormat);
-				append_if_relevant(dv["swapchains"], chain, q);
-			}
-			dv["semaphores_count"] = (Json::Value::UInt64)dev.semaphores.size();
-			dv["semaphores"] = Json::arrayValue;
-			for (const cVkSemaphore& s : dev.semaphores)
-			{
-				Json::Value p = json_base(s);
-				p["flags"] = VkSemaphoreCreateFlags_to_string(s.flags);
-				dv["semaphores"].append(p);
-			}
-			dv["events_count"] = (Json::Value::UInt64)dev.events.size();
-
-			// Images
-			dv["images_count"] = (Json::Value::UInt64)dev.images.size();
-			int count_tx_src_bit = 0;
-			int count_tx_dst_bit = 0;
-			int count_sampled_bit = 0;
-			int count_transient_bit = 0;
-			int count_input_bit = 0;
-			int count_usage_bit = 0;
-			int count_color_bit = 0;
-			int count_depth_stencil_bit = 0;
-			int count_usage_but_not_color_bit = 0;
-			int count_usage_but_not_depth_stencil_bit = 0;
-			std::map<std::string, uint64_t> image_flag_histogram;
-			std::map<std::string, uint64_t> image_type_histogram;
-			std::map<std::string, uint64_t> image_format_histogram;
-			std::map<std::string, uint64_t> image_size_histogram;
-			std::map<std::string, uint64_t> image_samples_histogram;
-			std::map<std::string, uint64_t> image_tiling_histogram;
-			std::map<std::string, uint64_t> image_usage_histogram;
-			std::map<std::string, uint64_t> image_sharing_histogram;
-			std::map<uint64_t, uint64_t> image_miplevels_histogram;
-			std::map<uint64_t, uint64_t> image_arraylayers_histogram;
-			for (const cVkImage& cv : dev.images)
-			{
-				if (cv.imageType == VK_IMAGE_TYPE_MAX_ENUM) continue; // swapchain
-
-				if (cv.flags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) count_tx_src_bit++;
-				if (cv.flags & VK_IMAGE_USAGE_TRANSFER_DST_BIT) count_tx_dst_bit++;
-				if (cv.flags & VK_IMAGE_USAGE_SAMPLED_BIT) count_sampled_bit++;
-				if (cv.flags & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) count_transient_bit++;
-				if (cv.flags & VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT) count_input_bit++;
-				if (cv.flags & VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT) count_color_bit++;
-				if (cv.flags & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT) count_depth_stencil_bit++;
-				if (cv.flags & VK_IMAGE_USAGE_STORAGE_BIT) count_usage_bit++;
-				if ((cv.flags & VK_IMAGE_USAGE_STORAGE_BIT) && !(cv.flags & VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT)) count_usage_but_not_color_bit++;
-				if ((cv.flags & VK_IMAGE_USAGE_STORAGE_BIT) && !(cv.flags & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)) count_usage_but_not_depth_stencil_bit++;
-
-				image_flag_histogram[VkImageCreateFlags_to_string(cv.flags)]++;
-				image_type_histogram[VkImageType_to_string(cv.imageType)]++;
-				image_format_histogram[VkFormat_to_string(cv.format)]++;
-				std::string dim = std::to_string(cv.extent.width) + "x" + std::to_string(cv.extent.height) + "x" + std::to_string(cv.extent.depth);
-				image_size_histogram[dim]++;
-				image_samples_histogram[VkSampleCountFlags_to_string(cv.samples)]++;
-				image_tiling_histogram[VkImageTiling_to_string(cv.tiling)]++;
-				image_usage_histogram[VkImageUsageFlags_to_string(cv.usage)]++;
-				image_sharing_histogram[VkSharingMode_to_string(cv.sharingMode)]++;
-				image_miplevels_histogram[cv.mipLevels]++;
-				image_arraylayers_histogram[cv.arrayLayers]++;
-			}
-			dv["image_flag_histogram"] = histogram_to_json(image_flag_histogram);
-			dv["image_type_histogram"] = histogram_to_json(image_type_histogram);
-			dv["image_format_histogram"] = histogram_to_json(image_format_histogram);
-			dv["image_size_histogram"] = histogram_to_json(image_size_histogram);
-			dv["image_samples_histogram"] = histogram_to_json(image_samples_histogram);
-			dv["image_tiling_histogram"] = histogram_to_json(image_tiling_histogram);
-			dv["image_usage_histogram"] = histogram_to_json(image_usage_histogram);
-			dv["image_sharing_histogram"] = histogram_to_json(image_sharing_histogram);
-			dv["image_miplevels_histogram"] = histogram_to_json(image_miplevels_histogram);
-			dv["image_arraylayers_histogram"] = histogram_to_json(image_arraylayers_histogram);
-			dv["images_with_sampled_bit"] = count_sampled_bit;
-			dv["images_with_tx_src_bit"] = count_tx_src_bit;
-			dv["images_with_tx_dst_bit"] = count_tx_dst_bit;
-			dv["images_with_depth_stencil_bit"] = count_depth_stencil_bit;
-			dv["images_with_transient_bit"] = count_transient_bit;
-			dv["images_with_input_bit"] = count_input_bit;
-			dv["images_with_usage_bit"] = count_usage_bit;
-			dv["images_with_usage_but_not_color_bit"] = count_usage_but_not_color_bit;
-			dv["images_with_usage_but_not_depth_stencil_bit"] = count_usage_but_not_depth_stencil_bit;
-
-			// Image views
-			dv["image_views_count"] = (Json::Value::UInt64)dev.imageViews.size();
-			std::map<std::string, uint64_t> imageview_flag_histogram;
-			std::map<std::string, uint64_t> imageview_type_histogram;
-			std::map<std::string, uint64_t> imageview_format_histogram;
-			for (const cVkImageView& cv : dev.imageViews)
-			{
-				imageview_flag_histogram[VkImageViewCreateFlags_to_string(cv.flags)]++;
-				imageview_type_histogram[VkImageViewType_to_string(cv.viewType)]++;
-				imageview_format_histogram[VkFormat_to_string(cv.format)]++;
-			}
-			dv["image_view_flag_histogram"] = histogram_to_json(imageview_flag_histogram);
-			dv["image_view_type_histogram"] = histogram_to_json(imageview_type_histogram);
-			dv["image_view_format_histogram"] = histogram_to_json(imageview_format_histogram);
-
-			// Buffers
-			dv["buffers_count"] = (Json::Value::UInt64)dev.buffers.size();
-			std::map<std::string, uint64_t> buffer_flag_histogram;
-			std::map<std::string, uint64_t> buffer_usage_histogram;
-			std::map<std::string, uint64_t> buffer_sharing_histogram;
-			for (const cVkBuffer& buf : dev.buffers)
-			{
-				buffer_flag_histogram[VkBufferCreateFlags_to_string(buf.flags)]++;
-				buffer_usage_histogram[VkBufferUsageFlags_to_string(buf.usage)]++;
-				buffer_sharing_histogram[VkSharingMode_to_string(buf.sharingMode)]++;
-			}
-			dv["buffer_flag_histogram"] = histogram_to_json(buffer_flag_histogram);
-			dv["buffer_usage_histogram"] = histogram_to_json(buffer_usage_histogram);
-			dv["buffer_sharing_histogram"] = histogram_to_json(buffer_sharing_histogram);
-
-			dv["buffer_views_count"] = (Json::Value::UInt64)dev.bufferViews.size();
-			dv["query_pools_count"] = (Json::Value::UInt64)dev.queryPools.size();
-
-			// Pipeline caches
-			dv["pipeline_caches_count"] = (Json::Value::UInt64)dev.pipelineCaches.size();
-			dv["pipeline_caches"] = Json::arrayValue;
-			std::map<uint64_t, uint64_t> pipelinecache_pipelines_histogram;
-			for (const cVkPipelineCache& cache : dev.pipelineCaches)
-			{
-				pipelinecache_pipelines_histogram[cache.pipelines.size()]++;
-			}
-			dv["pipelinecache_pipeline_count_histogram"] = histogram_to_json(pipelinecache_pipelines_histogram);
-
-			// Pipeline layouts
-			dv["pipeline_layouts_count"] = (Json::Value::UInt64)dev.pipelineLayouts.size();
-			dv["pipeline_layouts"] = Json::arrayValue;
-			std::map<uint64_t, uint64_t> pipelinelayout_sets_histogram;
-			std::map<uint64_t, uint64_t> pipelinelayout_pushconstant_ranges_histogram;
-			std::map<std::string, uint64_t> pipelinelayout_flags_histogram;
-			for (const cVkPipelineLayout& layout : dev.pipelineLayouts)
-			{
-				Json::Value layoutv = json_base(layout);
-				pipelinelayout_flags_histogram[VkPipelineLayoutCreateFlags_to_string(layout.flags)]++;
-				pipelinelayout_sets_histogram[layout.setLayouts.size()]++;
-				pipelinelayout_pushconstant_ranges_histogram[layout.pushConstantRanges.size()]++;
-			}
-			dv["pipelinelayout_sets_histogram"] = histogram_to_json(pipelinelayout_sets_histogram);
-			dv["pipelinelayout_pushconstant_ranges_histogram"] = histogram_to_json(pipelinelayout_pushconstant_ranges_histogram);
-			dv["pipelinelayout_flags_histogram"] = histogram_to_json(pipelinelayout_flags_histogram);
-
-			// Samplers
-			dv["samplers_count"] = (Json::Value::UInt64)dev.samplers.size();
-			dv["samplers"] = Json::arrayValue;
-			std::map<std::string, uint64_t> sampler_address_mode_histogram;
-			std::map<std::string, uint64_t> sampler_flags_histogram;
-			std::map<std::string, uint64_t> sampler_mag_filter_histogram;
-			std::map<std::string, uint64_t> sampler_min_filter_histogram;
-			std::map<std::string, uint64_t> sampler_mipmap_histogram;
-			std::map<std::string, uint64_t> sampler_compareop_histogram;
-			std::map<std::string, uint64_t> sampler_compareenable_histogram;
-			std::map<std::string, uint64_t> sampler_bordercolor_histogram;
-			std::map<std::string, uint64_t> sampler_anisotropy_histogram;
-			std::map<uint64_t, uint64_t> sampler_maxanisotropy_histogram;
-			std::map<std::string, uint64_t> sampler_unnormalized_coordinates_histogram;
-			for (const cVkSampler& s : dev.samplers)
-			{
-				sampler_flags_histogram[VkSamplerCreateFlags_to_string(s.info.flags)]++;
-				sampler_mag_filter_histogram[VkFilter_to_string(s.info.magFilter)]++;
-				sampler_min_filter_histogram[VkFilter_to_string(s.info.minFilter)]++;
-				sampler_mipmap_histogram[VkSamplerMipmapMode_to_string(s.info.mipmapMode)]++;
-				sampler_address_mode_histogram[VkSamplerAddressMode_to_string(s.info.addressModeU)]++;
-				sampler_address_mode_histogram[VkSamplerAddressMode_to_string(s.info.addressModeV)]++;
-				sampler_address_mode_histogram[VkSamplerAddressMode_to_string(s.info.addressModeW)]++;
-				sampler_anisotropy_histogram[s.info.anisotropyEnable ? "true" : "false"]++;
-				sampler_maxanisotropy_histogram[s.info.maxAnisotropy]++;
-				sampler_compareenable_histogram[s.info.compareEnable ? "true" : "false"]++;
-				sampler_compareop_histogram[VkCompareOp_to_string(s.info.compareOp)]++;
-				sampler_bordercolor_histogram[VkBorderColor_to_string(s.info.borderColor)]++;
-				sampler_unnormalized_coordinates_histogram[s.info.unnormalizedCoordinates ? "true" : "false"]++;
-			}
-			dv["sampler_address_mode_histogram"] = histogram_to_json(sampler_address_mode_histogram);
-			dv["sampler_flags_histogram"] = histogram_to_json(sampler_flags_histogram);
-			dv["sampler_mag_filter_histogram"] = histogram_to_json(sampler_mag_filter_histogram);
-			dv["sampler_min_filter_histogram"] = histogram_to_json(sampler_min_filter_histogram);
-			dv["sampler_mipmap_histogram"] = histogram_to_json(sampler_mipmap_histogram);
-			dv["sampler_compareop_histogram"] = histogram_to_json(sampler_compareop_histogram);
-			dv["sampler_compareenable_histogram"] = histogram_to_json(sampler_compareenable_histogram);
-			dv["sampler_bordercolor_histogram"] = histogram_to_json(sampler_bordercolor_histogram);
-			dv["sampler_anisotropy_histogram"] = histogram_to_json(sampler_anisotropy_histogram);
-			dv["sampler_maxanisotropy_histogram"] = histogram_to_json(sampler_maxanisotropy_histogram);
-			dv["sampler_unnormalized_coordinates_histogram"] = histogram_to_json(sampler_unnormalized_coordinates_histogram);
-
-			// Descriptorsets
-			dv["descriptor_set_layouts_count"] = (Json::Value::UInt64)dev.descriptorSetLayouts.size();
-			if (verbose >= 2)
-			{
-				dv["descriptor_set_layouts"] = Json::arrayValue;
-				for (const cVkDescriptorSetLayout& layout : dev.descriptorSetLayouts)
-				{
-					Json::Value layoutv = json_base(layout);
-					layoutv["flags"] = VkDescriptorSetLayoutCreateFlags_to_string(layout.flags);
-					layoutv["bindings"] = Json::arrayValue;
-					for (const cVkDescriptorSetLayoutBinding& binding : layout.bindings)
-					{
-						Json::Value bindingv; // _not_ based on cVkBase
-						bindingv["binding"] = (unsigned)binding.binding;
-						bindingv["type"] = VkDescriptorType_to_string(binding.descriptorType);
-						bindingv["count"] = (unsigned)binding.descriptorCount;
-						bindingv["flags"] = VkShaderStageFlags_to_string(binding.stageFlags);
-						bindingv["immutable_samplers"] = (unsigned)binding.immutableSamplers.size();
-						layoutv["bindings"].append(bindingv);
-					}
-					dv["descriptor_set_layouts"].append(layoutv);
-				}
-			}
-			dv["renderpasses_count"] = (Json::Value::UInt64)dev.renderpasses.size();
-			dv["renderpasses"] = Json::arrayValue;
-			for (const cVkRenderPass& q : dev.renderpasses)
-			{
-				Json::Value pass = json_base(q);
-				pass["attachments"] = (Json::Value::UInt64)q.attachments.size();
-				pass["subpasses"] = q.subpassCount;
-				pass["dependencies"] = q.dependencyCount;
-				dv["renderpasses"].append(pass);
-			}
-			dv["descriptor_pools_count"] = (Json::Value::UInt64)dev.descriptorPools.size();
-			dv["descriptor_pools"] = Json::arrayValue;
-			std::map<uint64_t, uint64_t> set_sizes;
-			std::map<uint64_t, uint64_t> pool_sizes;
-			for (const cVkDescriptorPool& q : dev.descriptorPools)
+			if (b.count[i].metrics[0] > 0) counter_histogram[(vk_command)i] += b.count[i].metrics[0];
+		}
+	}
+
+	out.begin_object();
+	json_base(out, q);
+	write_histogram(out, "call_histogram", call_histogram);
+	out.member("command_buffers_count", (Json::Value::UInt64)q.commandBuffers.size());
+	write_histogram(out, "counter_histogram", counter_histogram, vk_command_to_string);
+	write_histogram(out, "usage_flag_histogram", usageflag_histogram, VkCommandBufferUsageFlags_to_string);
+	write_histogram(out, "stage_flag_histogram", stageflag_histogram, VkPipelineStageFlags_to_string);
+	out.stream_key("command_buffers");
+	out.begin_array();
+	for (const cVkCommandBuffer& b : q.commandBuffers)
+	{
+		if (!is_relevant(b, 1))
+		{
+			count_thread_accesses(b);
+			continue;
+		}
+		out.begin_object();
+		json_base(out, b);
+		out.member("commands", (Json::Value::UInt64)b.commands.size());
+		out.member("usage_flags", VkCommandBufferUsageFlags_to_string(b.flags));
+		out.member("stage_flags", VkPipelineStageFlags_to_string(b.flags));
+		out.member("times_called_lifetime", (Json::Value::UInt64)b.lifetime_calls);
+		out.member("times_called_frames_of_interest", (Json::Value::UInt64)b.frames_of_interest_calls);
+		for (int i = 0; i < ENUM_MAX_COMMANDS; i++)
+		{
+			if (b.count[i].metrics[0] > 0)
 			{
-				Json::Value pool = json_base(q);
-				pool["maxSets"] = q.maxSets;
-				set_sizes[q.maxSets]++;
-				pool_sizes[q.poolSizeCount]++;
-				pool["poolSizeCount"] = q.poolSizeCount;
-				pool["flags"] = VkDescriptorPoolCreateFlags_to_string(q.flags);
-				append_if_relevant(dv["descriptor_pools"], pool, q);
+				out.member(vk_command_to_string((vk_command)i), (Json::Value::UInt64)b.count[i].metrics[0]);
 			}
-			dv["descriptor_pool_max_set_histogram"] = histogram_to_json(set_sizes);
-			dv["descriptor_pool_size_histogram"] = histogram_to_json(pool_sizes);
-			dv["framebuffers_count"] = (Json::Value::UInt64)dev.framebuffers.size();
-			dv["framebuffers"] = Json::arrayValue;
-			for (const cVkFramebuffer& q : dev.framebuffers)
+		}
+		json_command_buffer_work(out, b);
+		out.end_object();
+	}
+	out.end_array();
+	out.end_object();
+}
+
+static void json_shader_modules(ReportWriter& out, const cVkDevice& dev, const std::string& report_name, int instance_id, int dump_shaders)
+{
+	out.stream_key("shader_modules");
+	out.begin_array();
+	for (const cVkShaderModule& q : dev.shaderModules)
+	{
+		const bool dump = ((dump_shaders == 1 && q.used_in_frame.intersects(frames_of_interest)) || (dump_shaders == 2)) && (q.type != VK_SHADER_STAGE_FLAG_BITS_MAX_ENUM);
+		if (dump && q.used_as == 0)
+		{
+			fprintf(stderr, "Shader with uid: %d was not submitted to any queues. Skipping writeout.\n", q.uid);
+			count_thread_accesses(q);
+			continue;
+		}
+		std::string filename;
+		if (dump)
+		{
+			if (q.type != q.used_as)
 			{
-				Json::Value buf = json_base(q);
-				buf["width"] = q.width;
-				buf["height"] = q.height;
-				buf["layers"] = q.layers;
-				buf["flags"] = VkFramebufferCreateFlags_to_string(q.flags);
-				// TBD attachments, renderPass
-				append_if_relevant(dv["framebuffers"], buf, q);
+				fprintf(stderr, "Shader with uid: %d was used in multiple stages (type: %d, used_as: %d). Naming is likely not complete.\n", q.uid, static_cast<int>(q.type), static_cast<int>(q.used_as));
 			}
-			dv["command_pools_count"] = (Json::Value::UInt64)dev.commandPools.size();
-			dv["command_pools"] = Json::arrayValue;
-			for (const cVkCommandPool& q : dev.commandPools)
+
+			mkdir(report_name.c_str(), 0755);
+			std::string prefix = std::string(report_name);
+			filename = prefix + "/shader_i" + _to_string(instance_id) + "_s" + _to_string(q.uid) + "." + shader_name(q.type) + ".spv";
+			write_file(filename, q.code.data(), q.code.size());
+		}
+		if (!q.used_in_frame.intersects(frames_of_interest))
+		{
+			count_thread_accesses(q);
+			continue;
+		}
+		out.begin_object();
+		json_base(out, q);
+		out.member("vertices", (Json::Value::Int64)q.count.vertices);
+		out.member("draws", (Json::Value::Int64)q.count.draws);
+		out.member("dispatches", (Json::Value::Int64)q.count.dispatches);
+		out.member("flags", VkShaderModuleCreateFlags_to_string(q.flags));
+		out.key("pipelines");
+		out.begin_array();
+		for (int p : q.pipelines)
+		{
+			out.value(p);
+		}
+		out.end_array();
+		if (dump)
+		{
+			out.member("filename", filename);
+			out.member("type", shader_name(q.type));
+			out.key("frames_of_interest_used_in");
+			out.begin_array();
+			std::vector<int> frames(frames_of_interest.begin(), frames_of_interest.end());
+			std::sort(frames.begin(), frames.end());
+			for (int frame_used : frames)
 			{
-				Json::Value qv = json_base(q);
-				std::map<uint64_t, uint64_t> call_histogram;
-				std::map<std::string, uint64_t> counter_histogram;
-				std::map<std::string, uint64_t> usageflag_histogram;
-				std::map<std::string, uint64_t> stageflag_histogram;
-				qv["command_buffers_count"] = (Json::Value::UInt64)q.commandBuffers.size();
-				qv["command_buffers"] = Json::arrayValue;
-				for (const cVkCommandBuffer& b : q.commandBuffers)
+				if (q.used_in_frame.contains(frame_used))
 				{
-					call_histogram[b.sum.metrics[0]]++;
-					Json::Value buf = json_base(b);
-					buf["commands"] = (Json::Value::UInt64)b.commands.size();
-					buf["usage_flags"] = VkCommandBufferUsageFlags_to_string(b.flags);
-					for (uint32_t i = 0; i < 32; i++) if ((1 << i) & b.flags) usageflag_histogram[VkCommandBufferUsageFlags_to_string(1 << i)]++;
-					buf["stage_flags"] = VkPipelineStageFlags_to_string(b.flags);
-					for (uint32_t i = 0; i < 32; i++) if ((1 << i) & b.maxStageFlags) stageflag_histogram[VkPipelineStageFlags_to_string(1 << i)]++;
-					buf["times_called_lifetime"] = (Json::Value::UInt64)b.lifetime_calls;
-					buf["times_called_frames_of_interest"] = (Json::Value::UInt64)b.frames_of_interest_calls;
-					for (int i = 0; i < ENUM_MAX_COMMANDS; i++)
-					{
-						if (b.count[i].metrics[0] > 0)
-						{
-							std::string name = vk_command_to_string((vk_command)i);
-							buf[name] = (Json::Value::UInt64)b.count[i].metrics[0];
-							counter_histogram[name] += b.count[i].metrics[0];
-						}
-					}
-					append_if_relevant(qv["command_buffers"], buf, b, 1);
+					out.value(frame_used);
 				}
-				qv["usage_flag_histogram"] = histogram_to_json(usageflag_histogram);
-				qv["stage_flag_histogram"] = histogram_to_json(stageflag_histogram);
-				qv["call_histogram"] = histogram_to_json(call_histogram);
-				qv["counter_histogram"] = histogram_to_json(counter_histogram);
-				dv["command_pools"].append(qv);
 			}
-			dv["queues"] = Json::arrayValue;
-			for (const cVkQueue& q : dev.queues)
+			out.end_array();
+		}
+		out.end_object();
+	}
+	out.end_array();
+}
+
+static void json_device(ReportWriter& out, const cVkDevice& dev, const std::string& report_name, int instance_id, int dump_shaders)
+{
+	// The large lists of objects at the end are streamed in sorted order, so everything
+	// that sorts before them, including all the histograms, is collected first.
+	out.begin_object();
+	json_base(out, dev);
+	out.key("enabled_device_extensions");
+	out.begin_array();
+	for (const std::string& extension : dev.enabledExtensions)
+	{
+		out.value(extension);
+	}
+	out.end_array();
+	out.member("device_memory_allocations", (Json::Value::UInt64)dev.deviceMemory.size());
+	out.key("device_memory_max_allocated");
+	out.begin_array();
+	for (uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i++)
+	{
+		if (dev.memory_highest[i] == 0) continue;
+		out.begin_object();
+		out.member("memory_type_index", i); // TBD, add what type of memory this is
+		out.member("max_memory_allocated", (Json::Value::UInt64)dev.memory_highest[i].load());
+		out.end_object();
+	}
+	out.end_array();
+	if (dirty_tracking)
+	{
+		out.member("device_memory_dirty_page_size", (Json::Value::UInt64)dirty_tracking_page_size());
+		out.key("device_memory_dirty_pages");
+		out.begin_array();
+		for (const cVkDeviceMemory& mem : dev.deviceMemory)
+		{
+			if (mem.dirty_pages.empty()) continue;
+			out.begin_object();
+			out.member("uid", mem.uid);
+			out.member("memory_type_index", mem.memoryTypeIndex);
+			out.member("size", (Json::Value::UInt64)mem.allocationSize);
+			out.key("frames");
+			out.begin_array();
+			for (const auto& pair : mem.dirty_pages)
 			{
-				Json::Value qv = json_base(q);
-				qv["index"] = q.index;
-				qv["priority"] = q.priority;
-				Json::Value stages;
-				for (int i = 0; i < 32; i++)
-				{
-					unsigned bit = 1 << i;
-					if (q.stageflag_usage.count(i) > 0) stages[VkPipelineStageFlags_to_string(bit)] = q.stageflag_usage.at(i);
-				}
-				qv["stage_flags"] = stages;
-				dv["queues"].append(qv);
+				out.begin_object();
+				out.member("frame", pair.first);
+				out.member("pages", pair.second);
+				out.end_object();
 			}
-			dv["shader_modules_count"] = (Json::Value::UInt64)dev.shaderModules.size();
-			dv["shader_modules"] = Json::arrayValue;
-			for (const cVkShaderModule& q : dev.shaderModules)
+			out.end_array();
+			out.end_object();
+		}
+		out.end_array();
+	}
+	out.member("fences_count", (Json::Value::UInt64)dev.fences.size());
+	out.member("semaphores_count", (Json::Value::UInt64)dev.semaphores.size());
+	out.member("events_count", (Json::Value::UInt64)dev.events.size());
+
+	// Images
+	out.member("images_count", (Json::Value::UInt64)(dev.images.size() + map_total(dev.reclaimed.images)));
+	int count_tx_src_bit = 0;
+	int count_tx_dst_bit = 0;
+	int count_sampled_bit = 0;
+	int count_transient_bit = 0;
+	int count_input_bit = 0;
+	int count_usage_bit = 0;
+	int count_color_bit = 0;
+	int count_depth_stencil_bit = 0;
+	int count_usage_but_not_color_bit = 0;
+	int count_usage_but_not_depth_stencil_bit = 0;
+	std::map<VkImageCreateFlags, uint64_t> image_flag_histogram;
+	std::map<VkImageType, uint64_t> image_type_histogram;
+	std::map<VkFormat, uint64_t> image_format_histogram;
+	std::map<image_size, uint64_t> image_size_histogram;
+	std::map<VkSampleCountFlags, uint64_t> image_samples_histogram;
+	std::map<VkImageTiling, uint64_t> image_tiling_histogram;
+	std::map<VkImageUsageFlags, uint64_t> image_usage_histogram;
+	std::map<VkSharingMode, uint64_t> image_sharing_histogram;
+	std::map<uint64_t, uint64_t> image_miplevels_histogram;
+	std::map<uint64_t, uint64_t> image_arraylayers_histogram;
+	std::map<cVkImageSummary, uint64_t> images = dev.reclaimed.images;
+	for (const cVkImage& cv : dev.images) images[cVkImageSummary(cv)]++;
+	for (const auto& pair : images)
+	{
+		const cVkImageSummary& cv = pair.first;
+		const uint64_t n = pair.second;
+		if (cv.imageType == VK_IMAGE_TYPE_MAX_ENUM) continue; // swapchain
+
+		if (cv.flags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) count_tx_src_bit += n;
+		if (cv.flags & VK_IMAGE_USAGE_TRANSFER_DST_BIT) count_tx_dst_bit += n;
+		if (cv.flags & VK_IMAGE_USAGE_SAMPLED_BIT) count_sampled_bit += n;
+		if (cv.flags & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) count_transient_bit += n;
+		if (cv.flags & VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT) count_input_bit += n;
+		if (cv.flags & VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT) count_color_bit += n;
+		if (cv.flags & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT) count_depth_stencil_bit += n;
+		if (cv.flags & VK_IMAGE_USAGE_STORAGE_BIT) count_usage_bit += n;
+		if ((cv.flags & VK_IMAGE_USAGE_STORAGE_BIT) && !(cv.flags & VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT)) count_usage_but_not_color_bit += n;
+		if ((cv.flags & VK_IMAGE_USAGE_STORAGE_BIT) && !(cv.flags & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)) count_usage_but_not_depth_stencil_bit += n;
+
+		image_flag_histogram[cv.flags] += n;
+		image_type_histogram[cv.imageType] += n;
+		image_format_histogram[cv.format] += n;
+		image_size_histogram[{ cv.width, cv.height, cv.depth }] += n;
+		image_samples_histogram[cv.samples] += n;
+		image_tiling_histogram[cv.tiling] += n;
+		image_usage_histogram[cv.usage] += n;
+		image_sharing_histogram[cv.sharingMode] += n;
+		image_miplevels_histogram[cv.mipLevels] += n;
+		image_arraylayers_histogram[cv.arrayLayers] += n;
+	}
+	write_histogram(out, "image_flag_histogram", image_flag_histogram, VkImageCreateFlags_to_string);
+	write_histogram(out, "image_type_histogram", image_type_histogram, VkImageType_to_string);
+	write_histogram(out, "image_format_histogram", image_format_histogram, VkFormat_to_string);
+	write_histogram(out, "image_size_histogram", image_size_histogram, image_size_name);
+	write_histogram(out, "image_samples_histogram", image_samples_histogram, VkSampleCountFlags_to_string);
+	write_histogram(out, "image_tiling_histogram", image_tiling_histogram, VkImageTiling_to_string);
+	write_histogram(out, "image_usage_histogram", image_usage_histogram, VkImageUsageFlags_to_string);
+	write_histogram(out, "image_sharing_histogram", image_sharing_histogram, VkSharingMode_to_string);
+	write_histogram(out, "image_miplevels_histogram", image_miplevels_histogram);
+	write_histogram(out, "image_arraylayers_histogram", image_arraylayers_histogram);
+	out.member("images_with_sampled_bit", count_sampled_bit);
+	out.member("images_with_tx_src_bit", count_tx_src_bit);
+	out.member("images_with_tx_dst_bit", count_tx_dst_bit);
+	out.member("images_with_depth_stencil_bit", count_depth_stencil_bit);
+	out.member("images_with_transient_bit", count_transient_bit);
+	out.member("images_with_input_bit", count_input_bit);
+	out.member("images_with_usage_bit", count_usage_bit);
+	out.member("images_with_usage_but_not_color_bit", count_usage_but_not_color_bit);
+	out.member("images_with_usage_but_not_depth_stencil_bit", count_usage_but_not_depth_stencil_bit);
+
+	// Image views
+	out.member("image_views_count", (Json::Value::UInt64)(dev.imageViews.size() + map_total(dev.reclaimed.imageViews)));
+	std::map<VkImageViewCreateFlags, uint64_t> imageview_flag_histogram;
+	std::map<VkImageViewType, uint64_t> imageview_type_histogram;
+	std::map<VkFormat, uint64_t> imageview_format_histogram;
+	std::map<cVkImageViewSummary, uint64_t> image_views = dev.reclaimed.imageViews;
+	for (const cVkImageView& cv : dev.imageViews) image_views[cVkImageViewSummary(cv)]++;
+	for (const auto& pair : image_views)
+	{
+		imageview_flag_histogram[pair.first.flags] += pair.second;
+		imageview_type_histogram[pair.first.viewType] += pair.second;
+		imageview_format_histogram[pair.first.format] += pair.second;
+	}
+	write_histogram(out, "image_view_flag_histogram", imageview_flag_histogram, VkImageViewCreateFlags_to_string);
+	write_histogram(out, "image_view_type_histogram", imageview_type_histogram, VkImageViewType_to_string);
+	write_histogram(out, "image_view_format_histogram", imageview_format_histogram, VkFormat_to_string);
+
+	// Buffers
+	out.member("buffers_count", (Json::Value::UInt64)(dev.buffers.size() + map_total(dev.reclaimed.buffers)));
+	std::map<VkBufferCreateFlags, uint64_t> buffer_flag_histogram;
+	std::map<VkBufferUsageFlags, uint64_t> buffer_usage_histogram;
+	std::map<VkSharingMode, uint64_t> buffer_sharing_histogram;
+	std::map<cVkBufferSummary, uint64_t> buffers = dev.reclaimed.buffers;
+	for (const cVkBuffer& buf : dev.buffers) buffers[cVkBufferSummary(buf)]++;
+	for (const auto& pair : buffers)
+	{
+		buffer_flag_histogram[pair.first.flags] += pair.second;
+		buffer_usage_histogram[pair.first.usage] += pair.second;
+		buffer_sharing_histogram[pair.first.sharingMode] += pair.second;
+	}
+	write_histogram(out, "buffer_flag_histogram", buffer_flag_histogram, VkBufferCreateFlags_to_string);
+	write_histogram(out, "buffer_usage_histogram", buffer_usage_histogram, VkBufferUsageFlags_to_string);
+	write_histogram(out, "buffer_sharing_histogram", buffer_sharing_histogram, VkSharingMode_to_string);
+
+	out.member("buffer_views_count", (Json::Value::UInt64)(dev.bufferViews.size() + dev.reclaimed.bufferViews));
+	out.member("query_pools_count", (Json::Value::UInt64)dev.queryPools.size());
+
+	// Pipeline caches
+	out.member("pipeline_caches_count", (Json::Value::UInt64)dev.pipelineCaches.size());
+	out.key("pipeline_caches");
+	out.begin_array();
+	out.end_array();
+	std::map<uint64_t, uint64_t> pipelinecache_pipelines_histogram;
+	for (const cVkPipelineCache& cache : dev.pipelineCaches)
+	{
+		pipelinecache_pipelines_histogram[cache.pipelines.size()]++;
+	}
+	write_histogram(out, "pipelinecache_pipeline_count_histogram", pipelinecache_pipelines_histogram);
+
+	// Pipeline layouts
+	out.member("pipeline_layouts_count", (Json::Value::UInt64)dev.pipelineLayouts.size());
+	out.key("pipeline_layouts");
+	out.begin_array();
+	out.end_array();
+	std::map<uint64_t, uint64_t> pipelinelayout_sets_histogram;
+	std::map<uint64_t, uint64_t> pipelinelayout_pushconstant_ranges_histogram;
+	std::map<VkPipelineLayoutCreateFlags, uint64_t> pipelinelayout_flags_histogram;
+	for (const cVkPipelineLayout& layout : dev.pipelineLayouts)
+	{
+		count_thread_accesses(layout);
+		pipelinelayout_flags_histogram[layout.flags]++;
+		pipelinelayout_sets_histogram[layout.setLayouts.size()]++;
+		pipelinelayout_pushconstant_ranges_histogram[layout.pushConstantRanges.size()]++;
+	}
+	write_histogram(out, "pipelinelayout_sets_histogram", pipelinelayout_sets_histogram);
+	write_histogram(out, "pipelinelayout_pushconstant_ranges_histogram", pipelinelayout_pushconstant_ranges_histogram);
+	write_histogram(out, "pipelinelayout_flags_histogram", pipelinelayout_flags_histogram, VkPipelineLayoutCreateFlags_to_string);
+
+	// Samplers
+	out.member("samplers_count", (Json::Value::UInt64)dev.samplers.size());
+	out.key("samplers");
+	out.begin_array();
+	out.end_array();
+	std::map<VkSamplerAddressMode, uint64_t> sampler_address_mode_histogram;
+	std::map<VkSamplerCreateFlags, uint64_t> sampler_flags_histogram;
+	std::map<VkFilter, uint64_t> sampler_mag_filter_histogram;
+	std::map<VkFilter, uint64_t> sampler_min_filter_histogram;
+	std::map<VkSamplerMipmapMode, uint64_t> sampler_mipmap_histogram;
+	std::map<VkCompareOp, uint64_t> sampler_compareop_histogram;
+	std::map<VkBool32, uint64_t> sampler_compareenable_histogram;
+	std::map<VkBorderColor, uint64_t> sampler_bordercolor_histogram;
+	std::map<VkBool32, uint64_t> sampler_anisotropy_histogram;
+	std::map<uint64_t, uint64_t> sampler_maxanisotropy_histogram;
+	std::map<VkBool32, uint64_t> sampler_unnormalized_coordinates_histogram;
+	for (const cVkSampler& s : dev.samplers)
+	{
+		sampler_flags_histogram[s.info.flags]++;
+		sampler_mag_filter_histogram[s.info.magFilter]++;
+		sampler_min_filter_histogram[s.info.minFilter]++;
+		sampler_mipmap_histogram[s.info.mipmapMode]++;
+		sampler_address_mode_histogram[s.info.addressModeU]++;
+		sampler_address_mode_histogram[s.info.addressModeV]++;
+		sampler_address_mode_histogram[s.info.addressModeW]++;
+		sampler_anisotropy_histogram[s.info.anisotropyEnable != VK_FALSE]++;
+		sampler_maxanisotropy_histogram[s.info.maxAnisotropy]++;
+		sampler_compareenable_histogram[s.info.compareEnable != VK_FALSE]++;
+		sampler_compareop_histogram[s.info.compareOp]++;
+		sampler_bordercolor_histogram[s.info.borderColor]++;
+		sampler_unnormalized_coordinates_histogram[s.info.unnormalizedCoordinates != VK_FALSE]++;
+	}
+	write_histogram(out, "sampler_address_mode_histogram", sampler_address_mode_histogram, VkSamplerAddressMode_to_string);
+	write_histogram(out, "sampler_flags_histogram", sampler_flags_histogram, VkSamplerCreateFlags_to_string);
+	write_histogram(out, "sampler_mag_filter_histogram", sampler_mag_filter_histogram, VkFilter_to_string);
+	write_histogram(out, "sampler_min_filter_histogram", sampler_min_filter_histogram, VkFilter_to_string);
+	write_histogram(out, "sampler_mipmap_histogram", sampler_mipmap_histogram, VkSamplerMipmapMode_to_string);
+	write_histogram(out, "sampler_compareop_histogram", sampler_compareop_histogram, VkCompareOp_to_string);
+	write_histogram(out, "sampler_compareenable_histogram", sampler_compareenable_histogram, bool_name);
+	write_histogram(out, "sampler_bordercolor_histogram", sampler_bordercolor_histogram, VkBorderColor_to_string);
+	write_histogram(out, "sampler_anisotropy_histogram", sampler_anisotropy_histogram, bool_name);
+	write_histogram(out, "sampler_maxanisotropy_histogram", sampler_maxanisotropy_histogram);
+	write_histogram(out, "sampler_unnormalized_coordinates_histogram", sampler_unnormalized_coordinates_histogram, bool_name);
+
+	out.member("descriptor_set_layouts_count", (Json::Value::UInt64)dev.descriptorSetLayouts.size());
+	out.member("renderpasses_count", (Json::Value::UInt64)dev.renderpasses.size());
+	out.member("descriptor_pools_count", (Json::Value::UInt64)dev.descriptorPools.size());
+	std::map<uint64_t, uint64_t> set_sizes;
+	std::map<uint64_t, uint64_t> pool_sizes;
+	for (const cVkDescriptorPool& q : dev.descriptorPools)
+	{
+		set_sizes[q.maxSets]++;
+		pool_sizes[q.poolSizeCount]++;
+	}
+	write_histogram(out, "descriptor_pool_max_set_histogram", set_sizes);
+	write_histogram(out, "descriptor_pool_size_histogram", pool_sizes);
+	out.member("framebuffers_count", (Json::Value::UInt64)(dev.framebuffers.size() + dev.reclaimed.framebuffers));
+	for (const auto& pair : dev.reclaimed.accessed_by_thread) threads[pair.first] += pair.second;
+	out.member("command_pools_count", (Json::Value::UInt64)dev.commandPools.size());
+	out.key("queues");
+	out.begin_array();
+	for (const cVkQueue& q : dev.queues)
+	{
+		out.begin_object();
+		json_base(out, q);
+		out.member("index", q.index);
+		out.member("priority", q.priority);
+		out.key("stage_flags");
+		bool any_stages = false;
+		for (const auto& pair : q.stageflag_usage) if (pair.first >= 0 && pair.first < 32) any_stages = true;
+		if (any_stages)
+		{
+			out.begin_object();
+			for (int i = 0; i < 32; i++)
 			{
-				Json::Value qv = json_base(q);
-				qv["vertices"] = (Json::Value::Int64)q.count.vertices;
-				qv["draws"] = (Json::Value::Int64)q.count.draws;
-				qv["dispatches"] = (Json::Value::Int64)q.count.dispatches;
-				qv["flags"] = VkShaderModuleCreateFlags_to_string(q.flags);
-				qv["pipelines"] = Json::arrayValue;
-				for (int p : q.pipelines)
-				{
-					qv["pipelines"].append(p);
-				}
-				if (((dump_shaders == 1 && naive_intersect(q.used_in_frame, frames_of_interest)) || (dump_shaders == 2)) && (q.type != VK_SHADER_STAGE_FLAG_BITS_MAX_ENUM))
-				{
-					if (q.used_as == 0)
-					{
-						fprintf(stderr, "Shader with uid: %d was not submitted to any queues. Skipping writeout.\n", q.uid);
-						continue;
-					}
-
-					if (q.type != q.used_as)
-					{
-						fprintf(stderr, "Shader with uid: %d was used in multiple stages (type: %d, used_as: %d). Naming is likely not complete.\n", q.uid, static_cast<int>(q.type), static_cast<int>(q.used_as));
-					}
-
-					mkdir(report_name.c_str(), 0755);
-					std::string shader_name_str = shader_name(q.type);
-					std::string prefix = std::string(report_name);
-					std::string filename = prefix + "/shader_i" + _to_string(instance->instance_id) + "_s" + _to_string(q.uid) + "." + shader_name_str + ".spv";
-					qv["filename"] = filename;
-					qv["type"] = shader_name_str;
-					qv["frames_of_interest_used_in"] = Json::Value(Json::arrayValue);
-					for (int frame_used : q.used_in_frame)
-					{
-						if (frames_of_interest.find(frame_used) != frames_of_interest.end())
-						{
-							qv["frames_of_interest_used_in"].append(frame_used);
-						}
-					}
-					write_file(filename, q.code.data(), q.code.size());
-				}
-				if (naive_intersect(q.used_in_frame, frames_of_interest)) dv["shader_modules"].append(qv);
+				unsigned bit = 1 << i;
+				if (q.stageflag_usage.count(i) > 0) out.member(VkPipelineStageFlags_to_string(bit), q.stageflag_usage.at(i));
 			}
+			out.end_object();
+		}
+		else out.null();
+		out.end_object();
+	}
+	out.end_array();
+	out.member("shader_modules_count", (Json::Value::UInt64)dev.shaderModules.size());
+	out.member("pipelines_count", (Json::Value::UInt64)dev.pipelines.size());
+	std::map<VkPipelineCreateFlags, uint64_t> pipeline_flags_histogram;
+	for (const cVkPipeline& pipe : dev.pipelines)
+	{
+		pipeline_flags_histogram[pipe.flags]++;
+	}
+	write_histogram(out, "pipeline_flags_histogram", pipeline_flags_histogram, VkPipelineCreateFlags_to_string);
 
-			// Pipelines
-			dv["pipelines_count"] = (Json::Value::UInt64)dev.pipelines.size();
-			dv["pipelines"] = Json::arrayValue;
-			std::map<std::string, uint64_t> pipeline_flags_histogram;
-			for (const cVkPipeline& pipe : dev.pipelines)
+	// Lists of objects, in sorted order
+	out.stream_key("command_pools");
+	out.begin_array();
+	for (const cVkCommandPool& q : dev.commandPools)
+	{
+		json_command_pool(out, q);
+	}
+	out.end_array();
+	out.stream_key("descriptor_pools");
+	out.begin_array();
+	for (const cVkDescriptorPool& q : dev.descriptorPools)
+	{
+		if (!is_relevant(q))
+		{
+			count_thread_accesses(q);
+			continue;
+		}
+		out.begin_object();
+		json_base(out, q);
+		out.member("maxSets", q.maxSets);
+		out.member("poolSizeCount", q.poolSizeCount);
+		out.member("flags", VkDescriptorPoolCreateFlags_to_string(q.flags));
+		out.end_object();
+	}
+	out.end_array();
+	if (verbose >= 2)
+	{
+		out.stream_key("descriptor_set_layouts");
+		out.begin_array();
+		for (const cVkDescriptorSetLayout& layout : dev.descriptorSetLayouts)
+		{
+			out.begin_object();
+			json_base(out, layout);
+			out.member("flags", VkDescriptorSetLayoutCreateFlags_to_string(layout.flags));
+			out.key("bindings");
+			out.begin_array();
+			for (const cVkDescriptorSetLayoutBinding& binding : layout.bindings)
 			{
-				pipeline_flags_histogram[VkPipelineCreateFlags_to_string(pipe.flags)]++;
-
-				Json::Value p = json_base(pipe);
-				p["flags"] = VkPipelineCreateFlags_to_string(pipe.flags);
-				if (pipe.layout) p["layout"] = pipe.layout->uid;
-				if (pipe.renderPass) p["renderpass"] = pipe.renderPass->uid;
-				p["draws"] = (Json::Value::UInt64)pipe.count.draws;
-				p["dispatches"] = (Json::Value::UInt64)pipe.count.dispatches;
-				p["vertices"] = (Json::Value::UInt64)pipe.count.vertices;
-				if (pipe.subpass != UINT32_MAX) p["subpass"] = pipe.subpass;
-				p["stages"] = Json::arrayValue;
-				for (const cVkPipelineStage &stage : pipe.stages)
-				{
-					Json::Value sv; // not based on cVkBase
-					sv["flags"] = VkPipelineShaderStageCreateFlags_to_string(stage.flags);
-					sv["stage"] = VkShaderStageFlags_to_string(stage.stage);
-					if (stage.module)
-					{
-						sv["module"] = stage.module->uid;
-					}
-					sv["name"] = stage.name;
-					sv["specialization_data"] = !stage.specializationData.empty();
-					sv["specialization_map_count"] = (int)stage.specializationMap.size();
-					p["stages"].append(sv);
-				}
-				if (pipe.vertexInputState.enabled)
-				{
-					p["vertex_input_state"] = Json::objectValue;
-					p["vertex_input_state"]["flags"] = VkPipelineVertexInputStateCreateFlags_to_string(pipe.vertexInputState.flags);
-					p["vertex_input_state"]["vertex_binding_descriptions_count"] = (int)pipe.vertexInputState.vertexBindingDescriptions.size();
-					p["vertex_input_state"]["vertex_attribute_descriptions_count"] = (int)pipe.vertexInputState.vertexAttributeDescriptions.size();
-				}
-				if (pipe.vertexInputAssemblyState.enabled)
-				{
-					p["vertex_assembly_state"]["flags"] = VkPipelineInputAssemblyStateCreateFlags_to_string(pipe.vertexInputAssemblyState.flags);
-					p["vertex_assembly_state"]["topology"] = VkPrimitiveTopology_to_string(pipe.vertexInputAssemblyState.topology);
-					p["vertex_assembly_state"]["primitive_restart_enable"] = pipe.vertexInputAssemblyState.primitiveRestartEnable;
-				}
-				if (pipe.tessellationState.enabled)
-				{
-					p["tessellation_state"] = Json::objectValue;
-					p["tessellation_state"]["flags"] = VkPipelineTessellationStateCreateFlags_to_string(pipe.tessellationState.flags);
-					p["tessellation_state"]["patchControlPoints"] = pipe.tessellationState.patchControlPoints;
-				}
-				if (pipe.viewportState.enabled)
-				{
-					p["viewport_state"] = Json::objectValue;
-					p["viewport_state"]["flags"] = VkPipelineViewportStateCreateFlags_to_string(pipe.viewportState.flags);
-					p["viewport_state"]["viewports_count"] = (int)pipe.viewportState.viewports.size();
-					p["viewport_state"]["scissors_count"] = (int)pipe.viewportState.scissors.size();
-				}
-				if (pipe.rasterizationState.enabled)
-				{
-					p["rasterization_state"] = Json::objectValue;
-					p["rasterization_state"]["flags"] = VkPipelineRasterizationStateCreateFlags_to_string(pipe.rasterizationState.flags);
-					p["rasterization_state"]["depthClampEnable"] = pipe.rasterizationState.depthClampEnable;
-					p["rasterization_state"]["rasterizerDiscardEnable"] = pipe.rasterizationState.rasterizerDiscardEnable;
-					p["rasterization_state"]["polygonMode"] = VkPolygonMode_to_string(pipe.rasterizationState.polygonMode);
-					p["rasterization_state"]["cullMode"] = VkCullModeFlags_to_string(pipe.rasterizationState.cullMode);
-					p["rasterization_state"]["frontFace"] = VkFrontFace_to_string(pipe.rasterizationState.frontFace);
-					p["rasterization_state"]["depthBiasEnable"] = pipe.rasterizationState.depthBiasEnable;
-					p["rasterization_state"]["depthBiasConstantFactor"] = pipe.rasterizationState.depthBiasConstantFactor;
-					p["rasterization_state"]["depthBiasClamp"] = pipe.rasterizationState.depthBiasClamp;
-					p["rasterization_state"]["depthBiasSlopeFactor"] = pipe.rasterizationState.depthBiasSlopeFactor;
-					p["rasterization_state"]["lineWidth"] = pipe.rasterizationState.lineWidth;
-				}
-				if (pipe.multisampleState.enabled)
-				{
-					p["multisample_state"] = Json::objectValue;
-					p["multisample_state"]["flags"] = VkPipelineMultisampleStateCreateFlags_to_string(pipe.multisampleState.flags);
-					p["multisample_state"]["rasterizationSamples"] = pipe.multisampleState.rasterizationSamples;
-					p["multisample_state"]["sampleShadingEnable"] = pipe.multisampleState.sampleShadingEnable;
-					p["multisample_state"]["minSampleShading"] = pipe.multisampleState.minSampleShading;
-					p["multisample_state"]["pSampleMask"] = "TBD"; // FIXME
-					p["multisample_state"]["alphaToCoverageEnable"] = pipe.multisampleState.alphaToCoverageEnable;
-					p["multisample_state"]["alphaToOneEnable"] = pipe.multisampleState.alphaToOneEnable;
-				}
-				if (pipe.pipelineColorBlendState.enabled)
-				{
-					p["pipeline_color_blend_state"] = Json::objectValue;
-					p["pipeline_color_blend_state"]["flags"] = VkPipelineColorBlendStateCreateFlags_to_string(pipe.pipelineColorBlendState.flags);
-					p["pipeline_color_blend_state"]["logicOpEnable"] = pipe.pipelineColorBlendState.logicOpEnable;
-					p["pipeline_color_blend_state"]["logicOp"] = VkLogicOp_to_string(pipe.pipelineColorBlendState.logicOp);
-					p["pipeline_color_blend_state"]["attachments_count"] = (int)pipe.pipelineColorBlendState.attachments.size();
-					// TBD write out colorblendattachments
-					p["pipeline_color_blend_state"]["blendConstants"] = Json::arrayValue;
-					p["pipeline_color_blend_state"]["blendConstants"][0] = pipe.pipelineColorBlendState.blendConstants[0];
-					p["pipeline_color_blend_state"]["blendConstants"][1] = pipe.pipelineColorBlendState.blendConstants[1];
-					p["pipeline_color_blend_state"]["blendConstants"][2] = pipe.pipelineColorBlendState.blendConstants[2];
-					p["pipeline_color_blend_state"]["blendConstants"][3] = pipe.pipelineColorBlendState.blendConstants[3];
-				}
-				if (pipe.dynamicState.enabled)
-				{
-					p["dynamic_state"] = Json::objectValue;
-					p["dynamic_state"]["flags"] = VkPipelineDynamicStateCreateFlags_to_string(pipe.dynamicState.flags);
-					p["dynamic_state"]["states_count"] = (int)pipe.dynamicState.states.size();
-				}
-				append_if_relevant(dv["pipelines"], p, pipe);
+				out.begin_object(); // _not_ based on cVkBase
+				out.member("binding", (unsigned)binding.binding);
+				out.member("type", VkDescriptorType_to_string(binding.descriptorType));
+				out.member("count", (unsigned)binding.descriptorCount);
+				out.member("flags", VkShaderStageFlags_to_string(binding.stageFlags));
+				out.member("immutable_samplers", (unsigned)binding.immutableSamplers.size());
+				out.end_object();
 			}
-			dv["pipeline_flags_histogram"] = histogram_to_json(pipeline_flags_histogram);
-
-			pdv["devices"].append(dv);
+			out.end_array();
+			out.end_object();
 		}
-		result["physical_devices"].append(pdv);
+		out.end_array();
+	}
+	out.stream_key("framebuffers");
+	out.begin_array();
+	for (const cVkFramebuffer& q : dev.framebuffers)
+	{
+		if (!is_relevant(q))
+		{
+			count_thread_accesses(q);
+			continue;
+		}
+		out.begin_object();
+		json_base(out, q);
+		out.member("width", q.width);
+		out.member("height", q.height);
+		out.member("layers", q.layers);
+		out.member("flags", VkFramebufferCreateFlags_to_string(q.flags));
+		// TBD attachments, renderPass
+		out.end_object();
+	}
+	out.end_array();
+	out.stream_key("pipelines");
+	out.begin_array();
+	for (const cVkPipeline& pipe : dev.pipelines)
+	{
+		if (is_relevant(pipe)) json_pipeline(out, pipe);
+		else count_thread_accesses(pipe);
+	}
+	out.end_array();
+	out.stream_key("renderpasses");
+	out.begin_array();
+	for (const cVkRenderPass& q : dev.renderpasses)
+	{
+		out.begin_object();
+		json_base(out, q);
+		out.member("attachments", (Json::Value::UInt64)q.attachments.size());
+		out.member("subpasses", q.subpassCount);
+		out.member("dependencies", q.dependencyCount);
+		out.end_object();
 	}
-	Json::Value thread_histogram;
-	for (const auto& pair : threads)
+	out.end_array();
+	out.stream_key("semaphores");
+	out.begin_array();
+	for (const cVkSemaphore& s : dev.semaphores)
+	{
+		out.begin_object();
+		json_base(out, s);
+		out.member("flags", VkSemaphoreCreateFlags_to_string(s.flags));
+		out.end_object();
+	}
+	out.end_array();
+	json_shader_modules(out, dev, report_name, instance_id, dump_shaders);
+	out.stream_key("swapchains");
+	out.begin_array();
+	for (const cVkSwapchainKHR& q : dev.swapchains)
+	{
+		if (!is_relevant(q))
+		{
+			count_thread_accesses(q);
+			continue;
+		}
+		out.begin_object();
+		json_base(out, q);
+		out.member("images", (Json::Value::UInt64)q.images.size());
+		out.member("clipped", q.clipped);
+		out.member("present_mode", VkPresentModeKHR_to_string(q.presentMode));
+		out.member("image_format", VkFormat_to_string(q.imageFormat));
+		out.end_object();
+	}
+	out.end_array();
+	out.end_object();
+}
+
+void json_overview(const std::string& report_name, cVkInstance* instance, bool hw_info)
+{
+	instance->update(); // update transitive information
+	int dump_shaders = get_env_int("CHAMELEON_SHADERDUMP", 0);
+	verbose = get_env_int("CHAMELEON_VERBOSITY", 0); // verbosity level
+	frames_of_interest = get_env_ints("CHAMELEON_FRAMES");
+	const char* format = getenv("CHAMELEON_REPORT_FORMAT");
+	const bool cbor = format && strcmp(format, "cbor") == 0;
+
+	std::string filename = report_name + "_" + _to_string(instance->instance_id) + (cbor ? ".cbor" : ".json");
+	FILE* fp = fopen(filename.c_str(), "w");
+	if (!fp)
 	{
-		thread_histogram[_to_string(pair.first)] = (Json::Value::Int64)pair.second;
+		fprintf(stderr, "Failed to open %s: %s", filename.c_str(), strerror(errno));
+		return;
 	}
-	if (!deterministic) result["thread_resource_accesses"] = thread_histogram;
+	JsonReportWriter json_writer(fp);
+	CborReportWriter cbor_writer(fp);
+	ReportWriter& out = cbor ? static_cast<ReportWriter&>(cbor_writer) : json_writer;
 
-	std::string dump = result.toStyledString();
-	std::string filename = report_name + "_" + _to_string(instance->instance_id) + ".json";
-	write_file(filename, dump.c_str(), dump.size());
+	out.begin_object();
+	json_base(out, *instance);
+	out.key("chameleon_settings");
+	out.begin_object();
+	out.member("verbosity", verbose);
+	out.member("dump_shaders", dump_shaders);
+	if (frames_of_interest.size() > 0)
+	{
+		out.member("frames_of_interest", set_to_comma_string(frames_of_interest));
+	}
+	out.end_object();
+	const char* source = getenv("CHAMELEON_SOURCE");
+	if (source) out.member("source", source);
+	int priority = get_env_int("CHAMELEON_PRIORITY", -1);
+	if (priority != -1) out.member("priority", priority);
+	out.member("instances", (unsigned)instance->instance_counter);
+	out.member("instance", instance->instance_id);
+	out.key("surfaces");
+	out.begin_array();
+	out.end_array();
+	out.key("displays");
+	out.begin_array();
+	out.end_array();
+	out.key("enabled_instance_extensions");
+	out.begin_array();
+	for (const std::string& extension : instance->enabledExtensions)
+	{
+		out.value(extension);
+	}
+	out.end_array();
+	out.stream_key("physical_devices");
+	out.begin_array();
+	for (cVkPhysicalDevice& pdev : instance->GPUs)
+	{
+		out.begin_object();
+		json_base(out, pdev);
+		out.member("device_name", pdev.properties.deviceName);
+		out.member("android_hw_level", android_hw_level(*reinterpret_cast<VkPhysicalDeviceFeatures*>(pdev.features[VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2].first)));
+		out.member("gpu_path", getenv("CHAMELEON_GPU"));
+		out.stream_key("devices");
+		out.begin_array();
+		for (const cVkDevice& dev : pdev.devices)
+		{
+			json_device(out, dev, report_name, instance->instance_id, dump_shaders);
+		}
+		out.end_array();
+		out.end_object();
+	}
+	out.end_array();
+	if (!deterministic)
+	{
+		std::map<long, long> sorted_threads(threads.begin(), threads.end());
+		out.key("thread_resource_accesses");
+		if (sorted_threads.empty()) out.null();
+		else
+		{
+			out.begin_object();
+			for (const auto& pair : sorted_threads)
+			{
+				out.member(_to_string(pair.first), (Json::Value::Int64)pair.second);
+			}
+			out.end_object();
+		}
+	}
+	out.end_object();
+	if (!out.finish()) fprintf(stderr, "Failed to write %s: %s", filename.c_str(), strerror(errno));
+	fclose(fp);
 
 	std::string bufferfile = report_name + "_" + _to_string(instance->instance_id) + "_buffers.csv";
-	FILE *fp = fopen(bufferfile.c_str(), "w");
+	fp = fopen(bufferfile.c_str(), "w");
 	if (!fp)
 	{
 		fprintf(stderr, "Failed to open %s: %s", filename.c_str(), strerror(errno));
@@ -693,6 +961,13 @@ void json_overview(const std::string& report_name, cVkInstance* instance, bool h
 			{
 				fprintf(fp, "%s,%u,%u\n", VkBufferUsageFlags_to_string(buf.usage).c_str(), (unsigned)buf.size, (unsigned)buf.memoryOffset);
 			}
+			for (const auto& pair : dev.reclaimed.buffers)
+			{
+				for (uint64_t i = 0; i < pair.second; i++)
+				{
+					fprintf(fp, "%s,%u,%u\n", VkBufferUsageFlags_to_string(pair.first.usage).c_str(), (unsigned)pair.first.size, (unsigned)pair.first.memoryOffset);
+				}
+			}
 		}
 	}
 	fclose(fp);
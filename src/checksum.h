@@ -0,0 +1,178 @@
+#pragma once
+
+// Fast Adler-32 checksum, shared by the tests and by Chameleon. Instead of taking the
+// modulo for every byte, we sum up as many bytes as we can before the sums could overflow
+// 32 bits, and take the modulo once per block. Blocks are summed with SIMD instructions
+// where we have them.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CHECKSUM_X86 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define CHECKSUM_NEON 1
+#endif
+
+#define ADLER32_MOD 65521u
+/// Largest number of bytes we can sum up before 'b' could overflow 32 bits
+#define ADLER32_NMAX 5552u
+
+/// Sum up a number of bytes without taking the modulo. At most ADLER32_NMAX bytes.
+static inline void adler32_scalar_block(uint32_t& a, uint32_t& b, const unsigned char* data, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+	{
+		a += data[i];
+		b += a;
+	}
+}
+
+static __attribute__((pure)) inline uint32_t adler32_scalar(uint32_t adler, const unsigned char* data, size_t len)
+{
+	uint32_t a = adler & 0xffff;
+	uint32_t b = adler >> 16;
+	while (len > 0)
+	{
+		const size_t n = len < ADLER32_NMAX ? len : ADLER32_NMAX;
+		adler32_scalar_block(a, b, data, n);
+		a %= ADLER32_MOD;
+		b %= ADLER32_MOD;
+		data += n;
+		len -= n;
+	}
+	return (b << 16) | a;
+}
+
+// The vector versions below all work the same way on chunks of 16 or 32 bytes. For a block
+// of 'n' chunks, 'a' grows by the sum of all bytes. 'b' grows by 'a' for each byte, that is
+// by the starting 'a' times the block length, plus each chunk's sum times the number of bytes
+// after it in the block, plus each byte weighted by its distance from the end of its chunk.
+// We keep a running total of the chunk sums seen so far, and add it up once per chunk, to get
+// the middle term without any multiplications in the inner loop.
+
+#ifdef CHECKSUM_X86
+static inline uint32_t checksum_hsum_epi32(__m128i v)
+{
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+	return (uint32_t)_mm_cvtsi128_si32(v);
+}
+
+static __attribute__((pure)) inline uint32_t adler32_sse2(uint32_t adler, const unsigned char* data, size_t len)
+{
+	const unsigned block = ADLER32_NMAX / 16;
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i weights_lo = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+	const __m128i weights_hi = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+	uint32_t a = adler & 0xffff;
+	uint32_t b = adler >> 16;
+	while (len >= 16)
+	{
+		const size_t chunks = len / 16 < block ? len / 16 : block;
+		__m128i vs1 = zero; // sum of bytes
+		__m128i vs1_total = zero; // running total of the chunk sums before each chunk
+		__m128i vs2 = zero; // bytes weighted by distance from the chunk end
+		for (size_t i = 0; i < chunks; i++)
+		{
+			const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i * 16));
+			vs1_total = _mm_add_epi32(vs1_total, vs1);
+			vs1 = _mm_add_epi32(vs1, _mm_sad_epu8(bytes, zero));
+			vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(_mm_unpacklo_epi8(bytes, zero), weights_lo));
+			vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(_mm_unpackhi_epi8(bytes, zero), weights_hi));
+		}
+		const uint64_t sum = checksum_hsum_epi32(vs1);
+		b = (uint32_t)((b + (uint64_t)a * chunks * 16 + (uint64_t)checksum_hsum_epi32(vs1_total) * 16 + checksum_hsum_epi32(vs2)) % ADLER32_MOD);
+		a = (uint32_t)((a + sum) % ADLER32_MOD);
+		data += chunks * 16;
+		len -= chunks * 16;
+	}
+	adler32_scalar_block(a, b, data, len); // less than 16 bytes left, cannot overflow
+	return ((b % ADLER32_MOD) << 16) | (a % ADLER32_MOD);
+}
+
+__attribute__((target("avx2"))) static inline uint32_t adler32_avx2(uint32_t adler, const unsigned char* data, size_t len)
+{
+	const unsigned block = ADLER32_NMAX / 32;
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i ones = _mm256_set1_epi16(1);
+	const __m256i weights = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+	                                         16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+	uint32_t a = adler & 0xffff;
+	uint32_t b = adler >> 16;
+	while (len >= 32)
+	{
+		const size_t chunks = len / 32 < block ? len / 32 : block;
+		__m256i vs1 = zero;
+		__m256i vs1_total = zero;
+		__m256i vs2 = zero;
+		for (size_t i = 0; i < chunks; i++)
+		{
+			const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i * 32));
+			vs1_total = _mm256_add_epi32(vs1_total, vs1);
+			vs1 = _mm256_add_epi32(vs1, _mm256_sad_epu8(bytes, zero));
+			// adjacent byte pairs times their weights fit in 16 bits, then sum pairs of those
+			vs2 = _mm256_add_epi32(vs2, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, weights), ones));
+		}
+		const __m128i s1 = _mm_add_epi32(_mm256_castsi256_si128(vs1), _mm256_extracti128_si256(vs1, 1));
+		const __m128i s1_total = _mm_add_epi32(_mm256_castsi256_si128(vs1_total), _mm256_extracti128_si256(vs1_total, 1));
+		const __m128i s2 = _mm_add_epi32(_mm256_castsi256_si128(vs2), _mm256_extracti128_si256(vs2, 1));
+		const uint64_t sum = checksum_hsum_epi32(s1);
+		b = (uint32_t)((b + (uint64_t)a * chunks * 32 + (uint64_t)checksum_hsum_epi32(s1_total) * 32 + checksum_hsum_epi32(s2)) % ADLER32_MOD);
+		a = (uint32_t)((a + sum) % ADLER32_MOD);
+		data += chunks * 32;
+		len -= chunks * 32;
+	}
+	return adler32_sse2((b << 16) | a, data, len);
+}
+#endif
+
+#ifdef CHECKSUM_NEON
+static __attribute__((pure)) inline uint32_t adler32_neon(uint32_t adler, const unsigned char* data, size_t len)
+{
+	const unsigned block = ADLER32_NMAX / 16;
+	static const uint8_t weight_values[16] = { 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1 };
+	const uint8x8_t weights_lo = vld1_u8(weight_values);
+	const uint8x8_t weights_hi = vld1_u8(weight_values + 8);
+	uint32_t a = adler & 0xffff;
+	uint32_t b = adler >> 16;
+	while (len >= 16)
+	{
+		const size_t chunks = len / 16 < block ? len / 16 : block;
+		uint32x4_t vs1 = vdupq_n_u32(0);
+		uint32x4_t vs1_total = vdupq_n_u32(0);
+		uint32x4_t vs2 = vdupq_n_u32(0);
+		for (size_t i = 0; i < chunks; i++)
+		{
+			const uint8x16_t bytes = vld1q_u8(data + i * 16);
+			vs1_total = vaddq_u32(vs1_total, vs1);
+			vs1 = vpadalq_u16(vs1, vpaddlq_u8(bytes));
+			vs2 = vpadalq_u16(vs2, vmull_u8(vget_low_u8(bytes), weights_lo));
+			vs2 = vpadalq_u16(vs2, vmull_u8(vget_high_u8(bytes), weights_hi));
+		}
+		const uint64_t sum = vaddvq_u32(vs1);
+		b = (uint32_t)((b + (uint64_t)a * chunks * 16 + (uint64_t)vaddvq_u32(vs1_total) * 16 + vaddvq_u32(vs2)) % ADLER32_MOD);
+		a = (uint32_t)((a + sum) % ADLER32_MOD);
+		data += chunks * 16;
+		len -= chunks * 16;
+	}
+	adler32_scalar_block(a, b, data, len);
+	return ((b % ADLER32_MOD) << 16) | (a % ADLER32_MOD);
+}
+#endif
+
+/// Continue an Adler-32 checksum with more data. Start with 1 for a new checksum.
+static inline uint32_t adler32_update(uint32_t adler, const unsigned char* data, size_t len)
+{
+#if defined(CHECKSUM_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return adler32_avx2(adler, data, len);
+	return adler32_sse2(adler, data, len);
+#elif defined(CHECKSUM_NEON)
+	return adler32_neon(adler, data, len);
+#else
+	return adler32_scalar(adler, data, len);
+#endif
+}
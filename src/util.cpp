@@ -1,7 +1,10 @@
 #include "util.h"
 
 #include "external/json.hpp"
+#include <algorithm>
+#include <errno.h>
 #include <fstream>
+#include <math.h>
 #include <termios.h>
 #include <unistd.h>
 #include <string.h>
@@ -12,6 +15,12 @@
 #include <sys/prctl.h>
 #endif
 
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
 #ifdef SDL
 #define SDL_MAIN_HANDLED
 #include <SDL2/SDL.h>
@@ -29,44 +38,338 @@ int get_env_int(const char* name, int fallback)
 }
 
 uint_fast32_t p__loops = get_env_int("TOOLSTEST_TIMES", 10);
+double p__loop_time = get_env_int("TOOLSTEST_LOOP_TIME", 0);
 uint_fast8_t p__sanity = get_env_int("TOOLSTEST_SANITY", 1);
 uint_fast8_t p__debug_level = get_env_int("TOOLSTEST_DEBUG", 0);
 uint_fast8_t p__validation = get_env_int("TOOLSTEST_VALIDATION", 0);
 int_fast8_t p__device = get_env_int("TOOLSTEST_DEVICE", -1);
 
+void bench_init(benchmarking& b, const char* test_name, char* enable_file, const char* results_file)
+{
+	b.test_name = test_name;
+	b.init_time = gettime();
+	b.enable_file = enable_file;
+	b.results_file = results_file;
+	if (enable_file) b.raw_samples = nlohmann::json::parse(enable_file).value("raw_samples", false);
+	if (get_env_int("TOOLSTEST_PERF_COUNTERS", 0) && !bench_counters_open(b.counters))
+	{
+		WLOG("Performance counters are not available here (%s), continuing without them", strerror(errno));
+	}
+}
+
+static const char* bench_counter_names[BENCH_COUNTER_COUNT] = { "cycles", "instructions", "cache_misses", "page_faults", "context_switches" };
+
+bool bench_counters_open(bench_counters& c)
+{
+	for (int i = 0; i < BENCH_COUNTER_COUNT; i++) { c.fds[i] = -1; c.slot[i] = -1; c.start[i] = 0; }
+	c.leader = -1;
+	c.count = 0;
+	c.user_only = false;
+#ifdef __linux__
+	const struct { uint32_t type; uint64_t config; } events[BENCH_COUNTER_COUNT] = {
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+		{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+		{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+	};
+	int saved_errno = 0;
+	for (int i = 0; i < BENCH_COUNTER_COUNT; i++)
+	{
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = events[i].type;
+		attr.config = events[i].config;
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		attr.disabled = (c.leader < 0); // the whole group is enabled through its leader
+		attr.exclude_hv = 1;
+		attr.exclude_kernel = c.user_only;
+		int fd = syscall(__NR_perf_event_open, &attr, 0, -1, c.leader, PERF_FLAG_FD_CLOEXEC);
+		if (fd < 0 && c.leader < 0 && !c.user_only)
+		{
+			// perf_event_paranoid commonly allows counting only user space for unprivileged users
+			attr.exclude_kernel = 1;
+			fd = syscall(__NR_perf_event_open, &attr, 0, -1, c.leader, PERF_FLAG_FD_CLOEXEC);
+			if (fd >= 0) c.user_only = true;
+		}
+		if (fd < 0)
+		{
+			saved_errno = errno;
+			DLOG("Could not open performance counter %s: %s", bench_counter_names[i], strerror(errno));
+			continue;
+		}
+		if (c.leader < 0) c.leader = fd;
+		c.fds[i] = fd;
+		c.slot[i] = c.count++;
+	}
+	if (c.leader < 0)
+	{
+		errno = saved_errno;
+		return false;
+	}
+	ioctl(c.leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(c.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	return true;
+#else
+	errno = ENOSYS;
+	return false;
+#endif
+}
+
+void bench_counters_close(bench_counters& c)
+{
+	if (c.leader < 0) return;
+	for (int i = 0; i < BENCH_COUNTER_COUNT; i++) if (c.fds[i] >= 0 && c.fds[i] != c.leader) close(c.fds[i]);
+	close(c.leader);
+	c.leader = -1;
+}
+
+void bench_counters_read(const bench_counters& c, uint64_t* values)
+{
+	uint64_t data[3 + BENCH_COUNTER_COUNT] = {}; // count, time enabled, time running, then the values
+	if (c.leader < 0 || read(c.leader, data, sizeof(data)) < (ssize_t)(3 * sizeof(uint64_t)))
+	{
+		for (int i = 0; i < BENCH_COUNTER_COUNT; i++) values[i] = 0;
+		return;
+	}
+	// If there are more counters than hardware registers, the kernel takes turns counting them
+	const double scale = (data[2] > 0 && data[2] < data[1]) ? (double)data[1] / (double)data[2] : 1.0;
+	for (int i = 0; i < BENCH_COUNTER_COUNT; i++)
+	{
+		values[i] = (c.slot[i] >= 0 && (uint64_t)c.slot[i] < data[0]) ? (uint64_t)((double)data[3 + c.slot[i]] * scale) : 0;
+	}
+}
+
+void bench_record_iteration(benchmarking& b, uint64_t start, uint64_t end)
+{
+	const int scene = std::max<int>(0, (int)b.scene_name.size() - 1);
+	if (b.raw_samples) b.results.push_back({ start, end, scene });
+	if ((int)b.stats.size() <= scene) b.stats.resize(scene + 1);
+	bench_scene_stats& s = b.stats[scene];
+	uint64_t delta[BENCH_COUNTER_COUNT] = {};
+	if (b.counters.leader >= 0)
+	{
+		uint64_t now[BENCH_COUNTER_COUNT];
+		bench_counters_read(b.counters, now);
+		for (int i = 0; i < BENCH_COUNTER_COUNT; i++)
+		{
+			delta[i] = (now[i] > b.counters.start[i]) ? now[i] - b.counters.start[i] : 0; // scaling can make values go back
+			s.counters[i] += delta[i];
+			if (b.raw_samples) b.results.back().counters[i] = delta[i];
+			b.counters.start[i] = now[i];
+		}
+	}
+	const uint64_t time = end - start;
+	if (s.count == 0) s.start = start;
+	s.stop = end;
+	if (s.head.size() < bench_scene_stats::head_size)
+	{
+		s.head.push_back(time);
+		// Keep the counters of the head too, so that the warmup can be taken out of them later
+		if (b.counters.leader >= 0) s.head_counters.insert(s.head_counters.end(), delta, delta + BENCH_COUNTER_COUNT);
+	}
+	else
+	{
+		s.tail_min = std::min(s.tail_min, time);
+		s.tail_max = std::max(s.tail_max, time);
+	}
+	const double shifted = (double)time - (double)s.head[0];
+	s.sum += shifted;
+	s.sum_squares += shifted * shifted;
+	if (s.histogram.counts.empty()) s.histogram.counts.resize(bench_histogram::bucket_count);
+	s.histogram.counts[bench_histogram::index(time)]++;
+	s.count++;
+}
+
+/// Value below which the given fraction of the iterations in the histogram fall
+static uint64_t histogram_percentile(const std::vector<uint32_t>& counts, uint64_t total, double fraction)
+{
+	const uint64_t rank = std::max<uint64_t>(1, (uint64_t)ceil(fraction * total));
+	uint64_t seen = 0;
+	for (int i = 0; i < (int)counts.size(); i++)
+	{
+		seen += counts[i];
+		if (seen >= rank) return bench_histogram::middle(i);
+	}
+	return 0;
+}
+
+bench_summary bench_summarize(const bench_scene_stats& s)
+{
+	bench_summary r;
+	r.iterations = s.count;
+	if (s.count == 0) return r;
+	std::vector<uint32_t> counts = s.histogram.counts;
+
+	// Tukey's fences for "far out" values, three interquartile ranges outside the quartiles
+	const auto fences = [&](uint64_t total)
+	{
+		const uint64_t q1 = histogram_percentile(counts, total, 0.25);
+		const uint64_t q3 = histogram_percentile(counts, total, 0.75);
+		r.low_fence = (q1 > 3 * (q3 - q1)) ? q1 - 3 * (q3 - q1) : 0;
+		r.high_fence = q3 + 3 * (q3 - q1);
+	};
+
+	// The warmup phase lasts until the first run of iterations that all fall inside the fences. We
+	// only look for it in the head, and only if the rest of the run is much longer than the warmup.
+	const unsigned settled_run = 5;
+	fences(s.count);
+	unsigned run = 0;
+	for (unsigned i = 0; i < s.head.size() && run < settled_run; i++)
+	{
+		// The fences are bucket midpoints, so compare with the midpoint of our own bucket, as the outlier count does
+		const uint64_t value = bench_histogram::middle(bench_histogram::index(s.head[i]));
+		run = (value >= r.low_fence && value <= r.high_fence) ? run + 1 : 0;
+		if (run == settled_run) r.warmup_iterations = i + 1 - settled_run;
+	}
+	if (run < settled_run || r.warmup_iterations * 2 > s.count) r.warmup_iterations = 0;
+
+	// Remove the warmup from the statistics
+	double sum = s.sum;
+	double sum_squares = s.sum_squares;
+	for (unsigned i = 0; i < r.warmup_iterations; i++)
+	{
+		const double shifted = (double)s.head[i] - (double)s.head[0];
+		sum -= shifted;
+		sum_squares -= shifted * shifted;
+		counts[bench_histogram::index(s.head[i])]--;
+	}
+	const uint64_t n = s.count - r.warmup_iterations;
+	if (!s.head_counters.empty())
+	{
+		for (int c = 0; c < BENCH_COUNTER_COUNT; c++)
+		{
+			uint64_t warmup = 0;
+			for (unsigned i = 0; i < r.warmup_iterations; i++) warmup += s.head_counters[i * BENCH_COUNTER_COUNT + c];
+			r.counters[c] = (double)(s.counters[c] - warmup) / n;
+			if (r.warmup_iterations > 0) r.warmup_counters[c] = (double)warmup / r.warmup_iterations;
+		}
+	}
+	r.min = s.tail_min;
+	r.max = s.tail_max;
+	for (unsigned i = r.warmup_iterations; i < s.head.size(); i++)
+	{
+		r.min = std::min(r.min, s.head[i]);
+		r.max = std::max(r.max, s.head[i]);
+	}
+	r.mean = (double)s.head[0] + sum / n;
+	const double variance = (n > 1) ? std::max(0.0, (sum_squares - sum * sum / n) / (n - 1)) : 0.0;
+	r.stddev = sqrt(variance);
+	r.cv = (r.mean > 0.0) ? r.stddev / r.mean : 0.0;
+	r.p50 = std::clamp(histogram_percentile(counts, n, 0.50), r.min, r.max);
+	r.p90 = std::clamp(histogram_percentile(counts, n, 0.90), r.min, r.max);
+	r.p99 = std::clamp(histogram_percentile(counts, n, 0.99), r.min, r.max);
+	fences(n);
+	for (int i = 0; i < (int)counts.size(); i++)
+	{
+		const uint64_t value = bench_histogram::middle(i);
+		if (value < r.low_fence || value > r.high_fence) r.outliers += counts[i];
+	}
+	return r;
+}
+
+/// Write the results file as we go, instead of building it all in memory first, since it can
+/// get very large with raw samples.
 void bench_save_results_file(const benchmarking& b)
 {
-	printf("Writing benchmarking results file (%d iterations): %s\n", (int)b.results.size(), b.results_file.c_str());
-	nlohmann::json data;
-	data["app_version"] = "1.0";
-	data["std_version"] = 1;
-	data["enable_file"] = nlohmann::json::parse(b.enable_file);
-	if (!b.backend_name.empty()) data["rendering_backend"] = b.backend_name;
-	data["init_time"] = b.init_time;
-	data["end_time"] = gettime();
-	nlohmann::json results = nlohmann::json::array();
-	for (const auto& v : b.results)
-	{
-		nlohmann::json result;
-		if (!b.scene_name.empty())
+	const int scenes = std::max<int>(b.stats.size(), b.scene_name.size());
+	printf("Writing benchmarking results file (%d scenes): %s\n", scenes, b.results_file.c_str());
+	FILE* fp = fopen(b.results_file.c_str(), "w");
+	if (!fp)
+	{
+		ELOG("Failed to open results file %s: %s", b.results_file.c_str(), strerror(errno));
+		return;
+	}
+	fprintf(fp, "{\n");
+	fprintf(fp, "    \"app_version\": \"1.0\",\n");
+	fprintf(fp, "    \"std_version\": 1,\n");
+	fprintf(fp, "    \"enable_file\": %s,\n", nlohmann::json::parse(b.enable_file).dump().c_str());
+	if (!b.backend_name.empty()) fprintf(fp, "    \"rendering_backend\": %s,\n", nlohmann::json(b.backend_name).dump().c_str());
+	fprintf(fp, "    \"init_time\": %llu,\n", (unsigned long long)b.init_time);
+	fprintf(fp, "    \"end_time\": %llu,\n", (unsigned long long)gettime());
+	fprintf(fp, "    \"results\": [");
+	size_t raw_index = 0;
+	const bench_scene_stats no_iterations;
+	for (int scene = 0; scene < scenes; scene++)
+	{
+		const bench_scene_stats& s = (scene < (int)b.stats.size()) ? b.stats[scene] : no_iterations;
+		const bench_summary r = bench_summarize(s);
+		fprintf(fp, "%s\n        {\n", scene > 0 ? "," : "");
+		if (scene < (int)b.scene_name.size())
+		{
+			fprintf(fp, "            \"scene\": %s,\n", nlohmann::json(b.scene_name.at(scene)).dump().c_str());
+			if (scene < (int)b.scene_result_file.size() && !b.scene_result_file.at(scene).empty())
+			{
+				fprintf(fp, "            \"output\": %s,\n", nlohmann::json(b.scene_result_file.at(scene)).dump().c_str());
+				fprintf(fp, "            \"output_type\": \"png\",\n");
+				fprintf(fp, "            \"validated\": false,\n");
+			}
+		}
+		fprintf(fp, "            \"duration\": %llu,\n", (unsigned long long)((s.stop - s.start) / 1000000));
+		fprintf(fp, "            \"start_time\": %llu,\n", (unsigned long long)s.start);
+		fprintf(fp, "            \"stop_time\": %llu,\n", (unsigned long long)s.stop);
+		if (s.work > 0 && s.stop > s.start) fprintf(fp, "            \"throughput\": %.1f,\n", s.work * 1000000000.0 / (s.stop - s.start));
+		fprintf(fp, "            \"statistics\": {\n");
+		fprintf(fp, "                \"iterations\": %llu,\n", (unsigned long long)r.iterations);
+		fprintf(fp, "                \"warmup_iterations\": %llu,\n", (unsigned long long)r.warmup_iterations);
+		fprintf(fp, "                \"min\": %llu,\n", (unsigned long long)r.min);
+		fprintf(fp, "                \"mean\": %.1f,\n", r.mean);
+		fprintf(fp, "                \"p50\": %llu,\n", (unsigned long long)r.p50);
+		fprintf(fp, "                \"p90\": %llu,\n", (unsigned long long)r.p90);
+		fprintf(fp, "                \"p99\": %llu,\n", (unsigned long long)r.p99);
+		fprintf(fp, "                \"max\": %llu,\n", (unsigned long long)r.max);
+		fprintf(fp, "                \"stddev\": %.1f,\n", r.stddev);
+		fprintf(fp, "                \"cv\": %.6f,\n", r.cv);
+		fprintf(fp, "                \"outliers\": %llu\n", (unsigned long long)r.outliers);
+		fprintf(fp, "            }");
+		if (b.counters.leader >= 0 && s.count > 0)
 		{
-			result["scene"] = b.scene_name.at(v.scene);
-			if ((int)b.scene_result_file.size() >= v.scene && !b.scene_result_file.at(v.scene).empty())
+			fprintf(fp, ",\n            \"counters\": {\n");
+			fprintf(fp, "                \"user_only\": %s", b.counters.user_only ? "true" : "false");
+			for (int i = 0; i < BENCH_COUNTER_COUNT; i++)
 			{
-				result["output"] = b.scene_result_file.at(v.scene);
-				result["putput_type"] = "png";
-				result["validated"] = false;
+				if (b.counters.slot[i] < 0) continue;
+				fprintf(fp, ",\n                \"%s\": %.1f", bench_counter_names[i], r.counters[i]);
 			}
+			fprintf(fp, "\n            }");
 		}
-		result["start_time"] = v.start;
-		result["stop_time"] = v.end;
-		result["time"] = v.end - v.start;
-		results.push_back(result);
-	}
-	data["results"] = results;
-	std::ofstream file(b.results_file);
-	file << data.dump(4);
-	file.close();
+		if (b.counters.leader >= 0 && r.warmup_iterations > 0)
+		{
+			fprintf(fp, ",\n            \"warmup_counters\": {\n");
+			fprintf(fp, "                \"user_only\": %s", b.counters.user_only ? "true" : "false");
+			for (int i = 0; i < BENCH_COUNTER_COUNT; i++)
+			{
+				if (b.counters.slot[i] < 0) continue;
+				fprintf(fp, ",\n                \"%s\": %.1f", bench_counter_names[i], r.warmup_counters[i]);
+			}
+			fprintf(fp, "\n            }");
+		}
+		if (b.raw_samples)
+		{
+			fprintf(fp, ",\n            \"samples\": [");
+			uint64_t i = 0;
+			for (; raw_index < b.results.size() && b.results[raw_index].scene == scene; raw_index++, i++)
+			{
+				const result_t& v = b.results[raw_index];
+				const uint64_t time = v.end - v.start;
+				const uint64_t value = bench_histogram::middle(bench_histogram::index(time)); // as in the histogram
+				const bool outlier = i >= r.warmup_iterations && (value < r.low_fence || value > r.high_fence);
+				fprintf(fp, "%s\n                { \"start_time\": %llu, \"stop_time\": %llu, \"time\": %llu%s%s", i > 0 ? "," : "",
+				        (unsigned long long)v.start, (unsigned long long)v.end, (unsigned long long)time, i < r.warmup_iterations ? ", \"warmup\": true" : "",
+				        outlier ? ", \"outlier\": true" : "");
+				for (int c = 0; c < BENCH_COUNTER_COUNT && b.counters.leader >= 0; c++)
+				{
+					if (b.counters.slot[c] >= 0) fprintf(fp, ", \"%s\": %llu", bench_counter_names[c], (unsigned long long)v.counters[c]);
+				}
+				fprintf(fp, " }");
+			}
+			fprintf(fp, "\n            ]");
+		}
+		fprintf(fp, "\n        }");
+	}
+	fprintf(fp, "\n    ]\n}\n");
+	fclose(fp);
 }
 
 void set_thread_name(const char* name)
@@ -16,10 +16,13 @@
 #include <string>
 #include <stdint.h>
 
+#include "checksum.h"
+
 /// Implement support for naming threads, missing from c++11
 void set_thread_name(const char* name);
 
 extern uint_fast32_t p__loops;
+extern double p__loop_time;
 extern uint_fast8_t p__sanity;
 extern uint_fast8_t p__debug_level;
 extern uint_fast8_t p__validation;
@@ -85,16 +88,9 @@ int STOI(const std::string& value);
 #define UINT32_MAX (4294967295U)
 #endif
 
-static __attribute__((pure)) inline uint32_t adler32(unsigned char *data, size_t len)
+static inline uint32_t adler32(const unsigned char *data, size_t len)
 {
-	const uint32_t MOD_ADLER = 65521;
-	uint32_t a = 1, b = 0;
-	for (size_t index = 0; index < len; ++index)
-	{
-		a = (a + data[index]) % MOD_ADLER;
-		b = (b + a) % MOD_ADLER;
-	}
-	return (b << 16) | a;
+	return adler32_update(1, data, len);
 }
 
 static __attribute__((pure)) inline uint64_t gettime()
@@ -109,15 +105,119 @@ static __attribute__((pure)) inline uint64_t gettime()
 }
 
 /// Things needed for implementing benchmarking standard
+
+/// Performance counters that we can capture around each iteration
+enum bench_counter
+{
+	BENCH_COUNTER_CYCLES,
+	BENCH_COUNTER_INSTRUCTIONS,
+	BENCH_COUNTER_CACHE_MISSES,
+	BENCH_COUNTER_PAGE_FAULTS,
+	BENCH_COUNTER_CONTEXT_SWITCHES,
+	BENCH_COUNTER_COUNT
+};
+
+/// A group of performance counters opened with perf_event_open() for the calling thread. Counters
+/// that we are not allowed to open, for example in containers or because of perf_event_paranoid,
+/// are left out, and if none could be opened the group is not used at all.
+struct bench_counters
+{
+	int leader = -1; // file descriptor of the group leader, or -1 if not in use
+	int fds[BENCH_COUNTER_COUNT];
+	int slot[BENCH_COUNTER_COUNT]; // position of each counter in a group read, or -1 if not opened
+	int count = 0; // number of counters in the group
+	bool user_only = false; // could only count user space
+	uint64_t start[BENCH_COUNTER_COUNT]; // values at the start of the current iteration
+};
+
 struct result_t
 {
 	uint64_t start;
 	uint64_t end;
 	int scene;
+	uint64_t counters[BENCH_COUNTER_COUNT];
+};
+
+/// Log-linear histogram of iteration times in nanoseconds, in the style of HdrHistogram. Each power
+/// of two range is split into 64 buckets, so percentiles are within about 1.6% of their true value.
+struct bench_histogram
+{
+	static constexpr int sub_bits = 6;
+	static constexpr int sub_count = 1 << sub_bits;
+	static constexpr int bucket_count = (64 - sub_bits + 1) * sub_count;
+
+	std::vector<uint32_t> counts; // allocated on first use
+
+	static inline int index(uint64_t value)
+	{
+		if (value < 2 * sub_count) return (int)value;
+		const int shift = 63 - __builtin_clzll(value) - sub_bits;
+		return (shift + 1) * sub_count + (int)(value >> shift) - sub_count;
+	}
+	/// Lowest value that falls into a bucket
+	static inline uint64_t lowest(int index)
+	{
+		if (index < 2 * sub_count) return index;
+		const int shift = index / sub_count - 1;
+		return (uint64_t)(index % sub_count + sub_count) << shift;
+	}
+	/// Value in the middle of a bucket, which is what we report for it
+	static inline uint64_t middle(int index)
+	{
+		if (index < 2 * sub_count) return index;
+		return lowest(index) + (1ull << (index / sub_count - 1)) / 2;
+	}
+};
+
+/// Streaming statistics for the iterations of one scene. We do not keep every iteration time, only
+/// the first few, which we need to find where the warmup phase ends.
+struct bench_scene_stats
+{
+	static constexpr unsigned head_size = 1024;
+
+	uint64_t count = 0;
+	uint64_t start = 0; // start of the first iteration
+	uint64_t stop = 0; // end of the last iteration
+	uint64_t tail_min = UINT64_MAX; // over iterations after the head
+	uint64_t tail_max = 0;
+	// Sums of iteration times minus the first one, which keeps the variance numerically stable
+	double sum = 0.0;
+	double sum_squares = 0.0;
+	bench_histogram histogram;
+	std::vector<uint64_t> head; // times of the first iterations
+	uint64_t counters[BENCH_COUNTER_COUNT] = {}; // totals over all iterations
+	std::vector<uint64_t> head_counters; // counters of the head iterations, BENCH_COUNTER_COUNT values each
+	uint64_t work = 0; // work items done, from bench_add_work()
 };
+
+/// Summary of the iterations of one scene after its warmup phase. All times are in nanoseconds.
+struct bench_summary
+{
+	uint64_t iterations = 0;
+	uint64_t warmup_iterations = 0;
+	uint64_t min = 0;
+	uint64_t max = 0;
+	double mean = 0.0;
+	double stddev = 0.0;
+	double cv = 0.0; // coefficient of variation, stddev / mean
+	uint64_t p50 = 0;
+	uint64_t p90 = 0;
+	uint64_t p99 = 0;
+	uint64_t outliers = 0; // iterations outside the outlier fences below
+	uint64_t low_fence = 0;
+	uint64_t high_fence = 0;
+	double counters[BENCH_COUNTER_COUNT] = {}; // mean per iteration after the warmup phase
+	double warmup_counters[BENCH_COUNTER_COUNT] = {}; // mean per iteration during the warmup phase
+};
+
 struct benchmarking
 {
-	std::vector<result_t> results; // store all results
+	std::vector<result_t> results; // store all results, if raw samples were asked for
+	std::vector<bench_scene_stats> stats; // by scene
+	bool raw_samples = false;
+	bool looping = false; // iterations are driven by bench_loop()
+	uint64_t loop_start = 0;
+	bench_counters counters;
 	uint64_t init_time = 0; // to track start of whole run
 	uint64_t latest_time = 0; // if we need it, to track start of latest iteration
 	char* enable_file = nullptr; // copy of the enable file for the results file
@@ -128,20 +228,56 @@ struct benchmarking
 	std::string backend_name;
 };
 
+void bench_init(benchmarking& b, const char* test_name, char* enable_file, const char* results_file);
+void bench_record_iteration(benchmarking& b, uint64_t start, uint64_t end);
+bench_summary bench_summarize(const bench_scene_stats& s);
 void bench_save_results_file(const benchmarking& b);
-static inline void bench_init(benchmarking& b, const char* test_name, char* enable_file, const char* results_file)
-{
-	b.test_name = test_name;
-	b.init_time = gettime();
-	b.enable_file = enable_file;
-	b.results_file = results_file;
-}
+/// Open performance counters for the calling thread. Returns false if none could be opened.
+bool bench_counters_open(bench_counters& c);
+void bench_counters_close(bench_counters& c);
+/// Read the current value of each counter, scaled up if the kernel had to multiplex them.
+void bench_counters_read(const bench_counters& c, uint64_t* values);
 static inline void bench_done(benchmarking& b)
 {
 	if (b.enable_file) { bench_save_results_file(b); free(b.enable_file); }
+	bench_counters_close(b.counters);
+}
+static inline void bench_start_iteration(benchmarking& b)
+{
+	if (b.counters.leader >= 0) bench_counters_read(b.counters, b.counters.start);
+	b.latest_time = gettime();
+}
+static inline void bench_stop_iteration(benchmarking& b) { bench_record_iteration(b, b.latest_time, gettime()); }
+/// Count work items done in the current scene, for tests that measure throughput rather than time
+static inline void bench_add_work(benchmarking& b, uint64_t items)
+{
+	const int scene = b.scene_name.empty() ? 0 : (int)b.scene_name.size() - 1;
+	if ((int)b.stats.size() <= scene) b.stats.resize(scene + 1);
+	b.stats[scene].work += items;
+}
+
+/// Shared driver for test loops, which implements the loops and loop_time capabilities. Use it as
+/// the loop condition, like `for (unsigned frame = 0; bench_loop(b, frame); frame++)`. It runs
+/// p__loops iterations, so none if that is zero, unless p__loop_time gives a time budget in
+/// seconds, in which case it runs iterations until the budget is spent. Sustained runs must set a
+/// time budget. Each iteration is timed as a benchmark iteration, so the loop body should not
+/// call bench_start/stop_iteration().
+static inline bool bench_loop(benchmarking& b, uint64_t iteration)
+{
+	const uint64_t now = gettime();
+	if (iteration == 0)
+	{
+		b.loop_start = now;
+		if (b.counters.leader >= 0) bench_counters_read(b.counters, b.counters.start);
+	}
+	else bench_record_iteration(b, b.latest_time, now);
+	bool more;
+	if (p__loop_time > 0.0) more = now - b.loop_start < (uint64_t)(p__loop_time * 1000000000.0);
+	else more = iteration < p__loops;
+	b.looping = more;
+	b.latest_time = now;
+	return more;
 }
-static inline void bench_start_iteration(benchmarking& b) { b.latest_time = gettime(); }
-static inline void bench_stop_iteration(benchmarking& b) { b.results.push_back({ b.latest_time, gettime(), std::max<int>(0, (int)b.scene_name.size() - 1) }); }
 static inline void bench_start_scene(benchmarking& b, const std::string& scene_name) { b.scene_name.push_back(scene_name); }
 static inline void bench_stop_scene(benchmarking& b, const std::string& filename = std::string()) { b.scene_result_file.push_back(filename); }
 
@@ -1,6 +1,9 @@
 #include "vulkan_common.h"
 #include "external/json.hpp"
+#include <algorithm>
+#include <atomic>
 #include <fstream>
+#include <memory>
 #include <spirv/unified1/spirv.h>
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -10,6 +13,22 @@ static VkPhysicalDeviceMemoryProperties memory_properties = {};
 static int no_explicit = 0;
 static int no_trace_helpers = 0;
 
+/// Instance and device kept alive between tests run in the same process by the test runner
+struct shared_setup
+{
+	vulkan_setup_t vulkan;
+	VkPhysicalDeviceMemoryProperties memory_properties = {};
+	std::unique_ptr<std::atomic<int64_t>> allocations; // live device memory allocations, if we have VK_EXT_device_memory_report
+	int64_t allocations_at_init = 0;
+	PFN_vkGetLiveObjectCountsCHAMELEON vkGetLiveObjectCounts = nullptr; // if the driver is Chameleon
+	std::vector<VkObjectType> live_types;
+	std::vector<int64_t> live_at_init;
+	bool in_use = false;
+};
+static bool share_setups = false;
+static std::unordered_map<std::string, shared_setup> shared_setups; // by requirements
+static int64_t shared_leaks = 0;
+
 static VkBool32 messenger_callback(
     VkDebugUtilsMessageSeverityFlagBitsEXT           messageSeverity,
     VkDebugUtilsMessageTypeFlagsEXT                  messageTypes,
@@ -57,9 +76,42 @@ void testFreeMemory(const vulkan_setup_t& vulkan, VkDeviceMemory memory)
 	vkFreeMemory(vulkan.device, memory, nullptr);
 }
 
+/// Number of live objects of each type in shared.live_types, as counted by Chameleon
+static std::vector<int64_t> live_objects(shared_setup& shared)
+{
+	if (!shared.vkGetLiveObjectCounts) return std::vector<int64_t>();
+	uint32_t count = 0;
+	shared.vkGetLiveObjectCounts(shared.vulkan.device, &count, nullptr, nullptr);
+	shared.live_types.resize(count);
+	std::vector<int64_t> live(count);
+	shared.vkGetLiveObjectCounts(shared.vulkan.device, &count, shared.live_types.data(), live.data());
+	return live;
+}
+
 void test_done(vulkan_setup_t& vulkan, bool shared_instance)
 {
 	bench_done(vulkan.bench);
+	for (auto& pair : shared_setups)
+	{
+		shared_setup& shared = pair.second;
+		if (shared.vulkan.device != vulkan.device) continue;
+		// Keep it for the next test, but check that this one cleaned up after itself
+		vkDeviceWaitIdle(vulkan.device);
+		const int64_t leaked = shared.allocations ? shared.allocations->load() - shared.allocations_at_init : 0;
+		if (leaked > 0) ELOG("%lld device memory allocations were not freed", (long long)leaked);
+		if (leaked > 0) shared_leaks += leaked;
+		const std::vector<int64_t> live = live_objects(shared);
+		for (unsigned i = 0; i < live.size() && i < shared.live_at_init.size(); i++)
+		{
+			const int64_t leaked_objects = live[i] - shared.live_at_init[i];
+			if (leaked_objects > 0) ELOG("%lld objects of type %d were not destroyed", (long long)leaked_objects, (int)shared.live_types[i]);
+			if (leaked_objects > 0) shared_leaks += leaked_objects;
+		}
+		shared.in_use = false;
+		vulkan.device = VK_NULL_HANDLE;
+		if (!shared_instance) vulkan.instance = VK_NULL_HANDLE;
+		return;
+	}
 	vkDestroyDevice(vulkan.device, nullptr);
 	vulkan.device = VK_NULL_HANDLE;
 
@@ -70,6 +122,85 @@ void test_done(vulkan_setup_t& vulkan, bool shared_instance)
 	}
 }
 
+void test_share_setups(bool enable)
+{
+	share_setups = enable;
+}
+
+int64_t test_shared_finish()
+{
+	for (auto& pair : shared_setups) pair.second.in_use = false; // in case the test did not call test_done()
+	const int64_t leaks = shared_leaks;
+	shared_leaks = 0;
+	return leaks;
+}
+
+void test_destroy_shared_setups()
+{
+	for (auto& pair : shared_setups)
+	{
+		vkDestroyDevice(pair.second.vulkan.device, nullptr);
+		vkDestroyInstance(pair.second.vulkan.instance, nullptr);
+	}
+	shared_setups.clear();
+}
+
+template<typename T> static void append_features(std::string& key, const T& features)
+{
+	const size_t header = sizeof(VkBaseOutStructure); // sType and pNext
+	key.append((const char*)&features + header, sizeof(T) - header);
+}
+
+/// Everything from the requirements and command line that can change how we create the instance and device. Requirements
+/// with extension feature structures cannot be compared, so these are never shared.
+static std::string setup_key(int argc, char** argv, const vulkan_req_t& reqs)
+{
+	std::string key = std::to_string(reqs.apiVersion) + " " + std::to_string(reqs.queues) + " " + std::to_string(reqs.required_queue_flags) + " " +
+	                  std::to_string(reqs.fence_delay) + " " + std::to_string(reqs.samplerAnisotropy) + std::to_string(reqs.bufferDeviceAddress);
+	for (int i = 1; i < argc; i++) key += std::string(" ") + argv[i];
+	std::vector<std::string> instance_extensions = reqs.instance_extensions;
+	std::vector<std::string> device_extensions = reqs.device_extensions;
+	std::sort(instance_extensions.begin(), instance_extensions.end());
+	std::sort(device_extensions.begin(), device_extensions.end());
+	for (const std::string& str : instance_extensions) key += " i:" + str;
+	for (const std::string& str : device_extensions) key += " d:" + str;
+	for (VkDriverId id : reqs.blocked_drivers) key += " b:" + std::to_string((int)id);
+	key += '\0';
+	key.append((const char*)&reqs.reqfeat2.features, sizeof(reqs.reqfeat2.features));
+	append_features(key, reqs.reqfeat11);
+	append_features(key, reqs.reqfeat12);
+	append_features(key, reqs.reqfeat13);
+	append_features(key, reqs.reqfeat14);
+	return key;
+}
+
+/// Fix up the feature chain after copying a setup, so that it does not point into the original
+static void link_features(vulkan_setup_t& vulkan)
+{
+	vulkan.hasfeat2.pNext = &vulkan.hasfeat11;
+	vulkan.hasfeat11.pNext = &vulkan.hasfeat12;
+	vulkan.hasfeat12.pNext = &vulkan.hasfeat13;
+	vulkan.hasfeat13.pNext = &vulkan.hasfeat14;
+	vulkan.hasfeat14.pNext = nullptr;
+}
+
+static void VKAPI_PTR memory_report_callback(const VkDeviceMemoryReportCallbackDataEXT* pCallbackData, void* pUserData)
+{
+	std::atomic<int64_t>* allocations = (std::atomic<int64_t>*)pUserData;
+	if (pCallbackData->objectType != VK_OBJECT_TYPE_DEVICE_MEMORY) return; // ignore internal driver allocations
+	if (pCallbackData->type == VK_DEVICE_MEMORY_REPORT_EVENT_TYPE_ALLOCATE_EXT || pCallbackData->type == VK_DEVICE_MEMORY_REPORT_EVENT_TYPE_IMPORT_EXT) (*allocations)++;
+	else if (pCallbackData->type == VK_DEVICE_MEMORY_REPORT_EVENT_TYPE_FREE_EXT || pCallbackData->type == VK_DEVICE_MEMORY_REPORT_EVENT_TYPE_UNIMPORT_EXT) (*allocations)--;
+}
+
+/// Skip the test. When run by the test runner, we clean up and return to it instead of exiting.
+[[noreturn]] static void skip_test(vulkan_setup_t& vulkan, const vulkan_req_t& reqs)
+{
+	if (!share_setups) exit(77);
+	if (vulkan.device != VK_NULL_HANDLE) vkDestroyDevice(vulkan.device, nullptr);
+	if (vulkan.instance != VK_NULL_HANDLE && vulkan.instance != reqs.instance) vkDestroyInstance(vulkan.instance, nullptr);
+	throw test_skip_exception();
+}
+
 static int apiversion2variant(uint32_t apiversion)
 {
 	switch(apiversion)
@@ -164,6 +295,7 @@ static bool check_bench(vulkan_setup_t& vulkan, vulkan_req_t& reqs, const char*
 		reqs.fence_delay = caps.value("gpu_delay_reuse", 0);
 		if (caps.count("frameless") && caps.value("frameless", true) == false) enable_frame_boundary(reqs);
 		p__loops = caps.value("loops", p__loops);
+		p__loop_time = caps.value("loop_time", p__loop_time);
 		// TBD: gpu_no_coherent
 	}
 
@@ -213,6 +345,8 @@ vulkan_setup_t test_init(int argc, char** argv, const std::string& testname, vul
 	check_bench(vulkan, reqs, testname.c_str());
 	vulkan.bench.backend_name = "Vulkan " + api;
 
+	no_explicit = 0; // the test runner may run many tests in one process
+	no_trace_helpers = 0;
 	for (int i = 1; i < argc; i++)
 	{
 		int old = i;
@@ -294,6 +428,29 @@ vulkan_setup_t test_init(int argc, char** argv, const std::string& testname, vul
 		print_usage(reqs);
 	}
 
+	// Reuse instance and device from an earlier test with the same requirements, if the test runner allows it
+	const bool shareable = share_setups && reqs.instance == VK_NULL_HANDLE && reqs.extension_features == nullptr && !reqs.surface;
+	const std::string key = shareable ? setup_key(argc, argv, reqs) : std::string();
+	std::unique_ptr<std::atomic<int64_t>> allocations;
+	if (shareable && shared_setups.count(key) && !shared_setups.at(key).in_use)
+	{
+		shared_setup& shared = shared_setups.at(key);
+		benchmarking bench = std::move(vulkan.bench);
+		vulkan = shared.vulkan;
+		link_features(vulkan);
+		vulkan.bench = std::move(bench);
+		memory_properties = shared.memory_properties;
+		if (shared.allocations) shared.allocations_at_init = shared.allocations->load();
+		shared.live_at_init = live_objects(shared);
+		shared.in_use = true;
+		ILOG("Reusing Vulkan instance and device from an earlier test");
+		return vulkan;
+	}
+	else if (shareable && !shared_setups.count(key))
+	{
+		allocations = std::make_unique<std::atomic<int64_t>>(0);
+	}
+
 	std::unordered_set<std::string> instance_required(reqs.instance_extensions.begin(), reqs.instance_extensions.end()); // temp copy
 	std::unordered_set<std::string> device_required(reqs.device_extensions.begin(), reqs.device_extensions.end()); // temp copy
 	vulkan.instance_extensions.insert(reqs.instance_extensions.begin(), reqs.instance_extensions.end()); // permanent copy
@@ -340,7 +497,7 @@ vulkan_setup_t test_init(int argc, char** argv, const std::string& testname, vul
 		{
 			printf("Missing required Vulkan instance extensions:\n");
 			for (auto str : instance_required) printf("\t%s\n", str.c_str());
-			exit(77);
+			skip_test(vulkan, reqs);
 		}
 		if (wsi && strcmp(wsi, "headless") == 0 && reqs.surface)
 		{
@@ -421,7 +578,7 @@ vulkan_setup_t test_init(int argc, char** argv, const std::string& testname, vul
 	if (selected_gpu == -1)
 	{
 		printf("No GPU of the desired type found\n");
-		exit(77);
+		skip_test(vulkan, reqs);
 	}
 	printf("Selecting physical device %d\n", selected_gpu);
 	assert(selected_gpu < (int)num_devices); // Should not be possible
@@ -431,7 +588,7 @@ vulkan_setup_t test_init(int argc, char** argv, const std::string& testname, vul
 	{
 		printf("Selected GPU does support required Vulkan version %d.%d.%d\n", VK_VERSION_MAJOR(reqs.apiVersion),
 		       VK_VERSION_MINOR(reqs.apiVersion), VK_VERSION_PATCH(reqs.apiVersion));
-		exit(77);
+		skip_test(vulkan, reqs);
 	}
 	vulkan.physical = physical_devices.at(selected_gpu);
 
@@ -450,7 +607,7 @@ vulkan_setup_t test_init(int argc, char** argv, const std::string& testname, vul
 			if (familyprops[0].queueFamilyProperties.queueCount < reqs.queues)
 			{
 				printf("Vulkan implementation does not have sufficient queues (only %d, need %u) for this test\n", familyprops[0].queueFamilyProperties.queueCount, reqs.queues);
-				exit(77);
+				skip_test(vulkan, reqs);
 			}
 			selected_queue_family = 0;
 			found_matching_queue_family = true;
@@ -478,7 +635,7 @@ vulkan_setup_t test_init(int argc, char** argv, const std::string& testname, vul
 			if (familyprops[0].queueCount < reqs.queues)
 			{
 				printf("Vulkan implementation does not have sufficient queues (only %d, need %u) for this test\n", familyprops[0].queueCount, reqs.queues);
-				exit(77);
+				skip_test(vulkan, reqs);
 			}
 			selected_queue_family = 0;
 			found_matching_queue_family = true;
@@ -501,14 +658,14 @@ vulkan_setup_t test_init(int argc, char** argv, const std::string& testname, vul
 	{
 		printf("Vulkan implementation does not have a queue family matching flags 0x%x with at least %u queues for this test\n",
 		       reqs.required_queue_flags, reqs.queues);
-		exit(77);
+		skip_test(vulkan, reqs);
 	}
 	vulkan.queue_family_index = selected_queue_family;
 
 	if (reqs.bufferDeviceAddress && reqs.apiVersion < VK_API_VERSION_1_2)
 	{
 		printf("Buffer device address feature requires at least Vulkan 1.2 - set the Vulkan version with the -V parameter\n");
-		exit(77);
+		skip_test(vulkan, reqs);
 	}
 	if (reqs.bufferDeviceAddress)
 	{
@@ -519,9 +676,9 @@ vulkan_setup_t test_init(int argc, char** argv, const std::string& testname, vul
 	if (VK_VERSION_MAJOR(reqs.apiVersion) >= 1 && VK_VERSION_MINOR(reqs.apiVersion) >= 1)
 	{
 		vkGetPhysicalDeviceFeatures2(vulkan.physical, &vulkan.hasfeat2);
-		if (reqs.samplerAnisotropy && !vulkan.hasfeat2.features.samplerAnisotropy) { printf("Sampler anisotropy required but not supported!\n"); exit(77); }
-		if (reqs.reqfeat12.bufferDeviceAddress && !vulkan.hasfeat12.bufferDeviceAddress) { printf("Buffer device address extension feature required but not supported!\n"); exit(77); }
-		if (reqs.bufferDeviceAddress && !vulkan.hasfeat12.bufferDeviceAddress) { printf("Buffer device address required but not supported!\n"); exit(77); }
+		if (reqs.samplerAnisotropy && !vulkan.hasfeat2.features.samplerAnisotropy) { printf("Sampler anisotropy required but not supported!\n"); skip_test(vulkan, reqs); }
+		if (reqs.reqfeat12.bufferDeviceAddress && !vulkan.hasfeat12.bufferDeviceAddress) { printf("Buffer device address extension feature required but not supported!\n"); skip_test(vulkan, reqs); }
+		if (reqs.bufferDeviceAddress && !vulkan.hasfeat12.bufferDeviceAddress) { printf("Buffer device address required but not supported!\n"); skip_test(vulkan, reqs); }
 		if (vulkan.hasfeat13.synchronization2 == VK_TRUE) reqs.reqfeat13.synchronization2 = VK_TRUE;
 	}
 	else // vulkan 1.0 mode
@@ -555,7 +712,7 @@ vulkan_setup_t test_init(int argc, char** argv, const std::string& testname, vul
 		if (!has_driver_properties)
 		{
 			printf("Driver ID blocking requested for %s, but the selected Vulkan driver does not expose driver properties.\n", testname.c_str());
-			exit(77);
+			skip_test(vulkan, reqs);
 		}
 	}
 
@@ -586,7 +743,7 @@ vulkan_setup_t test_init(int argc, char** argv, const std::string& testname, vul
 		{
 			printf("Skipping %s on blocked Vulkan driver ID %d (%s: %s)\n",
 			       testname.c_str(), driver_properties.driverID, driver_properties.driverName, driver_properties.driverInfo);
-			exit(77);
+			skip_test(vulkan, reqs);
 		}
 	}
 	else
@@ -595,7 +752,7 @@ vulkan_setup_t test_init(int argc, char** argv, const std::string& testname, vul
 		if (!reqs.blocked_drivers.empty())
 		{
 			printf("Driver ID blocking requested for %s, but this test is running in Vulkan 1.0 mode.\n", testname.c_str());
-			exit(77);
+			skip_test(vulkan, reqs);
 		}
 	}
 
@@ -630,6 +787,9 @@ vulkan_setup_t test_init(int argc, char** argv, const std::string& testname, vul
 	}
 
 	VkPhysicalDeviceExplicitHostUpdatesFeaturesARM explicit_updates_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXPLICIT_HOST_UPDATES_FEATURES_ARM, nullptr };
+	VkPhysicalDeviceDeviceMemoryReportFeaturesEXT memory_report_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DEVICE_MEMORY_REPORT_FEATURES_EXT, nullptr };
+	VkDeviceDeviceMemoryReportCreateInfoEXT memory_report_info = { VK_STRUCTURE_TYPE_DEVICE_DEVICE_MEMORY_REPORT_CREATE_INFO_EXT, nullptr };
+	bool has_memory_report = false;
 
 	for (const VkExtensionProperties& s : supported_device_extensions)
 	{
@@ -649,6 +809,23 @@ vulkan_setup_t test_init(int argc, char** argv, const std::string& testname, vul
 			explicit_updates_features.pNext = (void*)deviceInfo.pNext;
 			deviceInfo.pNext = &explicit_updates_features;
 		}
+		else if (allocations && strcmp(s.extensionName, VK_EXT_DEVICE_MEMORY_REPORT_EXTENSION_NAME) == 0 && reqs.apiVersion >= VK_API_VERSION_1_1 &&
+		         vulkan.device_extensions.count(VK_EXT_DEVICE_MEMORY_REPORT_EXTENSION_NAME) == 0)
+		{
+			// Used by the test runner to check for leaks in tests that share this device
+			VkPhysicalDeviceFeatures2 features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2, &memory_report_features };
+			vkGetPhysicalDeviceFeatures2(vulkan.physical, &features);
+			if (memory_report_features.deviceMemoryReport)
+			{
+				enabledExtensions.push_back(s.extensionName);
+				has_memory_report = true;
+				memory_report_features.pNext = (void*)deviceInfo.pNext;
+				memory_report_info.pNext = &memory_report_features;
+				memory_report_info.pfnUserCallback = memory_report_callback;
+				memory_report_info.pUserData = allocations.get();
+				deviceInfo.pNext = &memory_report_info;
+			}
+		}
 		else if (reqs.bufferDeviceAddress && strcmp(s.extensionName, VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME) == 0 &&
 		         vulkan.device_extensions.count(VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME) == 0)
 		{
@@ -673,7 +850,7 @@ vulkan_setup_t test_init(int argc, char** argv, const std::string& testname, vul
 	{
 		printf("Missing required Vulkan device extensions:\n");
 		for (auto str : device_required) printf("\t%s\n", str.c_str());
-		exit(77);
+		skip_test(vulkan, reqs);
 	}
 	deviceInfo.enabledExtensionCount = enabledExtensions.size();
 	if (enabledExtensions.size() > 0)
@@ -692,7 +869,7 @@ vulkan_setup_t test_init(int argc, char** argv, const std::string& testname, vul
 	}
 
 	result = vkCreateDevice(vulkan.physical, &deviceInfo, NULL, &vulkan.device);
-	if (result == VK_ERROR_FEATURE_NOT_PRESENT) { ILOG("Device creation failed due to missing feature"); exit(77); }
+	if (result == VK_ERROR_FEATURE_NOT_PRESENT) { ILOG("Device creation failed due to missing feature"); skip_test(vulkan, reqs); }
 	check(result);
 	test_set_name(vulkan, VK_OBJECT_TYPE_DEVICE, (uint64_t)vulkan.device, "Our device");
 
@@ -749,6 +926,19 @@ vulkan_setup_t test_init(int argc, char** argv, const std::string& testname, vul
 		vulkan.vkCmdPushConstants2 = reinterpret_cast<PFN_vkCmdPushConstants2KHR>(vkGetDeviceProcAddr(vulkan.device, "vkCmdPushConstants2KHR"));
 	}
 
+	if (allocations)
+	{
+		shared_setup& shared = shared_setups[key];
+		shared.vulkan = vulkan;
+		link_features(shared.vulkan);
+		shared.vulkan.bench = benchmarking();
+		shared.memory_properties = memory_properties;
+		if (has_memory_report) shared.allocations = std::move(allocations);
+		shared.vkGetLiveObjectCounts = reinterpret_cast<PFN_vkGetLiveObjectCountsCHAMELEON>(vkGetDeviceProcAddr(vulkan.device, "vkGetLiveObjectCountsCHAMELEON"));
+		shared.live_at_init = live_objects(shared);
+		shared.in_use = true;
+	}
+
 	return vulkan;
 }
 
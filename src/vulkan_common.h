@@ -175,6 +175,16 @@ struct dummy_ext { VkStructureType sType; dummy_ext* pNext; };
 
 vulkan_setup_t test_init(int argc, char** argv, const std::string& testname, vulkan_req_t& reqs);
 void test_done(vulkan_setup_t& vulkan, bool shared_instance = false);
+
+/// Thrown by test_init() instead of exiting with the skip return code (77) while instances and devices are shared
+struct test_skip_exception {};
+/// Used by the test runner to run many tests in one process. While enabled, test_done() keeps the instance and device,
+/// and test_init() hands them out again to later tests with the same requirements and command line.
+void test_share_setups(bool enable);
+/// Call after each test while sharing. Returns the number of device memory allocations that the test did not free, if the
+/// driver supports VK_EXT_device_memory_report, plus the number of objects it did not destroy, if the driver is Chameleon.
+int64_t test_shared_finish();
+void test_destroy_shared_setups();
 uint32_t get_device_memory_type(uint32_t type_filter, VkMemoryPropertyFlags properties);
 void test_set_name(const vulkan_setup_t& vulkan, VkObjectType type, uint64_t handle, const char* name);
 /// Add a test marker. Requires VK_EXT_debug_utils, but you do not need to add this to requirements yourself. It is added automatically and this is a no-op if it is not present.
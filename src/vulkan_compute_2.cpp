@@ -449,11 +449,9 @@ int main(int argc, char** argv)
 	check(result);
 
 	bench_start_scene(vulkan.bench, "compute_2");
-	assert(p__loops > 0);
-	for (unsigned i = 0; i < p__loops; i++)
+	for (unsigned i = 0; bench_loop(vulkan.bench, i); i++)
 	{
 		test_marker(vulkan, "Frame " + std::to_string(i));
-		bench_start_iteration(vulkan.bench);
 		for (unsigned node = 0; node < nodes; node++)
 		{
 			VkPipelineStageFlags flag = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
@@ -477,7 +475,6 @@ int main(int argc, char** argv)
 			result = vkResetFences(vulkan.device, nodes, fences.data());
 			check(result);
 		}
-		bench_stop_iteration(vulkan.bench);
 	}
 
 	if (output)
@@ -152,7 +152,7 @@ int main(int argc, char** argv)
 	VkDeviceAddress address = vulkan.vkGetBufferDeviceAddress(vulkan.device, &bdainfo);
 	bda_sc_create_pipeline(vulkan, r, reqs, address);
 
-	for (unsigned frame = 0; frame < p__loops; frame++)
+	for (unsigned frame = 0; bench_loop(vulkan.bench, frame); frame++)
 	{
 		test_marker(vulkan, "Frame " + std::to_string(frame));
 
@@ -161,7 +161,7 @@ int main(int argc, char** argv)
 	const VkDeviceAddress address = vulkan.vkGetBufferDeviceAddress(vulkan.device, &address_info);
 	std::vector<VkShaderEXT> shaders = create_shaders(vulkan, resources, reqs, address, pf_vkCreateShadersEXT);
 
-	for (uint32_t frame = 0; frame < p__loops; frame++)
+	for (uint32_t frame = 0; bench_loop(vulkan.bench, frame); frame++)
 	{
 		test_marker(vulkan, "Frame " + std::to_string(frame));
 
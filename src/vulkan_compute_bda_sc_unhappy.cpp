@@ -193,7 +193,7 @@ int main(int argc, char** argv)
 	const VkDeviceAddress address = vulkan.vkGetBufferDeviceAddress(vulkan.device, &address_info);
 	std::vector<VkPipeline> pipelines = create_pipelines(vulkan, r, reqs, address);
 
-	for (unsigned frame = 0; frame < p__loops; frame++)
+	for (unsigned frame = 0; bench_loop(vulkan.bench, frame); frame++)
 	{
 		test_marker(vulkan, "Frame " + std::to_string(frame));
 
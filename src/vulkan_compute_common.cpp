@@ -235,8 +235,9 @@ compute_resources compute_init(vulkan_setup_t& vulkan, vulkan_req_t& reqs)
 
 void compute_submit(vulkan_setup_t& vulkan, compute_resources& r, vulkan_req_t& reqs)
 {
-	bench_start_scene(vulkan.bench, "compute");
-	bench_start_iteration(vulkan.bench);
+	if (r.frame == 0) bench_start_scene(vulkan.bench, "compute");
+	const bool timed = !vulkan.bench.looping; // otherwise bench_loop() times the whole iteration
+	if (timed) bench_start_iteration(vulkan.bench);
 
 	VkFence fence;
 	VkFenceCreateInfo fenceCreateInfo = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, nullptr };
@@ -303,14 +304,12 @@ void compute_submit(vulkan_setup_t& vulkan, compute_resources& r, vulkan_req_t&
 
 	vkDestroyFence(vulkan.device, fence, nullptr);
 
-	bench_stop_iteration(vulkan.bench);
+	if (timed) bench_stop_iteration(vulkan.bench);
 	if (reqs.options.count("image_output"))
 	{
-		std::string filename = "compute_" + std::to_string(r.frame) + ".png";
-		test_save_image(vulkan, filename.c_str(), r.memory, 0, std::get<int>(reqs.options.at("width")), std::get<int>(reqs.options.at("height")));
-		bench_stop_scene(vulkan.bench, filename.c_str());
+		r.output = "compute_" + std::to_string(r.frame) + ".png";
+		test_save_image(vulkan, r.output.c_str(), r.memory, 0, std::get<int>(reqs.options.at("width")), std::get<int>(reqs.options.at("height")));
 	}
-	else bench_stop_scene(vulkan.bench);
 
 	vkResetCommandBuffer(r.commandBuffer, 0);
 
@@ -322,6 +321,7 @@ void compute_submit(vulkan_setup_t& vulkan, compute_resources& r, vulkan_req_t&
 
 void compute_done(vulkan_setup_t& vulkan, compute_resources& r, vulkan_req_t& reqs)
 {
+	if (r.frame > 0) bench_stop_scene(vulkan.bench, r.output);
 	if (reqs.options.count("pipelinecache") && reqs.options.count("cachefile"))
 	{
 		std::string file = std::get<std::string>(reqs.options.at("cachefile"));
@@ -22,7 +22,9 @@ struct compute_resources
 	// used for frame boundary extension
 	VkImage image = VK_NULL_HANDLE;
 	VkCommandBuffer commandBufferFrameBoundary = VK_NULL_HANDLE;
-	int frame = 0;
+	int frame = 0; // number of submits so far
+
+	std::string output; // latest image output, if any
 };
 
 bool compute_cmdopt(int& i, int argc, char** argv, vulkan_req_t& reqs);
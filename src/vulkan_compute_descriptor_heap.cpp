@@ -328,7 +328,7 @@ int main(int argc, char** argv)
 	test_set_name(vulkan, VK_OBJECT_TYPE_PIPELINE, (uint64_t)r.pipeline, "compute_descriptor_heap_pipeline");
 	test_marker_mention(vulkan, "Compute descriptor heap resources are ready", VK_OBJECT_TYPE_BUFFER, (uint64_t)resource_heap.buffer);
 
-	for (unsigned frame = 0; frame < p__loops; frame++)
+	for (unsigned frame = 0; bench_loop(vulkan.bench, frame); frame++)
 	{
 		VkCommandBufferBeginInfo begin_info{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO, nullptr};
 		begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
@@ -366,7 +366,7 @@ int main(int argc, char** argv)
 	result = vkAllocateCommandBuffers(vulkan.device, &state_alloc_info, &state_cmd);
 	check(result);
 
-	for (unsigned frame = 0; frame < p__loops; ++frame)
+	for (unsigned frame = 0; bench_loop(vulkan.bench, frame); ++frame)
 	{
 		test_marker(vulkan, "Frame " + std::to_string(frame));
 		VkCommandBufferBeginInfo begin_info = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO, nullptr };
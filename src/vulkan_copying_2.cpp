@@ -192,10 +192,9 @@ static void copying_2(int argc, char** argv)
 		check(result);
 	}
 
-	for (unsigned frame = 0; frame < p__loops; frame++)
+	for (unsigned frame = 0; bench_loop(vulkan.bench, frame); frame++)
 	{
 		test_marker(vulkan, "Frame " + std::to_string(frame));
-		bench_start_iteration(vulkan.bench);
 		for (unsigned i = 0; i < num_buffers; i++)
 		{
 			if (flush_variant == 1 || vulkan.has_explicit_host_updates) testFlushMemory(vulkan, origin_memory, aligned_size * i, aligned_size, flush_variant != 1); // add useless flush
@@ -251,7 +250,6 @@ static void copying_2(int argc, char** argv)
 			result = vkResetFences(vulkan.device, num_buffers, fences.data());
 			check(result);
 		}
-		bench_stop_iteration(vulkan.bench);
 	}
 
 	// Verification
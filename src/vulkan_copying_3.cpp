@@ -81,7 +81,7 @@ static void copying_3(int argc, char** argv)
 	std::vector<char> buf(buffer_size);
 	size_t r = fread(buf.data(), buffer_size, 1, fp);
 	assert(r == 1); // this should not fail
-	for (unsigned i = 0; i < p__loops; i++)
+	for (unsigned i = 0; bench_loop(vulkan.bench, i); i++)
 	{
 		switch (method)
 		{
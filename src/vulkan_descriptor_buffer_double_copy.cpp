@@ -198,7 +198,7 @@ int main(int argc, char** argv)
 	r.code = copy_shader(vulkan_compute_1_spirv, vulkan_compute_1_spirv_len);
 	compute_create_pipeline(vulkan, r, req, VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT);
 
-	for (unsigned frame = 0; frame < p__loops; frame++)
+	for (unsigned frame = 0; bench_loop(vulkan.bench, frame); frame++)
 	{
 		VkCommandBufferBeginInfo begin_info = {
 			VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
@@ -396,19 +396,15 @@ static void save_texture_debug(const vulkan_setup_t& vulkan, Image& image, uint3
 
 static void render(const vulkan_setup_t& vulkan)
 {
-	bool first_loop = true;
-	benchmarking bench = vulkan.bench;
+	// Results are written from the context's copy of the setup
+	benchmarking& bench = p_benchmark->m_vulkanSetup.bench;
 
-	while (p__loops--)
+	for (unsigned frame = 0; bench_loop(bench, frame); frame++)
 	{
 		VkCommandBuffer defaultCmd = p_benchmark->m_defaultCommandBuffer->getHandle();
 
 		vkWaitForFences(vulkan.device, 1, &p_benchmark->m_frameFence, VK_TRUE, UINT64_MAX);
 
-		if (!first_loop)
-		{
-			bench_stop_iteration(bench);
-		}
 		updateTransformData(*p_benchmark->m_transformUniformBuffer);
 
 		vkResetFences(vulkan.device, 1, &p_benchmark->m_frameFence);
@@ -448,15 +444,10 @@ static void render(const vulkan_setup_t& vulkan)
 		p_benchmark->m_defaultCommandBuffer->endRenderPass();
 		p_benchmark->m_defaultCommandBuffer->end();
 
-		bench_start_iteration(bench);
-
 		// submit
 		p_benchmark->submit(p_benchmark->m_defaultQueue, std::vector<std::shared_ptr<CommandBuffer>> {p_benchmark->m_defaultCommandBuffer}, p_benchmark->m_frameFence);
-
-		first_loop = false;
 	}
 
 	vkWaitForFences(vulkan.device, 1, &p_benchmark->m_frameFence, VK_TRUE, UINT64_MAX);
-	bench_stop_iteration(bench);
 	p_benchmark->saveImageOutput();
 }
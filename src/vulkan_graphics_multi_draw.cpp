@@ -638,21 +638,16 @@ static void record_multi_draws(const vulkan_setup_t& vulkan, VkCommandBuffer com
 
 static void render(const vulkan_setup_t& vulkan)
 {
-	bool first_loop = true;
-	uint32_t frame_index = 0;
-	benchmarking bench = vulkan.bench;
+	// Results are written from the context's copy of the setup
+	benchmarking& bench = p_benchmark->m_vulkanSetup.bench;
 
-	while (p__loops--)
+	for (uint32_t frame_index = 0; bench_loop(bench, frame_index); frame_index++)
 	{
 		VkCommandBuffer defaultCmd = p_benchmark->m_defaultCommandBuffer->getHandle();
 
 		VkResult result = vkWaitForFences(vulkan.device, 1, &p_benchmark->m_frameFence, VK_TRUE, UINT64_MAX);
 		check(result);
 
-		if (!first_loop)
-		{
-			bench_stop_iteration(bench);
-		}
 		updateTransformData(*p_benchmark->m_transformUniformBuffer);
 
 		vkResetFences(vulkan.device, 1, &p_benchmark->m_frameFence);
@@ -690,15 +685,10 @@ static void render(const vulkan_setup_t& vulkan)
 		p_benchmark->m_defaultCommandBuffer->endRenderPass();
 		p_benchmark->m_defaultCommandBuffer->end();
 
-		bench_start_iteration(bench);
 		p_benchmark->submit(p_benchmark->m_defaultQueue, std::vector<std::shared_ptr<CommandBuffer>> {p_benchmark->m_defaultCommandBuffer}, p_benchmark->m_frameFence);
-
-		first_loop = false;
-		frame_index++;
 	}
 
 	VkResult result = vkWaitForFences(vulkan.device, 1, &p_benchmark->m_frameFence, VK_TRUE, UINT64_MAX);
 	check(result);
-	bench_stop_iteration(bench);
 	p_benchmark->saveImageOutput();
 }
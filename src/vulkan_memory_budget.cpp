@@ -8,6 +8,14 @@ static VkPhysicalDeviceMemoryProperties2 get_memory_budget_properties(const vulk
 	VkPhysicalDeviceMemoryProperties2 properties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2, &budget };
 	vkGetPhysicalDeviceMemoryProperties2(vulkan.physical, &properties);
 	assert(properties.memoryProperties.memoryHeapCount > 0);
+	// the budget must be filled in for every heap, and zero for the rest
+	for (uint32_t i = 0; i < VK_MAX_MEMORY_HEAPS; i++)
+	{
+		const bool valid = i < properties.memoryProperties.memoryHeapCount;
+		assert(!valid || budget.heapBudget[i] > 0);
+		assert(valid || (budget.heapBudget[i] == 0 && budget.heapUsage[i] == 0));
+		(void)valid;
+	}
 	return properties;
 }
 
@@ -0,0 +1,172 @@
+// Runs many Vulkan tests in one process, to avoid paying for process startup, loader scans and device creation for
+// each of them. The tests are built as loadable modules (see VULKAN_RUNNER in CMakeLists.txt) and their main() is
+// called one after another. Tests with the same requirements and command line share one instance and device.
+
+#include "vulkan_common.h"
+#include <dlfcn.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+
+struct runner_test
+{
+	std::string name;
+	std::string module;
+	std::vector<std::string> args;
+};
+
+struct runner_result
+{
+	const char* status;
+	uint64_t time;
+};
+
+static std::vector<runner_test> tests;
+static std::vector<runner_result> results;
+static const char* current_test = nullptr;
+static uint64_t start = 0;
+
+/// Print the results we have so far, which is all of them unless a test ended the run
+static void print_summary()
+{
+	int failed = 0;
+	int skipped = 0;
+	printf("\n%-60s %-8s %10s\n", "Test", "Result", "Time (ms)");
+	for (unsigned i = 0; i < results.size(); i++)
+	{
+		printf("%-60s %-8s %10.2f\n", tests[i].name.c_str(), results[i].status, results[i].time / 1000000.0);
+		if (strcmp(results[i].status, "skipped") == 0) skipped++;
+		else if (strcmp(results[i].status, "passed") != 0) failed++;
+	}
+	const uint64_t total = gettime() - start;
+	printf("\n%d of %d tests run, %d failed, %d skipped, %.2f ms in total\n", (int)results.size(), (int)tests.size(), failed, skipped, total / 1000000.0);
+	fflush(stdout);
+}
+
+static void exit_handler()
+{
+	if (!current_test) return;
+	fprintf(stderr, "Test %s exited the test runner\n", current_test);
+	results.push_back({ "EXITED", 0 });
+	print_summary();
+}
+
+static void show_usage()
+{
+	printf("Usage: vulkan_runner <test list file> [test name ...]\n");
+	printf("Each line in the test list file is a test name, the path of its module and its command line arguments.\n");
+	printf("If test names are given, only those tests are run.\n");
+	exit(1);
+}
+
+static std::vector<runner_test> read_test_list(const char* filename)
+{
+	std::vector<runner_test> tests;
+	std::ifstream file(filename);
+	if (!file)
+	{
+		ELOG("Failed to open test list %s", filename);
+		exit(1);
+	}
+	std::string line;
+	while (std::getline(file, line))
+	{
+		std::istringstream words(line);
+		runner_test test;
+		if (!(words >> test.name >> test.module) || test.name[0] == '#') continue;
+		std::string arg;
+		while (words >> arg) test.args.push_back(arg);
+		tests.push_back(test);
+	}
+	return tests;
+}
+
+static int run_test(const runner_test& test)
+{
+	void* handle = dlopen(test.module.c_str(), RTLD_NOW | RTLD_LOCAL);
+	if (!handle)
+	{
+		ELOG("Failed to load %s: %s", test.module.c_str(), dlerror());
+		return 1;
+	}
+	typedef int (*PFN_main)(int argc, char** argv);
+	PFN_main test_main = (PFN_main)dlsym(handle, "main");
+	if (!test_main)
+	{
+		ELOG("No main() in %s", test.module.c_str());
+		dlclose(handle);
+		return 1;
+	}
+
+	std::vector<char*> argv;
+	argv.push_back((char*)test.name.c_str());
+	for (const std::string& arg : test.args) argv.push_back((char*)arg.c_str());
+	argv.push_back(nullptr);
+
+	// Tests are allowed to change these
+	const uint_fast32_t loops = p__loops;
+	const double loop_time = p__loop_time;
+	const uint_fast8_t sanity = p__sanity;
+	const uint_fast8_t debug_level = p__debug_level;
+	const uint_fast8_t validation = p__validation;
+	const int_fast8_t device = p__device;
+
+	int result;
+	try
+	{
+		result = test_main((int)argv.size() - 1, argv.data());
+	}
+	catch (const test_skip_exception&)
+	{
+		result = 77;
+	}
+
+	p__loops = loops;
+	p__loop_time = loop_time;
+	p__sanity = sanity;
+	p__debug_level = debug_level;
+	p__validation = validation;
+	p__device = device;
+	dlclose(handle);
+	return result;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2 || match(argv[1], "-h", "--help")) show_usage();
+	tests = read_test_list(argv[1]);
+	if (argc > 2)
+	{
+		std::unordered_set<std::string> selected(argv + 2, argv + argc);
+		std::vector<runner_test> filtered;
+		for (const runner_test& test : tests) if (selected.count(test.name)) filtered.push_back(test);
+		tests.swap(filtered);
+	}
+
+	test_share_setups(true);
+	atexit(exit_handler);
+	bool failed = false;
+	start = gettime();
+	for (const runner_test& test : tests)
+	{
+		printf("==== Running %s ====\n", test.name.c_str());
+		fflush(stdout);
+		current_test = test.name.c_str();
+		const uint64_t test_start = gettime();
+		const int result = run_test(test);
+		const int64_t leaks = test_shared_finish();
+		const uint64_t time = gettime() - test_start;
+		current_test = nullptr;
+		const char* status = "passed";
+		if (result == 77) status = "skipped";
+		else if (result != 0) status = "FAILED";
+		else if (leaks > 0) status = "LEAKED";
+		if (result != 77 && (result != 0 || leaks > 0)) failed = true;
+		results.push_back({ status, time });
+		printf("==== %s %s in %.2f ms ====\n", test.name.c_str(), status, time / 1000000.0);
+		fflush(stdout);
+	}
+	test_destroy_shared_setups();
+	print_summary();
+	return failed ? 1 : 0;
+}
@@ -162,7 +162,7 @@ int main(int argc, char** argv)
 	r.code = copy_shader(vulkan_compute_1_spirv, vulkan_compute_1_spirv_len);
 	compute_create_pipeline(vulkan, r, req, VK_PIPELINE_CREATE_2_INSTRUMENT_SHADERS_BIT_ARM);
 
-	for (unsigned frame = 0; frame < p__loops; frame++)
+	for (unsigned frame = 0; bench_loop(vulkan.bench, frame); frame++)
 	{
 		test_marker(vulkan, "Frame " + std::to_string(frame));
 		VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO, nullptr };
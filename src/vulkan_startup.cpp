@@ -0,0 +1,94 @@
+// Measure the startup cost of a driver or a layer: creating and destroying instances and devices, and looking up
+// function pointers the way a loader or an application using a function loader does at startup.
+
+#include "vulkan_common.h"
+
+static vulkan_setup_t vulkan;
+
+/// A mix of core and extension functions. Functions that the device does not support are still looked up, since
+/// function loaders ask for every function they know.
+static const char* device_procs[] = {
+	"vkGetDeviceQueue", "vkQueueSubmit", "vkQueueWaitIdle", "vkDeviceWaitIdle", "vkAllocateMemory", "vkFreeMemory",
+	"vkMapMemory", "vkUnmapMemory", "vkBindBufferMemory", "vkBindImageMemory", "vkGetBufferMemoryRequirements",
+	"vkGetImageMemoryRequirements", "vkCreateFence", "vkDestroyFence", "vkWaitForFences", "vkCreateBuffer",
+	"vkDestroyBuffer", "vkCreateImage", "vkDestroyImage", "vkCreateImageView", "vkCreateShaderModule",
+	"vkCreateGraphicsPipelines", "vkCreateComputePipelines", "vkDestroyPipeline", "vkCreateDescriptorSetLayout",
+	"vkAllocateDescriptorSets", "vkUpdateDescriptorSets", "vkCreateCommandPool", "vkAllocateCommandBuffers",
+	"vkBeginCommandBuffer", "vkEndCommandBuffer", "vkCmdBindPipeline", "vkCmdDraw", "vkCmdDrawIndexed",
+	"vkCmdDispatch", "vkCmdCopyBuffer", "vkCmdPipelineBarrier", "vkBindBufferMemory2", "vkGetBufferDeviceAddress",
+	"vkCmdDrawIndirectCount", "vkQueueSubmit2", "vkCmdBeginRendering", "vkCreateSwapchainKHR", "vkQueuePresentKHR",
+	"vkCmdBuildAccelerationStructuresKHR", "vkCmdTraceRaysKHR", "vkSetDebugUtilsObjectNameEXT", "vkNotAFunction",
+};
+static const unsigned device_proc_count = sizeof(device_procs) / sizeof(device_procs[0]);
+
+static void bench_instances()
+{
+	VkApplicationInfo app = { VK_STRUCTURE_TYPE_APPLICATION_INFO, nullptr };
+	app.pApplicationName = "vulkan_startup";
+	app.apiVersion = VK_API_VERSION_1_1;
+	VkInstanceCreateInfo info = { VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO, nullptr };
+	info.pApplicationInfo = &app;
+
+	bench_start_scene(vulkan.bench, "create_instance");
+	for (uint64_t iteration = 0; bench_loop(vulkan.bench, iteration); iteration++)
+	{
+		VkInstance instance = VK_NULL_HANDLE;
+		VkResult result = vkCreateInstance(&info, nullptr, &instance);
+		check(result);
+		vkDestroyInstance(instance, nullptr);
+		bench_add_work(vulkan.bench, 1);
+	}
+	bench_stop_scene(vulkan.bench);
+}
+
+static void bench_devices()
+{
+	const float priority = 1.0f;
+	VkDeviceQueueCreateInfo queueinfo = { VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO, nullptr };
+	queueinfo.queueFamilyIndex = vulkan.queue_family_index;
+	queueinfo.queueCount = 1;
+	queueinfo.pQueuePriorities = &priority;
+	VkDeviceCreateInfo info = { VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO, nullptr };
+	info.queueCreateInfoCount = 1;
+	info.pQueueCreateInfos = &queueinfo;
+
+	bench_start_scene(vulkan.bench, "create_device");
+	for (uint64_t iteration = 0; bench_loop(vulkan.bench, iteration); iteration++)
+	{
+		VkDevice device = VK_NULL_HANDLE;
+		VkResult result = vkCreateDevice(vulkan.physical, &info, nullptr, &device);
+		check(result);
+		vkDestroyDevice(device, nullptr);
+		bench_add_work(vulkan.bench, 1);
+	}
+	bench_stop_scene(vulkan.bench);
+}
+
+static void bench_proc_lookups()
+{
+	bench_start_scene(vulkan.bench, "device_proc_lookup");
+	for (uint64_t iteration = 0; bench_loop(vulkan.bench, iteration); iteration++)
+	{
+		unsigned found = 0;
+		for (unsigned i = 0; i < device_proc_count; i++)
+		{
+			if (vkGetDeviceProcAddr(vulkan.device, device_procs[i])) found++;
+		}
+		assert(found < device_proc_count); // the last one does not exist
+		bench_add_work(vulkan.bench, device_proc_count);
+	}
+	bench_stop_scene(vulkan.bench);
+}
+
+int main(int argc, char** argv)
+{
+	vulkan_req_t reqs;
+	vulkan = test_init(argc, argv, "vulkan_startup", reqs);
+
+	bench_instances();
+	bench_devices();
+	bench_proc_lookups();
+
+	test_done(vulkan);
+	return 0;
+}
@@ -0,0 +1,184 @@
+// Measure how well a driver or a layer scales with the number of threads calling it. Unlike the other thread tests, this
+// has no artificial delays and each thread does the same fixed amount of work, so that lock contention shows up as
+// a drop in throughput as the number of threads goes up. Each thread count is reported as a scene of its own.
+
+#include <algorithm>
+#include <atomic>
+#include <barrier>
+#include <thread>
+
+#include "vulkan_common.h"
+
+static unsigned max_threads = std::max(1u, std::thread::hardware_concurrency());
+static unsigned work = 100; // work items per thread per iteration
+static vulkan_setup_t vulkan;
+static VkBuffer buffer = VK_NULL_HANDLE;
+static VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+
+static void show_usage()
+{
+	printf("-t/--threads N         Set the highest number of threads to test (default %u)\n", max_threads);
+	printf("-w/--work N            Set the number of work items per thread per iteration (default %u)\n", work);
+}
+
+static bool test_cmdopt(int& i, int argc, char** argv, vulkan_req_t& reqs)
+{
+	if (match(argv[i], "-t", "--threads"))
+	{
+		max_threads = get_arg(argv, ++i, argc);
+		return max_threads > 0;
+	}
+	else if (match(argv[i], "-w", "--work"))
+	{
+		work = get_arg(argv, ++i, argc);
+		return work > 0;
+	}
+	return false;
+}
+
+/// One work item: record a command buffer, create and destroy an object, and update a descriptor set
+static void work_item(VkCommandPool cmdpool, VkDescriptorPool descpool, VkCommandBuffer& cmd, uint32_t value)
+{
+	VkCommandBufferAllocateInfo allocinfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO, nullptr };
+	allocinfo.commandBufferCount = 1;
+	allocinfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocinfo.commandPool = cmdpool;
+	VkResult result = vkAllocateCommandBuffers(vulkan.device, &allocinfo, &cmd);
+	check(result);
+	VkCommandBufferBeginInfo begininfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO, nullptr };
+	begininfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	result = vkBeginCommandBuffer(cmd, &begininfo);
+	check(result);
+	vkCmdFillBuffer(cmd, buffer, 0, VK_WHOLE_SIZE, value);
+	VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr };
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+	result = vkEndCommandBuffer(cmd);
+	check(result);
+
+	VkBuffer tmpbuffer = VK_NULL_HANDLE;
+	VkBufferCreateInfo bufferinfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO, nullptr };
+	bufferinfo.size = 1024;
+	bufferinfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	bufferinfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	result = vkCreateBuffer(vulkan.device, &bufferinfo, nullptr, &tmpbuffer);
+	check(result);
+	vkDestroyBuffer(vulkan.device, tmpbuffer, nullptr);
+
+	VkDescriptorSet descset = VK_NULL_HANDLE;
+	VkDescriptorSetAllocateInfo setinfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO, nullptr };
+	setinfo.descriptorPool = descpool;
+	setinfo.descriptorSetCount = 1;
+	setinfo.pSetLayouts = &layout;
+	result = vkAllocateDescriptorSets(vulkan.device, &setinfo, &descset);
+	check(result);
+	VkDescriptorBufferInfo descbufferinfo = { buffer, 0, VK_WHOLE_SIZE };
+	VkWriteDescriptorSet write = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, nullptr };
+	write.dstSet = descset;
+	write.dstBinding = 0;
+	write.descriptorCount = 1;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	write.pBufferInfo = &descbufferinfo;
+	vkUpdateDescriptorSets(vulkan.device, 1, &write, 0, nullptr);
+}
+
+static void thread_worker(int tid, std::barrier<>& sync, const std::atomic_bool& running)
+{
+	set_thread_name("scaling thread");
+
+	VkCommandPool cmdpool = VK_NULL_HANDLE;
+	VkCommandPoolCreateInfo cmdcreateinfo = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO, nullptr };
+	cmdcreateinfo.queueFamilyIndex = vulkan.queue_family_index;
+	VkResult result = vkCreateCommandPool(vulkan.device, &cmdcreateinfo, nullptr, &cmdpool);
+	check(result);
+	std::string name = "Command pool for thread " + _to_string(tid);
+	test_set_name(vulkan, VK_OBJECT_TYPE_COMMAND_POOL, (uint64_t)cmdpool, name.c_str());
+
+	VkDescriptorPool descpool = VK_NULL_HANDLE;
+	VkDescriptorPoolSize poolsize = { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, work };
+	VkDescriptorPoolCreateInfo poolinfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO, nullptr };
+	poolinfo.maxSets = work;
+	poolinfo.poolSizeCount = 1;
+	poolinfo.pPoolSizes = &poolsize;
+	result = vkCreateDescriptorPool(vulkan.device, &poolinfo, nullptr, &descpool);
+	check(result);
+
+	std::vector<VkCommandBuffer> cmdbuffers(work);
+	while (true)
+	{
+		sync.arrive_and_wait(); // start of iteration
+		if (!running) break;
+		for (unsigned i = 0; i < work; i++) work_item(cmdpool, descpool, cmdbuffers[i], i);
+		vkFreeCommandBuffers(vulkan.device, cmdpool, cmdbuffers.size(), cmdbuffers.data());
+		result = vkResetDescriptorPool(vulkan.device, descpool, 0);
+		check(result);
+		sync.arrive_and_wait(); // end of iteration
+	}
+
+	vkDestroyDescriptorPool(vulkan.device, descpool, nullptr);
+	vkDestroyCommandPool(vulkan.device, cmdpool, nullptr);
+}
+
+static void run_scene(unsigned threads)
+{
+	std::barrier<> sync(threads + 1);
+	std::atomic_bool running(true);
+	std::vector<std::thread> workers;
+	for (unsigned i = 0; i < threads; i++) workers.emplace_back(thread_worker, i, std::ref(sync), std::cref(running));
+
+	bench_start_scene(vulkan.bench, "threads_" + _to_string(threads));
+	for (uint64_t iteration = 0; bench_loop(vulkan.bench, iteration); iteration++)
+	{
+		sync.arrive_and_wait(); // let them go
+		sync.arrive_and_wait(); // wait for all of them to finish
+		bench_add_work(vulkan.bench, threads * work);
+	}
+	bench_stop_scene(vulkan.bench);
+
+	running = false;
+	sync.arrive_and_wait();
+	for (std::thread& t : workers) t.join();
+}
+
+int main(int argc, char** argv)
+{
+	vulkan_req_t reqs;
+	reqs.usage = show_usage;
+	reqs.cmdopt = test_cmdopt;
+	vulkan = test_init(argc, argv, "vulkan_thread_scaling", reqs);
+
+	VkBufferCreateInfo bufferinfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO, nullptr };
+	bufferinfo.size = 4096;
+	bufferinfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	bufferinfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	VkResult result = vkCreateBuffer(vulkan.device, &bufferinfo, nullptr, &buffer);
+	check(result);
+	VkMemoryRequirements req;
+	vkGetBufferMemoryRequirements(vulkan.device, buffer, &req);
+	VkMemoryAllocateInfo meminfo = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO, nullptr };
+	meminfo.memoryTypeIndex = get_device_memory_type(req.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	meminfo.allocationSize = req.size;
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	result = vkAllocateMemory(vulkan.device, &meminfo, nullptr, &memory);
+	check(result);
+	result = vkBindBufferMemory(vulkan.device, buffer, memory, 0);
+	check(result);
+
+	VkDescriptorSetLayoutBinding binding = { 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr };
+	VkDescriptorSetLayoutCreateInfo layoutinfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO, nullptr };
+	layoutinfo.bindingCount = 1;
+	layoutinfo.pBindings = &binding;
+	result = vkCreateDescriptorSetLayout(vulkan.device, &layoutinfo, nullptr, &layout);
+	check(result);
+
+	// Double the number of threads each time, and always include the highest
+	for (unsigned threads = 1; threads < max_threads; threads *= 2) run_scene(threads);
+	run_scene(max_threads);
+
+	vkDestroyDescriptorSetLayout(vulkan.device, layout, nullptr);
+	vkDestroyBuffer(vulkan.device, buffer, nullptr);
+	testFreeMemory(vulkan, memory);
+	test_done(vulkan);
+	return 0;
+}